@@ -12,10 +12,14 @@ FREETYPE_VERSION="2.13.2"
 FRIBIDI_SRC="$ROOT_DIR/third_party/fribidi"
 FRIBIDI_VERSION="v1.0.13"
 VARIANT="${FFMPEG_WASM_VARIANT:-}"
+SPLIT="${FFMPEG_WASM_SPLIT:-0}"
+MEMORY64="${FFMPEG_WASM_MEMORY64:-0}"
+# Decoders that stay in the core module of a --split build
+CORE_DECODERS="av1,vp8,vp9,opus,vorbis,flac,pcm_s16le,pcm_s24le,pcm_f32le,pcm_s16be,pcm_u8,pcm_s8,ass,ssa,subrip,webvtt"
 
 usage() {
   cat <<'EOF'
-Usage: ./scripts/build-ffmpeg.sh [--variant royaltyfree|royaltyfree-lgpl|full|gpl|gpl-royaltyfree|royaltyfree-gpl|lgpl|nonfree]
+Usage: ./scripts/build-ffmpeg.sh [--variant royaltyfree|royaltyfree-lgpl|full|gpl|gpl-royaltyfree|royaltyfree-gpl|lgpl|nonfree] [--split] [--memory64]
 
 Variants:
   royaltyfree  AV1/VP9/Opus only, LGPL-friendly, avoids patent-encumbered codecs.
@@ -26,6 +30,18 @@ Variants:
   royaltyfree-gpl  Alias for gpl-royaltyfree.
   lgpl         Alias for full.
   nonfree      Non-redistributable build. Unsafe for public distribution/monetization.
+
+--split (or FFMPEG_WASM_SPLIT=1) builds a dynamically linked core
+(MAIN_MODULE) with only the royalty-free decoders, plus side modules the
+worker loads on demand: codec-<name>.wasm per remaining decoder of the
+variant, and subtitles.wasm (libass + FreeType + FriBidi). Output goes to
+build/<variant dir>-split/.
+
+--memory64 (or FFMPEG_WASM_MEMORY64=1) compiles everything with -sMEMORY64
+so the heap can grow past 4 GB (up to 16 GB), for multi-GB buffers and
+large frame queues. Needs a browser with wasm Memory64. Pointer-sized
+values still reach JS as Numbers. Output goes to build/<variant dir>-memory64/
+(combined with --split: <variant dir>-split-memory64/).
 EOF
 }
 
@@ -64,10 +80,27 @@ else
   popd >/dev/null
 fi
 
-if [ "${1:-}" = "--variant" ]; then
-  VARIANT="${2:-}"
-  shift 2
-fi
+while [ $# -gt 0 ]; do
+  case "$1" in
+    --variant)
+      VARIANT="${2:-}"
+      shift 2
+      ;;
+    --split)
+      SPLIT=1
+      shift
+      ;;
+    --memory64)
+      MEMORY64=1
+      shift
+      ;;
+    *)
+      echo "Unknown option: $1" >&2
+      usage >&2
+      exit 1
+      ;;
+  esac
+done
 
 case "${VARIANT:-full}" in
   royaltyfree|royaltyfree-lgpl)
@@ -113,6 +146,23 @@ case "${VARIANT:-full}" in
     ;;
 esac
 
+MONOLITHIC_DIR="$OUT_DIR"
+if [ "$SPLIT" = "1" ]; then
+  OUT_DIR="$OUT_DIR-split"
+  # Everything linked into MAIN_MODULE/SIDE_MODULE must be position independent
+  export CFLAGS="${CFLAGS:-} -fPIC"
+fi
+
+MEMORY64_FLAGS=()
+if [ "$MEMORY64" = "1" ]; then
+  OUT_DIR="$OUT_DIR-memory64"
+  MONOLITHIC_DIR="$MONOLITHIC_DIR-memory64"
+  MEMORY64_FLAGS=(-s MEMORY64=1)
+  # FriBidi, FreeType, libass and FFmpeg must all be wasm64 objects
+  export CFLAGS="${CFLAGS:-} -sMEMORY64=1"
+  export LDFLAGS="${LDFLAGS:-} -sMEMORY64=1"
+fi
+
 PREFIX_DIR="$OUT_DIR"
 OUT_JS="$OUT_DIR/ffmpeg_wasm.js"
 
@@ -195,45 +245,189 @@ emmake make -j"$(nproc)"
 emmake make install
 popd >/dev/null
 
-pushd "$FFMPEG_SRC" >/dev/null
+PIC_FLAGS=()
+if [ "$SPLIT" = "1" ]; then
+  PIC_FLAGS=(--enable-pic)
+fi
 
-EM_PKG_CONFIG_PATH="$PREFIX_DIR/lib/pkgconfig" \
-emconfigure ./configure \
-  --pkg-config-flags="--static" \
-  --extra-cflags="-I$PREFIX_DIR/include -I$PREFIX_DIR/include/freetype2 -I$PREFIX_DIR/include/fribidi -I$PREFIX_DIR/include/ass" \
-  --extra-ldflags="-L$PREFIX_DIR/lib" \
-  --prefix="$PREFIX_DIR" \
-  --cc=emcc \
-  --cxx=em++ \
-  --ar=emar \
-  --ranlib=emranlib \
-  --nm=emnm \
-  --target-os=none \
-  --arch=x86_32 \
-  --enable-cross-compile \
-  --disable-asm \
-  --disable-pthreads \
-  --disable-stripping \
-  --disable-programs \
-  --disable-doc \
-  --disable-debug \
-  --disable-network \
-  --enable-libass \
-  --enable-protocol=file \
-  --enable-demuxer=mov,matroska,avi,mpegts,mp3,ogg,flac,wav \
-  --enable-muxer=mp4,matroska \
-  "${DECODER_FLAGS[@]}" \
-  "${PARSER_FLAGS[@]}" \
-  "${LICENSE_FLAGS[@]}"
+FFMPEG_EXTRA_CFLAGS="-I$PREFIX_DIR/include -I$PREFIX_DIR/include/freetype2 -I$PREFIX_DIR/include/fribidi -I$PREFIX_DIR/include/ass"
+FFMPEG_EXTRA_LDFLAGS="-L$PREFIX_DIR/lib"
+if [ "$MEMORY64" = "1" ]; then
+  FFMPEG_EXTRA_CFLAGS="$FFMPEG_EXTRA_CFLAGS -sMEMORY64=1"
+  FFMPEG_EXTRA_LDFLAGS="$FFMPEG_EXTRA_LDFLAGS -sMEMORY64=1"
+fi
 
-emmake make -j"$(nproc)"
-emmake make install
+# Configure, build and install FFmpeg with the given decoder flags
+build_ffmpeg() {
+  pushd "$FFMPEG_SRC" >/dev/null
+  if [ "$SPLIT" = "1" ]; then
+    emmake make distclean >/dev/null 2>&1 || true  # Drop objects of the previous decoder set
+  fi
 
-popd >/dev/null
+  EM_PKG_CONFIG_PATH="$PREFIX_DIR/lib/pkgconfig" \
+  emconfigure ./configure \
+    --pkg-config-flags="--static" \
+    --extra-cflags="$FFMPEG_EXTRA_CFLAGS" \
+    --extra-ldflags="$FFMPEG_EXTRA_LDFLAGS" \
+    --prefix="$PREFIX_DIR" \
+    --cc=emcc \
+    --cxx=em++ \
+    --ar=emar \
+    --ranlib=emranlib \
+    --nm=emnm \
+    --target-os=none \
+    --arch=x86_32 \
+    --enable-cross-compile \
+    --disable-asm \
+    --disable-pthreads \
+    --disable-stripping \
+    --disable-programs \
+    --disable-doc \
+    --disable-debug \
+    --disable-network \
+    --enable-libass \
+    --enable-protocol=file \
+    --enable-demuxer=mov,matroska,avi,mpegts,mp3,ogg,flac,wav,aac \
+    --enable-muxer=mp4,matroska \
+    --disable-filters \
+    --enable-filter=buffer,buffersink,yadif,bwdif,scale,format \
+    "$@" \
+    "${PARSER_FLAGS[@]}" \
+    "${LICENSE_FLAGS[@]}" \
+    "${PIC_FLAGS[@]}"
+
+  emmake make -j"$(nproc)"
+  emmake make install
+  popd >/dev/null
+}
+
+list_avcodec_objects() {
+  (cd "$FFMPEG_SRC" && find libavcodec -name '*.o' | sort)
+}
+
+SIDE_DECODERS=()
+if [ "$SPLIT" = "1" ]; then
+  # Full decoder set first, to keep the objects only those decoders need
+  build_ffmpeg "${DECODER_FLAGS[@]}"
+  SIDE_OBJ_DIR="$OUT_DIR/side-objects"
+  rm -rf "$SIDE_OBJ_DIR"
+  mkdir -p "$SIDE_OBJ_DIR"
+  list_avcodec_objects >"$OUT_DIR/avcodec-full.txt"
+  (cd "$FFMPEG_SRC" && xargs cp --parents -t "$SIDE_OBJ_DIR" <"$OUT_DIR/avcodec-full.txt")
+
+  build_ffmpeg --disable-decoders --enable-decoder="$CORE_DECODERS"
+  list_avcodec_objects >"$OUT_DIR/avcodec-core.txt"
+  rm -f "$PREFIX_DIR/lib/libavcodec-side.a"
+  comm -23 "$OUT_DIR/avcodec-full.txt" "$OUT_DIR/avcodec-core.txt" |
+    sed "s|^|$SIDE_OBJ_DIR/|" | xargs emar rcs "$PREFIX_DIR/lib/libavcodec-side.a"
+
+  for decoder in $(printf '%s\n' "${DECODER_FLAGS[@]}" | sed -n 's/^--enable-decoder=//p' | tr ',' ' '); do
+    case ",$CORE_DECODERS," in
+      *",$decoder,"*) ;;
+      *) SIDE_DECODERS+=("$decoder") ;;
+    esac
+  done
+else
+  build_ffmpeg "${DECODER_FLAGS[@]}"
+fi
 
 mkdir -p "$OUT_DIR"
 
-emcc -O3 \
+# Compile the default subtitle font into the data segment so workers neither
+# fetch nor copy it in before the first subtitle track
+FONT_TTF="$ROOT_DIR/web/Inter-Regular.ttf"
+FONT_C="$OUT_DIR/default_font.c"
+FONT_FLAGS=()
+case "$(od -An -N4 -tx1 "$FONT_TTF" 2>/dev/null | tr -d ' ')" in
+  00010000|4f54544f)
+    {
+      echo "const unsigned char ffmpeg_wasm_default_font[] = {"
+      od -An -v -tx1 "$FONT_TTF" | sed -e 's/ *\([0-9a-f][0-9a-f]\)/0x\1,/g'
+      echo "};"
+      echo "const unsigned int ffmpeg_wasm_default_font_len = sizeof(ffmpeg_wasm_default_font);"
+    } >"$FONT_C"
+    FONT_FLAGS=(-DFFMPEG_WASM_EMBEDDED_FONT "$FONT_C")
+    ;;
+  *)
+    echo "warning: $FONT_TTF is not a TrueType/OpenType font; not embedding it" >&2
+    ;;
+esac
+
+EXPORTED_FUNCTIONS='["_ffmpeg_wasm_avcodec_version","_ffmpeg_wasm_avformat_version","_ffmpeg_wasm_avutil_version","_ffmpeg_wasm_has_hevc_av1","_ffmpeg_wasm_create","_ffmpeg_wasm_destroy","_ffmpeg_wasm_append","_ffmpeg_wasm_set_eof","_ffmpeg_wasm_set_keep_all","_ffmpeg_wasm_set_buffer_limit","_ffmpeg_wasm_set_file_size","_ffmpeg_wasm_set_audio_enabled","_ffmpeg_wasm_open","_ffmpeg_wasm_duration_seconds","_ffmpeg_wasm_seek_seconds","_ffmpeg_wasm_read_frame","_ffmpeg_wasm_read_video_frame","_ffmpeg_wasm_video_width","_ffmpeg_wasm_video_height","_ffmpeg_wasm_frame_format","_ffmpeg_wasm_frame_data_ptr","_ffmpeg_wasm_frame_linesize","_ffmpeg_wasm_frame_pts_seconds","_ffmpeg_wasm_frame_to_rgba","_ffmpeg_wasm_rgba_ptr","_ffmpeg_wasm_rgba_stride","_ffmpeg_wasm_rgba_size","_ffmpeg_wasm_audio_channels","_ffmpeg_wasm_audio_sample_rate","_ffmpeg_wasm_audio_nb_samples","_ffmpeg_wasm_audio_ptr","_ffmpeg_wasm_audio_bytes","_ffmpeg_wasm_audio_pts_seconds","_ffmpeg_wasm_buffered_bytes","_ffmpeg_wasm_compact_buffer","_ffmpeg_wasm_streams_count","_ffmpeg_wasm_stream_media_type","_ffmpeg_wasm_stream_codec_id","_ffmpeg_wasm_stream_codec_name","_ffmpeg_wasm_stream_language","_ffmpeg_wasm_stream_title","_ffmpeg_wasm_stream_is_default","_ffmpeg_wasm_selected_video_stream","_ffmpeg_wasm_selected_audio_stream","_ffmpeg_wasm_audio_is_enabled","_ffmpeg_wasm_select_streams","_ffmpeg_wasm_selected_subtitle_stream","_ffmpeg_wasm_subtitles_enabled","_ffmpeg_wasm_select_subtitle_stream","_ffmpeg_wasm_render_subtitles","_ffmpeg_wasm_clear_subtitle_track","_ffmpeg_wasm_add_font","_ffmpeg_wasm_subtitle_events_count","_ffmpeg_wasm_subtitle_first_start_ms","_ffmpeg_wasm_subtitle_first_end_ms","_ffmpeg_wasm_set_memory_budget","_ffmpeg_wasm_memory_budget","_ffmpeg_wasm_memory_current","_ffmpeg_wasm_memory_peak","_ffmpeg_wasm_memory_reset_peaks","_ffmpeg_wasm_memory_over_budget","_ffmpeg_wasm_mosaic_create","_ffmpeg_wasm_mosaic_destroy","_ffmpeg_wasm_mosaic_add_font","_ffmpeg_wasm_mosaic_attach","_ffmpeg_wasm_mosaic_detach","_ffmpeg_wasm_mosaic_present","_ffmpeg_wasm_mosaic_data_ptr","_ffmpeg_wasm_mosaic_linesize","_ffmpeg_wasm_mosaic_size","_ffmpeg_wasm_set_remux_only","_ffmpeg_wasm_remux_start","_ffmpeg_wasm_remux_step","_ffmpeg_wasm_remux_stop","_ffmpeg_wasm_remux_init_serial","_ffmpeg_wasm_remux_init_ptr","_ffmpeg_wasm_remux_init_size","_ffmpeg_wasm_remux_output_ptr","_ffmpeg_wasm_remux_output_size","_ffmpeg_wasm_remux_consume","_ffmpeg_wasm_remux_mime","_ffmpeg_wasm_export_clip","_ffmpeg_wasm_export_step","_ffmpeg_wasm_export_progress","_ffmpeg_wasm_export_size","_ffmpeg_wasm_export_chunk_count","_ffmpeg_wasm_export_chunk_ptr","_ffmpeg_wasm_export_chunk_size","_ffmpeg_wasm_export_stop","_ffmpeg_wasm_set_attached_pictures","_ffmpeg_wasm_set_audio_batch_samples","_ffmpeg_wasm_has_video","_ffmpeg_wasm_compute_peaks","_ffmpeg_wasm_peaks_step","_ffmpeg_wasm_peaks_ptr","_ffmpeg_wasm_peaks_filled","_ffmpeg_wasm_peaks_duration","_ffmpeg_wasm_peaks_stop","_ffmpeg_wasm_set_trick_play","_ffmpeg_wasm_trick_step","_ffmpeg_wasm_rgba_width","_ffmpeg_wasm_rgba_height","_ffmpeg_wasm_set_deinterlace","_ffmpeg_wasm_set_output_size","_ffmpeg_wasm_missing_modules","_ffmpeg_wasm_is_split_build","_ffmpeg_wasm_prewarm","_ffmpeg_wasm_has_default_font","_ffmpeg_wasm_set_range_source","_ffmpeg_wasm_append_at","_ffmpeg_wasm_range_position","_ffmpeg_wasm_range_wanted","_ffmpeg_wasm_range_cached_end","_ffmpeg_wasm_read_position","_ffmpeg_wasm_input_bitrate","_ffmpeg_wasm_buffered_seconds","_ffmpeg_wasm_append_audio","_ffmpeg_wasm_set_audio_input_eof","_ffmpeg_wasm_mark_segment_boundary","_ffmpeg_wasm_restart_segments","_ffmpeg_wasm_set_live","_ffmpeg_wasm_live_skips","_ffmpeg_wasm_save_open_state","_ffmpeg_wasm_open_state_ptr","_ffmpeg_wasm_open_state_size","_ffmpeg_wasm_header_end","_ffmpeg_wasm_set_open_state","_ffmpeg_wasm_resume_position","_ffmpeg_wasm_set_spill","_ffmpeg_wasm_spilled_bytes","_ffmpeg_wasm_is_memory64","_ffmpeg_wasm_frame_desc","_ffmpeg_wasm_present_frame","_ffmpeg_wasm_stream_table","_ffmpeg_wasm_set_tone_mapping","_ffmpeg_wasm_clock_reset","_ffmpeg_wasm_clock_set_paused","_ffmpeg_wasm_clock_set_speed","_ffmpeg_wasm_clock_audio_position","_ffmpeg_wasm_clock_time","_ffmpeg_wasm_clock_schedule","_ffmpeg_wasm_clock_drift","_ffmpeg_wasm_clock_dropped","_ffmpeg_wasm_clock_late","_ffmpeg_wasm_preload","_ffmpeg_wasm_handoff","_ffmpeg_wasm_set_packet_cache","_ffmpeg_wasm_seek_cached","_ffmpeg_wasm_set_gop_cache","_ffmpeg_wasm_gop_step","_malloc","_free"]'
+
+LINK_FLAGS=()
+LINK_LIBS=(-lass -lfreetype -lfribidi)
+RUNTIME_METHODS='["cwrap"]'
+if [ "$SPLIT" = "1" ]; then
+  # Side modules first: the core exports exactly what they import
+  emcc -O3 -msimd128 -s SIDE_MODULE=1 "${MEMORY64_FLAGS[@]}" \
+    -Wl,--whole-archive "$PREFIX_DIR/lib/libass.a" -Wl,--no-whole-archive \
+    "$PREFIX_DIR/lib/libfreetype.a" "$PREFIX_DIR/lib/libfribidi.a" \
+    -o "$OUT_DIR/subtitles.wasm"
+
+  rm -f "$OUT_DIR"/codec-*.wasm
+  BUILT_DECODERS=()
+  for decoder in "${SIDE_DECODERS[@]}"; do
+    if ! emnm "$PREFIX_DIR/lib/libavcodec-side.a" 2>/dev/null | grep -q " [DdRr] ff_${decoder}_decoder$"; then
+      echo "warning: ff_${decoder}_decoder shares objects with the core; add it to CORE_DECODERS" >&2
+      continue
+    fi
+    emcc -O3 -msimd128 -s SIDE_MODULE=1 "${MEMORY64_FLAGS[@]}" \
+      -Wl,-u,"ff_${decoder}_decoder" \
+      "$PREFIX_DIR/lib/libavcodec-side.a" \
+      -o "$OUT_DIR/codec-${decoder}.wasm"
+    BUILT_DECODERS+=("$decoder")
+  done
+
+  # Every symbol a side module imports (libc, libav* internals of the core
+  # configuration) must be exported by the core. MAIN_MODULE=2 exports only
+  # these, so dead code is still eliminated, and one the core lacks fails
+  # the link as an undefined exported symbol instead of aborting
+  # loadDynamicLibrary at runtime.
+  for module in "$OUT_DIR/subtitles.wasm" "$OUT_DIR"/codec-*.wasm; do
+    [ -f "$module" ] || continue
+    emnm -u "$module" | awk '{ print $NF }'
+  done | { grep -v -x -E '__memory_base|__table_base|__stack_pointer|__indirect_function_table|memory' || true; } |
+    sort -u >"$OUT_DIR/side-imports.txt"
+  if [ -s "$OUT_DIR/side-imports.txt" ]; then
+    SIDE_EXPORTS="$(sed 's/.*/"_&"/' "$OUT_DIR/side-imports.txt" | paste -sd, -)"
+    EXPORTED_FUNCTIONS="${EXPORTED_FUNCTIONS%]},$SIDE_EXPORTS]"
+  fi
+
+  SIDE_LIST="$(IFS=,; echo "${BUILT_DECODERS[*]:-}")"
+  # The core's only undefined symbols are the weak ass_* references
+  # (FFMPEG_WASM_SPLIT), bound when the worker loads subtitles.wasm
+  LINK_FLAGS=(-s MAIN_MODULE=2 -DFFMPEG_WASM_SPLIT "-DFFMPEG_WASM_SIDE_DECODERS=\"$SIDE_LIST\"")
+  LINK_LIBS=()
+  RUNTIME_METHODS='["cwrap","loadDynamicLibrary"]'
+fi
+
+# Memory64: exports taking or returning pointer-sized values (handles,
+# pointers, size_t) would otherwise hand JS a BigInt. The signatures come from
+# the one-line declarations in ffmpeg_wasm.h: p = pointer-sized, _ = other.
+signature_conversions() {
+  awk 'function kind(t) { return t ~ /\*|uintptr_t|size_t/ ? "p" : "_" }
+    /^[a-z].*ffmpeg_wasm_[a-z0-9_]*\(.*\);$/ {
+      open = index($0, "(")
+      head = substr($0, 1, open - 1)
+      args = substr($0, open + 1, length($0) - open - 2)
+      name = head
+      sub(/.*[ *]/, "", name)
+      sig = kind(substr(head, 1, length(head) - length(name)))
+      if (args != "void") {
+        n = split(args, arg, ",")
+        for (i = 1; i <= n; i++) sig = sig kind(arg[i])
+      }
+      printf "%s%s:%s", (count++ ? "," : ""), name, sig
+    }' "$ROOT_DIR/src/ffmpeg_wasm.h"
+}
+
+if [ "$MEMORY64" = "1" ]; then
+  LINK_FLAGS+=("${MEMORY64_FLAGS[@]}" -s MAXIMUM_MEMORY=16GB -s "SIGNATURE_CONVERSIONS=$(signature_conversions)")
+fi
+
+emcc -O3 -msimd128 \
+  "${LINK_FLAGS[@]}" \
   -s WASM=1 \
   -s MODULARIZE=1 \
   -s EXPORT_NAME=FFmpegWasm \
@@ -241,16 +435,52 @@ emcc -O3 \
   -s FILESYSTEM=0 \
   -s INITIAL_MEMORY=64MB \
   -s ALLOW_MEMORY_GROWTH=1 \
-  -s EXPORTED_FUNCTIONS='["_ffmpeg_wasm_avcodec_version","_ffmpeg_wasm_avformat_version","_ffmpeg_wasm_avutil_version","_ffmpeg_wasm_has_hevc_av1","_ffmpeg_wasm_create","_ffmpeg_wasm_destroy","_ffmpeg_wasm_append","_ffmpeg_wasm_set_eof","_ffmpeg_wasm_set_keep_all","_ffmpeg_wasm_set_buffer_limit","_ffmpeg_wasm_set_file_size","_ffmpeg_wasm_set_audio_enabled","_ffmpeg_wasm_open","_ffmpeg_wasm_duration_seconds","_ffmpeg_wasm_seek_seconds","_ffmpeg_wasm_read_frame","_ffmpeg_wasm_read_video_frame","_ffmpeg_wasm_video_width","_ffmpeg_wasm_video_height","_ffmpeg_wasm_frame_format","_ffmpeg_wasm_frame_data_ptr","_ffmpeg_wasm_frame_linesize","_ffmpeg_wasm_frame_pts_seconds","_ffmpeg_wasm_frame_to_rgba","_ffmpeg_wasm_rgba_ptr","_ffmpeg_wasm_rgba_stride","_ffmpeg_wasm_rgba_size","_ffmpeg_wasm_audio_channels","_ffmpeg_wasm_audio_sample_rate","_ffmpeg_wasm_audio_nb_samples","_ffmpeg_wasm_audio_ptr","_ffmpeg_wasm_audio_bytes","_ffmpeg_wasm_audio_pts_seconds","_ffmpeg_wasm_buffered_bytes","_ffmpeg_wasm_compact_buffer","_ffmpeg_wasm_streams_count","_ffmpeg_wasm_stream_media_type","_ffmpeg_wasm_stream_codec_id","_ffmpeg_wasm_stream_codec_name","_ffmpeg_wasm_stream_language","_ffmpeg_wasm_stream_title","_ffmpeg_wasm_stream_is_default","_ffmpeg_wasm_selected_video_stream","_ffmpeg_wasm_selected_audio_stream","_ffmpeg_wasm_audio_is_enabled","_ffmpeg_wasm_select_streams","_ffmpeg_wasm_selected_subtitle_stream","_ffmpeg_wasm_subtitles_enabled","_ffmpeg_wasm_select_subtitle_stream","_ffmpeg_wasm_render_subtitles","_ffmpeg_wasm_clear_subtitle_track","_ffmpeg_wasm_add_font","_ffmpeg_wasm_subtitle_events_count","_ffmpeg_wasm_subtitle_first_start_ms","_ffmpeg_wasm_subtitle_first_end_ms","_malloc","_free"]' \
-  -s EXPORTED_RUNTIME_METHODS='["cwrap"]' \
+  -s EXPORTED_FUNCTIONS="$EXPORTED_FUNCTIONS" \
+  -s EXPORTED_RUNTIME_METHODS="$RUNTIME_METHODS" \
   --no-entry \
   -I"$PREFIX_DIR/include" \
   "$ROOT_DIR/src/ffmpeg_wasm.c" \
+  "${FONT_FLAGS[@]}" \
   -L"$PREFIX_DIR/lib" \
   -Wl,--start-group \
-  -lavformat -lavcodec -lswresample -lswscale -lavutil \
-  -lass -lfreetype -lfribidi \
+  -lavfilter -lavformat -lavcodec -lswresample -lswscale -lavutil \
+  "${LINK_LIBS[@]}" \
   -Wl,--end-group \
   -o "$OUT_JS"
 
+# Build id for the workers' shared compiled module (web/wasm-module-cache.js),
+# in the glue so checking it costs no request
+BUILD_ID="$(sha256sum "$OUT_DIR/ffmpeg_wasm.wasm" | cut -c1-16)"
+printf '\nvar FFMPEG_WASM_BUILD_ID = "%s";\n' "$BUILD_ID" >>"$OUT_JS"
+
+file_size() {
+  stat -c %s "$1"
+}
+
+gzip_size() {
+  gzip -9 -c "$1" | wc -c
+}
+
+if [ "$SPLIT" = "1" ]; then
+  # Size report: core and side modules against the monolithic build, kept in
+  # size-report.txt next to the modules
+  {
+    printf '%-28s %12s %12s\n' "module" "bytes" "gzip -9"
+    for module in "$OUT_DIR/ffmpeg_wasm.wasm" "$OUT_DIR/subtitles.wasm" "$OUT_DIR"/codec-*.wasm; do
+      [ -f "$module" ] || continue
+      printf '%-28s %12s %12s\n' "$(basename "$module")" "$(file_size "$module")" "$(gzip_size "$module")"
+    done
+    if [ -f "$MONOLITHIC_DIR/ffmpeg_wasm.wasm" ]; then
+      printf '%-28s %12s %12s\n' "monolithic ffmpeg_wasm.wasm" "$(file_size "$MONOLITHIC_DIR/ffmpeg_wasm.wasm")" \
+        "$(gzip_size "$MONOLITHIC_DIR/ffmpeg_wasm.wasm")"
+    else
+      echo "Build without --split to compare against the monolithic module."
+    fi
+  } | tee "$OUT_DIR/size-report.txt"
+  if [ -f "$MONOLITHIC_DIR/ffmpeg_wasm.wasm" ] &&
+    [ "$(gzip_size "$OUT_DIR/ffmpeg_wasm.wasm")" -ge "$(gzip_size "$MONOLITHIC_DIR/ffmpeg_wasm.wasm")" ]; then
+    echo "warning: the split core is not smaller than the monolithic module" >&2
+  fi
+fi
+
 echo "Built to $OUT_DIR"
@@ -0,0 +1,100 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+ROOT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
+OUT_DIR="$ROOT_DIR/build/native"
+CC="${CC:-cc}"
+BUILD_TYPE="${FFMPEG_WASM_NATIVE_BUILD:-profile}"
+
+usage() {
+  cat <<'EOF'
+Usage: ./scripts/build-native.sh [--debug|--profile|--release]
+
+Builds src/ffmpeg_wasm.c as a native Linux shared library plus the
+ffmpeg_wasm_cli harness against the host FFmpeg/libass (via pkg-config),
+so the decode path can be profiled with perf/valgrind.
+
+Modes:
+  --profile  -O2 with debug info and frame pointers (default).
+  --debug    -O0 -g with AddressSanitizer.
+  --release  -O3, closest to the emcc -O3 wasm build.
+
+Outputs:
+  build/native/libffmpeg_wasm.so
+  build/native/ffmpeg_wasm_cli
+
+Example:
+  perf record -g ./build/native/ffmpeg_wasm_cli -f matroska input.mkv
+EOF
+}
+
+case "${1:-}" in
+  -h|--help)
+    usage
+    exit 0
+    ;;
+  --debug)
+    BUILD_TYPE="debug"
+    ;;
+  --profile)
+    BUILD_TYPE="profile"
+    ;;
+  --release)
+    BUILD_TYPE="release"
+    ;;
+  "")
+    ;;
+  *)
+    echo "Unknown option: $1" >&2
+    usage >&2
+    exit 1
+    ;;
+esac
+
+case "$BUILD_TYPE" in
+  debug)
+    OPT_FLAGS=(-O0 -g -fsanitize=address,undefined -fno-omit-frame-pointer)
+    ;;
+  profile)
+    OPT_FLAGS=(-O2 -g -fno-omit-frame-pointer)
+    ;;
+  release)
+    OPT_FLAGS=(-O3)
+    ;;
+  *)
+    echo "Unknown build type: $BUILD_TYPE" >&2
+    exit 1
+    ;;
+esac
+
+PKGS=(libavfilter libavformat libavcodec libswresample libswscale libavutil libass)
+if ! pkg-config --exists "${PKGS[@]}"; then
+  echo "Host FFmpeg/libass development packages not found via pkg-config." >&2
+  echo "Debian/Ubuntu: sudo apt install libavfilter-dev libavformat-dev libavcodec-dev libswresample-dev libswscale-dev libavutil-dev libass-dev" >&2
+  exit 1
+fi
+
+read -r -a PKG_CFLAGS <<<"$(pkg-config --cflags "${PKGS[@]}")"
+read -r -a PKG_LIBS <<<"$(pkg-config --libs "${PKGS[@]}")"
+
+mkdir -p "$OUT_DIR"
+
+"$CC" -std=c11 -Wall -Wextra -Wno-unused-parameter \
+  "${OPT_FLAGS[@]}" \
+  -fPIC -shared -fvisibility=hidden \
+  -I"$ROOT_DIR/src" \
+  "${PKG_CFLAGS[@]}" \
+  "$ROOT_DIR/src/ffmpeg_wasm.c" \
+  "${PKG_LIBS[@]}" -lm \
+  -o "$OUT_DIR/libffmpeg_wasm.so"
+
+"$CC" -std=c11 -Wall -Wextra \
+  "${OPT_FLAGS[@]}" \
+  -I"$ROOT_DIR/src" \
+  "$ROOT_DIR/src/ffmpeg_wasm_cli.c" \
+  -L"$OUT_DIR" -lffmpeg_wasm \
+  -Wl,-rpath,'$ORIGIN' \
+  -o "$OUT_DIR/ffmpeg_wasm_cli"
+
+echo "Host FFmpeg: libavformat $(pkg-config --modversion libavformat), libass $(pkg-config --modversion libass)"
+echo "Built to $OUT_DIR ($BUILD_TYPE)"
@@ -0,0 +1,102 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Generate HLS and DASH test presentations (two H.264 variants plus AAC audio)
+# with the ffmpeg CLI, for exercising manifest playback end to end:
+#
+#   ./scripts/make-test-streams.sh
+#   ./scripts/serve-range.py --directory web
+#   # then load http://localhost:8080/test-streams/hls/master.m3u8,
+#   # .../hls-ts/master.m3u8 or .../dash/manifest.mpd as the URL source
+
+ROOT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
+OUT_DIR="$ROOT_DIR/web/test-streams"
+DURATION=60
+SEGMENT_SECONDS=2
+FFMPEG="${FFMPEG:-ffmpeg}"
+
+usage() {
+  cat <<'EOF'
+Usage: ./scripts/make-test-streams.sh [--out DIR] [--duration SECONDS] [--segment SECONDS]
+
+Writes hls/ (fMP4 segments, separate audio rendition), hls-ts/ (muxed MPEG-TS
+segments) and dash/ (SegmentTimeline template) under DIR (web/test-streams).
+Set FFMPEG to pick the ffmpeg binary.
+EOF
+}
+
+while [ $# -gt 0 ]; do
+  case "$1" in
+    --out)
+      OUT_DIR="${2:-}"
+      shift 2
+      ;;
+    --duration)
+      DURATION="${2:-}"
+      shift 2
+      ;;
+    --segment)
+      SEGMENT_SECONDS="${2:-}"
+      shift 2
+      ;;
+    --help|-h)
+      usage
+      exit 0
+      ;;
+    *)
+      echo "Unknown option: $1" >&2
+      usage >&2
+      exit 1
+      ;;
+  esac
+done
+
+if ! command -v "$FFMPEG" >/dev/null 2>&1; then
+  echo "ffmpeg CLI not found (set FFMPEG=/path/to/ffmpeg)" >&2
+  exit 1
+fi
+
+# Keyframes exactly on segment edges so every variant switches cleanly
+GOP=$((SEGMENT_SECONDS * 30))
+INPUTS=(
+  -f lavfi -i "testsrc2=size=1280x720:rate=30"
+  -f lavfi -i "sine=frequency=440:sample_rate=48000:beep_factor=4"
+  -t "$DURATION"
+)
+VIDEO=(
+  -c:v libx264 -preset veryfast -profile:v main -pix_fmt yuv420p
+  -g "$GOP" -keyint_min "$GOP" -sc_threshold 0
+  -filter:v:0 scale=640:360 -b:v:0 600k
+  -filter:v:1 scale=1280:720 -b:v:1 2500k
+)
+AUDIO=(-c:a aac -b:a 128k -ac 2)
+
+rm -rf "$OUT_DIR/hls" "$OUT_DIR/hls-ts" "$OUT_DIR/dash"
+mkdir -p "$OUT_DIR/hls" "$OUT_DIR/hls-ts" "$OUT_DIR/dash"
+
+echo "HLS (fMP4, separate audio) -> $OUT_DIR/hls"
+"$FFMPEG" -hide_banner -loglevel error -y "${INPUTS[@]}" \
+  -map 0:v -map 0:v -map 1:a "${VIDEO[@]}" "${AUDIO[@]}" \
+  -f hls -hls_time "$SEGMENT_SECONDS" -hls_playlist_type vod -hls_segment_type fmp4 \
+  -master_pl_name master.m3u8 \
+  -var_stream_map "v:0,agroup:aud v:1,agroup:aud a:0,agroup:aud,default:yes" \
+  -hls_segment_filename "$OUT_DIR/hls/stream_%v_%03d.m4s" \
+  "$OUT_DIR/hls/stream_%v.m3u8"
+
+echo "HLS (MPEG-TS, muxed audio) -> $OUT_DIR/hls-ts"
+"$FFMPEG" -hide_banner -loglevel error -y "${INPUTS[@]}" \
+  -map 0:v -map 0:v -map 1:a -map 1:a "${VIDEO[@]}" "${AUDIO[@]}" \
+  -f hls -hls_time "$SEGMENT_SECONDS" -hls_playlist_type vod -hls_segment_type mpegts \
+  -master_pl_name master.m3u8 \
+  -var_stream_map "v:0,a:0 v:1,a:1" \
+  -hls_segment_filename "$OUT_DIR/hls-ts/stream_%v_%03d.ts" \
+  "$OUT_DIR/hls-ts/stream_%v.m3u8"
+
+echo "DASH (SegmentTimeline) -> $OUT_DIR/dash"
+"$FFMPEG" -hide_banner -loglevel error -y "${INPUTS[@]}" \
+  -map 0:v -map 0:v -map 1:a "${VIDEO[@]}" "${AUDIO[@]}" \
+  -f dash -seg_duration "$SEGMENT_SECONDS" -use_template 1 -use_timeline 1 \
+  -adaptation_sets "id=0,streams=v id=1,streams=a" \
+  "$OUT_DIR/dash/manifest.mpd"
+
+echo "Done. Serve with: ./scripts/serve-range.py --directory web"
@@ -3,10 +3,16 @@ set -euo pipefail
 
 ROOT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
 VARIANT="${FFMPEG_WASM_VARIANT:-}"
+SPLIT="${FFMPEG_WASM_SPLIT:-0}"
+MEMORY64="${FFMPEG_WASM_MEMORY64:-0}"
 
 usage() {
   cat <<'EOF'
-Usage: ./scripts/prepare-demo-assets.sh [--variant royaltyfree|royaltyfree-lgpl|full|gpl|gpl-royaltyfree|royaltyfree-gpl|lgpl|nonfree]
+Usage: ./scripts/prepare-demo-assets.sh [--variant royaltyfree|royaltyfree-lgpl|full|gpl|gpl-royaltyfree|royaltyfree-gpl|lgpl|nonfree] [--split] [--memory64]
+
+--split copies the core module of a `build-ffmpeg.sh --split` build together
+with its side modules (codec-*.wasm, subtitles.wasm). --memory64 picks the
+`build-ffmpeg.sh --memory64` build.
 EOF
 }
 
@@ -15,10 +21,27 @@ if [ "${1:-}" = "--help" ] || [ "${1:-}" = "-h" ]; then
   exit 0
 fi
 
-if [ "${1:-}" = "--variant" ]; then
-  VARIANT="${2:-}"
-  shift 2
-fi
+while [ $# -gt 0 ]; do
+  case "$1" in
+    --variant)
+      VARIANT="${2:-}"
+      shift 2
+      ;;
+    --split)
+      SPLIT=1
+      shift
+      ;;
+    --memory64)
+      MEMORY64=1
+      shift
+      ;;
+    *)
+      echo "Unknown option: $1" >&2
+      usage >&2
+      exit 1
+      ;;
+  esac
+done
 
 case "${VARIANT:-full}" in
   royaltyfree|royaltyfree-lgpl)
@@ -46,6 +69,13 @@ case "${VARIANT:-full}" in
     ;;
 esac
 
+if [ "$SPLIT" = "1" ]; then
+  SRC_DIR="$SRC_DIR-split"
+fi
+if [ "$MEMORY64" = "1" ]; then
+  SRC_DIR="$SRC_DIR-memory64"
+fi
+
 if [ ! -f "$SRC_DIR/ffmpeg_wasm.js" ] || [ ! -f "$SRC_DIR/ffmpeg_wasm.wasm" ]; then
   echo "Build artifacts not found in $SRC_DIR" >&2
   echo "Run ./scripts/build-ffmpeg.sh first." >&2
@@ -57,6 +87,10 @@ copy_to() {
   mkdir -p "$target_dir"
   cp "$SRC_DIR/ffmpeg_wasm.js" "$target_dir/"
   cp "$SRC_DIR/ffmpeg_wasm.wasm" "$target_dir/"
+  rm -f "$target_dir"/codec-*.wasm "$target_dir/subtitles.wasm"
+  if [ "$SPLIT" = "1" ]; then
+    cp "$SRC_DIR"/codec-*.wasm "$SRC_DIR/subtitles.wasm" "$target_dir/"
+  fi
 }
 
 copy_to "$ROOT_DIR/web"
@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+"""Static file server with HTTP Range support, for testing URL sources.
+
+python3 -m http.server ignores Range, so the worker falls back to one
+sequential fetch. This one answers single-range requests with 206 and
+Content-Range, which is what the worker's range source needs.
+
+Usage: scripts/serve-range.py [--directory web] [--delay-ms 0] [port]
+"""
+
+import argparse
+import functools
+import os
+import re
+import time
+from http import HTTPStatus
+from http.server import SimpleHTTPRequestHandler, ThreadingHTTPServer
+
+RANGE_RE = re.compile(r"bytes=(\d*)-(\d*)$")
+
+
+class RangeHandler(SimpleHTTPRequestHandler):
+    delay_ms = 0
+
+    def end_headers(self):
+        self.send_header("Accept-Ranges", "bytes")
+        self.send_header("Access-Control-Allow-Origin", "*")
+        self.send_header("Access-Control-Expose-Headers", "Content-Range, Content-Length")
+        super().end_headers()
+
+    def do_GET(self):
+        match = RANGE_RE.match(self.headers.get("Range", "").strip())
+        path = self.translate_path(self.path)
+        if not match or not os.path.isfile(path):
+            return super().do_GET()
+
+        size = os.path.getsize(path)
+        first, last = match.groups()
+        if first:
+            start = int(first)
+            end = min(int(last), size - 1) if last else size - 1
+        else:
+            start = max(0, size - int(last or 0))
+            end = size - 1
+        if start >= size or start > end:
+            self.send_response(HTTPStatus.REQUESTED_RANGE_NOT_SATISFIABLE)
+            self.send_header("Content-Range", f"bytes */{size}")
+            self.end_headers()
+            return
+
+        if self.delay_ms:
+            time.sleep(self.delay_ms / 1000)
+        self.send_response(HTTPStatus.PARTIAL_CONTENT)
+        self.send_header("Content-Type", self.guess_type(path))
+        self.send_header("Content-Range", f"bytes {start}-{end}/{size}")
+        self.send_header("Content-Length", str(end - start + 1))
+        self.end_headers()
+        with open(path, "rb") as f:
+            f.seek(start)
+            remaining = end - start + 1
+            while remaining > 0:
+                chunk = f.read(min(remaining, 256 * 1024))
+                if not chunk:
+                    break
+                self.wfile.write(chunk)
+                remaining -= len(chunk)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("port", nargs="?", type=int, default=8080)
+    parser.add_argument("--directory", default="web")
+    parser.add_argument("--delay-ms", type=int, default=0, help="latency added to every range response")
+    args = parser.parse_args()
+
+    RangeHandler.delay_ms = args.delay_ms
+    handler = functools.partial(RangeHandler, directory=args.directory)
+    with ThreadingHTTPServer(("", args.port), handler) as server:
+        print(f"Serving {args.directory} with Range support on http://localhost:{args.port}/")
+        server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
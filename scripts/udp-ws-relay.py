@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+"""Relay an MPEG-TS UDP feed to WebSocket clients, for testing live mode.
+
+Every datagram goes out as one binary WebSocket message as soon as it
+arrives; the player treats ws:// URLs as live sources. A client that falls
+behind loses its oldest queued datagrams instead of adding latency.
+
+  ffmpeg -re -f lavfi -i testsrc2=size=1280x720:rate=30 -f lavfi -i sine \\
+    -c:v libx264 -preset ultrafast -tune zerolatency -g 30 -c:a aac \\
+    -f mpegts "udp://127.0.0.1:1234?pkt_size=1316"
+  scripts/udp-ws-relay.py --udp 127.0.0.1:1234 --port 8765
+  # then load ws://localhost:8765/ as the URL source
+
+Usage: scripts/udp-ws-relay.py [--udp HOST:PORT] [--port 8765]
+"""
+
+import argparse
+import asyncio
+import base64
+import hashlib
+import ipaddress
+import socket
+import struct
+
+WS_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+CLIENT_QUEUE = 256  # Datagrams (~330 KB of 1316-byte TS) before the oldest are dropped
+
+
+class Relay(asyncio.DatagramProtocol):
+    def __init__(self):
+        self.clients = set()
+
+    def datagram_received(self, data, addr):
+        for queue in self.clients:
+            if queue.full():
+                queue.get_nowait()
+            queue.put_nowait(data)
+
+
+def ws_frame(opcode, payload):
+    length = len(payload)
+    if length < 126:
+        header = struct.pack("!BB", 0x80 | opcode, length)
+    elif length < 65536:
+        header = struct.pack("!BBH", 0x80 | opcode, 126, length)
+    else:
+        header = struct.pack("!BBQ", 0x80 | opcode, 127, length)
+    return header + payload
+
+
+async def read_frames(reader, writer):
+    """Answers pings and returns when the client closes."""
+    while True:
+        head = await reader.readexactly(2)
+        opcode = head[0] & 0x0F
+        length = head[1] & 0x7F
+        if length == 126:
+            (length,) = struct.unpack("!H", await reader.readexactly(2))
+        elif length == 127:
+            (length,) = struct.unpack("!Q", await reader.readexactly(8))
+        mask = await reader.readexactly(4) if head[1] & 0x80 else b"\0\0\0\0"
+        payload = bytes(b ^ mask[i % 4] for i, b in enumerate(await reader.readexactly(length)))
+        if opcode == 0x8:
+            writer.write(ws_frame(0x8, payload[:2]))
+            return
+        if opcode == 0x9:
+            writer.write(ws_frame(0xA, payload))
+
+
+async def handle_client(relay, reader, writer):
+    peer = writer.get_extra_info("peername")
+    try:
+        request = await reader.readuntil(b"\r\n\r\n")
+    except (asyncio.IncompleteReadError, asyncio.LimitOverrunError):
+        writer.close()
+        return
+    headers = {}
+    for line in request.decode("latin-1").split("\r\n")[1:]:
+        name, _, value = line.partition(":")
+        headers[name.strip().lower()] = value.strip()
+    key = headers.get("sec-websocket-key")
+    if not key or headers.get("upgrade", "").lower() != "websocket":
+        writer.write(b"HTTP/1.1 426 Upgrade Required\r\nConnection: close\r\n\r\n")
+        await writer.drain()
+        writer.close()
+        return
+
+    accept = base64.b64encode(hashlib.sha1((key + WS_GUID).encode()).digest()).decode()
+    writer.write(
+        (
+            "HTTP/1.1 101 Switching Protocols\r\n"
+            "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+            f"Sec-WebSocket-Accept: {accept}\r\n\r\n"
+        ).encode()
+    )
+    sock = writer.get_extra_info("socket")
+    if sock is not None:
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+
+    queue = asyncio.Queue(CLIENT_QUEUE)
+    relay.clients.add(queue)
+    print(f"Client connected: {peer}")
+    closed = asyncio.ensure_future(read_frames(reader, writer))
+    try:
+        while not closed.done():
+            getter = asyncio.ensure_future(queue.get())
+            done, _ = await asyncio.wait({getter, closed}, return_when=asyncio.FIRST_COMPLETED)
+            if getter not in done:
+                getter.cancel()
+                break
+            writer.write(ws_frame(0x2, getter.result()))
+            await writer.drain()
+    except (ConnectionError, asyncio.IncompleteReadError):
+        pass
+    finally:
+        relay.clients.discard(queue)
+        closed.cancel()
+        writer.close()
+        print(f"Client disconnected: {peer}")
+
+
+def open_udp_socket(host, port):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4 * 1024 * 1024)
+    if ipaddress.ip_address(host).is_multicast:
+        sock.bind(("", port))
+        membership = struct.pack("4s4s", socket.inet_aton(host), socket.inet_aton("0.0.0.0"))
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, membership)
+    else:
+        sock.bind((host, port))
+    return sock
+
+
+async def serve(args):
+    host, _, port = args.udp.rpartition(":")
+    loop = asyncio.get_running_loop()
+    relay = Relay()
+    await loop.create_datagram_endpoint(lambda: relay, sock=open_udp_socket(host or "0.0.0.0", int(port)))
+    server = await asyncio.start_server(
+        lambda r, w: handle_client(relay, r, w), host="", port=args.port
+    )
+    print(f"Relaying udp://{args.udp} to ws://localhost:{args.port}/")
+    async with server:
+        await server.serve_forever()
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--udp", default="127.0.0.1:1234", help="UDP address to receive MPEG-TS on")
+    parser.add_argument("--port", type=int, default=8765, help="WebSocket port")
+    args = parser.parse_args()
+    try:
+        asyncio.run(serve(args))
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
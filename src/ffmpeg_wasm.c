@@ -1,22 +1,110 @@
-#include <emscripten/emscripten.h>
 #include <libavcodec/avcodec.h>
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
 #include <libavformat/avformat.h>
 #include <libavformat/avio.h>
+#include <libavutil/avstring.h>
 #include <libavutil/avutil.h>
+#include <libavutil/buffer.h>
 #include <libavutil/channel_layout.h>
 #include <libavutil/dict.h>
 #include <libavutil/error.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/mastering_display_metadata.h>
 #include <libavutil/mem.h>
 #include <libavutil/rational.h>
 #include <libswresample/swresample.h>
 #include <libswscale/swscale.h>
 #include <ass/ass.h>
+#include <float.h>
 #include <limits.h>
+#include <math.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "ffmpeg_wasm.h"
+#include "ffmpeg_wasm_platform.h"
+
+#define DEFAULT_KEEP_BACKLOG (4 * 1024 * 1024)
+#define MIN_KEEP_BACKLOG (512 * 1024)
+#define OVER_BUDGET_GROWTH (1024 * 1024)  // Minimum growth step past the budget allowance
+#define DEFAULT_RANGE_CACHE (64 * 1024 * 1024)
+#define MAX_SEGMENT_BOUNDARIES 8
+#define LIVE_PROBESIZE (64 * 1024)        // Live: enough TS packets for PAT/PMT
+#define LIVE_ANALYZE_US 250000
+#define OPEN_STATE_MAGIC 0x534f5746       // "FWOS"
+#define OPEN_STATE_VERSION 1
+#define OPEN_STATE_MAX_INDEX 16384        // Keyframe entries saved per stream; longer indexes are thinned
+#define ASS_GLYPH_CACHE_MAX 4096
+#define ASS_BITMAP_CACHE_MB 16
+#define ASS_BITMAP_CACHE_MB_LOW 2
+#define MOSAIC_MAX_TILES 64
+#define SUBTITLE_MODULE "subtitles.wasm"  // libass + FreeType + FriBidi in split builds
+
+#ifdef FFMPEG_WASM_EMBEDDED_FONT
+// Inter-Regular.ttf, compiled into the data segment by build-ffmpeg.sh
+extern const unsigned char ffmpeg_wasm_default_font[];
+extern const unsigned int ffmpeg_wasm_default_font_len;
+#endif
+
+// Decoders that a split build moved into codec-<name>.wasm side modules
+#ifndef FFMPEG_WASM_SIDE_DECODERS
+#define FFMPEG_WASM_SIDE_DECODERS ""
+#endif
+
+#ifdef FFMPEG_WASM_SPLIT
+// libass is in subtitles.wasm. These weak references are the only symbols the
+// core links without, and the dynamic linker binds them when the worker loads
+// the module; every caller checks platform_side_module(SUBTITLE_MODULE) first.
+#pragma weak ass_add_font
+#pragma weak ass_free_track
+#pragma weak ass_library_done
+#pragma weak ass_library_init
+#pragma weak ass_new_track
+#pragma weak ass_process_chunk
+#pragma weak ass_process_codec_private
+#pragma weak ass_render_frame
+#pragma weak ass_renderer_done
+#pragma weak ass_renderer_init
+#pragma weak ass_set_cache_limits
+#pragma weak ass_set_fonts
+#pragma weak ass_set_frame_size
+#endif
+#define REMUX_PROBE_PACKETS 64            // Packets held back until every output stream was seen
+#define REMUX_AVIO_BUFFER_SIZE (64 * 1024)
+#define EXPORT_CHUNK_SIZE (1024 * 1024)
+#define AUDIO_ONLY_BATCH_SAMPLES 8192     // ~170 ms at 48 kHz per read_frame in audio-only mode
+#define PEAKS_MAX_BUCKETS (1 << 20)
+#define SPILL_CHUNK_SIZE (1024 * 1024)    // Largest single write to the spill store
+#define TONEMAP_LUT_SIZE 4096
+#define TONEMAP_SDR_WHITE_NITS 203.0      // BT.2408 reference white, written as RGBA 255
+#define TONEMAP_DEFAULT_PEAK_NITS 1000.0  // PQ without metadata; HLG nominal peak
+#define CLOCK_SLEW 0.1                    // Share of the audio drift corrected per report
+#define CLOCK_SNAP_SECONDS 0.25           // Larger drift: jump to the audio position
+#define CLOCK_RESYNC_SECONDS 1.0          // Without audio, a frame this far off re-anchors
+#define CLOCK_AUDIO_FRESH_SECONDS 0.5     // Audio is the master while reports are this recent
+#define CLOCK_EARLY_SECONDS 0.004         // Closer than a timer tick: present now
+#define CLOCK_MAX_WAIT_SECONDS 0.1        // Waits are re-evaluated at least this often
+#define CLOCK_MAX_DROPS 4                 // Present at least one frame in this many
+#define CLOCK_DEFAULT_FRAME_SECONDS 0.04
+#define PRELOAD_VIDEO 1                   // adopt/primed bits: per stream type
+#define PRELOAD_AUDIO 2
+#define PRELOAD_DONE 4                    // primed: ffmpeg_wasm_preload finished
+#define GOP_FRAMES_PER_CALL 8             // Decoded per gop_step call while filling the store
+#define GOP_PTS_EPSILON 1e-4              // Frame times closer than this are the same frame
+
+// Bytes compaction dropped from the front of the main buffer (set_spill), so
+// seeks behind the heap window still work. One contiguous extent that must
+// end at the window's offset to be usable.
+typedef struct SpillStore {
+  void *handle;  // platform_spill_open
+  int64_t start;
+  int64_t end;
+} SpillStore;
+
 typedef struct StreamBuffer {
   uint8_t *data;
   size_t size;
@@ -25,13 +113,300 @@ typedef struct StreamBuffer {
   size_t read_pos;
   int64_t offset;
   size_t limit;
+  size_t backlog;       // Consumed bytes kept behind read_pos for short back-seeks
+  size_t growth_cap;    // Soft capacity ceiling from the memory budget, 0 if none
   int keep_all;
   int eof;
   int64_t total_size;  // Known file size, -1 if unknown
+  // Offsets where a new init segment starts (manifest sources). Reads stop at
+  // the first one until the demuxer has been reopened there.
+  int64_t boundaries[MAX_SEGMENT_BOUNDARIES];
+  int boundary_count;
+  SpillStore *spill;  // NULL unless set_spill (main buffer only)
+  int cold;           // Reading spilled bytes at cold_pos; the window resumes at read_pos 0
+  int64_t cold_pos;
 } StreamBuffer;
 
+// Separate audio rendition of a manifest source (DASH audio adaptation set,
+// HLS EXT-X-MEDIA): its own bytes and demuxer, feeding the one audio decoder.
+typedef struct AudioInput {
+  StreamBuffer buffer;
+  AVIOContext *avio;
+  AVFormatContext *fmt;
+  const AVInputFormat *format;  // Kept to reopen at boundaries
+  int stream_index;
+  int reopen;           // Demuxer must be (re)opened before the next read
+  int eof;
+  double last_seconds;  // dts of the latest packet read, -1 = none
+} AudioInput;
+
+// Sparse byte cache for random-access sources (HTTP Range). Extents are sorted,
+// disjoint and never adjacent; JS appends at any offset and the demuxer may
+// seek anywhere in [0, total_size). A read that hits a hole records it in
+// wanted and returns EAGAIN so JS can fetch that range next.
+typedef struct RangeExtent {
+  int64_t offset;
+  uint8_t *data;
+  size_t size;
+  size_t capacity;
+} RangeExtent;
+
+typedef struct RangeCache {
+  RangeExtent *extents;
+  int count;
+  int capacity;
+  int64_t pos;
+  int64_t wanted;      // First missing byte a read ran into, -1 if none
+  int64_t total_size;
+  size_t bytes;        // Sum of extent capacities
+  size_t limit;
+} RangeCache;
+
+// Recently demuxed packets of the selected video and audio streams, in demux
+// order, so a short back-seek replays them instead of reading the input
+// again. Always one unbroken run: whatever moves the demuxer clears it.
+typedef struct CachedPacket {
+  AVPacket *pkt;
+  size_t bytes;    // Charged to FFMPEG_WASM_MEM_PACKET_CACHE
+  double seconds;  // pts (dts without one), NAN if neither
+  int key;         // Replay can start here: video keyframe, or any audio packet without video
+} CachedPacket;
+
+typedef struct PacketCache {
+  CachedPacket *entries;  // Ring of capacity; count entries from head
+  int capacity;
+  int head;
+  int count;
+  int replay;             // Next entry read_next_frame takes; count = read the input
+  size_t bytes;
+  size_t max_bytes;       // 0 = off
+  double max_seconds;
+  double end_seconds;     // Latest entry time, -1 = none
+} PacketCache;
+
+// Decoded frames around a step-back target, in pts order, for frame
+// step-back and reverse playback. One contiguous run of decoder output:
+// frames are only dropped from the front (the oldest).
+typedef struct GopFrame {
+  AVFrame *frame;  // Own copy, downscaled to max_height when set
+  double seconds;
+  size_t bytes;
+} GopFrame;
+
+typedef struct GopCache {
+  GopFrame *frames;
+  int count;
+  int capacity;
+  size_t bytes;
+  size_t max_bytes;        // 0 = off
+  int max_height;          // 0 = decoded size
+  struct SwsContext *sws;  // Downscaled copies
+  int follows;             // The decoder's next frame is the one after the newest stored
+  int filling;             // Decoding from a keyframe towards target
+  double target;
+  double start_seconds;    // Where the current fill started decoding
+  int seeked;              // The fill started from a demuxer seek, not the packet cache
+  double seek_back;        // Extra seconds before target when no frame came out ahead of it
+} GopCache;
+
+// What ingest flow control needs: how far the demuxer has read (in bytes and
+// media time), how far playback has got, and the bitrate seen in between.
+typedef struct FlowStats {
+  int64_t sample_pos;      // Byte position at the last bitrate sample
+  double sample_time;      // Media time at the last bitrate sample, -1 = none
+  double bitrate;          // Smoothed bits/s of the demuxed input, 0 = unknown
+  double demuxed_seconds;  // Media time of the latest demuxed packet, -1 = none
+  double played_seconds;   // pts of the latest frame handed to JS, -1 = none
+} FlowStats;
+
+// Presentation clock: media time as a function of the caller's wall time,
+// anchored on the first frame and slewed towards the audio position the
+// worklet reports, so audio is the master whenever it is playing.
+typedef struct PresentClock {
+  int anchored;
+  int paused;
+  double anchor_pts;      // Media time at anchor_wall
+  double anchor_wall;
+  double speed;
+  double drift;           // Audio position minus the clock at the last report
+  double audio_wall;      // Wall time of the last audio report, -1 = none
+  double frame_duration;  // Smoothed pts step between scheduled frames, 0 = unknown
+  double last_pts;        // -1 = none
+  int consecutive_drops;
+  int dropped;
+  int late;
+} PresentClock;
+
+// Bytes owned by one context, by FFMPEG_WASM_MEM_* category. Codec frames are
+// counted through get_buffer2; libass is charged its configured cache ceiling
+// plus injected fonts since it has no allocator hooks.
+typedef struct MemoryAccounting {
+  size_t current[FFMPEG_WASM_MEM_CATEGORY_COUNT];
+  size_t peak[FFMPEG_WASM_MEM_CATEGORY_COUNT];
+  size_t total;
+  size_t total_peak;
+  size_t budget;  // 0 = unlimited
+} MemoryAccounting;
+
+typedef struct TrackedBuffer {
+  MemoryAccounting *mem;
+  int category;
+  size_t size;
+  AVBufferRef *inner;
+} TrackedBuffer;
+
+// Growable FIFO of bytes; consumers read from data + start
+typedef struct ByteQueue {
+  uint8_t *data;
+  size_t start;
+  size_t size;
+  size_t capacity;
+} ByteQueue;
+
+// Stream-copy remux of the selected streams to fragmented MP4 for MSE.
+// Init (ftyp+moov) and media (moof+mdat) bytes are separated via AVIO data
+// markers so a SourceBuffer can be re-initialized after a seek.
+typedef struct RemuxState {
+  AVFormatContext *ofmt;
+  AVIOContext *avio;
+  int *stream_map;  // Input stream index -> output stream index, -1 = dropped
+  int nb_input_streams;
+  int has_video;
+  AVPacket *pending[REMUX_PROBE_PACKETS];
+  int nb_pending;
+  unsigned int seen_mask;  // Output streams with at least one pending packet
+  int header_written;
+  int finished;
+  int error;  // AVERROR once writing the header failed; later steps return it
+  int in_header;
+  int init_serial;  // Bumped each time a complete init segment is available
+  ByteQueue init;
+  ByteQueue media;
+  char mime[192];
+} RemuxState;
+
+// Seekable in-memory output split into EXPORT_CHUNK_SIZE chunks, so the
+// muxers can patch headers and a large clip never needs one contiguous block.
+typedef struct ChunkedOutput {
+  uint8_t **chunks;
+  int nb_chunks;
+  int64_t size;
+  int64_t pos;
+} ChunkedOutput;
+
+// Stream-copy export of [start, end) into mp4 or matroska
+typedef struct ExportJob {
+  AVFormatContext *ofmt;
+  AVIOContext *avio;
+  int *stream_map;  // Input stream index -> output stream index, -1 = dropped
+  int nb_input_streams;
+  int video_in;     // Input index of the exported video stream, -1 = none
+  int flags;
+  int64_t start_us;
+  int64_t end_us;
+  int64_t cut_us;   // Clip origin: video keyframe at/before start, AV_NOPTS_VALUE until known
+  AVPacket **gop;   // Packets since the last video keyframe while cut_us is unknown
+  int nb_gop;
+  int gop_capacity;
+  unsigned int ended_mask;  // Output streams past end_us
+  int64_t last_us;
+  int header_written;
+  int finished;
+  ChunkedOutput output;
+} ExportJob;
+
+// Waveform peaks over [0, duration): the audio stream is decoded in its
+// native sample format (no swr) and reduced to min/max/RMS per bucket.
+typedef struct PeakJob {
+  AVCodecContext *codec;
+  AVFrame *frame;
+  int stream_index;
+  AVRational time_base;
+  int64_t start_pts;    // Stream pts mapped to sample 0
+  int64_t next_sample;  // Position of the next frame when it has no pts
+  int buckets;
+  double duration;
+  float *peaks;         // buckets * 3: min, max, rms
+  double *sum_sq;
+  int64_t *counts;
+  int filled;           // Highest bucket touched + 1
+  int finished;
+} PeakJob;
+
+// Optional deinterlacer between the decoder and the frame accessors. Scaling
+// is not part of the graph: frame_to_rgba and mosaic tiles do it in their
+// existing sws pass (see out_width/out_height).
+typedef struct VideoFilter {
+  char name[8];          // "yadif" or "bwdif"
+  int double_rate;       // One output frame per field
+  AVFilterGraph *graph;  // Built from the first frame; NULL after a reset
+  AVFilterContext *src;
+  AVFilterContext *sink;
+  AVFrame *decoded;      // Decoder output on its way into the graph
+  int in_width;
+  int in_height;
+  int in_format;
+  int flushed;           // Decoder drained and EOF pushed into the graph
+} VideoFilter;
+
+// Fused 10-bit 4:2:0 -> RGBA path of frame_to_rgba. The transfer function,
+// tone curve (BT.2390 roll-off from the content peak to SDR white) and output
+// gamma are folded into two LUTs; BT.2020 -> BT.709 is a 3x3 matrix between
+// them in linear light. Rebuilt when the colour tags or the peak change.
+typedef struct ToneMap {
+  int trc;
+  int primaries;
+  int colorspace;
+  int range;
+  double peak_nits;
+  double metadata_peak;     // Last peak seen in side data; sticks between SEIs
+  int passthrough;          // SDR BT.709: R'G'B' straight to 8 bits, no LUTs
+  int gamut;                // BT.2020 primaries: convert to BT.709
+  float y_offset;           // 10-bit code -> Y' [0,1] and Cb/Cr [-0.5,0.5]
+  float y_scale;
+  float c_scale;
+  float cr_r;               // R'G'B' from Y'CbCr
+  float cb_g;
+  float cr_g;
+  float cb_b;
+  float to_linear[TONEMAP_LUT_SIZE];     // R' -> tone-mapped linear [0,1]
+  uint8_t to_display[TONEMAP_LUT_SIZE];  // sqrt(linear) -> BT.1886 8-bit
+} ToneMap;
+
+// A font added with ffmpeg_wasm_add_font: same name, size and content hash
+// means the same font
+typedef struct AssFontKey {
+  char *name;
+  int len;
+  uint64_t hash;
+} AssFontKey;
+
+// Fonts a context or mosaic added. They go to a libass library of its own,
+// created on the first add, so they never reach other contexts or later
+// files; only the embedded "Inter" lives in the shared library.
+typedef struct AssFonts {
+  ASS_Library *library;
+  AssFontKey *keys;
+  int count;
+  size_t bytes;  // Copies libass keeps, the default font in library included
+} AssFonts;
+
+struct FFmpegWasmMosaic;
+
 typedef struct FFmpegWasmContext {
   StreamBuffer buffer;
+  RangeCache *range;  // Replaces buffer as the AVIO source when set
+  AudioInput *audio_input;          // Audio comes from here instead of fmt when set
+  const AVInputFormat *segment_format;
+  int demux_reopen;                 // fmt is exhausted; reopen at the next boundary
+  uint8_t *new_extradata[2];        // Video, audio: for the next packet after a switch
+  int new_extradata_size[2];
+  uint8_t *open_state;              // Cached open state the next open applies
+  int open_state_size;
+  uint8_t *saved_state;             // Output of save_open_state
+  int saved_state_size;
+  int64_t header_end;               // Input bytes consumed by avformat_open_input
+  int state_applied;                // This open used a cached state
   AVIOContext *avio;
   AVFormatContext *fmt;
   AVPacket *packet;
@@ -47,15 +422,41 @@ typedef struct FFmpegWasmContext {
   int rgba_size;
   int rgba_width;
   int rgba_height;
+  int rgba_src_width;
+  int rgba_src_height;
   enum AVPixelFormat rgba_src_fmt;
+  int out_width;        // frame_to_rgba output size, 0 = frame size
+  int out_height;
+  VideoFilter *filter;  // Deinterlacer, NULL = frames go straight to the accessors
+  ToneMap *tonemap;     // Fused yuv420p10 path state, built on the first such frame
+  int tone_mapping;     // 0 = 10-bit frames go through sws like everything else
+  int rgba_fused;       // The last frame_to_rgba used the fused path
 
   struct SwrContext *swr;
   uint8_t *audio_data;
   int audio_linesize;
+  int audio_data_size;
   int audio_nb_samples;
   int audio_channels;
   int audio_sample_rate;
   double audio_pts_seconds;
+  int audio_batch_samples;  // Audio-only: samples gathered per read_frame, 0 = one codec frame
+  int audio_batching;       // convert_audio_frame appends instead of replacing
+  double audio_end_seconds; // pts just past the last converted sample, -1 = none
+  int swr_drained;          // The resampler tail went out after the decoder's EOF
+  int attached_pictures;    // Decode cover art (attached_pic streams) as video
+
+  double live_target;       // Live: latency target in seconds, 0 = not live (no seeking)
+  int live_skipping;        // Over the target: dropping packets up to a keyframe
+  int live_skips;
+
+  int trick_play;           // Keyframe-only scanning (skip_frame = NONKEY, audio off)
+  int trick_saved_audio;    // audio_enabled to restore when trick play ends
+  int trick_pending;        // Seeked for trick_target, still reading towards its keyframe
+  double trick_target;
+
+  int adopt;                // PRELOAD_*: decoders ffmpeg_wasm_handoff takes from the previous item
+  int primed;               // PRELOAD_*: frames ffmpeg_wasm_preload decoded, handed out first
 
   int video_stream_index;
   int audio_stream_index;
@@ -76,8 +477,167 @@ typedef struct FFmpegWasmContext {
   int subtitle_stream_index;
   AVCodecContext *subtitle_codec;
   int subtitles_enabled;
+  AssFonts ass_fonts;
+  int ass_cache_trimmed;    // Kept across renderers: the budget still applies
+
+  MemoryAccounting mem;
+  FlowStats flow;
+  PacketCache packets;
+  GopCache gop;
+  PresentClock clock;
+
+  int remux_only;      // Open without decoders; packets go to the remuxer/exporter only
+  RemuxState *remux;
+  ExportJob *export_job;
+  PeakJob *peak_job;
+
+  struct FFmpegWasmMosaic *mosaic;  // Shares its libass library/renderer when set
+  int mosaic_tile;
+  int64_t video_frame_serial;       // Bumped per decoded video frame
+
+  char missing_modules[160];  // Split builds: side modules the last open/select lacked
+
+  FFmpegWasmFrameDesc desc;         // Read by JS in place; see ffmpeg_wasm_frame_desc
+  uint8_t *stream_table;            // FFmpegWasmStreamTable plus entries
+  size_t stream_table_size;
 } FFmpegWasmContext;
 
+_Static_assert(offsetof(FFmpegWasmFrameDesc, pts) == 8, "frame desc layout");
+_Static_assert(offsetof(FFmpegWasmFrameDesc, data) == 32, "frame desc layout");
+_Static_assert(offsetof(FFmpegWasmFrameDesc, linesize) == 64, "frame desc layout");
+_Static_assert(offsetof(FFmpegWasmFrameDesc, rgba_data) == 96, "frame desc layout");
+_Static_assert(offsetof(FFmpegWasmFrameDesc, audio_pts) == 120, "frame desc layout");
+_Static_assert(offsetof(FFmpegWasmFrameDesc, subtitle_status) == 148, "frame desc layout");
+_Static_assert(sizeof(FFmpegWasmFrameDesc) == 152, "frame desc layout");
+_Static_assert(sizeof(FFmpegWasmStreamTable) == 32, "stream table layout");
+_Static_assert(offsetof(FFmpegWasmStreamEntry, codec_name) == 16, "stream entry layout");
+_Static_assert(sizeof(FFmpegWasmStreamEntry) == 40, "stream entry layout");
+
+// One tile of a mosaic atlas. The sws context scales the attached context's
+// frames straight into the tile, so per-stream RGBA buffers are not needed.
+typedef struct MosaicTile {
+  FFmpegWasmContext *ctx;
+  int x, y, width, height;
+  struct SwsContext *sws;
+  int src_width;
+  int src_height;
+  enum AVPixelFormat src_fmt;
+  int dst_x, dst_y, dst_width, dst_height;  // Aspect-fit rect inside the tile
+  int64_t presented_serial;
+} MosaicTile;
+
+typedef struct FFmpegWasmMosaic {
+  int width;
+  int height;
+  enum AVPixelFormat format;  // AV_PIX_FMT_RGBA or AV_PIX_FMT_YUV420P
+  uint8_t *data[4];
+  int linesize[4];
+  int size;
+
+  ASS_Library *ass_library;
+  ASS_Renderer *ass_renderer;
+  AssFonts ass_fonts;
+
+  MosaicTile tiles[MOSAIC_MAX_TILES];
+} FFmpegWasmMosaic;
+
+static void mem_update_peaks(MemoryAccounting *mem, int category) {
+  if (mem->current[category] > mem->peak[category]) {
+    mem->peak[category] = mem->current[category];
+  }
+  if (mem->total > mem->total_peak) {
+    mem->total_peak = mem->total;
+  }
+}
+
+static void mem_charge(MemoryAccounting *mem, int category, size_t bytes) {
+  if (!mem || category < 0 || category >= FFMPEG_WASM_MEM_CATEGORY_COUNT) {
+    return;
+  }
+  mem->current[category] += bytes;
+  mem->total += bytes;
+  mem_update_peaks(mem, category);
+}
+
+static void mem_release(MemoryAccounting *mem, int category, size_t bytes) {
+  if (!mem || category < 0 || category >= FFMPEG_WASM_MEM_CATEGORY_COUNT) {
+    return;
+  }
+  if (bytes > mem->current[category]) {
+    bytes = mem->current[category];
+  }
+  mem->current[category] -= bytes;
+  mem->total -= bytes;
+}
+
+static void mem_set(MemoryAccounting *mem, int category, size_t bytes) {
+  if (!mem || category < 0 || category >= FFMPEG_WASM_MEM_CATEGORY_COUNT) {
+    return;
+  }
+  mem->total = mem->total - mem->current[category] + bytes;
+  mem->current[category] = bytes;
+  mem_update_peaks(mem, category);
+}
+
+static int mem_over_budget(const MemoryAccounting *mem) {
+  return mem->budget > 0 && mem->total > mem->budget;
+}
+
+static void tracked_buffer_free(void *opaque, uint8_t *data) {
+  TrackedBuffer *tracked = (TrackedBuffer *)opaque;
+  mem_release(tracked->mem, tracked->category, tracked->size);
+  av_buffer_unref(&tracked->inner);
+  av_free(tracked);
+}
+
+// get_buffer2 hook: allocate through FFmpeg's default pools, then wrap each
+// plane buffer so the context is charged until the last reference drops.
+static int tracked_get_buffer2(AVCodecContext *codec, AVFrame *frame, int flags) {
+  int ret = avcodec_default_get_buffer2(codec, frame, flags);
+  MemoryAccounting *mem = (MemoryAccounting *)codec->opaque;
+  if (ret < 0 || !mem) {
+    return ret;
+  }
+
+  int category = codec->codec_type == AVMEDIA_TYPE_AUDIO ? FFMPEG_WASM_MEM_AUDIO
+                                                          : FFMPEG_WASM_MEM_CODEC_FRAMES;
+  for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++) {
+    AVBufferRef *inner = frame->buf[i];
+    TrackedBuffer *tracked = av_mallocz(sizeof(*tracked));
+    if (!tracked) {
+      break;  // Leave the rest untracked rather than failing the decode
+    }
+    AVBufferRef *outer = av_buffer_create(inner->data, inner->size, tracked_buffer_free, tracked, 0);
+    if (!outer) {
+      av_free(tracked);
+      break;
+    }
+    tracked->mem = mem;
+    tracked->category = category;
+    tracked->size = inner->size;
+    tracked->inner = inner;
+    frame->buf[i] = outer;
+    mem_charge(mem, category, inner->size);
+  }
+  return 0;
+}
+
+static void attach_memory_hooks(FFmpegWasmContext *ctx, AVCodecContext *codec) {
+  if (!ctx || !codec) {
+    return;
+  }
+  codec->opaque = &ctx->mem;
+  codec->get_buffer2 = tracked_get_buffer2;
+}
+
+// Byte counts from JS arrive as doubles (exact to 2^53); <= 0 maps to 0
+static size_t clamp_size(double bytes) {
+  if (!(bytes > 0.0)) {
+    return 0;
+  }
+  return bytes >= (double)SIZE_MAX ? SIZE_MAX : (size_t)bytes;
+}
+
 static int ensure_capacity(StreamBuffer *buffer, size_t needed) {
   if (!buffer) {
     return AVERROR(EINVAL);
@@ -107,6 +667,21 @@ static int ensure_capacity(StreamBuffer *buffer, size_t needed) {
     }
     new_capacity *= 2;
   }
+  // Under a memory budget, don't let doubling overshoot the allowance. Past
+  // it, still grow by a step so each append doesn't realloc the whole window.
+  if (buffer->growth_cap > 0 && new_capacity > buffer->growth_cap) {
+    if (needed <= buffer->growth_cap) {
+      new_capacity = buffer->growth_cap;
+    } else {
+      size_t step = needed - buffer->capacity;
+      if (step < OVER_BUDGET_GROWTH) {
+        step = OVER_BUDGET_GROWTH;
+      }
+      if (needed + step > needed && needed + step < new_capacity) {
+        new_capacity = needed + step;
+      }
+    }
+  }
 
   uint8_t *new_data = av_realloc(buffer->data, new_capacity);
   if (!new_data) {
@@ -118,20 +693,30 @@ static int ensure_capacity(StreamBuffer *buffer, size_t needed) {
   return 0;
 }
 
-static void compact_buffer(StreamBuffer *buffer) {
-  if (!buffer || buffer->read_pos == 0) {
-    return;
-  }
-  if (buffer->keep_all) {
-    return;
+// Copy the first len bytes of the window to the spill extent. A failed write
+// leaves the extent short of the new offset, so the next drop starts over.
+static void spill_front(StreamBuffer *buffer, size_t len) {
+  SpillStore *spill = buffer->spill;
+  if (spill->end != buffer->offset) {
+    spill->start = buffer->offset;
+    spill->end = buffer->offset;
+  }
+  const uint8_t *src = buffer->data + buffer->start;
+  while (len > 0) {
+    int chunk = len > SPILL_CHUNK_SIZE ? SPILL_CHUNK_SIZE : (int)len;
+    if (platform_spill_write(spill->handle, spill->end, src, chunk) != chunk) {
+      return;
+    }
+    spill->end += chunk;
+    src += chunk;
+    len -= (size_t)chunk;
   }
+}
 
-  const size_t keep_backlog = 4 * 1024 * 1024;
-  if (buffer->read_pos <= keep_backlog) {
-    return;
+static void buffer_drop_front(StreamBuffer *buffer, size_t drop) {
+  if (buffer->spill && drop > 0) {
+    spill_front(buffer, drop < buffer->size ? drop : buffer->size);
   }
-
-  size_t drop = buffer->read_pos - keep_backlog;
   if (drop >= buffer->size) {
     buffer->size = 0;
     buffer->read_pos = 0;
@@ -146,6 +731,32 @@ static void compact_buffer(StreamBuffer *buffer) {
   buffer->offset += (int64_t)drop;
 }
 
+static void close_spill(StreamBuffer *buffer) {
+  if (!buffer->spill) {
+    return;
+  }
+  platform_spill_close(buffer->spill->handle);
+  av_freep(&buffer->spill);
+  buffer->cold = 0;
+}
+
+static void compact_buffer(StreamBuffer *buffer) {
+  if (!buffer || buffer->read_pos == 0) {
+    return;
+  }
+  if (buffer->keep_all) {
+    return;
+  }
+
+  const size_t keep_backlog = buffer->backlog;
+  if (buffer->read_pos <= keep_backlog) {
+    return;
+  }
+
+  size_t drop = buffer->read_pos - keep_backlog;
+  buffer_drop_front(buffer, drop);
+}
+
 static void enforce_buffer_limit(StreamBuffer *buffer) {
   if (!buffer || buffer->limit == 0 || buffer->keep_all) {
     return;
@@ -154,7 +765,7 @@ static void enforce_buffer_limit(StreamBuffer *buffer) {
     return;
   }
 
-  const size_t keep_backlog = 4 * 1024 * 1024;
+  const size_t keep_backlog = buffer->backlog;
   size_t safe_drop = 0;
   if (buffer->read_pos > keep_backlog) {
     safe_drop = buffer->read_pos - keep_backlog;
@@ -167,18 +778,55 @@ static void enforce_buffer_limit(StreamBuffer *buffer) {
   if (drop > safe_drop) {
     drop = safe_drop;
   }
-  if (drop >= buffer->size) {
-    buffer->size = 0;
-    buffer->read_pos = 0;
-    buffer->offset += (int64_t)drop;
-    buffer->start = 0;
+  buffer_drop_front(buffer, drop);
+}
+
+// Give back capacity beyond what the buffered bytes (or target) need. Unlike
+// ensure_capacity this is only used to honor a memory budget.
+static void shrink_buffer(StreamBuffer *buffer, size_t target) {
+  if (!buffer || !buffer->data) {
+    return;
+  }
+  if (target < buffer->size) {
+    target = buffer->size;
+  }
+  if (target < 1024) {
+    target = 1024;
+  }
+  if (buffer->capacity <= target + target / 4) {
     return;
   }
 
-  buffer->start += drop;
-  buffer->size -= drop;
-  buffer->read_pos -= drop;
-  buffer->offset += (int64_t)drop;
+  if (buffer->start > 0 && buffer->size > 0) {
+    memmove(buffer->data, buffer->data + buffer->start, buffer->size);
+  }
+  buffer->start = 0;
+  uint8_t *new_data = av_realloc(buffer->data, target);
+  if (!new_data) {
+    return;
+  }
+  buffer->data = new_data;
+  buffer->capacity = target;
+}
+
+// Bytes at cold_pos come from the spill until it reaches the window
+static int read_cold(StreamBuffer *buffer, uint8_t *buf, int buf_size) {
+  SpillStore *spill = buffer->spill;
+  int64_t until = buffer->offset - buffer->cold_pos;
+  if (!spill || spill->end != buffer->offset || until <= 0) {
+    buffer->cold = 0;
+    return 0;
+  }
+  int want = until < buf_size ? (int)until : buf_size;
+  int got = platform_spill_read(spill->handle, buffer->cold_pos, buf, want);
+  if (got <= 0) {
+    return AVERROR(EIO);
+  }
+  buffer->cold_pos += got;
+  if (buffer->cold_pos >= buffer->offset) {
+    buffer->cold = 0;
+  }
+  return got;
 }
 
 static int read_packet(void *opaque, uint8_t *buf, int buf_size) {
@@ -186,8 +834,23 @@ static int read_packet(void *opaque, uint8_t *buf, int buf_size) {
   if (!buffer || buf_size <= 0) {
     return 0;
   }
+  if (buffer->cold) {
+    int ret = read_cold(buffer, buf, buf_size);
+    if (ret != 0) {
+      return ret;
+    }
+  }
 
   size_t available = buffer->size - buffer->read_pos;
+  if (buffer->boundary_count > 0) {
+    int64_t until = buffer->boundaries[0] - (buffer->offset + (int64_t)buffer->read_pos);
+    if (until <= 0) {
+      return AVERROR_EOF;  // The next bytes belong to a new init segment
+    }
+    if ((int64_t)available > until) {
+      available = (size_t)until;
+    }
+  }
   if (available == 0) {
     return buffer->eof ? AVERROR_EOF : AVERROR(EAGAIN);
   }
@@ -217,7 +880,7 @@ static int64_t seek_stream(void *opaque, int64_t offset, int whence) {
   }
 
   int64_t new_pos = -1;
-  int64_t current = buffer->offset + (int64_t)buffer->read_pos;
+  int64_t current = buffer->cold ? buffer->cold_pos : buffer->offset + (int64_t)buffer->read_pos;
   switch (whence & ~AVSEEK_FORCE) {
     case SEEK_SET:
       new_pos = offset;
@@ -235,1586 +898,6820 @@ static int64_t seek_stream(void *opaque, int64_t offset, int whence) {
       return -1;
   }
 
+  SpillStore *spill = buffer->spill;
+  if (new_pos < buffer->offset && spill && spill->end == buffer->offset && new_pos >= spill->start) {
+    buffer->cold = 1;
+    buffer->cold_pos = new_pos;
+    buffer->read_pos = 0;
+    return new_pos;
+  }
   if (new_pos < buffer->offset || new_pos > buffer->offset + (int64_t)buffer->size) {
     return -1;
   }
+  if (buffer->boundary_count > 0 && new_pos > buffer->boundaries[0]) {
+    return -1;
+  }
 
+  buffer->cold = 0;
   buffer->read_pos = (size_t)(new_pos - buffer->offset);
   return new_pos;
 }
 
-static void free_rgba_buffers(FFmpegWasmContext *ctx) {
-  if (!ctx) {
-    return;
-  }
-  if (ctx->rgba_data[0]) {
-    av_freep(&ctx->rgba_data[0]);
-    ctx->rgba_data[1] = NULL;
-    ctx->rgba_data[2] = NULL;
-    ctx->rgba_data[3] = NULL;
+static void range_remove(RangeCache *cache, int index) {
+  av_freep(&cache->extents[index].data);
+  cache->bytes -= cache->extents[index].capacity;
+  memmove(&cache->extents[index], &cache->extents[index + 1],
+          (size_t)(cache->count - index - 1) * sizeof(*cache->extents));
+  cache->count--;
+}
+
+// Index of the extent holding pos, or -1
+static int range_find(const RangeCache *cache, int64_t pos) {
+  for (int i = 0; i < cache->count; i++) {
+    const RangeExtent *ext = &cache->extents[i];
+    if (pos < ext->offset) {
+      break;
+    }
+    if (pos < ext->offset + (int64_t)ext->size) {
+      return i;
+    }
   }
-  ctx->rgba_size = 0;
-  ctx->rgba_width = 0;
-  ctx->rgba_height = 0;
-  ctx->rgba_src_fmt = AV_PIX_FMT_NONE;
+  return -1;
 }
 
-static void free_audio_buffers(FFmpegWasmContext *ctx) {
-  if (!ctx) {
+// Drop whole extents farthest from the read position, then the consumed head
+// of the current one, until the cache fits in limit.
+static void range_evict(RangeCache *cache, size_t limit) {
+  while (cache->bytes > limit && cache->count > 1) {
+    int victim = 0;
+    int64_t farthest = -1;
+    for (int i = 0; i < cache->count; i++) {
+      const RangeExtent *ext = &cache->extents[i];
+      int64_t end = ext->offset + (int64_t)ext->size;
+      int64_t distance = cache->pos < ext->offset ? ext->offset - cache->pos
+                         : cache->pos >= end      ? cache->pos - end + 1
+                                                  : 0;
+      if (distance > farthest) {
+        farthest = distance;
+        victim = i;
+      }
+    }
+    if (farthest == 0) {
+      break;
+    }
+    range_remove(cache, victim);
+  }
+
+  int index = range_find(cache, cache->pos);
+  if (cache->bytes <= limit || index < 0) {
     return;
   }
-  if (ctx->audio_data) {
-    av_freep(&ctx->audio_data);
+  RangeExtent *ext = &cache->extents[index];
+  size_t consumed = (size_t)(cache->pos - ext->offset);
+  size_t drop = consumed > MIN_KEEP_BACKLOG ? consumed - MIN_KEEP_BACKLOG : 0;
+  if (drop == 0) {
+    return;
+  }
+  memmove(ext->data, ext->data + drop, ext->size - drop);
+  ext->offset += (int64_t)drop;
+  ext->size -= drop;
+  uint8_t *shrunk = av_realloc(ext->data, ext->size);
+  if (shrunk) {
+    cache->bytes -= ext->capacity - ext->size;
+    ext->data = shrunk;
+    ext->capacity = ext->size;
   }
-  ctx->audio_linesize = 0;
-  ctx->audio_nb_samples = 0;
-  ctx->audio_pts_seconds = 0.0;
 }
 
-static void close_subtitle_decoder(FFmpegWasmContext *ctx) {
-  if (!ctx) {
-    return;
+// Store [offset, offset + len), merging with every extent it touches.
+static int range_insert(RangeCache *cache, int64_t offset, const uint8_t *data, size_t len) {
+  int64_t start = offset;
+  int64_t end = offset + (int64_t)len;
+  int first = 0;
+  while (first < cache->count &&
+         cache->extents[first].offset + (int64_t)cache->extents[first].size < start) {
+    first++;
+  }
+  int last = first;
+  while (last < cache->count && cache->extents[last].offset <= end) {
+    last++;
+  }
+
+  if (last == first) {
+    // Disjoint: new extent at first
+    if (cache->count == cache->capacity) {
+      int capacity = cache->capacity ? cache->capacity * 2 : 16;
+      RangeExtent *grown = av_realloc_array(cache->extents, capacity, sizeof(*grown));
+      if (!grown) {
+        return AVERROR(ENOMEM);
+      }
+      cache->extents = grown;
+      cache->capacity = capacity;
+    }
+    uint8_t *copy = av_malloc(len);
+    if (!copy) {
+      return AVERROR(ENOMEM);
+    }
+    memcpy(copy, data, len);
+    memmove(&cache->extents[first + 1], &cache->extents[first],
+            (size_t)(cache->count - first) * sizeof(*cache->extents));
+    cache->extents[first] = (RangeExtent){offset, copy, len, len};
+    cache->count++;
+    cache->bytes += len;
+    return 0;
   }
-  if (ctx->ass_track) {
-    ass_free_track(ctx->ass_track);
-    ctx->ass_track = NULL;
+
+  // Grow extents[first] to cover the union, then fold the others into it
+  RangeExtent *ext = &cache->extents[first];
+  RangeExtent *tail = &cache->extents[last - 1];
+  if (tail->offset + (int64_t)tail->size > end) {
+    end = tail->offset + (int64_t)tail->size;
   }
-  if (ctx->subtitle_codec) {
-    avcodec_free_context(&ctx->subtitle_codec);
+  size_t head = ext->offset > start ? (size_t)(ext->offset - start) : 0;
+  size_t needed = (size_t)(end - (ext->offset < start ? ext->offset : start));
+  if (needed > ext->capacity) {
+    size_t capacity = ext->capacity * 2 > needed ? ext->capacity * 2 : needed;
+    uint8_t *grown = av_realloc(ext->data, capacity);
+    if (!grown) {
+      return AVERROR(ENOMEM);
+    }
+    cache->bytes += capacity - ext->capacity;
+    ext->data = grown;
+    ext->capacity = capacity;
   }
-  ctx->subtitle_stream_index = -1;
+  if (head > 0) {
+    memmove(ext->data + head, ext->data, ext->size);
+    ext->offset = start;
+    ext->size += head;
+  }
+  for (int i = first + 1; i < last; i++) {
+    RangeExtent *other = &cache->extents[i];
+    memcpy(ext->data + (other->offset - ext->offset), other->data, other->size);
+  }
+  memcpy(ext->data + (offset - ext->offset), data, len);
+  ext->size = (size_t)(end - ext->offset);
+  while (last - 1 > first) {
+    range_remove(cache, --last);
+  }
+  return 0;
 }
 
-static void free_ass_renderer(FFmpegWasmContext *ctx) {
-  if (!ctx) {
-    return;
-  }
-  close_subtitle_decoder(ctx);
-  if (ctx->ass_renderer) {
-    ass_renderer_done(ctx->ass_renderer);
-    ctx->ass_renderer = NULL;
+static int range_read(void *opaque, uint8_t *buf, int buf_size) {
+  RangeCache *cache = (RangeCache *)opaque;
+  if (cache->total_size >= 0 && cache->pos >= cache->total_size) {
+    return AVERROR_EOF;
   }
-  if (ctx->ass_library) {
-    ass_library_done(ctx->ass_library);
-    ctx->ass_library = NULL;
+  int index = range_find(cache, cache->pos);
+  if (index < 0) {
+    cache->wanted = cache->pos;
+    return AVERROR(EAGAIN);
   }
+  const RangeExtent *ext = &cache->extents[index];
+  size_t available = (size_t)(ext->offset + (int64_t)ext->size - cache->pos);
+  size_t to_copy = available < (size_t)buf_size ? available : (size_t)buf_size;
+  memcpy(buf, ext->data + (cache->pos - ext->offset), to_copy);
+  cache->pos += (int64_t)to_copy;
+  return (int)to_copy;
 }
 
-static int init_ass_library(FFmpegWasmContext *ctx) {
-  if (!ctx) {
-    return AVERROR(EINVAL);
+static int64_t range_seek(void *opaque, int64_t offset, int whence) {
+  RangeCache *cache = (RangeCache *)opaque;
+  if (whence == AVSEEK_SIZE) {
+    return cache->total_size;
   }
-  if (ctx->ass_library) {
-    return 0;
+  int64_t new_pos;
+  switch (whence & ~AVSEEK_FORCE) {
+    case SEEK_SET:
+      new_pos = offset;
+      break;
+    case SEEK_CUR:
+      new_pos = cache->pos + offset;
+      break;
+    case SEEK_END:
+      if (cache->total_size < 0) {
+        return -1;
+      }
+      new_pos = cache->total_size + offset;
+      break;
+    default:
+      return -1;
   }
+  if (new_pos < 0 || (cache->total_size >= 0 && new_pos > cache->total_size)) {
+    return -1;
+  }
+  cache->pos = new_pos;
+  return new_pos;
+}
 
-  ctx->ass_library = ass_library_init();
-  if (!ctx->ass_library) {
-    return AVERROR(ENOMEM);
+static void free_range_cache(FFmpegWasmContext *ctx) {
+  if (!ctx->range) {
+    return;
   }
+  for (int i = 0; i < ctx->range->count; i++) {
+    av_freep(&ctx->range->extents[i].data);
+  }
+  av_freep(&ctx->range->extents);
+  av_freep(&ctx->range);
+}
 
-  ctx->ass_renderer = ass_renderer_init(ctx->ass_library);
-  if (!ctx->ass_renderer) {
-    ass_library_done(ctx->ass_library);
-    ctx->ass_library = NULL;
-    return AVERROR(ENOMEM);
+static void free_input_demuxer(AVIOContext **avio, AVFormatContext **fmt) {
+  if (*fmt) {
+    avformat_close_input(fmt);
+  }
+  if (*avio) {
+    av_freep(&(*avio)->buffer);
+    avio_context_free(avio);
   }
+}
 
-  // Use embedded font only (no fontconfig); JS side injects "Inter"
-  ass_set_fonts(ctx->ass_renderer, NULL, "Inter", 0, NULL, 1);
-  return 0;
+static void close_audio_input(AudioInput *input) {
+  free_input_demuxer(&input->avio, &input->fmt);
+  input->reopen = 1;
+  input->eof = 0;
+  input->last_seconds = -1.0;
 }
 
-static void blend_ass_image(uint8_t *dst, int dst_stride, int dst_width, int dst_height, ASS_Image *img) {
-  while (img) {
-    if (img->w == 0 || img->h == 0 || !img->bitmap) {
-      img = img->next;
-      continue;
-    }
+#define FLOW_SAMPLE_SECONDS 1.0
 
-    // libass uses AABBGGRR ordering
-    uint8_t a = 255 - ((img->color >> 24) & 0xFF);
-    uint8_t b = (img->color >> 16) & 0xFF;
-    uint8_t g = (img->color >> 8) & 0xFF;
-    uint8_t r = img->color & 0xFF;
-
-    for (int y = 0; y < img->h; y++) {
-      int dst_y = img->dst_y + y;
-      if (dst_y < 0 || dst_y >= dst_height) {
-        continue;
-      }
+// Drops the anchor (seek, stream switch); speed, pause state and counters stay
+static void clock_reset(PresentClock *clock) {
+  clock->anchored = 0;
+  clock->drift = 0.0;
+  clock->audio_wall = -1.0;
+  clock->frame_duration = 0.0;
+  clock->last_pts = -1.0;
+  clock->consecutive_drops = 0;
+}
 
-      uint8_t *src_row = img->bitmap + y * img->stride;
-      uint8_t *dst_row = dst + dst_y * dst_stride;
+static double clock_now(const PresentClock *clock, double wall) {
+  if (clock->paused) {
+    return clock->anchor_pts;
+  }
+  return clock->anchor_pts + (wall - clock->anchor_wall) * clock->speed;
+}
 
-      for (int x = 0; x < img->w; x++) {
-        int dst_x = img->dst_x + x;
-        if (dst_x < 0 || dst_x >= dst_width) {
-          continue;
-        }
+static void clock_anchor(PresentClock *clock, double pts, double wall) {
+  clock->anchored = 1;
+  clock->anchor_pts = pts;
+  clock->anchor_wall = wall;
+}
 
-        uint8_t alpha = (src_row[x] * a) / 255;
-        if (alpha == 0) {
-          continue;
-        }
+static void flow_reset(FFmpegWasmContext *ctx) {
+  ctx->flow.sample_time = -1.0;
+  ctx->flow.demuxed_seconds = -1.0;
+  ctx->flow.played_seconds = -1.0;
+}
 
-        uint8_t *pixel = dst_row + dst_x * 4;
-        if (alpha == 255) {
-          pixel[0] = r;
-          pixel[1] = g;
-          pixel[2] = b;
-          pixel[3] = 255;
-        } else {
-          pixel[0] = (pixel[0] * (255 - alpha) + r * alpha) / 255;
-          pixel[1] = (pixel[1] * (255 - alpha) + g * alpha) / 255;
-          pixel[2] = (pixel[2] * (255 - alpha) + b * alpha) / 255;
-          pixel[3] = (pixel[3] * (255 - alpha) + 255 * alpha) / 255;
-        }
-      }
-    }
-    img = img->next;
+// Logical position of the demuxer in the input, in bytes
+static int64_t flow_read_position(FFmpegWasmContext *ctx) {
+  if (ctx->avio) {
+    return avio_tell(ctx->avio);
+  }
+  if (ctx->range) {
+    return ctx->range->pos;
   }
+  return ctx->buffer.cold ? ctx->buffer.cold_pos : ctx->buffer.offset + (int64_t)ctx->buffer.read_pos;
 }
 
-static void reset_decoder(FFmpegWasmContext *ctx) {
-  if (!ctx) {
+// Sample the input bitrate once per FLOW_SAMPLE_SECONDS of the main stream's
+// dts; other streams are interleaved with it and would only add jitter.
+static void flow_note_packet(FFmpegWasmContext *ctx, const AVPacket *pkt) {
+  // A separate audio rendition has its own demuxer; only video is sampled then
+  int main_index = ctx->video_stream_index >= 0 || ctx->audio_input ? ctx->video_stream_index
+                                                                     : ctx->audio_stream_index;
+  int64_t ts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+  if (pkt->stream_index != main_index || ts == AV_NOPTS_VALUE) {
     return;
   }
-
-  if (ctx->packet) {
-    av_packet_free(&ctx->packet);
-  }
-  if (ctx->video_frame) {
-    av_frame_free(&ctx->video_frame);
-  }
-  if (ctx->audio_frame) {
-    av_frame_free(&ctx->audio_frame);
-  }
-  if (ctx->video_codec) {
-    avcodec_free_context(&ctx->video_codec);
-  }
-  if (ctx->audio_codec) {
-    avcodec_free_context(&ctx->audio_codec);
-  }
-  free_ass_renderer(ctx);
-  if (ctx->fmt) {
-    avformat_close_input(&ctx->fmt);
-  }
-  if (ctx->avio) {
-    avio_context_free(&ctx->avio);
+  FlowStats *flow = &ctx->flow;
+  double time = ts * av_q2d(ctx->fmt->streams[main_index]->time_base);
+  int64_t pos = flow_read_position(ctx);
+  flow->demuxed_seconds = time;
+  if (flow->sample_time < 0.0 || time < flow->sample_time || pos < flow->sample_pos) {
+    flow->sample_time = time;  // First packet, or a discontinuity
+    flow->sample_pos = pos;
+    return;
   }
-  if (ctx->sws) {
-    sws_freeContext(ctx->sws);
-    ctx->sws = NULL;
+  double elapsed = time - flow->sample_time;
+  if (elapsed < FLOW_SAMPLE_SECONDS) {
+    return;
   }
-  if (ctx->swr) {
-    swr_free(&ctx->swr);
+  double rate = (double)(pos - flow->sample_pos) * 8.0 / elapsed;
+  flow->bitrate = flow->bitrate > 0.0 ? 0.75 * flow->bitrate + 0.25 * rate : rate;
+  flow->sample_time = time;
+  flow->sample_pos = pos;
+}
+
+static double flow_bitrate(const FFmpegWasmContext *ctx) {
+  if (ctx->flow.bitrate > 0.0) {
+    return ctx->flow.bitrate;
   }
+  return ctx->fmt && ctx->fmt->bit_rate > 0 ? (double)ctx->fmt->bit_rate : 0.0;
+}
 
-  free_rgba_buffers(ctx);
-  free_audio_buffers(ctx);
+static CachedPacket *packet_cache_at(const PacketCache *cache, int index) {
+  return &cache->entries[(cache->head + index) % cache->capacity];
+}
 
-  ctx->opened = 0;
-  ctx->draining = 0;
-  ctx->video_eof = 0;
-  ctx->audio_eof = 0;
-  ctx->video_flush_sent = 0;
-  ctx->audio_flush_sent = 0;
-  ctx->video_stream_index = -1;
-  ctx->audio_stream_index = -1;
-  ctx->subtitle_stream_index = -1;
-  ctx->video_time_base = (AVRational){0, 1};
-  ctx->audio_time_base = (AVRational){0, 1};
-  ctx->audio_channels = 0;
-  ctx->audio_sample_rate = 0;
-  ctx->subtitles_enabled = 0;
+static void packet_cache_drop_front(PacketCache *cache) {
+  CachedPacket *entry = packet_cache_at(cache, 0);
+  cache->bytes -= entry->bytes;
+  av_packet_free(&entry->pkt);
+  cache->head = (cache->head + 1) % cache->capacity;
+  cache->count--;
+  cache->replay--;
 }
 
-static int setup_audio_resampler(FFmpegWasmContext *ctx) {
-  if (!ctx || !ctx->audio_codec) {
-    return AVERROR(EINVAL);
+static void packet_cache_clear(FFmpegWasmContext *ctx) {
+  PacketCache *cache = &ctx->packets;
+  while (cache->count > 0) {
+    packet_cache_drop_front(cache);
   }
-  if (ctx->swr) {
-    return 0;
+  cache->head = 0;
+  cache->replay = 0;
+  cache->end_seconds = -1.0;
+  mem_set(&ctx->mem, FFMPEG_WASM_MEM_PACKET_CACHE, 0);
+}
+
+static void packet_cache_free(FFmpegWasmContext *ctx) {
+  packet_cache_clear(ctx);
+  av_freep(&ctx->packets.entries);
+  ctx->packets.capacity = 0;
+}
+
+// Oldest first, down to max_bytes and max_seconds; a partial GOP left at the
+// front goes too, since replay can only start at a key entry. Entries still
+// to be replayed stay.
+static void packet_cache_trim(FFmpegWasmContext *ctx, size_t max_bytes) {
+  PacketCache *cache = &ctx->packets;
+  while (cache->replay > 0) {
+    const CachedPacket *first = packet_cache_at(cache, 0);
+    int over = cache->bytes > max_bytes ||
+               (!isnan(first->seconds) && cache->end_seconds - first->seconds > cache->max_seconds);
+    if (!over && first->key) {
+      break;
+    }
+    packet_cache_drop_front(cache);
   }
+  mem_set(&ctx->mem, FFMPEG_WASM_MEM_PACKET_CACHE, cache->bytes);
+}
 
-  if (ctx->audio_codec->ch_layout.nb_channels == 0) {
-    av_channel_layout_default(&ctx->audio_codec->ch_layout, 2);
+static void packet_cache_add(FFmpegWasmContext *ctx, const AVPacket *pkt) {
+  PacketCache *cache = &ctx->packets;
+  if (cache->max_bytes == 0 || ctx->live_target > 0.0 || ctx->audio_input ||
+      (pkt->stream_index != ctx->video_stream_index && pkt->stream_index != ctx->audio_stream_index)) {
+    return;
+  }
+  if (cache->count == cache->capacity) {
+    int capacity = cache->capacity ? cache->capacity * 2 : 256;
+    CachedPacket *entries = av_malloc_array(capacity, sizeof(*entries));
+    if (!entries) {
+      packet_cache_clear(ctx);  // A gap would break the run
+      return;
+    }
+    for (int i = 0; i < cache->count; i++) {
+      entries[i] = *packet_cache_at(cache, i);
+    }
+    av_free(cache->entries);
+    cache->entries = entries;
+    cache->capacity = capacity;
+    cache->head = 0;
+  }
+  AVPacket *copy = av_packet_clone(pkt);
+  if (!copy) {
+    packet_cache_clear(ctx);
+    return;
   }
 
-  AVChannelLayout out_layout;
-  av_channel_layout_default(&out_layout, 2);
-  int out_channels = out_layout.nb_channels;
-  const int out_rate = 48000;
+  int64_t ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+  CachedPacket *entry = &cache->entries[(cache->head + cache->count) % cache->capacity];
+  entry->pkt = copy;
+  entry->bytes = sizeof(*copy) + (size_t)copy->size;
+  entry->seconds = ts != AV_NOPTS_VALUE ? ts * av_q2d(ctx->fmt->streams[pkt->stream_index]->time_base) : NAN;
+  entry->key = pkt->stream_index == ctx->video_stream_index ? (pkt->flags & AV_PKT_FLAG_KEY) != 0
+                                                            : ctx->video_stream_index < 0;
+  if (entry->seconds > cache->end_seconds) {
+    cache->end_seconds = entry->seconds;
+  }
+  cache->bytes += entry->bytes;
+  cache->count++;
+  cache->replay = cache->count;
+  packet_cache_trim(ctx, cache->max_bytes);
+}
 
-  int ret = swr_alloc_set_opts2(
-      &ctx->swr,
-      &out_layout,
-      AV_SAMPLE_FMT_FLT,
-      out_rate,
-      &ctx->audio_codec->ch_layout,
-      ctx->audio_codec->sample_fmt,
-      ctx->audio_codec->sample_rate,  // use actual input sample rate
-      0,
-      NULL);
-  av_channel_layout_uninit(&out_layout);
-  if (ret < 0) {
-    return ret;
+// Next replayed packet into pkt: 1, or 0 once caught up with the input
+static int packet_cache_next(FFmpegWasmContext *ctx, AVPacket *pkt) {
+  PacketCache *cache = &ctx->packets;
+  if (cache->replay >= cache->count) {
+    return 0;
   }
-
-  ret = swr_init(ctx->swr);
+  int ret = av_packet_ref(pkt, packet_cache_at(cache, cache->replay)->pkt);
   if (ret < 0) {
-    swr_free(&ctx->swr);
     return ret;
   }
+  cache->replay++;
+  return 1;
+}
 
-  ctx->audio_channels = out_channels;
-  ctx->audio_sample_rate = out_rate;
-  return 0;
+static void gop_cache_drop_front(GopCache *gop) {
+  gop->bytes -= gop->frames[0].bytes;
+  av_frame_free(&gop->frames[0].frame);
+  gop->count--;
+  memmove(gop->frames, gop->frames + 1, (size_t)gop->count * sizeof(*gop->frames));
 }
 
-static int convert_audio_frame(FFmpegWasmContext *ctx) {
-  if (!ctx || !ctx->audio_frame || !ctx->audio_codec) {
-    return AVERROR(EINVAL);
+static void gop_cache_clear(FFmpegWasmContext *ctx) {
+  GopCache *gop = &ctx->gop;
+  while (gop->count > 0) {
+    gop_cache_drop_front(gop);
   }
+  gop->follows = 0;
+  gop->filling = 0;
+  mem_set(&ctx->mem, FFMPEG_WASM_MEM_GOP_CACHE, 0);
+}
 
-  int ret = setup_audio_resampler(ctx);
-  if (ret < 0) {
-    return ret;
-  }
+static void gop_cache_free(FFmpegWasmContext *ctx) {
+  gop_cache_clear(ctx);
+  av_freep(&ctx->gop.frames);
+  ctx->gop.capacity = 0;
+  sws_freeContext(ctx->gop.sws);
+  ctx->gop.sws = NULL;
+}
 
-  int out_samples = swr_get_out_samples(ctx->swr, ctx->audio_frame->nb_samples);
-  if (out_samples <= 0) {
-    return AVERROR(EINVAL);
+// Oldest first; the newest two stay, as a fill needs the frame before its
+// target and the target's own
+static void gop_cache_trim(FFmpegWasmContext *ctx, size_t max_bytes) {
+  GopCache *gop = &ctx->gop;
+  while (gop->count > 2 && gop->bytes > max_bytes) {
+    gop_cache_drop_front(gop);
   }
+  mem_set(&ctx->mem, FFMPEG_WASM_MEM_GOP_CACHE, gop->bytes);
+}
 
-  free_audio_buffers(ctx);
-
-  ret = av_samples_alloc(
-      &ctx->audio_data,
-      &ctx->audio_linesize,
-      ctx->audio_channels,
-      out_samples,
-      AV_SAMPLE_FMT_FLT,
-      0);
-  if (ret < 0) {
-    return ret;
+static void free_rgba_buffers(FFmpegWasmContext *ctx) {
+  if (!ctx) {
+    return;
+  }
+  if (ctx->rgba_data[0]) {
+    av_freep(&ctx->rgba_data[0]);
+    ctx->rgba_data[1] = NULL;
+    ctx->rgba_data[2] = NULL;
+    ctx->rgba_data[3] = NULL;
   }
+  ctx->rgba_size = 0;
+  mem_set(&ctx->mem, FFMPEG_WASM_MEM_RGBA, 0);
+  ctx->rgba_width = 0;
+  ctx->rgba_height = 0;
+  ctx->rgba_src_width = 0;
+  ctx->rgba_src_height = 0;
+  ctx->rgba_src_fmt = AV_PIX_FMT_NONE;
+}
 
-  int converted = swr_convert(
-      ctx->swr,
-      &ctx->audio_data,
-      out_samples,
-      (const uint8_t **)ctx->audio_frame->extended_data,
-      ctx->audio_frame->nb_samples);
-  if (converted < 0) {
-    return converted;
+// Drop the graph and any frames buffered in it (seek, new decoder); the
+// configuration stays and the graph is rebuilt from the next frame.
+static void video_filter_reset(FFmpegWasmContext *ctx) {
+  VideoFilter *f = ctx ? ctx->filter : NULL;
+  if (!f) {
+    return;
   }
+  avfilter_graph_free(&f->graph);
+  f->src = NULL;
+  f->sink = NULL;
+  f->flushed = 0;
+}
 
-  ctx->audio_nb_samples = converted;
+static void free_video_filter(FFmpegWasmContext *ctx) {
+  if (!ctx || !ctx->filter) {
+    return;
+  }
+  video_filter_reset(ctx);
+  av_frame_free(&ctx->filter->decoded);
+  av_freep(&ctx->filter);
+}
 
-  int64_t pts = ctx->audio_frame->best_effort_timestamp;
-  if (pts == AV_NOPTS_VALUE || ctx->audio_time_base.den == 0) {
-    ctx->audio_pts_seconds = 0.0;
-  } else {
-    ctx->audio_pts_seconds = pts * av_q2d(ctx->audio_time_base);
+static void free_audio_buffers(FFmpegWasmContext *ctx) {
+  if (!ctx) {
+    return;
+  }
+  if (ctx->audio_data) {
+    av_freep(&ctx->audio_data);
+    mem_release(&ctx->mem, FFMPEG_WASM_MEM_AUDIO, (size_t)ctx->audio_data_size);
   }
+  ctx->audio_data_size = 0;
+  ctx->audio_linesize = 0;
+  ctx->audio_nb_samples = 0;
+  ctx->audio_pts_seconds = 0.0;
+}
 
-  return 0;
+static void note_missing_module(FFmpegWasmContext *ctx, const char *name) {
+  if (!ctx || strstr(ctx->missing_modules, name)) {
+    return;
+  }
+  size_t len = strlen(ctx->missing_modules);
+  snprintf(ctx->missing_modules + len, sizeof(ctx->missing_modules) - len, "%s%s", len ? "," : "", name);
 }
 
-static int receive_video_frame(FFmpegWasmContext *ctx) {
-  if (!ctx || !ctx->video_codec || !ctx->video_frame) {
-    return AVERROR(EAGAIN);
+static int is_side_decoder(const char *name) {
+  const char *list = FFMPEG_WASM_SIDE_DECODERS;
+  size_t len = strlen(name);
+  for (const char *p = list; (p = strstr(p, name)) != NULL; p += len) {
+    if ((p == list || p[-1] == ',') && (p[len] == ',' || p[len] == '\0')) {
+      return 1;
+    }
   }
+  return 0;
+}
 
-  av_frame_unref(ctx->video_frame);
-  int ret = avcodec_receive_frame(ctx->video_codec, ctx->video_frame);
-  if (ret == 0) {
-    return 1;
+// avcodec_find_decoder, plus the codec-<name>.wasm side modules of a split
+// build. FFCodec starts with its AVCodec, so the module's ff_<name>_decoder is
+// usable as one. A decoder whose module is not loaded yet is recorded in
+// missing_modules for the caller to report FFMPEG_WASM_ERROR_NEED_MODULE.
+static const AVCodec *find_decoder(FFmpegWasmContext *ctx, enum AVCodecID codec_id) {
+  const AVCodec *decoder = avcodec_find_decoder(codec_id);
+  if (decoder || !avcodec_descriptor_get(codec_id)) {
+    return decoder;
+  }
+  const char *name = avcodec_get_name(codec_id);
+  if (!is_side_decoder(name)) {
+    return NULL;
   }
-  if (ret == AVERROR_EOF) {
-    ctx->video_eof = 1;
-    return AVERROR(EAGAIN);
+  char module_name[64];
+  char symbol[64];
+  snprintf(module_name, sizeof(module_name), "codec-%s.wasm", name);
+  snprintf(symbol, sizeof(symbol), "ff_%s_decoder", name);
+  decoder = platform_side_symbol(platform_side_module(module_name), symbol);
+  if (!decoder) {
+    note_missing_module(ctx, module_name);
   }
-  return ret;
+  return decoder;
 }
 
-static int receive_audio_frame(FFmpegWasmContext *ctx) {
-  if (!ctx || !ctx->audio_codec || !ctx->audio_frame) {
-    return AVERROR(EAGAIN);
+static int decoder_not_found(FFmpegWasmContext *ctx) {
+  return ctx->missing_modules[0] ? FFMPEG_WASM_ERROR_NEED_MODULE : AVERROR_DECODER_NOT_FOUND;
+}
+
+// One libass library per instance, shared by every context and mosaic, so the
+// default font is registered once rather than per context. A spare renderer
+// (ffmpeg_wasm_prewarm) lets the next context skip ass_renderer_init and
+// ass_set_fonts.
+static ASS_Library *shared_ass_library;
+static ASS_Renderer *spare_ass_renderer;
+
+// FNV-1a; only compared together with the name and size
+static uint64_t font_hash(const uint8_t *data, int len) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (int i = 0; i < len; i++) {
+    hash = (hash ^ data[i]) * 0x100000001b3ULL;
   }
+  return hash;
+}
 
-  av_frame_unref(ctx->audio_frame);
-  int ret = avcodec_receive_frame(ctx->audio_codec, ctx->audio_frame);
-  if (ret == 0) {
-    ret = convert_audio_frame(ctx);
-    if (ret < 0) {
-      return ret;
+// A library with the embedded default font; adds the bytes libass copied
+static ASS_Library *new_ass_library(size_t *font_bytes) {
+  ASS_Library *library = ass_library_init();
+#ifdef FFMPEG_WASM_EMBEDDED_FONT
+  if (library) {
+    ass_add_font(library, "Inter", (char *)ffmpeg_wasm_default_font, (int)ffmpeg_wasm_default_font_len);
+    if (font_bytes) {
+      *font_bytes += ffmpeg_wasm_default_font_len;
     }
-    return 2;
   }
-  if (ret == AVERROR_EOF) {
-    ctx->audio_eof = 1;
-    return AVERROR(EAGAIN);
+#endif
+  return library;
+}
+
+static ASS_Library *get_shared_ass_library(void) {
+  if (!shared_ass_library) {
+    shared_ass_library = new_ass_library(NULL);
   }
-  return ret;
+  return shared_ass_library;
 }
 
-static int reopen_video_stream(FFmpegWasmContext *ctx, int stream_index) {
-  if (!ctx || !ctx->fmt) {
-    return AVERROR(EINVAL);
+static ASS_Renderer *new_library_renderer(ASS_Library *library) {
+  ASS_Renderer *renderer = library ? ass_renderer_init(library) : NULL;
+  if (renderer) {
+    // Use embedded fonts only (no fontconfig); "Inter" is the default
+    ass_set_fonts(renderer, NULL, "Inter", 0, NULL, 1);
+    ass_set_cache_limits(renderer, ASS_GLYPH_CACHE_MAX, ASS_BITMAP_CACHE_MB);
   }
-  if (stream_index < 0 || stream_index >= (int)ctx->fmt->nb_streams) {
-    return AVERROR(EINVAL);
+  return renderer;
+}
+
+static ASS_Renderer *new_ass_renderer(void) {
+  if (spare_ass_renderer) {
+    ASS_Renderer *renderer = spare_ass_renderer;
+    spare_ass_renderer = NULL;
+    return renderer;
   }
+  return new_library_renderer(get_shared_ass_library());
+}
 
-  AVStream *stream = ctx->fmt->streams[stream_index];
-  if (!stream || !stream->codecpar) {
-    return AVERROR(EINVAL);
+// Tracks made from fonts->library must be freed first
+static void free_ass_fonts(AssFonts *fonts) {
+  for (int i = 0; i < fonts->count; i++) {
+    av_freep(&fonts->keys[i].name);
   }
-  if (stream->codecpar->codec_type != AVMEDIA_TYPE_VIDEO) {
-    return AVERROR(EINVAL);
+  av_freep(&fonts->keys);
+  if (fonts->library) {
+    ass_library_done(fonts->library);
   }
+  memset(fonts, 0, sizeof(*fonts));
+}
 
-  const AVCodec *decoder = avcodec_find_decoder(stream->codecpar->codec_id);
-  if (!decoder) {
-    return AVERROR_DECODER_NOT_FOUND;
+// Adds a font to the owner's own library, moving *renderer onto that library
+// the first time. Returns 1 if added, 0 if this exact font already was.
+static int ass_fonts_add(AssFonts *fonts, ASS_Renderer **renderer, const char *name, const uint8_t *data,
+                         int len) {
+  uint64_t hash = font_hash(data, len);
+  for (int i = 0; i < fonts->count; i++) {
+    const AssFontKey *key = &fonts->keys[i];
+    if (key->len == len && key->hash == hash && strcmp(key->name, name) == 0) {
+      return 0;
+    }
   }
-
-  AVCodecContext *codec = avcodec_alloc_context3(decoder);
-  if (!codec) {
+  AssFontKey *keys = av_realloc_array(fonts->keys, (size_t)fonts->count + 1, sizeof(*keys));
+  if (!keys) {
     return AVERROR(ENOMEM);
   }
-  int ret = avcodec_parameters_to_context(codec, stream->codecpar);
-  if (ret < 0) {
-    avcodec_free_context(&codec);
-    return ret;
+  fonts->keys = keys;
+  char *key_name = av_strdup(name);
+  if (!key_name) {
+    return AVERROR(ENOMEM);
   }
-  codec->thread_count = 1;
-  codec->thread_type = 0;
 
-  ret = avcodec_open2(codec, decoder, NULL);
-  if (ret < 0) {
-    avcodec_free_context(&codec);
-    return ret;
-  }
+  if (!fonts->library) {
+    size_t default_bytes = 0;
+    ASS_Library *library = new_ass_library(&default_bytes);
+    ASS_Renderer *moved = new_library_renderer(library);
+    if (!moved) {
+      if (library) {
+        ass_library_done(library);
+      }
+      av_free(key_name);
+      return AVERROR(ENOMEM);
+    }
+    if (*renderer) {
+      ass_renderer_done(*renderer);
+    }
+    *renderer = moved;
+    fonts->library = library;
+    fonts->bytes += default_bytes;
+  }
+  ass_add_font(fonts->library, name, (char *)data, len);
+  // Fonts added after ass_set_fonts need a new font provider
+  ass_set_fonts(*renderer, NULL, "Inter", 0, NULL, 1);
+  keys[fonts->count++] = (AssFontKey){key_name, len, hash};
+  fonts->bytes += len;  // libass keeps its own copy
+  return 1;
+}
 
-  if (ctx->video_codec) {
-    avcodec_free_context(&ctx->video_codec);
+static void close_subtitle_decoder(FFmpegWasmContext *ctx) {
+  if (!ctx) {
+    return;
   }
-  ctx->video_codec = codec;
-  ctx->video_stream_index = stream_index;
-  ctx->video_time_base = stream->time_base;
-  ctx->video_eof = 0;
-  ctx->video_flush_sent = 0;
-
-  if (ctx->sws) {
-    sws_freeContext(ctx->sws);
-    ctx->sws = NULL;
+  if (ctx->ass_track) {
+    ass_free_track(ctx->ass_track);
+    ctx->ass_track = NULL;
   }
-  free_rgba_buffers(ctx);
-  return 0;
+  if (ctx->subtitle_codec) {
+    avcodec_free_context(&ctx->subtitle_codec);
+  }
+  ctx->subtitle_stream_index = -1;
 }
 
-static void close_audio_decoder(FFmpegWasmContext *ctx) {
+static void free_ass_renderer(FFmpegWasmContext *ctx) {
   if (!ctx) {
     return;
   }
-  if (ctx->audio_codec) {
-    avcodec_free_context(&ctx->audio_codec);
+  close_subtitle_decoder(ctx);
+  if (ctx->mosaic) {
+    // Owned by the mosaic; just drop the borrowed pointers
+    ctx->ass_renderer = NULL;
+    ctx->ass_library = NULL;
   }
-  if (ctx->swr) {
-    swr_free(&ctx->swr);
+  if (ctx->ass_renderer) {
+    ass_renderer_done(ctx->ass_renderer);
+    ctx->ass_renderer = NULL;
   }
-  free_audio_buffers(ctx);
-  ctx->audio_stream_index = -1;
-  ctx->audio_time_base = (AVRational){0, 1};
-  ctx->audio_channels = 0;
-  ctx->audio_sample_rate = 0;
-  ctx->audio_pts_seconds = 0.0;
-  ctx->audio_nb_samples = 0;
+  ctx->ass_library = NULL;  // The shared one lives as long as the instance
+  free_ass_fonts(&ctx->ass_fonts);
+  mem_set(&ctx->mem, FFMPEG_WASM_MEM_LIBASS, 0);
 }
 
-static int reopen_audio_stream(FFmpegWasmContext *ctx, int stream_index) {
-  if (!ctx || !ctx->fmt) {
-    return AVERROR(EINVAL);
-  }
-  if (stream_index < 0 || stream_index >= (int)ctx->fmt->nb_streams) {
-    return AVERROR(EINVAL);
+static void charge_ass_memory(FFmpegWasmContext *ctx) {
+  if (!ctx->ass_renderer || ctx->mosaic) {
+    mem_set(&ctx->mem, FFMPEG_WASM_MEM_LIBASS, ctx->ass_fonts.bytes);
+    return;
   }
+  size_t cache_mb = ctx->ass_cache_trimmed ? ASS_BITMAP_CACHE_MB_LOW : ASS_BITMAP_CACHE_MB;
+  mem_set(&ctx->mem, FFMPEG_WASM_MEM_LIBASS, cache_mb * 1024 * 1024 + ctx->ass_fonts.bytes);
+}
 
-  AVStream *stream = ctx->fmt->streams[stream_index];
-  if (!stream || !stream->codecpar) {
+static int init_ass_library(FFmpegWasmContext *ctx) {
+  if (!ctx) {
     return AVERROR(EINVAL);
   }
-  if (stream->codecpar->codec_type != AVMEDIA_TYPE_AUDIO) {
-    return AVERROR(EINVAL);
+  if (ctx->ass_library) {
+    return 0;
   }
-
-  const AVCodec *decoder = avcodec_find_decoder(stream->codecpar->codec_id);
-  if (!decoder) {
-    return AVERROR_DECODER_NOT_FOUND;
+  if (ctx->mosaic) {
+    ctx->ass_library = ctx->mosaic->ass_library;
+    ctx->ass_renderer = ctx->mosaic->ass_renderer;
+    return 0;
+  }
+  if (platform_is_split() && !platform_side_module(SUBTITLE_MODULE)) {
+    note_missing_module(ctx, SUBTITLE_MODULE);
+    return FFMPEG_WASM_ERROR_NEED_MODULE;
   }
 
-  AVCodecContext *codec = avcodec_alloc_context3(decoder);
-  if (!codec) {
+  ctx->ass_renderer = new_ass_renderer();
+  if (!ctx->ass_renderer) {
     return AVERROR(ENOMEM);
   }
-  int ret = avcodec_parameters_to_context(codec, stream->codecpar);
-  if (ret < 0) {
-    avcodec_free_context(&codec);
-    return ret;
-  }
-  codec->thread_count = 1;
-  codec->thread_type = 0;
-
-  ret = avcodec_open2(codec, decoder, NULL);
-  if (ret < 0) {
-    avcodec_free_context(&codec);
-    return ret;
+  ctx->ass_library = shared_ass_library;
+  if (ctx->ass_cache_trimmed) {
+    ass_set_cache_limits(ctx->ass_renderer, ASS_GLYPH_CACHE_MAX / 4, ASS_BITMAP_CACHE_MB_LOW);
   }
-
-  close_audio_decoder(ctx);
-  ctx->audio_codec = codec;
-  ctx->audio_stream_index = stream_index;
-  ctx->audio_time_base = stream->time_base;
-  ctx->audio_enabled = 1;
-  ctx->audio_eof = 0;
-  ctx->audio_flush_sent = 0;
+  charge_ass_memory(ctx);
   return 0;
 }
 
-static int reopen_subtitle_stream(FFmpegWasmContext *ctx, int stream_index) {
-  if (!ctx || !ctx->fmt) {
-    return AVERROR(EINVAL);
+static size_t stream_buffer_bytes(const FFmpegWasmContext *ctx) {
+  return ctx->buffer.capacity + (ctx->audio_input ? ctx->audio_input->buffer.capacity : 0);
+}
+
+// Bring a context back under its memory budget without failing anything:
+// trim the libass caches and shrink the StreamBuffer backlog, then, while
+// still over, trim the GOP cache, then the packet cache, and only then evict
+// range blocks or return unused StreamBuffer capacity. Unread bytes are never
+// dropped, so the context can stay over budget until the decoder catches up.
+static void enforce_memory_budget(FFmpegWasmContext *ctx) {
+  MemoryAccounting *mem = &ctx->mem;
+  if (mem->budget == 0) {
+    ctx->buffer.growth_cap = 0;
+    return;
   }
-  if (stream_index < 0 || stream_index >= (int)ctx->fmt->nb_streams) {
-    return AVERROR(EINVAL);
+
+  if (mem_over_budget(mem) && ctx->ass_renderer && !ctx->mosaic && !ctx->ass_cache_trimmed) {
+    ctx->ass_cache_trimmed = 1;
+    ass_set_cache_limits(ctx->ass_renderer, ASS_GLYPH_CACHE_MAX / 4, ASS_BITMAP_CACHE_MB_LOW);
+    charge_ass_memory(ctx);
   }
 
-  AVStream *stream = ctx->fmt->streams[stream_index];
-  if (!stream || !stream->codecpar) {
-    return AVERROR(EINVAL);
+  size_t others = mem->total - mem->current[FFMPEG_WASM_MEM_STREAM_BUFFER];
+  size_t allowance = mem->budget > others ? mem->budget - others : 0;
+  ctx->buffer.growth_cap = allowance;
+
+  size_t backlog = allowance / 8;
+  if (backlog > DEFAULT_KEEP_BACKLOG) {
+    backlog = DEFAULT_KEEP_BACKLOG;
   }
-  if (stream->codecpar->codec_type != AVMEDIA_TYPE_SUBTITLE) {
-    return AVERROR(EINVAL);
+  if (backlog < MIN_KEEP_BACKLOG) {
+    backlog = MIN_KEEP_BACKLOG;
   }
+  ctx->buffer.backlog = ctx->live_target > 0.0 ? 0 : backlog;  // Live never seeks back
 
-  int ret = init_ass_library(ctx);
-  if (ret < 0) {
-    return ret;
+  if (!mem_over_budget(mem)) {
+    return;
   }
-
-  const AVCodec *decoder = avcodec_find_decoder(stream->codecpar->codec_id);
-  if (!decoder) {
-    return AVERROR_DECODER_NOT_FOUND;
+  // Cached frames and packets only save a re-decode or a re-read; they go
+  // before input bytes do
+  size_t excess = mem->total - mem->budget;
+  gop_cache_trim(ctx, ctx->gop.bytes > excess ? ctx->gop.bytes - excess : 0);
+  excess = mem_over_budget(mem) ? mem->total - mem->budget : 0;
+  packet_cache_trim(ctx, ctx->packets.bytes > excess ? ctx->packets.bytes - excess : 0);
+  others = mem->total - mem->current[FFMPEG_WASM_MEM_STREAM_BUFFER];
+  allowance = mem->budget > others ? mem->budget - others : 0;
+  if (!mem_over_budget(mem)) {
+    return;
   }
-
-  AVCodecContext *codec = avcodec_alloc_context3(decoder);
-  if (!codec) {
-    return AVERROR(ENOMEM);
+  if (ctx->range) {
+    range_evict(ctx->range, allowance);
+    mem_set(mem, FFMPEG_WASM_MEM_STREAM_BUFFER, ctx->range->bytes);
+    return;
   }
-  ret = avcodec_parameters_to_context(codec, stream->codecpar);
-  if (ret < 0) {
-    avcodec_free_context(&codec);
-    return ret;
+  compact_buffer(&ctx->buffer);
+  if (ctx->audio_input) {
+    compact_buffer(&ctx->audio_input->buffer);
+    shrink_buffer(&ctx->audio_input->buffer, 0);
+    allowance = allowance > ctx->audio_input->buffer.capacity ? allowance - ctx->audio_input->buffer.capacity : 0;
   }
+  shrink_buffer(&ctx->buffer, allowance);
+  mem_set(mem, FFMPEG_WASM_MEM_STREAM_BUFFER, stream_buffer_bytes(ctx));
+}
 
-  ret = avcodec_open2(codec, decoder, NULL);
-  if (ret < 0) {
-    avcodec_free_context(&codec);
-    return ret;
+static void mosaic_fill_rect(FFmpegWasmMosaic *mosaic, int x, int y, int width, int height) {
+  if (mosaic->format == AV_PIX_FMT_RGBA) {
+    for (int row = y; row < y + height; row++) {
+      uint8_t *pixel = mosaic->data[0] + row * mosaic->linesize[0] + x * 4;
+      for (int col = 0; col < width; col++, pixel += 4) {
+        pixel[0] = 0;
+        pixel[1] = 0;
+        pixel[2] = 0;
+        pixel[3] = 255;
+      }
+    }
+    return;
   }
+  for (int row = y; row < y + height; row++) {
+    memset(mosaic->data[0] + row * mosaic->linesize[0] + x, 16, (size_t)width);
+  }
+  for (int row = y / 2; row < (y + height) / 2; row++) {
+    memset(mosaic->data[1] + row * mosaic->linesize[1] + x / 2, 128, (size_t)width / 2);
+    memset(mosaic->data[2] + row * mosaic->linesize[2] + x / 2, 128, (size_t)width / 2);
+  }
+}
 
-  close_subtitle_decoder(ctx);
-  ctx->subtitle_codec = codec;
-  ctx->subtitle_stream_index = stream_index;
+static void blend_ass_image(uint8_t *dst, int dst_stride, int dst_width, int dst_height, ASS_Image *img) {
+  while (img) {
+    if (img->w == 0 || img->h == 0 || !img->bitmap) {
+      img = img->next;
+      continue;
+    }
 
-  ctx->ass_track = ass_new_track(ctx->ass_library);
-  if (!ctx->ass_track) {
-    close_subtitle_decoder(ctx);
-    return AVERROR(ENOMEM);
-  }
+    // libass uses AABBGGRR ordering
+    uint8_t a = 255 - ((img->color >> 24) & 0xFF);
+    uint8_t b = (img->color >> 16) & 0xFF;
+    uint8_t g = (img->color >> 8) & 0xFF;
+    uint8_t r = img->color & 0xFF;
 
-  if (codec->subtitle_header && codec->subtitle_header_size > 0) {
-    ass_process_codec_private(ctx->ass_track, (char *)codec->subtitle_header, codec->subtitle_header_size);
+    for (int y = 0; y < img->h; y++) {
+      int dst_y = img->dst_y + y;
+      if (dst_y < 0 || dst_y >= dst_height) {
+        continue;
+      }
+
+      uint8_t *src_row = img->bitmap + y * img->stride;
+      uint8_t *dst_row = dst + dst_y * dst_stride;
+
+      for (int x = 0; x < img->w; x++) {
+        int dst_x = img->dst_x + x;
+        if (dst_x < 0 || dst_x >= dst_width) {
+          continue;
+        }
+
+        uint8_t alpha = (src_row[x] * a) / 255;
+        if (alpha == 0) {
+          continue;
+        }
+
+        uint8_t *pixel = dst_row + dst_x * 4;
+        if (alpha == 255) {
+          pixel[0] = r;
+          pixel[1] = g;
+          pixel[2] = b;
+          pixel[3] = 255;
+        } else {
+          pixel[0] = (pixel[0] * (255 - alpha) + r * alpha) / 255;
+          pixel[1] = (pixel[1] * (255 - alpha) + g * alpha) / 255;
+          pixel[2] = (pixel[2] * (255 - alpha) + b * alpha) / 255;
+          pixel[3] = (pixel[3] * (255 - alpha) + 255 * alpha) / 255;
+        }
+      }
+    }
+    img = img->next;
   }
+}
 
-  ctx->subtitles_enabled = 1;
+static int byte_queue_push(ByteQueue *queue, const uint8_t *data, size_t len) {
+  if (queue->start > 0 && queue->start + queue->size + len > queue->capacity) {
+    memmove(queue->data, queue->data + queue->start, queue->size);
+    queue->start = 0;
+  }
+  size_t needed = queue->size + len;
+  if (needed > queue->capacity) {
+    size_t capacity = queue->capacity ? queue->capacity : 64 * 1024;
+    while (capacity < needed) {
+      capacity *= 2;
+    }
+    uint8_t *data = av_realloc(queue->data, capacity);
+    if (!data) {
+      return AVERROR(ENOMEM);
+    }
+    queue->data = data;
+    queue->capacity = capacity;
+  }
+  memcpy(queue->data + queue->start + queue->size, data, len);
+  queue->size += len;
   return 0;
 }
 
-static void process_subtitle_packet(FFmpegWasmContext *ctx, AVPacket *pkt) {
-  if (!ctx || !ctx->subtitle_codec || !ctx->ass_track || !pkt) {
+static void byte_queue_consume(ByteQueue *queue, size_t len) {
+  if (len >= queue->size) {
+    queue->start = 0;
+    queue->size = 0;
     return;
   }
+  queue->start += len;
+  queue->size -= len;
+}
 
-  AVSubtitle sub;
-  memset(&sub, 0, sizeof(sub));
-  int got_sub = 0;
+static void byte_queue_free(ByteQueue *queue) {
+  av_freep(&queue->data);
+  queue->start = 0;
+  queue->size = 0;
+  queue->capacity = 0;
+}
 
-  int ret = avcodec_decode_subtitle2(ctx->subtitle_codec, &sub, &got_sub, pkt);
-  if (ret < 0 || !got_sub) {
+static void remux_drop_pending(RemuxState *remux) {
+  for (int i = 0; i < remux->nb_pending; i++) {
+    av_packet_free(&remux->pending[i]);
+  }
+  remux->nb_pending = 0;
+}
+
+static void free_remux(FFmpegWasmContext *ctx) {
+  RemuxState *remux = ctx ? ctx->remux : NULL;
+  if (!remux) {
     return;
   }
+  remux_drop_pending(remux);
+  if (remux->ofmt) {
+    avformat_free_context(remux->ofmt);
+  }
+  if (remux->avio) {
+    av_freep(&remux->avio->buffer);
+    avio_context_free(&remux->avio);
+  }
+  av_freep(&remux->stream_map);
+  byte_queue_free(&remux->init);
+  byte_queue_free(&remux->media);
+  av_freep(&ctx->remux);
+}
 
-  int64_t start_time = pkt->pts;
-  if (start_time == AV_NOPTS_VALUE) {
-    start_time = pkt->dts;
+static void export_free_gop(ExportJob *job) {
+  for (int i = 0; i < job->nb_gop; i++) {
+    av_packet_free(&job->gop[i]);
   }
-  if (start_time == AV_NOPTS_VALUE) {
-    avsubtitle_free(&sub);
+  job->nb_gop = 0;
+}
+
+static void free_export(FFmpegWasmContext *ctx) {
+  ExportJob *job = ctx ? ctx->export_job : NULL;
+  if (!job) {
     return;
   }
+  export_free_gop(job);
+  av_freep(&job->gop);
+  if (job->ofmt) {
+    avformat_free_context(job->ofmt);
+  }
+  if (job->avio) {
+    av_freep(&job->avio->buffer);
+    avio_context_free(&job->avio);
+  }
+  av_freep(&job->stream_map);
+  for (int i = 0; i < job->output.nb_chunks; i++) {
+    av_free(job->output.chunks[i]);
+  }
+  av_freep(&job->output.chunks);
+  av_freep(&ctx->export_job);
+}
 
-  AVStream *stream = ctx->fmt->streams[ctx->subtitle_stream_index];
-  double start_sec = start_time * av_q2d(stream->time_base);
-  double duration_sec = (double)sub.end_display_time / 1000.0;
-  if (duration_sec <= 0.0) {
-    // Some decoders (e.g. ASS) can emit zero durations; fall back to packet duration or a small default
-    if (pkt->duration && pkt->duration != AV_NOPTS_VALUE) {
-      duration_sec = pkt->duration * av_q2d(stream->time_base);
-    }
-    if (duration_sec <= 0.0) {
-      duration_sec = 4.0;  // conservative default so text is visible
-    }
+static void free_peaks(FFmpegWasmContext *ctx) {
+  PeakJob *job = ctx ? ctx->peak_job : NULL;
+  if (!job) {
+    return;
   }
-  double start_ms = start_sec * 1000.0;
-  double end_ms = (start_sec + duration_sec) * 1000.0;
+  if (job->codec) {
+    avcodec_free_context(&job->codec);
+  }
+  av_frame_free(&job->frame);
+  if (job->peaks) {
+    mem_release(&ctx->mem, FFMPEG_WASM_MEM_AUDIO,
+                (size_t)job->buckets * (3 * sizeof(float) + sizeof(double) + sizeof(int64_t)));
+  }
+  av_freep(&job->peaks);
+  av_freep(&job->sum_sq);
+  av_freep(&job->counts);
+  av_freep(&ctx->peak_job);
+}
 
-  for (unsigned int i = 0; i < sub.num_rects; i++) {
-    AVSubtitleRect *rect = sub.rects[i];
-    if (!rect) {
+static void reset_decoder(FFmpegWasmContext *ctx) {
+  if (!ctx) {
+    return;
+  }
+
+  free_remux(ctx);
+  free_export(ctx);
+  free_peaks(ctx);
+  packet_cache_clear(ctx);
+  gop_cache_clear(ctx);
+  video_filter_reset(ctx);
+
+  if (ctx->packet) {
+    av_packet_free(&ctx->packet);
+  }
+  if (ctx->video_frame) {
+    av_frame_free(&ctx->video_frame);
+  }
+  if (ctx->audio_frame) {
+    av_frame_free(&ctx->audio_frame);
+  }
+  if (ctx->video_codec) {
+    avcodec_free_context(&ctx->video_codec);
+  }
+  if (ctx->audio_codec) {
+    avcodec_free_context(&ctx->audio_codec);
+  }
+  free_ass_renderer(ctx);
+  if (ctx->audio_input) {
+    close_audio_input(ctx->audio_input);
+  }
+  av_freep(&ctx->new_extradata[0]);
+  av_freep(&ctx->new_extradata[1]);
+  ctx->demux_reopen = 0;
+  if (ctx->fmt) {
+    avformat_close_input(&ctx->fmt);
+  }
+  if (ctx->avio) {
+    avio_context_free(&ctx->avio);
+  }
+  if (ctx->sws) {
+    sws_freeContext(ctx->sws);
+    ctx->sws = NULL;
+  }
+  if (ctx->swr) {
+    swr_free(&ctx->swr);
+  }
+
+  free_rgba_buffers(ctx);
+  av_freep(&ctx->tonemap);
+  free_audio_buffers(ctx);
+
+  ctx->opened = 0;
+  ctx->draining = 0;
+  ctx->video_eof = 0;
+  ctx->audio_eof = 0;
+  ctx->video_flush_sent = 0;
+  ctx->audio_flush_sent = 0;
+  ctx->video_stream_index = -1;
+  ctx->audio_stream_index = -1;
+  ctx->subtitle_stream_index = -1;
+  if (ctx->trick_play) {
+    ctx->audio_enabled = ctx->trick_saved_audio;
+  }
+  ctx->trick_play = 0;
+  ctx->trick_pending = 0;
+  ctx->live_skipping = 0;
+  ctx->live_skips = 0;
+  ctx->state_applied = 0;
+  ctx->video_time_base = (AVRational){0, 1};
+  ctx->audio_time_base = (AVRational){0, 1};
+  ctx->audio_channels = 0;
+  ctx->audio_sample_rate = 0;
+  ctx->audio_end_seconds = -1.0;
+  ctx->subtitles_enabled = 0;
+  ctx->adopt = 0;
+  ctx->primed = 0;
+}
+
+static int setup_audio_resampler(FFmpegWasmContext *ctx) {
+  if (!ctx || !ctx->audio_codec) {
+    return AVERROR(EINVAL);
+  }
+  if (ctx->swr) {
+    return 0;
+  }
+
+  if (ctx->audio_codec->ch_layout.nb_channels == 0) {
+    av_channel_layout_default(&ctx->audio_codec->ch_layout, 2);
+  }
+
+  AVChannelLayout out_layout;
+  av_channel_layout_default(&out_layout, 2);
+  int out_channels = out_layout.nb_channels;
+  const int out_rate = 48000;
+
+  int ret = swr_alloc_set_opts2(
+      &ctx->swr,
+      &out_layout,
+      AV_SAMPLE_FMT_FLT,
+      out_rate,
+      &ctx->audio_codec->ch_layout,
+      ctx->audio_codec->sample_fmt,
+      ctx->audio_codec->sample_rate,  // use actual input sample rate
+      0,
+      NULL);
+  av_channel_layout_uninit(&out_layout);
+  if (ret < 0) {
+    return ret;
+  }
+
+  ret = swr_init(ctx->swr);
+  if (ret < 0) {
+    swr_free(&ctx->swr);
+    return ret;
+  }
+
+  ctx->audio_channels = out_channels;
+  ctx->audio_sample_rate = out_rate;
+  return 0;
+}
+
+// Room for out_samples after offset in the output buffer, which is reused
+// across frames and only grows
+static int reserve_audio_output(FFmpegWasmContext *ctx, int offset, int out_samples) {
+  int frame_bytes = ctx->audio_channels * (int)sizeof(float);
+  int needed = (offset + out_samples) * frame_bytes;
+  if (needed <= ctx->audio_data_size) {
+    return 0;
+  }
+  int size = needed;
+  if (ctx->audio_batching && size < (ctx->audio_batch_samples + out_samples) * frame_bytes) {
+    size = (ctx->audio_batch_samples + out_samples) * frame_bytes;
+  }
+  uint8_t *data = av_realloc(ctx->audio_data, (size_t)size);
+  if (!data) {
+    return AVERROR(ENOMEM);
+  }
+  mem_release(&ctx->mem, FFMPEG_WASM_MEM_AUDIO, (size_t)ctx->audio_data_size);
+  mem_charge(&ctx->mem, FFMPEG_WASM_MEM_AUDIO, (size_t)size);
+  ctx->audio_data = data;
+  ctx->audio_data_size = size;
+  ctx->audio_linesize = size;
+  return 0;
+}
+
+static void note_audio_end(FFmpegWasmContext *ctx) {
+  ctx->audio_end_seconds = ctx->audio_pts_seconds + ctx->audio_nb_samples / (double)ctx->audio_sample_rate;
+}
+
+static int convert_audio_frame(FFmpegWasmContext *ctx) {
+  if (!ctx || !ctx->audio_frame || !ctx->audio_codec) {
+    return AVERROR(EINVAL);
+  }
+
+  int ret = setup_audio_resampler(ctx);
+  if (ret < 0) {
+    return ret;
+  }
+
+  int out_samples = swr_get_out_samples(ctx->swr, ctx->audio_frame->nb_samples);
+  if (out_samples <= 0) {
+    return AVERROR(EINVAL);
+  }
+
+  // Batching appends after the samples already gathered for this call
+  int offset = ctx->audio_batching ? ctx->audio_nb_samples : 0;
+  ret = reserve_audio_output(ctx, offset, out_samples);
+  if (ret < 0) {
+    return ret;
+  }
+
+  uint8_t *out = ctx->audio_data + offset * ctx->audio_channels * (int)sizeof(float);
+  int converted = swr_convert(
+      ctx->swr,
+      &out,
+      out_samples,
+      (const uint8_t **)ctx->audio_frame->extended_data,
+      ctx->audio_frame->nb_samples);
+  if (converted < 0) {
+    return converted;
+  }
+  ctx->swr_drained = 0;
+
+  ctx->audio_nb_samples = offset + converted;
+  if (offset > 0) {
+    note_audio_end(ctx);
+    return 0;  // Batch keeps the pts of its first frame
+  }
+
+  int64_t pts = ctx->audio_frame->best_effort_timestamp;
+  if (pts == AV_NOPTS_VALUE || ctx->audio_time_base.den == 0) {
+    ctx->audio_pts_seconds = 0.0;
+  } else {
+    ctx->audio_pts_seconds = pts * av_q2d(ctx->audio_time_base);
+  }
+  note_audio_end(ctx);
+
+  return 0;
+}
+
+// Once the decoder is drained, the samples still inside the resampler (its
+// filter delay when the rate changes). Without them every item ends a few
+// milliseconds short, which is audible between gapless playlist items.
+// 2 when samples came out.
+static int drain_audio_resampler(FFmpegWasmContext *ctx) {
+  if (!ctx->swr || ctx->swr_drained || ctx->audio_end_seconds < 0.0) {
+    return AVERROR(EAGAIN);
+  }
+  ctx->swr_drained = 1;
+  int out_samples = swr_get_out_samples(ctx->swr, 0);
+  if (out_samples <= 0) {
+    return AVERROR(EAGAIN);
+  }
+  int offset = ctx->audio_batching ? ctx->audio_nb_samples : 0;
+  int ret = reserve_audio_output(ctx, offset, out_samples);
+  if (ret < 0) {
+    return ret;
+  }
+  uint8_t *out = ctx->audio_data + offset * ctx->audio_channels * (int)sizeof(float);
+  int converted = swr_convert(ctx->swr, &out, out_samples, NULL, 0);
+  if (converted <= 0) {
+    return converted < 0 ? converted : AVERROR(EAGAIN);
+  }
+  if (offset == 0) {
+    ctx->audio_pts_seconds = ctx->audio_end_seconds;
+  }
+  ctx->audio_nb_samples = offset + converted;
+  note_audio_end(ctx);
+  return 2;
+}
+
+// buffer -> yadif/bwdif -> buffersink for frames shaped like this one
+static int video_filter_configure(FFmpegWasmContext *ctx, const AVFrame *frame) {
+  VideoFilter *f = ctx->filter;
+  if (f->graph && f->in_width == frame->width && f->in_height == frame->height &&
+      f->in_format == frame->format) {
+    return 0;
+  }
+  video_filter_reset(ctx);
+
+  f->graph = avfilter_graph_alloc();
+  if (!f->graph) {
+    return AVERROR(ENOMEM);
+  }
+  f->graph->nb_threads = 1;
+
+  AVRational sar = frame->sample_aspect_ratio.num > 0 ? frame->sample_aspect_ratio : (AVRational){0, 1};
+  AVRational time_base = ctx->video_time_base.den > 0 ? ctx->video_time_base : (AVRational){1, 1000};
+  char args[160];
+  snprintf(args, sizeof(args), "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
+           frame->width, frame->height, frame->format, time_base.num, time_base.den, sar.num, sar.den);
+  char deint_args[64];
+  snprintf(deint_args, sizeof(deint_args), "mode=%s:deint=interlaced",
+           f->double_rate ? "send_field" : "send_frame");
+
+  AVFilterContext *deint = NULL;
+  int ret = avfilter_graph_create_filter(&f->src, avfilter_get_by_name("buffer"), "in", args, NULL, f->graph);
+  if (ret >= 0) {
+    ret = avfilter_graph_create_filter(&deint, avfilter_get_by_name(f->name), "deint", deint_args, NULL,
+                                       f->graph);
+  }
+  if (ret >= 0) {
+    ret = avfilter_graph_create_filter(&f->sink, avfilter_get_by_name("buffersink"), "out", NULL, NULL,
+                                       f->graph);
+  }
+  if (ret >= 0) {
+    ret = avfilter_link(f->src, 0, deint, 0);
+  }
+  if (ret >= 0) {
+    ret = avfilter_link(deint, 0, f->sink, 0);
+  }
+  if (ret >= 0) {
+    ret = avfilter_graph_config(f->graph, NULL);
+  }
+  if (ret < 0) {
+    video_filter_reset(ctx);
+    return ret;
+  }
+  f->in_width = frame->width;
+  f->in_height = frame->height;
+  f->in_format = frame->format;
+  return 0;
+}
+
+// receive_video_frame with the deinterlacer in between. The graph may hold
+// a frame back (yadif needs the next one) or emit two per input (send_field).
+static int receive_filtered_frame(FFmpegWasmContext *ctx) {
+  VideoFilter *f = ctx->filter;
+  for (;;) {
+    if (f->sink) {
+      av_frame_unref(ctx->video_frame);
+      int ret = av_buffersink_get_frame(f->sink, ctx->video_frame);
+      if (ret == 0) {
+        // Field-rate output has its own time base; accessors read best_effort_timestamp
+        AVRational sink_tb = av_buffersink_get_time_base(f->sink);
+        if (ctx->video_frame->pts != AV_NOPTS_VALUE) {
+          ctx->video_frame->best_effort_timestamp =
+              av_rescale_q(ctx->video_frame->pts, sink_tb, ctx->video_time_base);
+        }
+        ctx->video_frame_serial++;
+        return 1;
+      }
+      if (ret == AVERROR_EOF) {
+        ctx->video_eof = 1;
+        return AVERROR(EAGAIN);
+      }
+      if (ret != AVERROR(EAGAIN)) {
+        return ret;
+      }
+    }
+    if (f->flushed) {
+      ctx->video_eof = 1;
+      return AVERROR(EAGAIN);
+    }
+
+    av_frame_unref(f->decoded);
+    int ret = avcodec_receive_frame(ctx->video_codec, f->decoded);
+    if (ret == AVERROR_EOF) {
+      f->flushed = 1;
+      if (f->src) {
+        av_buffersrc_add_frame(f->src, NULL);
+      }
       continue;
     }
+    if (ret < 0) {
+      return ret;
+    }
+    f->decoded->pts = f->decoded->best_effort_timestamp;
+    ret = video_filter_configure(ctx, f->decoded);
+    if (ret >= 0) {
+      ret = av_buffersrc_add_frame(f->src, f->decoded);
+    }
+    if (ret < 0) {
+      return ret;
+    }
+  }
+}
+
+static int receive_video_frame(FFmpegWasmContext *ctx) {
+  if (!ctx || !ctx->video_codec || !ctx->video_frame) {
+    return AVERROR(EAGAIN);
+  }
+  if (ctx->filter) {
+    return receive_filtered_frame(ctx);
+  }
+
+  av_frame_unref(ctx->video_frame);
+  int ret = avcodec_receive_frame(ctx->video_codec, ctx->video_frame);
+  if (ret == 0) {
+    ctx->video_frame_serial++;
+    return 1;
+  }
+  if (ret == AVERROR_EOF) {
+    ctx->video_eof = 1;
+    return AVERROR(EAGAIN);
+  }
+  return ret;
+}
+
+static int receive_audio_frame(FFmpegWasmContext *ctx) {
+  if (!ctx || !ctx->audio_codec || !ctx->audio_frame) {
+    return AVERROR(EAGAIN);
+  }
+
+  av_frame_unref(ctx->audio_frame);
+  int ret = avcodec_receive_frame(ctx->audio_codec, ctx->audio_frame);
+  if (ret == 0) {
+    ret = convert_audio_frame(ctx);
+    if (ret < 0) {
+      return ret;
+    }
+    return 2;
+  }
+  if (ret == AVERROR_EOF) {
+    if (drain_audio_resampler(ctx) == 2) {
+      return 2;
+    }
+    ctx->audio_eof = 1;
+    return AVERROR(EAGAIN);
+  }
+  return ret;
+}
+
+static int reopen_video_stream(FFmpegWasmContext *ctx, int stream_index) {
+  if (!ctx || !ctx->fmt) {
+    return AVERROR(EINVAL);
+  }
+  if (stream_index < 0 || stream_index >= (int)ctx->fmt->nb_streams) {
+    return AVERROR(EINVAL);
+  }
+
+  AVStream *stream = ctx->fmt->streams[stream_index];
+  if (!stream || !stream->codecpar) {
+    return AVERROR(EINVAL);
+  }
+  if (stream->codecpar->codec_type != AVMEDIA_TYPE_VIDEO) {
+    return AVERROR(EINVAL);
+  }
+
+  const AVCodec *decoder = find_decoder(ctx, stream->codecpar->codec_id);
+  if (!decoder) {
+    return decoder_not_found(ctx);
+  }
+
+  AVCodecContext *codec = avcodec_alloc_context3(decoder);
+  if (!codec) {
+    return AVERROR(ENOMEM);
+  }
+  int ret = avcodec_parameters_to_context(codec, stream->codecpar);
+  if (ret < 0) {
+    avcodec_free_context(&codec);
+    return ret;
+  }
+  codec->thread_count = 1;
+  codec->thread_type = 0;
+  codec->skip_frame = ctx->trick_play ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+  attach_memory_hooks(ctx, codec);
+
+  ret = avcodec_open2(codec, decoder, NULL);
+  if (ret < 0) {
+    avcodec_free_context(&codec);
+    return ret;
+  }
+
+  if (ctx->video_codec) {
+    avcodec_free_context(&ctx->video_codec);
+  }
+  ctx->video_codec = codec;
+  ctx->video_stream_index = stream_index;
+  ctx->video_time_base = stream->time_base;
+  ctx->video_eof = 0;
+  ctx->video_flush_sent = 0;
+  ctx->adopt &= ~PRELOAD_VIDEO;
+  video_filter_reset(ctx);
+
+  if (ctx->sws) {
+    sws_freeContext(ctx->sws);
+    ctx->sws = NULL;
+  }
+  free_rgba_buffers(ctx);
+  av_freep(&ctx->tonemap);
+  return 0;
+}
+
+static void close_video_decoder(FFmpegWasmContext *ctx) {
+  if (ctx->video_codec) {
+    avcodec_free_context(&ctx->video_codec);
+  }
+  if (ctx->sws) {
+    sws_freeContext(ctx->sws);
+    ctx->sws = NULL;
+  }
+  free_rgba_buffers(ctx);
+  av_freep(&ctx->tonemap);
+  video_filter_reset(ctx);
+  ctx->video_stream_index = -1;
+  ctx->video_time_base = (AVRational){0, 1};
+  ctx->video_eof = 1;
+  ctx->video_flush_sent = 1;
+  ctx->adopt &= ~PRELOAD_VIDEO;
+}
+
+// Best video stream to decode. Cover art (attached_pic) only counts when
+// requested with ffmpeg_wasm_set_attached_pictures.
+static int find_video_stream(FFmpegWasmContext *ctx) {
+  int index = av_find_best_stream(ctx->fmt, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+  if (index >= 0 && (ctx->fmt->streams[index]->disposition & AV_DISPOSITION_ATTACHED_PIC) &&
+      !ctx->attached_pictures) {
+    return AVERROR_STREAM_NOT_FOUND;
+  }
+  return index;
+}
+
+// Don't demux video streams nobody decodes (audio-only playback)
+static void discard_unused_video(FFmpegWasmContext *ctx) {
+  for (unsigned int i = 0; i < ctx->fmt->nb_streams; i++) {
+    AVStream *stream = ctx->fmt->streams[i];
+    if (stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+      stream->discard = (int)i == ctx->video_stream_index ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    }
+  }
+}
+
+static void close_audio_decoder(FFmpegWasmContext *ctx) {
+  if (!ctx) {
+    return;
+  }
+  if (ctx->audio_codec) {
+    avcodec_free_context(&ctx->audio_codec);
+  }
+  if (ctx->swr) {
+    swr_free(&ctx->swr);
+  }
+  free_audio_buffers(ctx);
+  ctx->audio_stream_index = -1;
+  ctx->audio_time_base = (AVRational){0, 1};
+  ctx->audio_channels = 0;
+  ctx->audio_sample_rate = 0;
+  ctx->audio_pts_seconds = 0.0;
+  ctx->audio_nb_samples = 0;
+  ctx->audio_end_seconds = -1.0;
+  ctx->adopt &= ~PRELOAD_AUDIO;
+}
+
+static int open_audio_decoder(FFmpegWasmContext *ctx, AVStream *stream, int stream_index);
+
+static int reopen_audio_stream(FFmpegWasmContext *ctx, int stream_index) {
+  if (!ctx || !ctx->fmt) {
+    return AVERROR(EINVAL);
+  }
+  if (stream_index < 0 || stream_index >= (int)ctx->fmt->nb_streams) {
+    return AVERROR(EINVAL);
+  }
+
+  AVStream *stream = ctx->fmt->streams[stream_index];
+  if (!stream || !stream->codecpar) {
+    return AVERROR(EINVAL);
+  }
+  if (stream->codecpar->codec_type != AVMEDIA_TYPE_AUDIO) {
+    return AVERROR(EINVAL);
+  }
+  return open_audio_decoder(ctx, stream, stream_index);
+}
+
+// Replace the audio decoder with one for stream (of ctx->fmt or the audio input)
+static int open_audio_decoder(FFmpegWasmContext *ctx, AVStream *stream, int stream_index) {
+  const AVCodec *decoder = find_decoder(ctx, stream->codecpar->codec_id);
+  if (!decoder) {
+    return decoder_not_found(ctx);
+  }
+
+  AVCodecContext *codec = avcodec_alloc_context3(decoder);
+  if (!codec) {
+    return AVERROR(ENOMEM);
+  }
+  int ret = avcodec_parameters_to_context(codec, stream->codecpar);
+  if (ret < 0) {
+    avcodec_free_context(&codec);
+    return ret;
+  }
+  codec->thread_count = 1;
+  codec->thread_type = 0;
+  attach_memory_hooks(ctx, codec);
+
+  ret = avcodec_open2(codec, decoder, NULL);
+  if (ret < 0) {
+    avcodec_free_context(&codec);
+    return ret;
+  }
+
+  close_audio_decoder(ctx);
+  ctx->audio_codec = codec;
+  ctx->audio_stream_index = stream_index;
+  ctx->audio_time_base = stream->time_base;
+  ctx->audio_enabled = 1;
+  ctx->audio_eof = 0;
+  ctx->audio_flush_sent = 0;
+  return 0;
+}
+
+static int reopen_subtitle_stream(FFmpegWasmContext *ctx, int stream_index) {
+  if (!ctx || !ctx->fmt) {
+    return AVERROR(EINVAL);
+  }
+  if (stream_index < 0 || stream_index >= (int)ctx->fmt->nb_streams) {
+    return AVERROR(EINVAL);
+  }
+
+  AVStream *stream = ctx->fmt->streams[stream_index];
+  if (!stream || !stream->codecpar) {
+    return AVERROR(EINVAL);
+  }
+  if (stream->codecpar->codec_type != AVMEDIA_TYPE_SUBTITLE) {
+    return AVERROR(EINVAL);
+  }
+
+  int ret = init_ass_library(ctx);
+  if (ret < 0) {
+    return ret;
+  }
+
+  const AVCodec *decoder = find_decoder(ctx, stream->codecpar->codec_id);
+  if (!decoder) {
+    return decoder_not_found(ctx);
+  }
+
+  AVCodecContext *codec = avcodec_alloc_context3(decoder);
+  if (!codec) {
+    return AVERROR(ENOMEM);
+  }
+  ret = avcodec_parameters_to_context(codec, stream->codecpar);
+  if (ret < 0) {
+    avcodec_free_context(&codec);
+    return ret;
+  }
+
+  ret = avcodec_open2(codec, decoder, NULL);
+  if (ret < 0) {
+    avcodec_free_context(&codec);
+    return ret;
+  }
+
+  close_subtitle_decoder(ctx);
+  ctx->subtitle_codec = codec;
+  ctx->subtitle_stream_index = stream_index;
+
+  ctx->ass_track = ass_new_track(ctx->ass_library);
+  if (!ctx->ass_track) {
+    close_subtitle_decoder(ctx);
+    return AVERROR(ENOMEM);
+  }
+
+  if (codec->subtitle_header && codec->subtitle_header_size > 0) {
+    ass_process_codec_private(ctx->ass_track, (char *)codec->subtitle_header, codec->subtitle_header_size);
+  }
+
+  ctx->subtitles_enabled = 1;
+  return 0;
+}
+
+static void process_subtitle_packet(FFmpegWasmContext *ctx, AVPacket *pkt) {
+  if (!ctx || !ctx->subtitle_codec || !ctx->ass_track || !pkt) {
+    return;
+  }
+
+  AVSubtitle sub;
+  memset(&sub, 0, sizeof(sub));
+  int got_sub = 0;
+
+  int ret = avcodec_decode_subtitle2(ctx->subtitle_codec, &sub, &got_sub, pkt);
+  if (ret < 0 || !got_sub) {
+    return;
+  }
+
+  int64_t start_time = pkt->pts;
+  if (start_time == AV_NOPTS_VALUE) {
+    start_time = pkt->dts;
+  }
+  if (start_time == AV_NOPTS_VALUE) {
+    avsubtitle_free(&sub);
+    return;
+  }
+
+  AVStream *stream = ctx->fmt->streams[ctx->subtitle_stream_index];
+  double start_sec = start_time * av_q2d(stream->time_base);
+  double duration_sec = (double)sub.end_display_time / 1000.0;
+  if (duration_sec <= 0.0) {
+    // Some decoders (e.g. ASS) can emit zero durations; fall back to packet duration or a small default
+    if (pkt->duration && pkt->duration != AV_NOPTS_VALUE) {
+      duration_sec = pkt->duration * av_q2d(stream->time_base);
+    }
+    if (duration_sec <= 0.0) {
+      duration_sec = 4.0;  // conservative default so text is visible
+    }
+  }
+  double start_ms = start_sec * 1000.0;
+  double end_ms = (start_sec + duration_sec) * 1000.0;
+
+  for (unsigned int i = 0; i < sub.num_rects; i++) {
+    AVSubtitleRect *rect = sub.rects[i];
+    if (!rect) {
+      continue;
+    }
+
+    if (rect->type == SUBTITLE_ASS && rect->ass) {
+      ass_process_chunk(ctx->ass_track, rect->ass, strlen(rect->ass),
+                        (long long)(start_sec * 1000), (long long)(duration_sec * 1000));
+
+      // Emit a debug log back to JS for visibility in the UI log panel
+      platform_post_subtitle_log(rect->ass, (int)start_ms, (int)end_ms);
+    } else if (rect->type == SUBTITLE_TEXT && rect->text) {
+      char buf[4096];
+      snprintf(buf, sizeof(buf), "Dialogue: 0,0:00:00.00,0:00:00.00,Default,,0,0,0,,%s", rect->text);
+      ass_process_chunk(ctx->ass_track, buf, strlen(buf),
+                        (long long)(start_sec * 1000), (long long)(duration_sec * 1000));
+
+      platform_post_subtitle_log(rect->text, (int)start_ms, (int)end_ms);
+    }
+  }
+
+  avsubtitle_free(&sub);
+}
+
+// Detach a tile's context and hand it back its own libass instance if it
+// had subtitles running on the shared one.
+static void mosaic_detach_tile(FFmpegWasmMosaic *mosaic, int index, int restore_subtitles) {
+  MosaicTile *tile = &mosaic->tiles[index];
+  FFmpegWasmContext *ctx = tile->ctx;
+  if (!ctx) {
+    return;
+  }
+  int subtitle_index = ctx->subtitles_enabled ? ctx->subtitle_stream_index : -1;
+  free_ass_renderer(ctx);
+  ctx->subtitles_enabled = 0;
+  ctx->mosaic = NULL;
+  ctx->mosaic_tile = -1;
+  if (restore_subtitles && ctx->opened && subtitle_index >= 0) {
+    reopen_subtitle_stream(ctx, subtitle_index);
+  }
+
+  if (tile->sws) {
+    sws_freeContext(tile->sws);
+  }
+  mosaic_fill_rect(mosaic, tile->x, tile->y, tile->width, tile->height);
+  memset(tile, 0, sizeof(*tile));
+}
+
+EMSCRIPTEN_KEEPALIVE unsigned int ffmpeg_wasm_avcodec_version(void) {
+  return avcodec_version();
+}
+
+EMSCRIPTEN_KEEPALIVE unsigned int ffmpeg_wasm_avformat_version(void) {
+  return avformat_version();
+}
+
+EMSCRIPTEN_KEEPALIVE unsigned int ffmpeg_wasm_avutil_version(void) {
+  return avutil_version();
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_has_hevc_av1(void) {
+  int hevc = avcodec_find_decoder(AV_CODEC_ID_HEVC) || is_side_decoder("hevc");
+  int av1 = avcodec_find_decoder(AV_CODEC_ID_AV1) || is_side_decoder("av1");
+  return hevc && av1;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_is_split_build(void) {
+  return platform_is_split();
+}
+
+// 1 in a -sMEMORY64 build (build-ffmpeg.sh --memory64), where the heap can
+// pass 4 GB
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_is_memory64(void) {
+  return sizeof(void *) == 8;
+}
+
+EMSCRIPTEN_KEEPALIVE const char *ffmpeg_wasm_missing_modules(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx ? ctx->missing_modules : "";
+}
+
+EMSCRIPTEN_KEEPALIVE uintptr_t ffmpeg_wasm_create(int initial_capacity) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)calloc(1, sizeof(FFmpegWasmContext));
+  if (!ctx) {
+    return 0;
+  }
+
+  if (initial_capacity > 0) {
+    ctx->buffer.capacity = (size_t)initial_capacity;
+    ctx->buffer.data = av_malloc(ctx->buffer.capacity);
+    if (!ctx->buffer.data) {
+      free(ctx);
+      return 0;
+    }
+  }
+
+  ctx->video_stream_index = -1;
+  ctx->audio_stream_index = -1;
+  ctx->subtitle_stream_index = -1;
+  ctx->rgba_src_fmt = AV_PIX_FMT_NONE;
+  ctx->video_time_base = (AVRational){0, 1};
+  ctx->audio_time_base = (AVRational){0, 1};
+  ctx->audio_enabled = 1;
+  ctx->audio_batch_samples = AUDIO_ONLY_BATCH_SAMPLES;
+  ctx->subtitles_enabled = 0;
+  ctx->mosaic_tile = -1;
+  ctx->desc.version = FFMPEG_WASM_DESC_VERSION;
+  ctx->tone_mapping = 1;
+  ctx->audio_end_seconds = -1.0;
+  ctx->packets.end_seconds = -1.0;
+  ctx->clock.speed = 1.0;
+  clock_reset(&ctx->clock);
+  ctx->buffer.start = 0;
+  ctx->buffer.limit = 0;
+  ctx->buffer.backlog = DEFAULT_KEEP_BACKLOG;
+  ctx->buffer.keep_all = 1;  // Keep all data until open succeeds
+  ctx->buffer.total_size = -1;
+  flow_reset(ctx);
+  mem_set(&ctx->mem, FFMPEG_WASM_MEM_STREAM_BUFFER, ctx->buffer.capacity);
+  av_log_set_level(AV_LOG_ERROR);
+  return (uintptr_t)ctx;
+}
+
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_destroy(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx) {
+    return;
+  }
+
+  if (ctx->mosaic) {
+    mosaic_detach_tile(ctx->mosaic, ctx->mosaic_tile, 0);
+  }
+  reset_decoder(ctx);
+  packet_cache_free(ctx);
+  gop_cache_free(ctx);
+  free_video_filter(ctx);
+  free_range_cache(ctx);
+  close_spill(&ctx->buffer);
+  if (ctx->audio_input) {
+    av_freep(&ctx->audio_input->buffer.data);
+    av_freep(&ctx->audio_input);
+  }
+  if (ctx->buffer.data) {
+    av_freep(&ctx->buffer.data);
+  }
+  av_freep(&ctx->open_state);
+  av_freep(&ctx->saved_state);
+  av_freep(&ctx->stream_table);
+  free(ctx);
+}
+
+static int buffer_append(StreamBuffer *buffer, const uint8_t *data, size_t len) {
+  if (len > SIZE_MAX - buffer->start - buffer->size) {
+    return AVERROR(ENOMEM);
+  }
+  size_t needed = buffer->start + buffer->size + len;
+  int ret = ensure_capacity(buffer, needed);
+  if (ret < 0) {
+    av_log(NULL, AV_LOG_ERROR, "append: ensure_capacity failed (%d), needed=%zu, start=%zu, size=%zu\n",
+           ret, needed, buffer->start, buffer->size);
+    return ret;
+  }
+  memcpy(buffer->data + buffer->start + buffer->size, data, len);
+  buffer->size += len;
+  return 0;
+}
+
+// Returns 0 or an AVERROR code
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_append(uintptr_t handle, const uint8_t *data, size_t len) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx) {
+    av_log(NULL, AV_LOG_ERROR, "append: ctx is NULL\n");
+    return AVERROR(EINVAL);
+  }
+  if (!data) {
+    av_log(NULL, AV_LOG_ERROR, "append: data is NULL\n");
+    return AVERROR(EINVAL);
+  }
+  if (len == 0) {
+    return 0;
+  }
+
+  if (mem_over_budget(&ctx->mem)) {
+    // Reuse consumed space before growing past the budget
+    compact_buffer(&ctx->buffer);
+  }
+
+  int ret = buffer_append(&ctx->buffer, data, len);
+  if (ret < 0) {
+    return ret;
+  }
+  mem_set(&ctx->mem, FFMPEG_WASM_MEM_STREAM_BUFFER, stream_buffer_bytes(ctx));
+  enforce_buffer_limit(&ctx->buffer);
+  enforce_memory_budget(ctx);
+  if (ctx->avio) {
+    ctx->avio->eof_reached = 0;
+    ctx->avio->error = 0;
+  }
+  return 0;
+}
+
+// Separate audio rendition of a manifest source (call before open, then keep
+// appending its segments alongside the main ones)
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_append_audio(uintptr_t handle, const uint8_t *data, size_t len) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !data || ctx->range) {
+    return AVERROR(EINVAL);
+  }
+  if (!ctx->audio_input) {
+    ctx->audio_input = av_mallocz(sizeof(AudioInput));
+    if (!ctx->audio_input) {
+      return AVERROR(ENOMEM);
+    }
+    ctx->audio_input->buffer.backlog = DEFAULT_KEEP_BACKLOG;
+    ctx->audio_input->buffer.keep_all = 1;
+    ctx->audio_input->buffer.total_size = -1;
+    ctx->audio_input->stream_index = -1;
+    ctx->audio_input->reopen = 1;
+    ctx->audio_input->last_seconds = -1.0;
+  }
+  AudioInput *input = ctx->audio_input;
+  int ret = buffer_append(&input->buffer, data, len);
+  if (ret < 0) {
+    return ret;
+  }
+  mem_set(&ctx->mem, FFMPEG_WASM_MEM_STREAM_BUFFER, stream_buffer_bytes(ctx));
+  enforce_memory_budget(ctx);
+  if (input->avio) {
+    input->avio->eof_reached = 0;
+    input->avio->error = 0;
+  }
+  return 0;
+}
+
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_set_audio_input_eof(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (ctx && ctx->audio_input) {
+    ctx->audio_input->buffer.eof = 1;
+    if (ctx->audio_input->avio) {
+      ctx->audio_input->avio->eof_reached = 0;
+      ctx->audio_input->avio->error = 0;
+    }
+  }
+}
+
+// The next byte appended (to the audio rendition if audio is set) starts a
+// new init segment: a variant switch or discontinuity. The demuxer is
+// reopened there; the decoders are kept when the codec stays the same.
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_mark_segment_boundary(uintptr_t handle, int audio) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || ctx->range || (audio && !ctx->audio_input)) {
+    return AVERROR(EINVAL);
+  }
+  StreamBuffer *buffer = audio ? &ctx->audio_input->buffer : &ctx->buffer;
+  int64_t end = buffer->offset + (int64_t)buffer->size;
+  if (buffer->boundary_count > 0 && buffer->boundaries[buffer->boundary_count - 1] == end) {
+    return 0;
+  }
+  if (end == 0 && !ctx->opened) {
+    return 0;  // Nothing before it; the first open starts here anyway
+  }
+  if (buffer->boundary_count >= MAX_SEGMENT_BOUNDARIES) {
+    return AVERROR(ENOSPC);
+  }
+  buffer->boundaries[buffer->boundary_count++] = end;
+  return 0;
+}
+
+// Manifest seek: drop all buffered segments and reopen both demuxers on
+// whatever is appended next (init segment first), keeping the decoders.
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_restart_segments(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->fmt || !ctx->opened || ctx->range) {
+    return AVERROR(EINVAL);
+  }
+  if (!ctx->segment_format) {
+    ctx->segment_format = ctx->fmt->iformat;
+  }
+  packet_cache_clear(ctx);
+  if (ctx->video_codec) {
+    avcodec_flush_buffers(ctx->video_codec);
+  }
+  if (ctx->audio_codec) {
+    avcodec_flush_buffers(ctx->audio_codec);
+  }
+  video_filter_reset(ctx);
+
+  StreamBuffer *buffers[2] = {&ctx->buffer, ctx->audio_input ? &ctx->audio_input->buffer : NULL};
+  for (int i = 0; i < 2; i++) {
+    if (!buffers[i]) {
+      continue;
+    }
+    buffers[i]->start = 0;
+    buffers[i]->size = 0;
+    buffers[i]->read_pos = 0;
+    buffers[i]->cold = 0;
+    buffers[i]->offset = 0;
+    buffers[i]->eof = 0;
+    buffers[i]->boundary_count = 0;
+    buffers[i]->keep_all = 1;
+  }
+  if (ctx->audio_input) {
+    if (ctx->audio_input->fmt && !ctx->audio_input->format) {
+      ctx->audio_input->format = ctx->audio_input->fmt->iformat;
+    }
+    close_audio_input(ctx->audio_input);
+  }
+  ctx->demux_reopen = 1;
+  flow_reset(ctx);
+
+  ctx->draining = 0;
+  ctx->video_eof = 0;
+  ctx->audio_eof = 0;
+  ctx->video_flush_sent = 0;
+  ctx->audio_flush_sent = 0;
+  return 0;
+}
+
+// Switch a fresh context to the sparse range cache (call before open). With a
+// known size the demuxer gets full random access, so container indexes at the
+// end of the file and backward seeks work without restreaming.
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_set_range_source(uintptr_t handle, double total_size, double cache_limit) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || ctx->avio || total_size <= 0) {
+    return AVERROR(EINVAL);
+  }
+  if (!ctx->range) {
+    ctx->range = av_mallocz(sizeof(*ctx->range));
+    if (!ctx->range) {
+      return AVERROR(ENOMEM);
+    }
+  }
+  // The StreamBuffer is unused from here on
+  av_freep(&ctx->buffer.data);
+  ctx->buffer.capacity = 0;
+  ctx->buffer.size = 0;
+  mem_set(&ctx->mem, FFMPEG_WASM_MEM_STREAM_BUFFER, 0);
+  ctx->range->total_size = (int64_t)total_size;
+  ctx->range->limit = cache_limit > 0 ? clamp_size(cache_limit) : DEFAULT_RANGE_CACHE;
+  ctx->range->wanted = -1;
+  return 0;
+}
+
+// Range-source counterpart of append: bytes for [offset, offset + len)
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_append_at(uintptr_t handle, double offset, const uint8_t *data, size_t len) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->range || !data || offset < 0) {
+    return AVERROR(EINVAL);
+  }
+  RangeCache *cache = ctx->range;
+  int ret = range_insert(cache, (int64_t)offset, data, len);
+  if (ret < 0) {
+    return ret;
+  }
+  if (cache->wanted >= 0 && range_find(cache, cache->wanted) >= 0) {
+    cache->wanted = -1;
+  }
+  size_t limit = cache->limit;
+  if (ctx->buffer.growth_cap > 0 && ctx->buffer.growth_cap < limit) {
+    limit = ctx->buffer.growth_cap;
+  }
+  range_evict(cache, limit);
+  mem_set(&ctx->mem, FFMPEG_WASM_MEM_STREAM_BUFFER, cache->bytes);
+  enforce_memory_budget(ctx);
+  if (ctx->avio) {
+    ctx->avio->eof_reached = 0;
+    ctx->avio->error = 0;
+  }
+  return 0;
+}
+
+// Demuxer read position, and the first missing byte a read stopped at (-1
+// when reads have not run into a hole since it was filled)
+EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_range_position(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx && ctx->range ? (double)ctx->range->pos : -1.0;
+}
+
+EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_range_wanted(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx && ctx->range ? (double)ctx->range->wanted : -1.0;
+}
+
+// End of the cached run starting at offset (offset itself if it is a hole)
+EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_range_cached_end(uintptr_t handle, double offset) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->range) {
+    return offset;
+  }
+  int index = range_find(ctx->range, (int64_t)offset);
+  if (index < 0) {
+    return offset;
+  }
+  const RangeExtent *ext = &ctx->range->extents[index];
+  return (double)(ext->offset + (int64_t)ext->size);
+}
+
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_set_eof(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (ctx) {
+    ctx->buffer.eof = 1;
+    if (ctx->avio) {
+      ctx->avio->eof_reached = 0;
+      ctx->avio->error = 0;
+    }
+  }
+}
+
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_set_keep_all(uintptr_t handle, int enabled) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (ctx) {
+    ctx->buffer.keep_all = enabled ? 1 : 0;
+  }
+}
+
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_set_buffer_limit(uintptr_t handle, double limit_bytes) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx) {
+    return;
+  }
+  ctx->buffer.limit = clamp_size(limit_bytes);
+  enforce_buffer_limit(&ctx->buffer);
+}
+
+// Spill bytes dropped from the front of the buffer to a secondary store so
+// a small buffer limit still allows seeking anywhere already read. ENOSYS
+// when no store is registered for this handle (see platform_spill_open).
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_set_spill(uintptr_t handle, int enabled) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || ctx->range) {
+    return AVERROR(EINVAL);
+  }
+  if (!enabled) {
+    if (ctx->buffer.cold) {
+      return AVERROR(EBUSY);
+    }
+    close_spill(&ctx->buffer);
+    return 0;
+  }
+  if (ctx->buffer.spill) {
+    return 0;
+  }
+  SpillStore *spill = av_mallocz(sizeof(*spill));
+  if (!spill) {
+    return AVERROR(ENOMEM);
+  }
+  spill->handle = platform_spill_open(handle);
+  if (!spill->handle) {
+    av_free(spill);
+    return AVERROR(ENOSYS);
+  }
+  spill->start = ctx->buffer.offset;
+  spill->end = ctx->buffer.offset;
+  ctx->buffer.spill = spill;
+  return 0;
+}
+
+// Bytes behind the heap window that seeks can still reach
+EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_spilled_bytes(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->buffer.spill || ctx->buffer.spill->end != ctx->buffer.offset) {
+    return 0.0;
+  }
+  return (double)(ctx->buffer.spill->end - ctx->buffer.spill->start);
+}
+
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_set_file_size(uintptr_t handle, double size) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (ctx) {
+    ctx->buffer.total_size = (int64_t)size;
+  }
+}
+
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_set_buffer_offset(uintptr_t handle, double offset) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (ctx) {
+    ctx->buffer.offset = (int64_t)offset;
+  }
+}
+
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_set_audio_enabled(uintptr_t handle, int enabled) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx) {
+    return;
+  }
+  ctx->audio_enabled = enabled ? 1 : 0;
+  if (!ctx->audio_enabled) {
+    free_audio_buffers(ctx);
+    ctx->audio_eof = 1;
+    ctx->audio_flush_sent = 1;
+    if (ctx->audio_codec) {
+      avcodec_flush_buffers(ctx->audio_codec);
+    }
+  } else {
+    ctx->audio_eof = 0;
+    ctx->audio_flush_sent = 0;
+    if (ctx->audio_codec) {
+      avcodec_flush_buffers(ctx->audio_codec);
+    }
+  }
+}
+
+// Decode cover art (attached_pic) as the video stream. Off by default so
+// music files open audio-only; takes effect on the next open.
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_set_attached_pictures(uintptr_t handle, int enabled) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (ctx) {
+    ctx->attached_pictures = enabled ? 1 : 0;
+  }
+}
+
+// Samples gathered per read_frame call when there is no video; 0 returns
+// one codec frame per call.
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_set_audio_batch_samples(uintptr_t handle, int samples) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (ctx) {
+    ctx->audio_batch_samples = samples > 0 ? samples : 0;
+  }
+}
+
+// Live input (e.g. MPEG-TS relayed over a WebSocket): open on minimal probing,
+// refuse seeks, keep no backlog, and skip ahead to a keyframe whenever more
+// than target_seconds is buffered. Set before open; 0 turns it off.
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_set_live(uintptr_t handle, double target_seconds) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || ctx->range || ctx->audio_input) {
+    return AVERROR(EINVAL);
+  }
+  if (ctx->opened && (ctx->live_target > 0.0) != (target_seconds > 0.0)) {
+    return AVERROR(EINVAL);  // The target can change, live itself cannot
+  }
+  ctx->live_target = target_seconds > 0.0 ? target_seconds : 0.0;
+  ctx->live_skipping = 0;
+  if (ctx->live_target > 0.0) {
+    ctx->buffer.backlog = 0;
+  }
+  return 0;
+}
+
+// Keyframe skips taken since open
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_live_skips(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx ? ctx->live_skips : 0;
+}
+
+// Manifest sources: the main buffer (and the separate audio rendition, if
+// any) carry concatenated segments. A variant switch or discontinuity starts
+// a new init segment at a boundary; the demuxer is reopened there while the
+// decoders stay open, getting changed codec config as new-extradata side data.
+
+static int at_segment_boundary(const StreamBuffer *buffer) {
+  return buffer->boundary_count > 0 &&
+         buffer->offset + (int64_t)buffer->read_pos >= buffer->boundaries[0];
+}
+
+// Drop everything before the first boundary so the new init segment is at 0
+static void rebase_at_boundary(StreamBuffer *buffer) {
+  int64_t base = buffer->boundaries[0];
+  size_t drop = (size_t)(base - buffer->offset);
+  if (drop > buffer->size) {
+    drop = buffer->size;
+  }
+  buffer->start += drop;
+  buffer->size -= drop;
+  if (buffer->size == 0) {
+    buffer->start = 0;
+  }
+  buffer->read_pos = 0;
+  buffer->offset = 0;
+  buffer->boundary_count--;
+  for (int i = 0; i < buffer->boundary_count; i++) {
+    buffer->boundaries[i] = buffer->boundaries[i + 1] - base;
+  }
+}
+
+// Open a demuxer on buffer from its first byte. EAGAIN until enough of the
+// segment is there (the caller keeps keep_all set meanwhile).
+static int open_input_demuxer(StreamBuffer *buffer, const AVInputFormat *format,
+                              AVIOContext **avio_out, AVFormatContext **fmt_out) {
+  const int avio_buffer_size = 32 * 1024;
+  buffer->read_pos = 0;
+  uint8_t *avio_buffer = av_malloc(avio_buffer_size);
+  if (!avio_buffer) {
+    return AVERROR(ENOMEM);
+  }
+  AVIOContext *avio = avio_alloc_context(avio_buffer, avio_buffer_size, 0, buffer,
+                                         read_packet, NULL, seek_stream);
+  if (!avio) {
+    av_free(avio_buffer);
+    return AVERROR(ENOMEM);
+  }
+  avio->seekable = 0;
+
+  AVFormatContext *fmt = avformat_alloc_context();
+  if (!fmt) {
+    free_input_demuxer(&avio, &fmt);
+    return AVERROR(ENOMEM);
+  }
+  fmt->pb = avio;
+  fmt->flags |= AVFMT_FLAG_CUSTOM_IO;
+  fmt->flags |= AVFMT_FLAG_NONBLOCK;
+
+  int ret = avformat_open_input(&fmt, NULL, format, NULL);
+  if (ret < 0) {
+    free_input_demuxer(&avio, &fmt);
+    return buffer->eof ? ret : AVERROR(EAGAIN);
+  }
+  avio->seekable = AVIO_SEEKABLE_NORMAL;
+  *avio_out = avio;
+  *fmt_out = fmt;
+  return 0;
+}
+
+// Same codec on both sides of a switch: keep the decoder and hand it the new
+// stream's codec config with the next packet
+static int stash_new_extradata(FFmpegWasmContext *ctx, int which, const AVCodecParameters *par) {
+  av_freep(&ctx->new_extradata[which]);
+  ctx->new_extradata_size[which] = 0;
+  if (!par->extradata || par->extradata_size <= 0) {
+    return 0;
+  }
+  ctx->new_extradata[which] = av_memdup(par->extradata, par->extradata_size);
+  if (!ctx->new_extradata[which]) {
+    return AVERROR(ENOMEM);
+  }
+  ctx->new_extradata_size[which] = par->extradata_size;
+  return 0;
+}
+
+static void attach_new_extradata(FFmpegWasmContext *ctx, int which, AVPacket *pkt) {
+  if (!ctx->new_extradata[which]) {
+    return;
+  }
+  uint8_t *side = av_packet_new_side_data(pkt, AV_PKT_DATA_NEW_EXTRADATA, ctx->new_extradata_size[which]);
+  if (side) {
+    memcpy(side, ctx->new_extradata[which], ctx->new_extradata_size[which]);
+  }
+  av_freep(&ctx->new_extradata[which]);
+  ctx->new_extradata_size[which] = 0;
+}
+
+// Reopen the main demuxer at the next init segment and map the decoders onto
+// its streams. EAGAIN until the segment's header is buffered.
+static int switch_main_demuxer(FFmpegWasmContext *ctx) {
+  StreamBuffer *buffer = &ctx->buffer;
+  if (!ctx->segment_format) {
+    ctx->segment_format = ctx->fmt->iformat;
+  }
+  if (at_segment_boundary(buffer)) {
+    rebase_at_boundary(buffer);
+  }
+  ctx->demux_reopen = 1;
+  buffer->keep_all = 1;
+  packet_cache_clear(ctx);
+
+  AVIOContext *avio = NULL;
+  AVFormatContext *fmt = NULL;
+  int ret = open_input_demuxer(buffer, ctx->segment_format, &avio, &fmt);
+  if (ret < 0) {
+    return ret;
+  }
+  ctx->demux_reopen = 0;
+  buffer->keep_all = 0;
+
+  free_input_demuxer(&ctx->avio, &ctx->fmt);
+  ctx->avio = avio;
+  ctx->fmt = fmt;
+  if (ctx->subtitle_codec) {
+    close_subtitle_decoder(ctx);  // Indexes mean nothing in the new demuxer
+  }
+
+  if (ctx->video_codec) {
+    int index = find_video_stream(ctx);
+    if (index < 0) {
+      close_video_decoder(ctx);
+    } else if (fmt->streams[index]->codecpar->codec_id == ctx->video_codec->codec_id) {
+      ctx->video_stream_index = index;
+      ctx->video_time_base = fmt->streams[index]->time_base;
+      ret = stash_new_extradata(ctx, 0, fmt->streams[index]->codecpar);
+    } else {
+      ret = reopen_video_stream(ctx, index);
+    }
+    if (ret < 0) {
+      return ret;
+    }
+  }
+  discard_unused_video(ctx);
+
+  if (ctx->audio_codec && !ctx->audio_input) {
+    int index = av_find_best_stream(fmt, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+    if (index < 0) {
+      close_audio_decoder(ctx);
+    } else if (fmt->streams[index]->codecpar->codec_id == ctx->audio_codec->codec_id) {
+      ctx->audio_stream_index = index;
+      ctx->audio_time_base = fmt->streams[index]->time_base;
+      ret = stash_new_extradata(ctx, 1, fmt->streams[index]->codecpar);
+    } else {
+      ret = open_audio_decoder(ctx, fmt->streams[index], index);
+    }
+    if (ret < 0) {
+      return ret;
+    }
+  }
+  return 0;
+}
+
+// (Re)open the separate audio rendition at its next init segment
+static int reopen_audio_input(FFmpegWasmContext *ctx) {
+  AudioInput *input = ctx->audio_input;
+  StreamBuffer *buffer = &input->buffer;
+  if (input->fmt && !input->format) {
+    input->format = input->fmt->iformat;
+  }
+  close_audio_input(input);
+  if (at_segment_boundary(buffer)) {
+    rebase_at_boundary(buffer);
+  }
+  buffer->keep_all = 1;
+
+  int ret = open_input_demuxer(buffer, input->format, &input->avio, &input->fmt);
+  if (ret < 0) {
+    return ret;
+  }
+  buffer->keep_all = 0;
+
+  int index = av_find_best_stream(input->fmt, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+  if (index < 0) {
+    close_audio_input(input);
+    return index;
+  }
+  AVStream *stream = input->fmt->streams[index];
+  if (ctx->audio_codec && stream->codecpar->codec_id == ctx->audio_codec->codec_id) {
+    ctx->audio_stream_index = index;
+    ctx->audio_time_base = stream->time_base;
+    ret = stash_new_extradata(ctx, 1, stream->codecpar);
+  } else {
+    ret = open_audio_decoder(ctx, stream, index);
+  }
+  if (ret < 0) {
+    close_audio_input(input);
+    return ret;
+  }
+  for (unsigned int i = 0; i < input->fmt->nb_streams; i++) {
+    input->fmt->streams[i]->discard = (int)i == index ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+  }
+  input->stream_index = index;
+  input->reopen = 0;
+  return 0;
+}
+
+// Feed one packet of the separate audio rendition to the audio decoder,
+// staying level with the main demuxer so neither buffer runs far ahead.
+// 1 = fed (or skipped) a packet, 0 = nothing to do until more data arrives.
+static int pump_audio_input(FFmpegWasmContext *ctx) {
+  AudioInput *input = ctx->audio_input;
+  if (!ctx->audio_enabled || !ctx->audio_codec || ctx->audio_flush_sent) {
+    return 0;
+  }
+  if (input->reopen) {
+    int ret = reopen_audio_input(ctx);
+    if (ret < 0) {
+      return ret == AVERROR(EAGAIN) ? 0 : ret;
+    }
+  }
+  if (!ctx->draining && ctx->video_codec && input->last_seconds >= 0.0 &&
+      input->last_seconds > ctx->flow.demuxed_seconds) {
+    return 0;
+  }
+
+  int ret = av_read_frame(input->fmt, ctx->packet);
+  if (ret == AVERROR_EOF) {
+    if (at_segment_boundary(&input->buffer)) {
+      input->reopen = 1;
+      return 1;
+    }
+    input->eof = 1;
+    ctx->audio_flush_sent = 1;
+    avcodec_send_packet(ctx->audio_codec, NULL);
+    return 1;
+  }
+  if (ret == AVERROR(EAGAIN)) {
+    return 0;
+  }
+  if (ret < 0) {
+    return ret;
+  }
+  if (ctx->packet->stream_index != input->stream_index) {
+    av_packet_unref(ctx->packet);
+    return 1;
+  }
+  int64_t ts = ctx->packet->dts != AV_NOPTS_VALUE ? ctx->packet->dts : ctx->packet->pts;
+  if (ts != AV_NOPTS_VALUE) {
+    input->last_seconds = ts * av_q2d(ctx->audio_time_base);
+  }
+  attach_new_extradata(ctx, 1, ctx->packet);
+  ret = avcodec_send_packet(ctx->audio_codec, ctx->packet);
+  av_packet_unref(ctx->packet);
+  if (ret < 0 && ret != AVERROR(EAGAIN)) {
+    return ret;
+  }
+  return 1;
+}
+
+// Open-state cache: the format, codec parameters, extradata, duration and
+// keyframe index of an opened input, serialized so reopening the same file
+// skips probing and rediscovering its seek structure. Values are in host byte
+// order; a blob is only read back by the build that wrote it.
+
+typedef struct StateWriter {
+  uint8_t *data;
+  size_t size;
+  size_t capacity;
+  int error;
+} StateWriter;
+
+typedef struct StateReader {
+  const uint8_t *data;
+  size_t size;
+  size_t pos;
+  int error;
+} StateReader;
+
+static void state_put(StateWriter *w, const void *src, size_t len) {
+  if (w->error) {
+    return;
+  }
+  if (w->size + len > w->capacity) {
+    size_t capacity = w->capacity ? w->capacity : 4096;
+    while (capacity < w->size + len) {
+      capacity *= 2;
+    }
+    uint8_t *data = av_realloc(w->data, capacity);
+    if (!data) {
+      w->error = AVERROR(ENOMEM);
+      return;
+    }
+    w->data = data;
+    w->capacity = capacity;
+  }
+  memcpy(w->data + w->size, src, len);
+  w->size += len;
+}
+
+static void state_put_i32(StateWriter *w, int32_t value) {
+  state_put(w, &value, sizeof(value));
+}
+
+static void state_put_i64(StateWriter *w, int64_t value) {
+  state_put(w, &value, sizeof(value));
+}
+
+static void state_put_bytes(StateWriter *w, const void *src, int len) {
+  state_put_i32(w, len);
+  if (len > 0) {
+    state_put(w, src, (size_t)len);
+  }
+}
+
+static const uint8_t *state_get(StateReader *r, size_t len) {
+  if (r->error || len > r->size - r->pos) {
+    r->error = AVERROR_INVALIDDATA;
+    return NULL;
+  }
+  const uint8_t *p = r->data + r->pos;
+  r->pos += len;
+  return p;
+}
+
+static int32_t state_get_i32(StateReader *r) {
+  int32_t value = 0;
+  const uint8_t *p = state_get(r, sizeof(value));
+  if (p) {
+    memcpy(&value, p, sizeof(value));
+  }
+  return value;
+}
+
+static int64_t state_get_i64(StateReader *r) {
+  int64_t value = 0;
+  const uint8_t *p = state_get(r, sizeof(value));
+  if (p) {
+    memcpy(&value, p, sizeof(value));
+  }
+  return value;
+}
+
+static const uint8_t *state_get_bytes(StateReader *r, int *len) {
+  *len = state_get_i32(r);
+  if (*len < 0) {
+    r->error = AVERROR_INVALIDDATA;
+    *len = 0;
+  }
+  return *len > 0 ? state_get(r, (size_t)*len) : NULL;
+}
+
+static void state_put_stream(StateWriter *w, AVStream *st) {
+  const AVCodecParameters *par = st->codecpar;
+  state_put_i32(w, par->codec_type);
+  state_put_i32(w, par->codec_id);
+  state_put_i32(w, par->format);
+  state_put_i64(w, par->bit_rate);
+  state_put_i32(w, par->width);
+  state_put_i32(w, par->height);
+  state_put_i32(w, par->sample_aspect_ratio.num);
+  state_put_i32(w, par->sample_aspect_ratio.den);
+  state_put_i32(w, par->field_order);
+  state_put_i32(w, par->color_range);
+  state_put_i32(w, par->color_primaries);
+  state_put_i32(w, par->color_trc);
+  state_put_i32(w, par->color_space);
+  state_put_i32(w, par->chroma_location);
+  state_put_i32(w, par->video_delay);
+  state_put_i32(w, par->sample_rate);
+  state_put_i32(w, par->ch_layout.order == AV_CHANNEL_ORDER_NATIVE);
+  state_put_i32(w, par->ch_layout.nb_channels);
+  state_put_i64(w, par->ch_layout.order == AV_CHANNEL_ORDER_NATIVE ? (int64_t)par->ch_layout.u.mask : 0);
+  state_put_i32(w, par->frame_size);
+  state_put_i32(w, par->profile);
+  state_put_i32(w, par->level);
+  state_put_bytes(w, par->extradata, par->extradata_size);
+  state_put_i32(w, st->time_base.num);
+  state_put_i32(w, st->time_base.den);
+  state_put_i64(w, st->start_time);
+  state_put_i64(w, st->duration);
+
+  int count = avformat_index_get_entries_count(st);
+  int keyframes = 0;
+  for (int i = 0; i < count; i++) {
+    const AVIndexEntry *entry = avformat_index_get_entry(st, i);
+    keyframes += entry && (entry->flags & AVINDEX_KEYFRAME);
+  }
+  int step = (keyframes + OPEN_STATE_MAX_INDEX - 1) / OPEN_STATE_MAX_INDEX;
+  if (step < 1) {
+    step = 1;
+  }
+  state_put_i32(w, (keyframes + step - 1) / step);
+  for (int i = 0, k = 0; i < count; i++) {
+    const AVIndexEntry *entry = avformat_index_get_entry(st, i);
+    if (!entry || !(entry->flags & AVINDEX_KEYFRAME) || k++ % step) {
+      continue;
+    }
+    state_put_i64(w, entry->pos);
+    state_put_i64(w, entry->timestamp);
+    state_put_i32(w, entry->size);
+    state_put_i32(w, entry->min_distance);
+  }
+}
+
+// Fills what the demuxer left unknown; a stream whose codec changed means
+// the blob belongs to another file
+static int state_apply_stream(StateReader *r, AVStream *st) {
+  AVCodecParameters *par = st->codecpar;
+  int codec_type = state_get_i32(r);
+  int codec_id = state_get_i32(r);
+  if (r->error || codec_type != (int)par->codec_type || codec_id != (int)par->codec_id) {
+    return AVERROR_INVALIDDATA;
+  }
+  int format = state_get_i32(r);
+  int64_t bit_rate = state_get_i64(r);
+  int width = state_get_i32(r);
+  int height = state_get_i32(r);
+  AVRational sar;
+  sar.num = state_get_i32(r);
+  sar.den = state_get_i32(r);
+  int field_order = state_get_i32(r);
+  int color_range = state_get_i32(r);
+  int color_primaries = state_get_i32(r);
+  int color_trc = state_get_i32(r);
+  int color_space = state_get_i32(r);
+  int chroma_location = state_get_i32(r);
+  int video_delay = state_get_i32(r);
+  int sample_rate = state_get_i32(r);
+  int native_layout = state_get_i32(r);
+  int nb_channels = state_get_i32(r);
+  uint64_t channel_mask = (uint64_t)state_get_i64(r);
+  int frame_size = state_get_i32(r);
+  int profile = state_get_i32(r);
+  int level = state_get_i32(r);
+  int extradata_size = 0;
+  const uint8_t *extradata = state_get_bytes(r, &extradata_size);
+  AVRational time_base;
+  time_base.num = state_get_i32(r);
+  time_base.den = state_get_i32(r);
+  int64_t start_time = state_get_i64(r);
+  int64_t duration = state_get_i64(r);
+  int entries = state_get_i32(r);
+  if (r->error || entries < 0) {
+    return AVERROR_INVALIDDATA;
+  }
+
+  if (par->format < 0) {
+    par->format = format;
+  }
+  if (!par->bit_rate) {
+    par->bit_rate = bit_rate;
+  }
+  if (!par->width || !par->height) {
+    par->width = width;
+    par->height = height;
+  }
+  if (!par->sample_aspect_ratio.num) {
+    par->sample_aspect_ratio = sar;
+  }
+  if (par->field_order == AV_FIELD_UNKNOWN) {
+    par->field_order = field_order;
+  }
+  if (par->color_range == AVCOL_RANGE_UNSPECIFIED) {
+    par->color_range = color_range;
+  }
+  if (par->color_primaries == AVCOL_PRI_UNSPECIFIED) {
+    par->color_primaries = color_primaries;
+  }
+  if (par->color_trc == AVCOL_TRC_UNSPECIFIED) {
+    par->color_trc = color_trc;
+  }
+  if (par->color_space == AVCOL_SPC_UNSPECIFIED) {
+    par->color_space = color_space;
+  }
+  if (par->chroma_location == AVCHROMA_LOC_UNSPECIFIED) {
+    par->chroma_location = chroma_location;
+  }
+  if (!par->video_delay) {
+    par->video_delay = video_delay;
+  }
+  if (!par->sample_rate) {
+    par->sample_rate = sample_rate;
+  }
+  if (!par->ch_layout.nb_channels && nb_channels > 0) {
+    if (native_layout) {
+      av_channel_layout_from_mask(&par->ch_layout, channel_mask);
+    } else {
+      av_channel_layout_default(&par->ch_layout, nb_channels);
+    }
+  }
+  if (!par->frame_size) {
+    par->frame_size = frame_size;
+  }
+  if (par->profile == AV_PROFILE_UNKNOWN) {
+    par->profile = profile;
+  }
+  if (par->level == AV_LEVEL_UNKNOWN) {
+    par->level = level;
+  }
+  if (!par->extradata_size && extradata_size > 0) {
+    par->extradata = av_mallocz((size_t)extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (!par->extradata) {
+      return AVERROR(ENOMEM);
+    }
+    memcpy(par->extradata, extradata, (size_t)extradata_size);
+    par->extradata_size = extradata_size;
+  }
+
+  // Index timestamps are only meaningful in the time base they were saved in
+  int same_base = av_cmp_q(time_base, st->time_base) == 0;
+  if (same_base && st->start_time == AV_NOPTS_VALUE) {
+    st->start_time = start_time;
+  }
+  if (same_base && st->duration == AV_NOPTS_VALUE) {
+    st->duration = duration;
+  }
+  int fill_index = same_base && avformat_index_get_entries_count(st) == 0;
+  for (int i = 0; i < entries; i++) {
+    int64_t pos = state_get_i64(r);
+    int64_t timestamp = state_get_i64(r);
+    int size = state_get_i32(r);
+    int min_distance = state_get_i32(r);
+    if (r->error) {
+      return AVERROR_INVALIDDATA;
+    }
+    if (fill_index) {
+      av_add_index_entry(st, pos, timestamp, size, min_distance, AVINDEX_KEYFRAME);
+    }
+  }
+  return 0;
+}
+
+// Format name of a cached state, or NULL when it is not a valid blob
+static const AVInputFormat *open_state_format(const FFmpegWasmContext *ctx) {
+  StateReader r = {ctx->open_state, (size_t)ctx->open_state_size, 0, 0};
+  if (state_get_i32(&r) != OPEN_STATE_MAGIC || state_get_i32(&r) != OPEN_STATE_VERSION) {
+    return NULL;
+  }
+  int len = 0;
+  const uint8_t *name = state_get_bytes(&r, &len);
+  char format_name[64];
+  if (!name || len >= (int)sizeof(format_name)) {
+    return NULL;
+  }
+  memcpy(format_name, name, (size_t)len);
+  format_name[len] = '\0';
+  return av_find_input_format(format_name);
+}
+
+static int apply_open_state(FFmpegWasmContext *ctx) {
+  StateReader r = {ctx->open_state, (size_t)ctx->open_state_size, 0, 0};
+  state_get_i32(&r);  // Magic and version, checked by open_state_format
+  state_get_i32(&r);
+  int len = 0;
+  state_get_bytes(&r, &len);
+  state_get_i64(&r);  // header_end, recomputed by this open
+  int64_t duration = state_get_i64(&r);
+  int nb_streams = state_get_i32(&r);
+  if (r.error || nb_streams != (int)ctx->fmt->nb_streams) {
+    return AVERROR_INVALIDDATA;
+  }
+  for (int i = 0; i < nb_streams; i++) {
+    int ret = state_apply_stream(&r, ctx->fmt->streams[i]);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+  if (ctx->fmt->duration == AV_NOPTS_VALUE || ctx->fmt->duration <= 0) {
+    ctx->fmt->duration = duration;
+  }
+  return 0;
+}
+
+static void mark_opened(FFmpegWasmContext *ctx) {
+  ctx->opened = 1;
+  flow_reset(ctx);
+  av_freep(&ctx->open_state);
+  ctx->open_state_size = 0;
+  ctx->draining = 0;
+  ctx->video_eof = 0;
+  ctx->audio_eof = 0;
+  ctx->video_flush_sent = 0;
+  ctx->audio_flush_sent = 0;
+
+  // Now that file is opened, enable seeking for playback
+  // seek_stream will return -1 if position is outside buffered range
+  if (ctx->avio && ctx->live_target <= 0.0) {
+    ctx->avio->seekable = AVIO_SEEKABLE_NORMAL;
+  }
+
+  // Allow buffer compaction now that open succeeded
+  ctx->buffer.keep_all = 0;
+}
+
+// Remux-only open: pick streams without requiring a decoder in this build,
+// since the browser does the decoding.
+static int open_remux_streams(FFmpegWasmContext *ctx) {
+  int video = av_find_best_stream(ctx->fmt, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+  int audio = av_find_best_stream(ctx->fmt, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+  if (video < 0 && audio < 0) {
+    return AVERROR_STREAM_NOT_FOUND;
+  }
+  ctx->video_stream_index = video >= 0 ? video : -1;
+  ctx->audio_stream_index = audio >= 0 ? audio : -1;
+  if (video >= 0) {
+    ctx->video_time_base = ctx->fmt->streams[video]->time_base;
+  }
+  if (audio >= 0) {
+    ctx->audio_time_base = ctx->fmt->streams[audio]->time_base;
+  }
+  ctx->packet = av_packet_alloc();
+  return ctx->packet ? 0 : AVERROR(ENOMEM);
+}
+
+// A decoder set up for par could be this one: same codec, extradata and the
+// parameters that shape its output
+static int decoder_matches(const AVCodecContext *codec, const AVCodecParameters *par) {
+  if (!codec || codec->codec_id != par->codec_id || codec->extradata_size != par->extradata_size ||
+      (par->extradata_size > 0 && memcmp(codec->extradata, par->extradata, par->extradata_size))) {
+    return 0;
+  }
+  if (par->codec_type == AVMEDIA_TYPE_VIDEO) {
+    return codec->width == par->width && codec->height == par->height &&
+           (int)codec->pix_fmt == par->format && codec->profile == par->profile;
+  }
+  return codec->sample_rate == par->sample_rate && (int)codec->sample_fmt == par->format &&
+         !av_channel_layout_compare(&codec->ch_layout, &par->ch_layout);
+}
+
+// reuse: the playlist item playing before this one (ffmpeg_wasm_preload).
+// Streams its decoders match are left without one here and marked in adopt;
+// ffmpeg_wasm_handoff moves them over.
+static int open_input(FFmpegWasmContext *ctx, const char *format_name, const FFmpegWasmContext *reuse) {
+  ctx->missing_modules[0] = '\0';
+
+  ctx->buffer.read_pos = 0;
+  ctx->buffer.cold = 0;
+  if (ctx->range) {
+    ctx->range->pos = 0;
+  }
+
+  const int avio_buffer_size = 32 * 1024;
+  uint8_t *avio_buffer = av_malloc(avio_buffer_size);
+  if (!avio_buffer) {
+    return AVERROR(ENOMEM);
+  }
+
+  ctx->avio = ctx->range ? avio_alloc_context(avio_buffer, avio_buffer_size, 0, ctx->range,
+                                              range_read, NULL, range_seek)
+                         : avio_alloc_context(avio_buffer, avio_buffer_size, 0, &ctx->buffer,
+                                              read_packet, NULL, seek_stream);
+  if (!ctx->avio) {
+    av_free(avio_buffer);
+    return AVERROR(ENOMEM);
+  }
+  // Disable seeking during open to prevent FFmpeg from seeking to find
+  // container metadata that isn't buffered yet. We'll enable it later
+  // once the file is opened and we can handle seek failures gracefully.
+  // A range source can fetch any offset, so it may seek from the start.
+  ctx->avio->seekable = ctx->range ? AVIO_SEEKABLE_NORMAL : 0;
+
+  ctx->fmt = avformat_alloc_context();
+  if (!ctx->fmt) {
+    reset_decoder(ctx);
+    return AVERROR(ENOMEM);
+  }
+
+  ctx->fmt->pb = ctx->avio;
+  ctx->fmt->flags |= AVFMT_FLAG_CUSTOM_IO;
+  ctx->fmt->flags |= AVFMT_FLAG_NONBLOCK;
+  if (ctx->live_target > 0.0) {
+    // Start on the first PAT/PMT instead of probing a few MB of backlog
+    ctx->fmt->probesize = LIVE_PROBESIZE;
+    ctx->fmt->format_probesize = LIVE_PROBESIZE;
+    ctx->fmt->max_analyze_duration = LIVE_ANALYZE_US;
+  }
+
+  // A cached open state names the format, so nothing is probed
+  const AVInputFormat *input_format = ctx->open_state ? open_state_format(ctx) : NULL;
+  if (!input_format && format_name && format_name[0]) {
+    input_format = av_find_input_format(format_name);
+  }
+
+  int ret = avformat_open_input(&ctx->fmt, NULL, input_format, NULL);
+  if (ret < 0) {
+    reset_decoder(ctx);
+    return ret;
+  }
+  ctx->header_end = avio_tell(ctx->avio);
+  if (ctx->open_state) {
+    ret = apply_open_state(ctx);
+    if (ret == AVERROR(ENOMEM)) {
+      reset_decoder(ctx);
+      return ret;
+    }
+    ctx->state_applied = ret >= 0;
+    if (ret < 0) {
+      av_freep(&ctx->open_state);  // Another file's state; open as usual
+      ctx->open_state_size = 0;
+    }
+  }
+
+  if (ctx->remux_only) {
+    ret = open_remux_streams(ctx);
+    if (ret < 0) {
+      reset_decoder(ctx);
+      return ret;
+    }
+    mark_opened(ctx);
+    return 0;
+  }
+
+  // No video (or only cover art): audio-only playback without a video decoder
+  int video_index = find_video_stream(ctx);
+  if (video_index >= 0 && reuse && decoder_matches(reuse->video_codec, ctx->fmt->streams[video_index]->codecpar)) {
+    ctx->video_stream_index = video_index;
+    ctx->video_time_base = ctx->fmt->streams[video_index]->time_base;
+    ctx->adopt |= PRELOAD_VIDEO;
+  } else if (video_index >= 0) {
+    ret = reopen_video_stream(ctx, video_index);
+    if (ret < 0 && ret != FFMPEG_WASM_ERROR_NEED_MODULE) {
+      reset_decoder(ctx);
+      return ret;
+    }
+  }
+  discard_unused_video(ctx);
+
+  // Split builds report every module the default streams need in one go
+  const AVCodec *audio_decoder = NULL;
+  int audio_index = av_find_best_stream(ctx->fmt, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+  if (audio_index >= 0) {
+    audio_decoder = find_decoder(ctx, ctx->fmt->streams[audio_index]->codecpar->codec_id);
+  }
+  if (audio_index >= 0 && !audio_decoder && !ctx->missing_modules[0]) {
+    audio_index = av_find_best_stream(ctx->fmt, AVMEDIA_TYPE_AUDIO, -1, -1, &audio_decoder, 0);
+  }
+  if (ctx->missing_modules[0]) {
+    reset_decoder(ctx);
+    return FFMPEG_WASM_ERROR_NEED_MODULE;
+  }
+  if (audio_index >= 0 && audio_decoder && reuse &&
+      decoder_matches(reuse->audio_codec, ctx->fmt->streams[audio_index]->codecpar)) {
+    ctx->audio_stream_index = audio_index;
+    ctx->audio_time_base = ctx->fmt->streams[audio_index]->time_base;
+    ctx->adopt |= PRELOAD_AUDIO;
+  } else if (audio_index >= 0 && audio_decoder) {
+    ctx->audio_stream_index = audio_index;
+    AVStream *audio_stream = ctx->fmt->streams[ctx->audio_stream_index];
+    ctx->audio_time_base = audio_stream->time_base;
+
+    ctx->audio_codec = avcodec_alloc_context3(audio_decoder);
+    if (!ctx->audio_codec) {
+      reset_decoder(ctx);
+      return AVERROR(ENOMEM);
+    }
+
+    ret = avcodec_parameters_to_context(ctx->audio_codec, audio_stream->codecpar);
+    if (ret < 0) {
+      reset_decoder(ctx);
+      return ret;
+    }
+
+    ctx->audio_codec->thread_count = 1;
+    ctx->audio_codec->thread_type = 0;
+    attach_memory_hooks(ctx, ctx->audio_codec);
+
+    ret = avcodec_open2(ctx->audio_codec, audio_decoder, NULL);
+    if (ret < 0) {
+      reset_decoder(ctx);
+      return ret;
+    }
+  }
+
+  if (!ctx->video_codec && !ctx->audio_codec && !ctx->adopt) {
+    reset_decoder(ctx);
+    return video_index >= 0 ? AVERROR_DECODER_NOT_FOUND : AVERROR_STREAM_NOT_FOUND;
+  }
+
+  ctx->packet = av_packet_alloc();
+  ctx->video_frame = av_frame_alloc();
+  ctx->audio_frame = av_frame_alloc();
+  if (!ctx->packet || !ctx->video_frame || !ctx->audio_frame) {
+    reset_decoder(ctx);
+    return AVERROR(ENOMEM);
+  }
+
+  if (ctx->audio_input) {
+    ret = reopen_audio_input(ctx);
+    if (ret < 0) {
+      reset_decoder(ctx);
+      return ret;
+    }
+  }
+
+  mark_opened(ctx);
+  if (!ctx->video_codec && !(ctx->adopt & PRELOAD_VIDEO)) {
+    ctx->video_eof = 1;
+    ctx->video_flush_sent = 1;
+  }
+  return 0;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_open(uintptr_t handle, const char *format_name) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx) {
+    return AVERROR(EINVAL);
+  }
+  if (ctx->opened) {
+    return 0;
+  }
+  return open_input(ctx, format_name, NULL);
+}
+
+EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_duration_seconds(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->fmt) {
+    return 0.0;
+  }
+  if (ctx->fmt->duration != AV_NOPTS_VALUE && ctx->fmt->duration > 0) {
+    return ctx->fmt->duration / (double)AV_TIME_BASE;
+  }
+
+  double best = 0.0;
+  for (unsigned int i = 0; i < ctx->fmt->nb_streams; i++) {
+    AVStream *stream = ctx->fmt->streams[i];
+    if (!stream) {
+      continue;
+    }
+    if (stream->duration == AV_NOPTS_VALUE || stream->duration <= 0) {
+      continue;
+    }
+    double seconds = stream->duration * av_q2d(stream->time_base);
+    if (seconds > best) {
+      best = seconds;
+    }
+  }
+  return best;
+}
+
+// Decoders continue from a new demux position (seek, cached seek)
+static void restart_decoding(FFmpegWasmContext *ctx) {
+  clock_reset(&ctx->clock);
+  ctx->primed = 0;
+  ctx->gop.follows = 0;
+  if (ctx->video_codec) {
+    avcodec_flush_buffers(ctx->video_codec);
+  }
+  if (ctx->audio_codec) {
+    avcodec_flush_buffers(ctx->audio_codec);
+  }
+  video_filter_reset(ctx);
+
+  ctx->draining = 0;
+  ctx->video_eof = 0;
+  ctx->audio_eof = 0;
+  ctx->video_flush_sent = 0;
+  ctx->audio_flush_sent = 0;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_seek_seconds(uintptr_t handle, double seconds) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->fmt || !ctx->opened) {
+    return AVERROR(EINVAL);
+  }
+  if (ctx->live_target > 0.0) {
+    return AVERROR(ESPIPE);
+  }
+
+  if (seconds < 0.0) {
+    seconds = 0.0;
+  }
+  int64_t target = (int64_t)(seconds * AV_TIME_BASE);
+  packet_cache_clear(ctx);
+  // Allow seeking to a keyframe before or at the target, but not after.
+  // This ensures we don't overshoot and end up at a random future position.
+  int ret = avformat_seek_file(ctx->fmt, -1, INT64_MIN, target, target, 0);
+  if (ret < 0) {
+    return ret;
+  }
+  flow_reset(ctx);
+  restart_decoding(ctx);
+  return 0;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_set_packet_cache(uintptr_t handle, double max_seconds, double max_bytes) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx) {
+    return AVERROR(EINVAL);
+  }
+  ctx->packets.max_seconds = max_seconds > 0.0 ? max_seconds : 0.0;
+  ctx->packets.max_bytes = max_seconds > 0.0 ? clamp_size(max_bytes) : 0;
+  if (ctx->packets.max_bytes == 0) {
+    packet_cache_clear(ctx);
+  } else {
+    packet_cache_trim(ctx, ctx->packets.max_bytes);
+  }
+  return 0;
+}
+
+// The demuxer stays where it is: replay runs up to the newest cached packet
+// and reading the input continues from there
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_seek_cached(uintptr_t handle, double seconds) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->fmt || !ctx->opened) {
+    return AVERROR(EINVAL);
+  }
+  PacketCache *cache = &ctx->packets;
+  if (seconds < 0.0) {
+    seconds = 0.0;
+  }
+  if (ctx->trick_play || cache->count == 0 || seconds > cache->end_seconds) {
+    return 0;
+  }
+  int start = -1;
+  for (int i = 0; i < cache->count; i++) {
+    const CachedPacket *entry = packet_cache_at(cache, i);
+    if (entry->key && entry->seconds <= seconds) {
+      start = i;
+    }
+  }
+  if (start < 0) {
+    return 0;
+  }
+  cache->replay = start;
+  restart_decoding(ctx);
+  ctx->flow.played_seconds = -1.0;  // demuxed_seconds is still the input's
+  return 1;
+}
+
+// Prepare for re-streaming from a new byte offset.
+// Keeps format context and codecs intact, just flushes buffers and resets stream position.
+// JS should call this, then stream new data from file.slice(new_offset) (or,
+// for a range source, fetch from there).
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_prepare_restream(uintptr_t handle, double new_byte_offset) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->fmt || !ctx->opened) {
+    return AVERROR(EINVAL);
+  }
+
+  int64_t byte_pos = (int64_t)new_byte_offset;
+  packet_cache_clear(ctx);
+
+  // Flush codec buffers
+  if (ctx->video_codec) {
+    avcodec_flush_buffers(ctx->video_codec);
+  }
+  if (ctx->audio_codec) {
+    avcodec_flush_buffers(ctx->audio_codec);
+  }
+  video_filter_reset(ctx);
+
+  // Clear stream buffer but keep it allocated; a range cache keeps its bytes
+  // and only moves the read position
+  if (ctx->range) {
+    ctx->range->pos = byte_pos;
+  } else {
+    ctx->buffer.start = 0;
+    ctx->buffer.size = 0;
+    ctx->buffer.read_pos = 0;
+    ctx->buffer.cold = 0;
+    ctx->buffer.eof = 0;
+    ctx->buffer.offset = byte_pos;
+  }
+
+  flow_reset(ctx);
+
+  // Reset EOF/draining state
+  ctx->draining = 0;
+  ctx->video_eof = 0;
+  ctx->audio_eof = 0;
+  ctx->video_flush_sent = 0;
+  ctx->audio_flush_sent = 0;
+
+  // Tell FFmpeg's AVIO layer about the new position
+  // This is critical - without this, FFmpeg will try to read from the old position
+  if (ctx->avio) {
+    ctx->avio->pos = byte_pos;
+    // Clear any internal AVIO buffer
+    ctx->avio->buf_ptr = ctx->avio->buffer;
+    ctx->avio->buf_end = ctx->avio->buffer;
+  }
+
+  return 0;
+}
+
+// Serializes the open state (see apply_open_state) for ffmpeg_wasm_open_state_ptr/
+// _size. Call it late: the keyframe index grows as the input is read. Returns
+// the size in bytes.
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_save_open_state(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->fmt || !ctx->opened || ctx->audio_input || ctx->segment_format ||
+      ctx->live_target > 0.0) {
+    return AVERROR(EINVAL);
+  }
+  StateWriter w = {0};
+  state_put_i32(&w, OPEN_STATE_MAGIC);
+  state_put_i32(&w, OPEN_STATE_VERSION);
+  const char *name = ctx->fmt->iformat->name;
+  state_put_bytes(&w, name, (int)strlen(name));
+  state_put_i64(&w, ctx->header_end);
+  state_put_i64(&w, ctx->fmt->duration);
+  state_put_i32(&w, (int32_t)ctx->fmt->nb_streams);
+  for (unsigned int i = 0; i < ctx->fmt->nb_streams; i++) {
+    state_put_stream(&w, ctx->fmt->streams[i]);
+  }
+  if (w.error || w.size > INT_MAX) {
+    av_free(w.data);
+    return w.error ? w.error : AVERROR(ERANGE);
+  }
+  av_free(ctx->saved_state);
+  ctx->saved_state = w.data;
+  ctx->saved_state_size = (int)w.size;
+  return ctx->saved_state_size;
+}
+
+EMSCRIPTEN_KEEPALIVE uintptr_t ffmpeg_wasm_open_state_ptr(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx ? (uintptr_t)ctx->saved_state : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE size_t ffmpeg_wasm_open_state_size(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx ? (size_t)ctx->saved_state_size : 0;
+}
+
+// Input bytes the container header took; a cached reopen appends only these
+// before jumping to its resume position
+EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_header_end(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx && ctx->opened ? (double)ctx->header_end : -1.0;
+}
+
+// Hands a saved blob to the next open (before open; len 0 clears it). A blob
+// that does not match the input is dropped and the open proceeds as usual.
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_set_open_state(uintptr_t handle, const uint8_t *data, size_t len) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || ctx->opened || len > INT_MAX || (len > 0 && !data)) {
+    return AVERROR(EINVAL);
+  }
+  av_freep(&ctx->open_state);
+  ctx->open_state_size = 0;
+  if (len == 0) {
+    return 0;
+  }
+  ctx->open_state = av_malloc(len);
+  if (!ctx->open_state) {
+    return AVERROR(ENOMEM);
+  }
+  memcpy(ctx->open_state, data, len);
+  ctx->open_state_size = (int)len;
+  if (!open_state_format(ctx)) {
+    av_freep(&ctx->open_state);
+    ctx->open_state_size = 0;
+    return AVERROR_INVALIDDATA;
+  }
+  return 0;
+}
+
+// After an open from a cached state: restreams from the indexed keyframe at
+// or before seconds and returns its byte position; JS then appends the input
+// from there. Matroska/WebM only, whose index points at clusters the demuxer
+// can start on. Returns a negative AVERROR code (never a valid offset)
+// otherwise or without an entry; playback then continues from header_end.
+EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_resume_position(uintptr_t handle, double seconds) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->opened || !ctx->state_applied || ctx->range) {
+    return AVERROR(EINVAL);
+  }
+  if (!av_match_name("matroska", ctx->fmt->iformat->name)) {
+    return AVERROR(ENOSYS);
+  }
+  int index = ctx->video_stream_index >= 0 ? ctx->video_stream_index : ctx->audio_stream_index;
+  if (index < 0) {
+    return AVERROR_STREAM_NOT_FOUND;
+  }
+  AVStream *st = ctx->fmt->streams[index];
+  int64_t ts = av_rescale_q((int64_t)(seconds * AV_TIME_BASE), AV_TIME_BASE_Q, st->time_base);
+  int entry = av_index_search_timestamp(st, ts, AVSEEK_FLAG_BACKWARD);
+  const AVIndexEntry *keyframe = entry >= 0 ? avformat_index_get_entry(st, entry) : NULL;
+  if (!keyframe || keyframe->pos <= ctx->header_end) {
+    return AVERROR(ENOENT);
+  }
+  int ret = ffmpeg_wasm_prepare_restream(handle, (double)keyframe->pos);
+  if (ret >= 0) {
+    ret = ffmpeg_wasm_seek_seconds(handle, seconds);  // Lands on keyframe->pos, the buffer start
+  }
+  return ret < 0 ? ret : (double)keyframe->pos;
+}
+
+// Media buffered ahead of playback: what the demuxer has read past the last
+// frame handed out, plus the unread input converted at the observed bitrate.
+// -1 until both are known.
+static double flow_buffered_seconds(FFmpegWasmContext *ctx) {
+  double bitrate = flow_bitrate(ctx);
+  if (bitrate <= 0.0) {
+    return -1.0;
+  }
+  double demuxed = 0.0;
+  if (ctx->flow.demuxed_seconds >= 0.0 && ctx->flow.played_seconds >= 0.0 &&
+      ctx->flow.demuxed_seconds > ctx->flow.played_seconds) {
+    demuxed = ctx->flow.demuxed_seconds - ctx->flow.played_seconds;
+  }
+  return demuxed + ffmpeg_wasm_buffered_bytes((uintptr_t)ctx) * 8.0 / bitrate;
+}
+
+// Live: once more than live_target seconds are buffered ahead of playback,
+// drop packets until a video keyframe (any audio packet without video) with
+// at most half the target still unread, and restart the decoders there.
+static int live_drop_packet(FFmpegWasmContext *ctx, const AVPacket *pkt) {
+  if (!ctx->live_skipping) {
+    if (flow_buffered_seconds(ctx) <= ctx->live_target) {
+      return 0;
+    }
+    ctx->live_skipping = 1;
+    ctx->live_skips++;
+  }
+  int entry = ctx->video_codec ? pkt->stream_index == ctx->video_stream_index && (pkt->flags & AV_PKT_FLAG_KEY)
+                               : pkt->stream_index == ctx->audio_stream_index;
+  double unread = ffmpeg_wasm_buffered_bytes((uintptr_t)ctx) * 8.0 / flow_bitrate(ctx);
+  if (!entry || unread > ctx->live_target / 2.0) {
+    return 1;
+  }
+  ctx->live_skipping = 0;
+  if (ctx->video_codec) {
+    avcodec_flush_buffers(ctx->video_codec);
+  }
+  if (ctx->audio_codec) {
+    avcodec_flush_buffers(ctx->audio_codec);
+  }
+  video_filter_reset(ctx);
+  ctx->flow.played_seconds = -1.0;  // Stale until the next frame goes out
+  return 0;
+}
+
+static int read_next_frame(FFmpegWasmContext *ctx) {
+  int ret = AVERROR(EAGAIN);
+  if (ctx->audio_enabled && ctx->audio_codec) {
+    ret = receive_audio_frame(ctx);
+    if (ret == 2) {
+      return 2;
+    }
+    if (ret < 0 && ret != AVERROR(EAGAIN)) {
+      return ret;
+    }
+  }
+
+  ret = receive_video_frame(ctx);
+  if (ret == 1) {
+    return 1;
+  }
+  if (ret < 0 && ret != AVERROR(EAGAIN)) {
+    return ret;
+  }
+
+  if (ctx->draining && (ctx->video_eof || !ctx->video_codec) &&
+      (ctx->audio_eof || !ctx->audio_codec || !ctx->audio_enabled)) {
+    return -1;
+  }
+
+  for (;;) {
+    int audio_fed = 1;
+    if (ctx->audio_input) {
+      audio_fed = pump_audio_input(ctx);
+      if (audio_fed < 0) {
+        return audio_fed;
+      }
+      ret = receive_audio_frame(ctx);
+      if (ret == 2) {
+        return 2;
+      }
+      if (ret < 0 && ret != AVERROR(EAGAIN)) {
+        return ret;
+      }
+    }
+    if (ctx->demux_reopen) {
+      ret = switch_main_demuxer(ctx);
+      if (ret == AVERROR(EAGAIN)) {
+        return 0;
+      }
+      if (ret < 0) {
+        return ret;
+      }
+    }
+
+    int replayed = packet_cache_next(ctx, ctx->packet);
+    if (replayed < 0) {
+      return replayed;
+    }
+    ret = replayed ? 0 : av_read_frame(ctx->fmt, ctx->packet);
+    if (ret == AVERROR_EOF && at_segment_boundary(&ctx->buffer)) {
+      ctx->demux_reopen = 1;
+      continue;
+    }
+    if (ret == AVERROR_EOF) {
+      // Flushed decoders give their remaining frames below, then EOF
+      ctx->draining = 1;
+      if (ctx->video_codec && !ctx->video_flush_sent) {
+        ctx->video_flush_sent = 1;
+        avcodec_send_packet(ctx->video_codec, NULL);
+      }
+      if (ctx->audio_enabled && ctx->audio_codec && !ctx->audio_flush_sent && !ctx->audio_input) {
+        ctx->audio_flush_sent = 1;
+        avcodec_send_packet(ctx->audio_codec, NULL);
+      }
+    } else if (ret == AVERROR(EAGAIN)) {
+      return 0;
+    } else if (ret < 0) {
+      return ret;
+    } else if (!replayed) {
+      flow_note_packet(ctx, ctx->packet);
+      if (ctx->live_target > 0.0 && live_drop_packet(ctx, ctx->packet)) {
+        av_packet_unref(ctx->packet);
+        continue;
+      }
+      packet_cache_add(ctx, ctx->packet);
+    }
+
+    if (ret < 0) {
+      // Draining: nothing to send
+    } else if (ctx->packet->stream_index == ctx->video_stream_index) {
+      attach_new_extradata(ctx, 0, ctx->packet);
+      ret = avcodec_send_packet(ctx->video_codec, ctx->packet);
+      av_packet_unref(ctx->packet);
+      if (ret == AVERROR(EAGAIN)) {
+        ret = receive_video_frame(ctx);
+        if (ret == 1) {
+          return 1;
+        }
+        if (ret < 0 && ret != AVERROR(EAGAIN)) {
+          return ret;
+        }
+      } else if (ret < 0) {
+        return ret;
+      }
+    } else if (ctx->packet->stream_index == ctx->audio_stream_index && !ctx->audio_input) {
+      if (ctx->audio_enabled && ctx->audio_codec) {
+        attach_new_extradata(ctx, 1, ctx->packet);
+        ret = avcodec_send_packet(ctx->audio_codec, ctx->packet);
+        av_packet_unref(ctx->packet);
+        if (ret == AVERROR(EAGAIN)) {
+          ret = receive_audio_frame(ctx);
+          if (ret == 2) {
+            return 2;
+          }
+          if (ret < 0 && ret != AVERROR(EAGAIN)) {
+            return ret;
+          }
+        } else if (ret < 0) {
+          return ret;
+        }
+      } else {
+        av_packet_unref(ctx->packet);
+      }
+    } else if (ctx->packet->stream_index == ctx->subtitle_stream_index) {
+      if (ctx->subtitles_enabled && ctx->subtitle_codec) {
+        process_subtitle_packet(ctx, ctx->packet);
+      }
+      av_packet_unref(ctx->packet);
+    } else {
+      av_packet_unref(ctx->packet);
+    }
+
+    if (ctx->audio_enabled && ctx->audio_codec) {
+      ret = receive_audio_frame(ctx);
+      if (ret == 2) {
+        return 2;
+      }
+      if (ret < 0 && ret != AVERROR(EAGAIN)) {
+        return ret;
+      }
+    }
+
+    ret = receive_video_frame(ctx);
+    if (ret == 1) {
+      return 1;
+    }
+    if (ret < 0 && ret != AVERROR(EAGAIN)) {
+      return ret;
+    }
+
+    if (ctx->draining && (ctx->video_eof || !ctx->video_codec) &&
+        (ctx->audio_eof || !ctx->audio_codec || !ctx->audio_enabled)) {
+      return -1;
+    }
+    if (ctx->draining && !audio_fed) {
+      return 0;  // Only the audio rendition is left, and it needs data
+    }
+  }
+}
+
+// Fill ctx->desc from the frame just produced, so JS reads one struct
+// instead of calling the getters below
+static void describe_video(FFmpegWasmContext *ctx) {
+  FFmpegWasmFrameDesc *desc = &ctx->desc;
+  const AVFrame *frame = ctx->video_frame;
+  desc->pts = ffmpeg_wasm_frame_pts_seconds((uintptr_t)ctx);
+  desc->width = frame && frame->width > 0 ? frame->width : ffmpeg_wasm_video_width((uintptr_t)ctx);
+  desc->height = frame && frame->height > 0 ? frame->height : ffmpeg_wasm_video_height((uintptr_t)ctx);
+  desc->format = frame ? frame->format : AV_PIX_FMT_NONE;
+  desc->flags = ctx->subtitles_enabled ? FFMPEG_WASM_FRAME_SUBTITLES_ENABLED : 0;
+  if (frame && (frame->flags & AV_FRAME_FLAG_KEY)) {
+    desc->flags |= FFMPEG_WASM_FRAME_KEY;
+  }
+  if (frame && (frame->flags & AV_FRAME_FLAG_INTERLACED)) {
+    desc->flags |= FFMPEG_WASM_FRAME_INTERLACED;
+  }
+  for (int i = 0; i < 4; i++) {
+    desc->data[i] = frame ? (uint64_t)(uintptr_t)frame->data[i] : 0;
+    desc->linesize[i] = frame ? frame->linesize[i] : 0;
+  }
+  desc->color_primaries = frame ? frame->color_primaries : AVCOL_PRI_UNSPECIFIED;
+  desc->color_trc = frame ? frame->color_trc : AVCOL_TRC_UNSPECIFIED;
+  desc->colorspace = frame ? frame->colorspace : AVCOL_SPC_UNSPECIFIED;
+  desc->color_range = frame ? frame->color_range : AVCOL_RANGE_UNSPECIFIED;
+  // The RGBA buffer still holds the previous frame until present_frame
+  desc->rgba_data = 0;
+  desc->subtitle_status = 0;
+}
+
+static void describe_audio(FFmpegWasmContext *ctx) {
+  FFmpegWasmFrameDesc *desc = &ctx->desc;
+  desc->audio_pts = ctx->audio_pts_seconds;
+  desc->audio_data = (uint64_t)(uintptr_t)ctx->audio_data;
+  desc->audio_channels = ctx->audio_channels;
+  desc->audio_sample_rate = ctx->audio_sample_rate;
+  desc->audio_nb_samples = ctx->audio_data ? ctx->audio_nb_samples : 0;
+}
+
+// Keyframe-only scanning for high-speed trick play. Entering turns audio off
+// and makes the decoder drop non-key frames; leaving restores both. Seek
+// afterwards to resume regular decoding from the last shown keyframe.
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_set_trick_play(uintptr_t handle, int enabled) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->opened || !ctx->video_codec) {
+    return AVERROR(EINVAL);
+  }
+  enabled = enabled ? 1 : 0;
+  if (enabled == ctx->trick_play) {
+    return 0;
+  }
+  ctx->gop.follows = 0;
+  if (enabled) {
+    packet_cache_clear(ctx);  // trick_step moves the demuxer without caching
+    ctx->trick_saved_audio = ctx->audio_enabled;
+    ffmpeg_wasm_set_audio_enabled(handle, 0);
+    ctx->video_codec->skip_frame = AVDISCARD_NONKEY;
+  } else {
+    ctx->video_codec->skip_frame = AVDISCARD_DEFAULT;
+    ffmpeg_wasm_set_audio_enabled(handle, ctx->trick_saved_audio);
+  }
+  avcodec_flush_buffers(ctx->video_codec);
+  video_filter_reset(ctx);
+  flow_reset(ctx);
+  ctx->trick_play = enabled;
+  ctx->trick_pending = 0;
+  ctx->draining = 0;
+  ctx->video_eof = 0;
+  ctx->video_flush_sent = 0;
+  return 0;
+}
+
+// Decode the keyframe nearest target_seconds in the scan direction (>= 0
+// forward: at or after, < 0 reverse: at or before). Non-key packets never
+// reach the decoder. Returns 1 with the frame readable like a decoded one,
+// 0 = need data (call again with the same target), -1 = no keyframe left.
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_trick_step(uintptr_t handle, double target_seconds, int direction) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->trick_play || !ctx->video_codec || !ctx->packet) {
+    return AVERROR(EINVAL);
+  }
+  if (target_seconds < 0.0) {
+    target_seconds = 0.0;
+  }
+
+  if (!ctx->trick_pending || target_seconds != ctx->trick_target) {
+    int64_t target = (int64_t)(target_seconds * AV_TIME_BASE);
+    int ret = direction >= 0 ? avformat_seek_file(ctx->fmt, -1, target, target, INT64_MAX, 0)
+                             : avformat_seek_file(ctx->fmt, -1, INT64_MIN, target, target, 0);
+    if (ret < 0 && direction < 0) {
+      return ret;
+    }
+    // A failed forward seek (no index yet) just scans on from here
+    avcodec_flush_buffers(ctx->video_codec);
+    ctx->trick_target = target_seconds;
+    ctx->trick_pending = 1;
+  }
+
+  AVRational time_base = ctx->fmt->streams[ctx->video_stream_index]->time_base;
+  for (;;) {
+    int ret = av_read_frame(ctx->fmt, ctx->packet);
+    if (ret == AVERROR(EAGAIN)) {
+      return 0;
+    }
+    if (ret == AVERROR_EOF) {
+      ctx->trick_pending = 0;
+      return -1;
+    }
+    if (ret < 0) {
+      return ret;
+    }
+
+    AVPacket *pkt = ctx->packet;
+    int64_t pts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+    if (pkt->stream_index != ctx->video_stream_index || !(pkt->flags & AV_PKT_FLAG_KEY) ||
+        (direction >= 0 && pts != AV_NOPTS_VALUE && pts * av_q2d(time_base) < target_seconds)) {
+      av_packet_unref(pkt);
+      continue;
+    }
+
+    ret = avcodec_send_packet(ctx->video_codec, pkt);
+    av_packet_unref(pkt);
+    if (ret < 0 && ret != AVERROR_INVALIDDATA) {
+      return ret;
+    }
+    // Drain right away: with reordering delay the keyframe would otherwise
+    // only come out once the next one is sent.
+    avcodec_send_packet(ctx->video_codec, NULL);
+    av_frame_unref(ctx->video_frame);
+    ret = avcodec_receive_frame(ctx->video_codec, ctx->video_frame);
+    avcodec_flush_buffers(ctx->video_codec);
+    if (ret == 0) {
+      ctx->video_frame_serial++;
+      ctx->trick_pending = 0;
+      describe_video(ctx);
+      ctx->desc.type = FFMPEG_WASM_FRAME_VIDEO;
+      return 1;
+    }
+    if (ret != AVERROR_EOF && ret != AVERROR(EAGAIN) && ret != AVERROR_INVALIDDATA) {
+      return ret;
+    }
+    // Not decodable on its own (e.g. an open-GOP recovery point); try the next
+  }
+}
+
+static double frame_seconds(const FFmpegWasmContext *ctx, const AVFrame *frame) {
+  if (ctx->video_time_base.den == 0 || frame->best_effort_timestamp == AV_NOPTS_VALUE) {
+    return 0.0;
+  }
+  return frame->best_effort_timestamp * av_q2d(ctx->video_time_base);
+}
+
+// Copy a decoded frame into the GOP store, in pts order
+static int gop_cache_store(FFmpegWasmContext *ctx, const AVFrame *src) {
+  GopCache *gop = &ctx->gop;
+  int width = src->width;
+  int height = src->height;
+  if (gop->max_height > 0 && height > gop->max_height) {
+    width = (int)av_rescale(width, gop->max_height, height) & ~1;
+    height = gop->max_height & ~1;
+  }
+  if (gop->count == gop->capacity) {
+    int capacity = gop->capacity ? gop->capacity * 2 : 64;
+    GopFrame *frames = av_realloc_array(gop->frames, (size_t)capacity, sizeof(*frames));
+    if (!frames) {
+      return AVERROR(ENOMEM);
+    }
+    gop->frames = frames;
+    gop->capacity = capacity;
+  }
+
+  AVFrame *copy = av_frame_alloc();
+  if (!copy) {
+    return AVERROR(ENOMEM);
+  }
+  copy->format = src->format;
+  copy->width = width;
+  copy->height = height;
+  int ret = av_frame_get_buffer(copy, 0);
+  if (ret >= 0) {
+    ret = av_frame_copy_props(copy, src);
+  }
+  if (ret >= 0 && width == src->width && height == src->height) {
+    ret = av_frame_copy(copy, src);
+  } else if (ret >= 0) {
+    enum AVPixelFormat format = (enum AVPixelFormat)src->format;
+    gop->sws = sws_getCachedContext(gop->sws, src->width, src->height, format, width, height, format,
+                                    SWS_BILINEAR, NULL, NULL, NULL);
+    ret = gop->sws ? sws_scale(gop->sws, (const uint8_t *const *)src->data, src->linesize, 0, src->height,
+                               copy->data, copy->linesize)
+                   : AVERROR(ENOSYS);
+  }
+  if (ret < 0) {
+    av_frame_free(&copy);
+    return ret;
+  }
+
+  double seconds = frame_seconds(ctx, src);
+  int index = gop->count;
+  while (index > 0 && gop->frames[index - 1].seconds > seconds) {
+    index--;
+  }
+  memmove(gop->frames + index + 1, gop->frames + index, (size_t)(gop->count - index) * sizeof(*gop->frames));
+  GopFrame *entry = &gop->frames[index];
+  entry->frame = copy;
+  entry->seconds = seconds;
+  entry->bytes = sizeof(*copy) + (size_t)av_image_get_buffer_size((enum AVPixelFormat)copy->format, width, height, 1);
+  gop->bytes += entry->bytes;
+  gop->count++;
+  gop_cache_trim(ctx, gop->max_bytes);
+  return 0;
+}
+
+// Newest stored frame before seconds, -1 if none
+static int gop_cache_before(const GopCache *gop, double seconds) {
+  int index = gop->count - 1;
+  while (index >= 0 && gop->frames[index].seconds > seconds - GOP_PTS_EPSILON) {
+    index--;
+  }
+  return index;
+}
+
+// Oldest stored frame after seconds, -1 if none
+static int gop_cache_after(const GopCache *gop, double seconds) {
+  for (int i = 0; i < gop->count; i++) {
+    if (gop->frames[i].seconds > seconds + GOP_PTS_EPSILON) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static int gop_present(FFmpegWasmContext *ctx, int index) {
+  av_frame_unref(ctx->video_frame);
+  int ret = av_frame_ref(ctx->video_frame, ctx->gop.frames[index].frame);
+  if (ret < 0) {
+    return ret;
+  }
+  ctx->video_frame_serial++;
+  describe_video(ctx);
+  ctx->desc.type = FFMPEG_WASM_FRAME_VIDEO;
+  ctx->flow.played_seconds = ctx->desc.pts;
+  return 1;
+}
+
+// Restart decoding at the keyframe before target - seek_back: replayed from
+// the packet cache when it holds one, else through a demuxer seek. The store
+// starts over, so evicted frames are decoded again.
+static int gop_fill_start(FFmpegWasmContext *ctx, double target) {
+  GopCache *gop = &ctx->gop;
+  PacketCache *cache = &ctx->packets;
+  double limit = target - (gop->seek_back > GOP_PTS_EPSILON ? gop->seek_back : GOP_PTS_EPSILON);
+  gop_cache_clear(ctx);
+
+  int start = -1;
+  for (int i = 0; i < cache->count; i++) {
+    const CachedPacket *entry = packet_cache_at(cache, i);
+    if (entry->key && entry->seconds <= limit) {
+      start = i;
+    }
+  }
+  if (start >= 0) {
+    cache->replay = start;
+    restart_decoding(ctx);
+    gop->start_seconds = packet_cache_at(cache, start)->seconds;
+    gop->seeked = 0;
+  } else {
+    limit = limit > 0.0 ? limit : 0.0;
+    int ret = ffmpeg_wasm_seek_seconds((uintptr_t)ctx, limit);
+    if (ret < 0) {
+      return ret;
+    }
+    gop->start_seconds = limit;
+    gop->seeked = 1;
+  }
+  gop->filling = 1;
+  gop->follows = 1;  // Every frame decoded from here on is stored
+  gop->target = target;
+  return 0;
+}
+
+// Decode towards the fill target, storing every video frame. 1 = done (a
+// frame at or past the target, or the end of the stream), 0 = call again.
+// A seek that lands after start_seconds (slow-seek formats) is an error:
+// seeking further back would not land any closer.
+static int gop_fill_step(FFmpegWasmContext *ctx) {
+  GopCache *gop = &ctx->gop;
+  int decoded = 0;
+  for (;;) {
+    int ret = read_next_frame(ctx);
+    if (ret == 2) {
+      continue;  // Audio is off in this mode; nothing to keep
+    }
+    if (ret == -1) {
+      break;
+    }
+    if (ret <= 0) {
+      return ret;
+    }
+    double seconds = frame_seconds(ctx, ctx->video_frame);
+    if (gop->seeked && gop->count == 0 && gop->start_seconds > 0.0 &&
+        seconds > gop->start_seconds + GOP_PTS_EPSILON) {
+      gop->filling = 0;
+      return AVERROR(ERANGE);
+    }
+    ret = gop_cache_store(ctx, ctx->video_frame);
+    if (ret < 0) {
+      return ret;
+    }
+    if (seconds >= gop->target - GOP_PTS_EPSILON) {
+      break;
+    }
+    if (++decoded >= GOP_FRAMES_PER_CALL) {
+      return 0;
+    }
+  }
+  gop->filling = 0;
+  return 1;
+}
+
+// The decoder's next video frame, stored like the rest; only valid while it
+// follows on from the newest stored frame
+static int gop_decode_next(FFmpegWasmContext *ctx) {
+  int ret;
+  do {
+    ret = read_next_frame(ctx);
+  } while (ret == 2);
+  if (ret != 1) {
+    return ret;
+  }
+  ret = gop_cache_store(ctx, ctx->video_frame);
+  if (ret < 0) {
+    return ret;
+  }
+  describe_video(ctx);
+  ctx->desc.type = FFMPEG_WASM_FRAME_VIDEO;
+  ctx->flow.played_seconds = ctx->desc.pts;
+  return 1;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_set_gop_cache(uintptr_t handle, double max_bytes, int max_height) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx) {
+    return AVERROR(EINVAL);
+  }
+  max_height = max_height > 0 ? max_height : 0;
+  ctx->gop.max_bytes = clamp_size(max_bytes);
+  // Stored copies keep the size they were made at, so a new height drops them
+  if (ctx->gop.max_bytes == 0 || max_height != ctx->gop.max_height) {
+    ctx->gop.max_height = max_height;
+    gop_cache_clear(ctx);
+  } else {
+    gop_cache_trim(ctx, ctx->gop.max_bytes);
+  }
+  return 0;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_gop_step(uintptr_t handle, double seconds, int direction) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->opened || !ctx->video_codec || !ctx->video_frame || ctx->trick_play ||
+      ctx->live_target > 0.0 || ctx->gop.max_bytes == 0) {
+    return AVERROR(EINVAL);
+  }
+  GopCache *gop = &ctx->gop;
+  // A fill stops at the first frame at or past its target: the frame after
+  // seconds going forward
+  double target = direction > 0 ? seconds + 2.0 * GOP_PTS_EPSILON : seconds;
+  if (gop->filling && target != gop->target) {
+    gop->filling = 0;  // A new target; the old fill is abandoned
+  }
+
+  int ret;
+  if (!gop->filling) {
+    // The store is one contiguous run: inside it, neighbours are stored too
+    int inside = gop->count > 0 && seconds >= gop->frames[0].seconds - GOP_PTS_EPSILON &&
+                 seconds <= gop->frames[gop->count - 1].seconds + GOP_PTS_EPSILON;
+    int index = direction > 0 ? gop_cache_after(gop, seconds) : gop_cache_before(gop, seconds);
+    if (index >= 0 && inside) {
+      return gop_present(ctx, index);
+    }
+    if (direction > 0 && inside && gop->follows) {
+      return gop_decode_next(ctx);
+    }
+    gop->seek_back = 0.0;
+    ret = gop_fill_start(ctx, target);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+  ret = gop_fill_step(ctx);
+  if (ret <= 0) {
+    return ret;
+  }
+  int index = direction > 0 ? gop_cache_after(gop, seconds) : gop_cache_before(gop, seconds);
+  if (index >= 0) {
+    return gop_present(ctx, index);
+  }
+  if (direction > 0 || gop->start_seconds <= 0.0) {
+    return -1;  // The stream ended, or nothing decodes before seconds
+  }
+  // The keyframe found was not early enough (an inexact index); go further back
+  gop->seek_back = gop->seek_back > 0.0 ? gop->seek_back * 2.0 : 1.0;
+  ret = gop_fill_start(ctx, target);
+  return ret < 0 ? ret : 0;
+}
+
+// Audio-only: gather frames until audio_batch_samples so JS crosses the
+// boundary once per ~170 ms instead of once per codec frame.
+static int read_audio_batch(FFmpegWasmContext *ctx) {
+  ctx->audio_nb_samples = 0;
+  ctx->audio_batching = 1;
+  int ret;
+  do {
+    ret = read_next_frame(ctx);
+  } while (ret == 2 && ctx->audio_nb_samples < ctx->audio_batch_samples);
+  ctx->audio_batching = 0;
+  if (ctx->audio_nb_samples > 0 && ret >= -1) {
+    return 2;
+  }
+  return ret;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_read_frame(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->opened || !ctx->fmt || (!ctx->video_codec && !ctx->audio_codec)) {
+    return AVERROR(EINVAL);
+  }
+  int ret;
+  ctx->gop.follows = 0;
+  if (ctx->primed & (PRELOAD_AUDIO | PRELOAD_VIDEO)) {
+    // Decoded ahead by ffmpeg_wasm_preload; the audio came first in decode order
+    ret = ctx->primed & PRELOAD_AUDIO ? 2 : 1;
+    ctx->primed &= ret == 2 ? ~PRELOAD_AUDIO : ~PRELOAD_VIDEO;
+  } else {
+    ret = !ctx->video_codec && ctx->audio_batch_samples > 0 ? read_audio_batch(ctx) : read_next_frame(ctx);
+  }
+  if (ret == 1) {
+    describe_video(ctx);
+    ctx->flow.played_seconds = ctx->desc.pts;
+  } else if (ret == 2) {
+    describe_audio(ctx);
+    if (!ctx->video_codec) {
+      ctx->flow.played_seconds = ctx->audio_pts_seconds;
+    }
+  }
+  ctx->desc.type = ret == 1 ? FFMPEG_WASM_FRAME_VIDEO : ret == 2 ? FFMPEG_WASM_FRAME_AUDIO
+                                                                  : FFMPEG_WASM_FRAME_NONE;
+  return ret;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_read_video_frame(uintptr_t handle) {
+  for (;;) {
+    int ret = ffmpeg_wasm_read_frame(handle);
+    if (ret == 1 || ret <= 0) {
+      return ret;
+    }
+  }
+}
+
+// Playlist: prepares this context, fed from the start of the next item,
+// while current plays. The first call opens it; decoders of current whose
+// parameters match are not opened again but left for ffmpeg_wasm_handoff.
+// Then it decodes ahead up to the first video frame, or audio_seconds of
+// audio when there is no video, and read_frame hands those out first. This
+// is per context, not per stream: once any decoder is adopted nothing is
+// decoded ahead, not even for a stream with its own decoder, since the
+// adopted stream's packets would have to be held until handoff. Such an item
+// decodes its first frames after the handoff. 1 = ready, 0 = append more and call again, < 0 = open or
+// decode error (before the open succeeds, possibly just too little input).
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_preload(uintptr_t handle, uintptr_t current, double audio_seconds) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || handle == current || ctx->remux_only) {
+    return AVERROR(EINVAL);
+  }
+  if (!ctx->opened) {
+    int ret = open_input(ctx, NULL, (const FFmpegWasmContext *)current);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+  if ((ctx->primed & PRELOAD_DONE) || ctx->adopt) {
+    ctx->primed |= PRELOAD_DONE;
+    return 1;
+  }
+
+  // Audio gathers in one batch across calls; only the first frame sets its pts
+  int ret;
+  ctx->audio_batching = 1;
+  do {
+    ret = read_next_frame(ctx);
+  } while (ret == 2 && (ctx->video_codec || ctx->audio_nb_samples < audio_seconds * ctx->audio_sample_rate));
+  ctx->audio_batching = 0;
+  if (ret == 0) {
+    return 0;
+  }
+  if (ret < -1) {
+    return ret;
+  }
+  if (ret == 1) {
+    ctx->primed |= PRELOAD_VIDEO;
+  }
+  if (ctx->audio_nb_samples > 0) {
+    ctx->primed |= PRELOAD_AUDIO;
+  }
+  ctx->primed |= PRELOAD_DONE;
+  return 1;
+}
+
+// pts of the last sample (or frame) previous handed out ends at, -1 = unknown
+static double item_end_seconds(const FFmpegWasmContext *ctx) {
+  if (ctx->audio_end_seconds >= 0.0) {
+    return ctx->audio_end_seconds;
+  }
+  if (ctx->clock.last_pts >= 0.0) {
+    double frame = ctx->clock.frame_duration > 0.0 ? ctx->clock.frame_duration : CLOCK_DEFAULT_FRAME_SECONDS;
+    return ctx->clock.last_pts + frame;
+  }
+  return -1.0;
+}
+
+// pts this item's output starts at: its first audio sample when it has audio
+static double item_start_seconds(FFmpegWasmContext *ctx) {
+  if (ctx->primed & PRELOAD_AUDIO) {
+    return ctx->audio_pts_seconds;
+  }
+  if ((ctx->primed & PRELOAD_VIDEO) && ctx->audio_stream_index < 0) {
+    return ffmpeg_wasm_frame_pts_seconds((uintptr_t)ctx);
+  }
+  return ctx->fmt->start_time != AV_NOPTS_VALUE ? ctx->fmt->start_time / (double)AV_TIME_BASE : 0.0;
+}
+
+// The decoder goes over flushed; its frames still in prev are dropped first,
+// since buffers it allocated stay charged to prev until released. The RGBA
+// scaler and buffers follow, so the first frame reuses them when the size
+// matches.
+static void adopt_video_decoder(FFmpegWasmContext *ctx, FFmpegWasmContext *prev) {
+  av_frame_unref(prev->video_frame);
+  video_filter_reset(prev);
+  avcodec_flush_buffers(prev->video_codec);
+  ctx->video_codec = prev->video_codec;
+  prev->video_codec = NULL;
+  attach_memory_hooks(ctx, ctx->video_codec);
+  ctx->video_codec->skip_frame = AVDISCARD_DEFAULT;
+
+  free_rgba_buffers(ctx);
+  ctx->sws = prev->sws;
+  prev->sws = NULL;
+  memcpy(ctx->rgba_data, prev->rgba_data, sizeof(ctx->rgba_data));
+  memcpy(ctx->rgba_linesize, prev->rgba_linesize, sizeof(ctx->rgba_linesize));
+  ctx->rgba_size = prev->rgba_size;
+  ctx->rgba_width = prev->rgba_width;
+  ctx->rgba_height = prev->rgba_height;
+  ctx->rgba_src_width = prev->rgba_src_width;
+  ctx->rgba_src_height = prev->rgba_src_height;
+  ctx->rgba_src_fmt = prev->rgba_src_fmt;
+  memset(prev->rgba_data, 0, sizeof(prev->rgba_data));
+  free_rgba_buffers(prev);
+  mem_set(&ctx->mem, FFMPEG_WASM_MEM_RGBA, ctx->rgba_size > 0 ? (size_t)ctx->rgba_size : 0);
+  av_freep(&ctx->tonemap);
+  ctx->tonemap = prev->tonemap;
+  prev->tonemap = NULL;
+  ctx->video_eof = 0;
+  ctx->video_flush_sent = 0;
+}
+
+// The resampler goes with the decoder; it was drained at prev's EOF
+static void adopt_audio_decoder(FFmpegWasmContext *ctx, FFmpegWasmContext *prev) {
+  av_frame_unref(prev->audio_frame);
+  avcodec_flush_buffers(prev->audio_codec);
+  ctx->audio_codec = prev->audio_codec;
+  prev->audio_codec = NULL;
+  attach_memory_hooks(ctx, ctx->audio_codec);
+  ctx->swr = prev->swr;
+  prev->swr = NULL;
+  ctx->audio_channels = prev->audio_channels;
+  ctx->audio_sample_rate = prev->audio_sample_rate;
+  ctx->audio_eof = 0;
+  ctx->audio_flush_sent = 0;
+}
+
+// Playlist: makes a preloaded context the playing one once previous returned
+// its last frame. Adopted decoders move over (opened here after all if
+// previous no longer has matching ones), and previous's presentation clock carries on
+// so this item's first sample is due right where previous's last one ended.
+// Destroy previous afterwards.
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_handoff(uintptr_t handle, uintptr_t previous) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  FFmpegWasmContext *prev = (FFmpegWasmContext *)previous;
+  if (!ctx || !ctx->opened || !prev || prev == ctx) {
+    return AVERROR(EINVAL);
+  }
+
+  // previous may have switched tracks since the preload matched its decoders
+  int ret = 0;
+  if (ctx->adopt & PRELOAD_VIDEO) {
+    if (decoder_matches(prev->video_codec, ctx->fmt->streams[ctx->video_stream_index]->codecpar)) {
+      adopt_video_decoder(ctx, prev);
+      ctx->adopt &= ~PRELOAD_VIDEO;
+    } else {
+      ret = reopen_video_stream(ctx, ctx->video_stream_index);
+    }
+  }
+  if (ret >= 0 && (ctx->adopt & PRELOAD_AUDIO)) {
+    if (decoder_matches(prev->audio_codec, ctx->fmt->streams[ctx->audio_stream_index]->codecpar)) {
+      adopt_audio_decoder(ctx, prev);
+      ctx->adopt &= ~PRELOAD_AUDIO;
+    } else {
+      ret = reopen_audio_stream(ctx, ctx->audio_stream_index);
+    }
+  }
+  if (ret < 0) {
+    return ret;
+  }
+
+  double end = item_end_seconds(prev);
+  if (prev->clock.anchored && end >= 0.0) {
+    ctx->clock = prev->clock;
+    ctx->clock.anchor_pts += item_start_seconds(ctx) - end;
+    ctx->clock.last_pts = -1.0;
+    ctx->clock.consecutive_drops = 0;
+  } else {
+    ctx->clock.paused = prev->clock.paused;
+    ctx->clock.speed = prev->clock.speed;
+  }
+  return 0;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_video_width(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return (ctx && ctx->video_codec) ? ctx->video_codec->width : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_video_height(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return (ctx && ctx->video_codec) ? ctx->video_codec->height : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_frame_format(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return (ctx && ctx->video_frame) ? ctx->video_frame->format : AV_PIX_FMT_NONE;
+}
+
+EMSCRIPTEN_KEEPALIVE uintptr_t ffmpeg_wasm_frame_data_ptr(uintptr_t handle, int plane) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->video_frame || plane < 0 || plane >= 4) {
+    return 0;
+  }
+  return (uintptr_t)ctx->video_frame->data[plane];
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_frame_linesize(uintptr_t handle, int plane) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->video_frame || plane < 0 || plane >= 4) {
+    return 0;
+  }
+  return ctx->video_frame->linesize[plane];
+}
+
+EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_frame_pts_seconds(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->video_frame || ctx->video_time_base.den == 0) {
+    return 0.0;
+  }
+  int64_t pts = ctx->video_frame->best_effort_timestamp;
+  if (pts == AV_NOPTS_VALUE) {
+    return 0.0;
+  }
+  return pts * av_q2d(ctx->video_time_base);
+}
+
+// SMPTE ST 2084: signal [0,1] <-> luminance / 10000 nits
+static double pq_to_linear(double e) {
+  const double m1 = 2610.0 / 16384.0, m2 = 2523.0 / 4096.0 * 128.0;
+  const double c1 = 3424.0 / 4096.0, c2 = 2413.0 / 4096.0 * 32.0, c3 = 2392.0 / 4096.0 * 32.0;
+  double p = pow(e, 1.0 / m2);
+  return pow(fmax(p - c1, 0.0) / (c2 - c3 * p), 1.0 / m1);
+}
+
+static double linear_to_pq(double y) {
+  const double m1 = 2610.0 / 16384.0, m2 = 2523.0 / 4096.0 * 128.0;
+  const double c1 = 3424.0 / 4096.0, c2 = 2413.0 / 4096.0 * 32.0, c3 = 2392.0 / 4096.0 * 32.0;
+  double p = pow(fmax(y, 0.0), m1);
+  return pow((c1 + c2 * p) / (1.0 + c3 * p), m2);
+}
+
+// ARIB STD-B67 inverse OETF: signal -> scene linear [0,1]
+static double hlg_to_linear(double e) {
+  const double a = 0.17883277, b = 0.28466892, c = 0.55991073;
+  return e <= 0.5 ? e * e / 3.0 : (exp((e - c) / a) + b) / 12.0;
+}
+
+// BT.2390 EETF on a PQ signal: unchanged below the knee, Hermite roll-off
+// from src_peak to dst_peak (both PQ-encoded) above it
+static double bt2390_eetf(double e, double src_peak, double dst_peak) {
+  double e1 = fmin(e / src_peak, 1.0);
+  double max_lum = dst_peak / src_peak;
+  double ks = fmax(1.5 * max_lum - 0.5, 0.0);
+  if (e1 <= ks || ks >= 1.0) {
+    return e;
+  }
+  double t = (e1 - ks) / (1.0 - ks);
+  double t2 = t * t, t3 = t2 * t;
+  double e2 = (2.0 * t3 - 3.0 * t2 + 1.0) * ks + (t3 - 2.0 * t2 + t) * (1.0 - ks) +
+              (-2.0 * t3 + 3.0 * t2) * max_lum;
+  return fmin(e2, max_lum) * src_peak;
+}
+
+static int is_hdr_trc(int trc) {
+  return trc == AVCOL_TRC_SMPTE2084 || trc == AVCOL_TRC_ARIB_STD_B67;
+}
+
+// MaxCLL, else the mastering display peak, from the frame or else the stream
+static double content_peak_nits(const FFmpegWasmContext *ctx, const AVFrame *frame) {
+  const AVFrameSideData *sd = av_frame_get_side_data(frame, AV_FRAME_DATA_CONTENT_LIGHT_LEVEL);
+  if (sd && ((const AVContentLightMetadata *)sd->data)->MaxCLL > 0) {
+    return ((const AVContentLightMetadata *)sd->data)->MaxCLL;
+  }
+  sd = av_frame_get_side_data(frame, AV_FRAME_DATA_MASTERING_DISPLAY_METADATA);
+  if (sd) {
+    const AVMasteringDisplayMetadata *md = (const AVMasteringDisplayMetadata *)sd->data;
+    if (md->has_luminance && av_q2d(md->max_luminance) > 0.0) {
+      return av_q2d(md->max_luminance);
+    }
+  }
+  if (ctx->tonemap && ctx->tonemap->metadata_peak > 0.0) {
+    return ctx->tonemap->metadata_peak;
+  }
+  if (!ctx->fmt || ctx->video_stream_index < 0) {
+    return 0.0;
+  }
+  const AVCodecParameters *par = ctx->fmt->streams[ctx->video_stream_index]->codecpar;
+  const AVPacketSideData *psd = av_packet_side_data_get(par->coded_side_data, par->nb_coded_side_data,
+                                                        AV_PKT_DATA_CONTENT_LIGHT_LEVEL);
+  if (psd && ((const AVContentLightMetadata *)psd->data)->MaxCLL > 0) {
+    return ((const AVContentLightMetadata *)psd->data)->MaxCLL;
+  }
+  psd = av_packet_side_data_get(par->coded_side_data, par->nb_coded_side_data,
+                                AV_PKT_DATA_MASTERING_DISPLAY_METADATA);
+  if (psd) {
+    const AVMasteringDisplayMetadata *md = (const AVMasteringDisplayMetadata *)psd->data;
+    if (md->has_luminance && av_q2d(md->max_luminance) > 0.0) {
+      return av_q2d(md->max_luminance);
+    }
+  }
+  return 0.0;
+}
+
+static void tonemap_build(ToneMap *tm, const AVFrame *frame, double peak_nits) {
+  tm->trc = frame->color_trc;
+  tm->primaries = frame->color_primaries;
+  tm->colorspace = frame->colorspace;
+  tm->range = frame->color_range;
+  tm->peak_nits = peak_nits;
+  tm->gamut = frame->color_primaries == AVCOL_PRI_BT2020;
+  tm->passthrough = !is_hdr_trc(frame->color_trc) && !tm->gamut;
+
+  double kr = 0.2126, kb = 0.0722;
+  if (frame->colorspace == AVCOL_SPC_BT2020_NCL || frame->colorspace == AVCOL_SPC_BT2020_CL ||
+      (frame->colorspace == AVCOL_SPC_UNSPECIFIED && tm->gamut)) {
+    kr = 0.2627;
+    kb = 0.0593;
+  } else if (frame->colorspace == AVCOL_SPC_BT470BG || frame->colorspace == AVCOL_SPC_SMPTE170M) {
+    kr = 0.299;
+    kb = 0.114;
+  }
+  double kg = 1.0 - kr - kb;
+  int full = frame->color_range == AVCOL_RANGE_JPEG;
+  tm->y_offset = full ? 0.0f : 64.0f;
+  tm->y_scale = full ? 1.0f / 1023.0f : 1.0f / 876.0f;
+  tm->c_scale = full ? 1.0f / 1023.0f : 1.0f / 896.0f;
+  tm->cr_r = (float)(2.0 * (1.0 - kr));
+  tm->cb_b = (float)(2.0 * (1.0 - kb));
+  tm->cb_g = (float)(2.0 * kb * (1.0 - kb) / kg);
+  tm->cr_g = (float)(2.0 * kr * (1.0 - kr) / kg);
+  if (tm->passthrough) {
+    return;
+  }
+
+  double src_peak = linear_to_pq(peak_nits / 10000.0);
+  double dst_peak = linear_to_pq(TONEMAP_SDR_WHITE_NITS / 10000.0);
+  for (int i = 0; i < TONEMAP_LUT_SIZE; i++) {
+    double e = (double)i / (TONEMAP_LUT_SIZE - 1);
+    double y;
+    if (frame->color_trc == AVCOL_TRC_SMPTE2084) {
+      y = pq_to_linear(bt2390_eetf(e, src_peak, dst_peak)) * 10000.0 / TONEMAP_SDR_WHITE_NITS;
+    } else if (frame->color_trc == AVCOL_TRC_ARIB_STD_B67) {
+      // OOTF per channel (system gamma 1.2) instead of on luminance
+      double nits = TONEMAP_DEFAULT_PEAK_NITS * pow(hlg_to_linear(e), 1.2);
+      y = pq_to_linear(bt2390_eetf(linear_to_pq(nits / 10000.0), src_peak, dst_peak)) * 10000.0 /
+          TONEMAP_SDR_WHITE_NITS;
+    } else {
+      y = pow(e, 2.4);  // SDR BT.2020: linearize for the gamut matrix only
+    }
+    tm->to_linear[i] = (float)fmin(fmax(y, 0.0), 1.0);
+    // Indexed by sqrt(linear) so the shadows get most of the entries
+    double v = e * e;
+    tm->to_display[i] = (uint8_t)lrint(pow(v, 1.0 / 2.4) * 255.0);
+  }
+}
+
+static const float bt2020_to_bt709[9] = {
+  1.6605f, -0.5876f, -0.0728f,
+  -0.1246f, 1.1329f, -0.0083f,
+  -0.0182f, -0.1006f, 1.1187f,
+};
+
+static inline int tonemap_index(float v) {
+  v = v < 0.0f ? 0.0f : v > 1.0f ? 1.0f : v;
+  return (int)(v * (TONEMAP_LUT_SIZE - 1) + 0.5f);
+}
+
+static inline uint8_t tonemap_clip8(float v) {
+  v = v * 255.0f + 0.5f;
+  return (uint8_t)(v < 0.0f ? 0.0f : v > 255.0f ? 255.0f : v);
+}
+
+static inline void tonemap_pixel(const ToneMap *tm, float y, float cb, float cr, uint8_t *dst) {
+  float r = y + tm->cr_r * cr;
+  float g = y - tm->cb_g * cb - tm->cr_g * cr;
+  float b = y + tm->cb_b * cb;
+  if (tm->passthrough) {
+    dst[0] = tonemap_clip8(r);
+    dst[1] = tonemap_clip8(g);
+    dst[2] = tonemap_clip8(b);
+    dst[3] = 255;
+    return;
+  }
+  r = tm->to_linear[tonemap_index(r)];
+  g = tm->to_linear[tonemap_index(g)];
+  b = tm->to_linear[tonemap_index(b)];
+  if (tm->gamut) {
+    const float *m = bt2020_to_bt709;
+    float r2 = m[0] * r + m[1] * g + m[2] * b;
+    float g2 = m[3] * r + m[4] * g + m[5] * b;
+    float b2 = m[6] * r + m[7] * g + m[8] * b;
+    r = r2;
+    g = g2;
+    b = b2;
+  }
+  dst[0] = tm->to_display[tonemap_index(sqrtf(r > 0.0f ? r : 0.0f))];
+  dst[1] = tm->to_display[tonemap_index(sqrtf(g > 0.0f ? g : 0.0f))];
+  dst[2] = tm->to_display[tonemap_index(sqrtf(b > 0.0f ? b : 0.0f))];
+  dst[3] = 255;
+}
+
+#ifdef __wasm_simd128__
+// Four pixels (two chroma samples): the YUV and gamut matrices run in SIMD,
+// the LUT lookups stay scalar (no gather in wasm SIMD)
+static inline void tonemap_pixels4(const ToneMap *tm, const uint16_t *ys, const uint16_t *us,
+                                   const uint16_t *vs, uint8_t *dst) {
+  v128_t y = wasm_f32x4_convert_i32x4(wasm_u32x4_load16x4(ys));
+  y = wasm_f32x4_mul(wasm_f32x4_sub(y, wasm_f32x4_splat(tm->y_offset)), wasm_f32x4_splat(tm->y_scale));
+  v128_t cb = wasm_f32x4_make(us[0], us[0], us[1], us[1]);
+  v128_t cr = wasm_f32x4_make(vs[0], vs[0], vs[1], vs[1]);
+  v128_t half = wasm_f32x4_splat(512.0f);
+  v128_t cscale = wasm_f32x4_splat(tm->c_scale);
+  cb = wasm_f32x4_mul(wasm_f32x4_sub(cb, half), cscale);
+  cr = wasm_f32x4_mul(wasm_f32x4_sub(cr, half), cscale);
+  v128_t rgb[3] = {
+    wasm_f32x4_add(y, wasm_f32x4_mul(cr, wasm_f32x4_splat(tm->cr_r))),
+    wasm_f32x4_sub(wasm_f32x4_sub(y, wasm_f32x4_mul(cb, wasm_f32x4_splat(tm->cb_g))),
+                   wasm_f32x4_mul(cr, wasm_f32x4_splat(tm->cr_g))),
+    wasm_f32x4_add(y, wasm_f32x4_mul(cb, wasm_f32x4_splat(tm->cb_b))),
+  };
+  v128_t zero = wasm_f32x4_splat(0.0f);
+  v128_t one = wasm_f32x4_splat(1.0f);
+  v128_t lut_max = wasm_f32x4_splat(TONEMAP_LUT_SIZE - 1);
+  v128_t round = wasm_f32x4_splat(0.5f);
+  int32_t out[3][4];
+  if (tm->passthrough) {
+    for (int c = 0; c < 3; c++) {
+      v128_t v = wasm_f32x4_min(wasm_f32x4_max(rgb[c], zero), one);
+      v = wasm_f32x4_add(wasm_f32x4_mul(v, wasm_f32x4_splat(255.0f)), round);
+      wasm_v128_store(out[c], wasm_i32x4_trunc_sat_f32x4(v));
+    }
+  } else {
+    int32_t idx[4];
+    float lin[3][4];
+    for (int c = 0; c < 3; c++) {
+      v128_t v = wasm_f32x4_min(wasm_f32x4_max(rgb[c], zero), one);
+      wasm_v128_store(idx, wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_add(wasm_f32x4_mul(v, lut_max), round)));
+      for (int i = 0; i < 4; i++) {
+        lin[c][i] = tm->to_linear[idx[i]];
+      }
+      rgb[c] = wasm_v128_load(lin[c]);
+    }
+    if (tm->gamut) {
+      const float *m = bt2020_to_bt709;
+      v128_t mixed[3];
+      for (int c = 0; c < 3; c++) {
+        mixed[c] = wasm_f32x4_add(
+            wasm_f32x4_add(wasm_f32x4_mul(rgb[0], wasm_f32x4_splat(m[c * 3])),
+                           wasm_f32x4_mul(rgb[1], wasm_f32x4_splat(m[c * 3 + 1]))),
+            wasm_f32x4_mul(rgb[2], wasm_f32x4_splat(m[c * 3 + 2])));
+      }
+      rgb[0] = mixed[0];
+      rgb[1] = mixed[1];
+      rgb[2] = mixed[2];
+    }
+    for (int c = 0; c < 3; c++) {
+      v128_t v = wasm_f32x4_sqrt(wasm_f32x4_min(wasm_f32x4_max(rgb[c], zero), one));
+      wasm_v128_store(idx, wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_add(wasm_f32x4_mul(v, lut_max), round)));
+      for (int i = 0; i < 4; i++) {
+        out[c][i] = tm->to_display[idx[i]];
+      }
+    }
+  }
+  for (int i = 0; i < 4; i++) {
+    dst[i * 4] = (uint8_t)out[0][i];
+    dst[i * 4 + 1] = (uint8_t)out[1][i];
+    dst[i * 4 + 2] = (uint8_t)out[2][i];
+    dst[i * 4 + 3] = 255;
+  }
+}
+#endif
+
+static void tonemap_frame(const ToneMap *tm, const AVFrame *frame, uint8_t *dst, int dst_stride) {
+  for (int row = 0; row < frame->height; row++) {
+    const uint16_t *ys = (const uint16_t *)(frame->data[0] + (size_t)row * frame->linesize[0]);
+    const uint16_t *us = (const uint16_t *)(frame->data[1] + (size_t)(row >> 1) * frame->linesize[1]);
+    const uint16_t *vs = (const uint16_t *)(frame->data[2] + (size_t)(row >> 1) * frame->linesize[2]);
+    uint8_t *out = dst + (size_t)row * dst_stride;
+    int x = 0;
+#ifdef __wasm_simd128__
+    for (; x + 4 <= frame->width; x += 4) {
+      tonemap_pixels4(tm, ys + x, us + (x >> 1), vs + (x >> 1), out + x * 4);
+    }
+#endif
+    for (; x < frame->width; x++) {
+      float cb = ((float)us[x >> 1] - 512.0f) * tm->c_scale;
+      float cr = ((float)vs[x >> 1] - 512.0f) * tm->c_scale;
+      tonemap_pixel(tm, ((float)ys[x] - tm->y_offset) * tm->y_scale, cb, cr, out + x * 4);
+    }
+  }
+}
+
+// yuv420p10 at its decoded size goes through the fused path; anything else,
+// or a set output size, through sws
+static int frame_to_rgba_fused(FFmpegWasmContext *ctx) {
+  const AVFrame *frame = ctx->video_frame;
+  if (!ctx->tone_mapping || frame->format != AV_PIX_FMT_YUV420P10 ||
+      (ctx->out_width > 0 && (ctx->out_width != frame->width || ctx->out_height != frame->height))) {
+    return 0;
+  }
+  if (!ctx->tonemap) {
+    ctx->tonemap = av_mallocz(sizeof(ToneMap));
+    if (!ctx->tonemap) {
+      return AVERROR(ENOMEM);
+    }
+  }
+  ToneMap *tm = ctx->tonemap;
+  double peak = content_peak_nits(ctx, frame);
+  if (peak > 0.0) {
+    tm->metadata_peak = peak;
+  } else {
+    peak = TONEMAP_DEFAULT_PEAK_NITS;
+  }
+  peak = fmin(fmax(peak, TONEMAP_SDR_WHITE_NITS), 10000.0);
+  if (frame->color_trc == AVCOL_TRC_ARIB_STD_B67) {
+    peak = TONEMAP_DEFAULT_PEAK_NITS;  // Scene-referred: no mastering peak applies
+  }
+  if (tm->peak_nits != peak || tm->trc != (int)frame->color_trc ||
+      tm->primaries != (int)frame->color_primaries || tm->colorspace != (int)frame->colorspace ||
+      tm->range != (int)frame->color_range) {
+    tonemap_build(tm, frame, peak);
+  }
+
+  if (ctx->sws) {
+    sws_freeContext(ctx->sws);  // Rebuilt by the sws path if it is needed again
+    ctx->sws = NULL;
+  }
+  if (!ctx->rgba_data[0] || ctx->rgba_width != frame->width || ctx->rgba_height != frame->height) {
+    free_rgba_buffers(ctx);
+    ctx->rgba_size = av_image_alloc(ctx->rgba_data, ctx->rgba_linesize, frame->width, frame->height,
+                                    AV_PIX_FMT_RGBA, 1);
+    if (ctx->rgba_size < 0) {
+      int err = ctx->rgba_size;
+      free_rgba_buffers(ctx);
+      return err;
+    }
+    mem_set(&ctx->mem, FFMPEG_WASM_MEM_RGBA, (size_t)ctx->rgba_size);
+    ctx->rgba_width = frame->width;
+    ctx->rgba_height = frame->height;
+  }
+  tonemap_frame(tm, frame, ctx->rgba_data[0], ctx->rgba_linesize[0]);
+  return 1;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_frame_to_rgba(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->video_frame || ctx->video_frame->width <= 0 ||
+      ctx->video_frame->height <= 0) {
+    return AVERROR(EINVAL);
+  }
+  int fused = frame_to_rgba_fused(ctx);
+  ctx->rgba_fused = fused > 0;
+  if (fused != 0) {
+    return fused;
+  }
+
+  // The requested output size is applied here, in the same sws pass as the
+  // RGBA conversion, rather than by a scale filter.
+  int out_width = ctx->out_width > 0 ? ctx->out_width : ctx->video_frame->width;
+  int out_height = ctx->out_height > 0 ? ctx->out_height : ctx->video_frame->height;
+  if (!ctx->sws || ctx->rgba_src_width != ctx->video_frame->width ||
+      ctx->rgba_src_height != ctx->video_frame->height ||
+      ctx->rgba_src_fmt != ctx->video_frame->format || ctx->rgba_width != out_width ||
+      ctx->rgba_height != out_height) {
+    if (ctx->sws) {
+      sws_freeContext(ctx->sws);
+      ctx->sws = NULL;
+    }
+    free_rgba_buffers(ctx);
+
+    ctx->sws = sws_getContext(
+        ctx->video_frame->width,
+        ctx->video_frame->height,
+        (enum AVPixelFormat)ctx->video_frame->format,
+        out_width,
+        out_height,
+        AV_PIX_FMT_RGBA,
+        SWS_BILINEAR,
+        NULL,
+        NULL,
+        NULL);
+    if (!ctx->sws) {
+      return AVERROR(ENOMEM);
+    }
+
+    ctx->rgba_size = av_image_alloc(
+        ctx->rgba_data,
+        ctx->rgba_linesize,
+        out_width,
+        out_height,
+        AV_PIX_FMT_RGBA,
+        1);
+    if (ctx->rgba_size < 0) {
+      int err = ctx->rgba_size;
+      free_rgba_buffers(ctx);
+      return err;
+    }
+    mem_set(&ctx->mem, FFMPEG_WASM_MEM_RGBA, (size_t)ctx->rgba_size);
+
+    ctx->rgba_width = out_width;
+    ctx->rgba_height = out_height;
+    ctx->rgba_src_width = ctx->video_frame->width;
+    ctx->rgba_src_height = ctx->video_frame->height;
+    ctx->rgba_src_fmt = (enum AVPixelFormat)ctx->video_frame->format;
+  }
+
+  int lines = sws_scale(
+      ctx->sws,
+      (const uint8_t *const *)ctx->video_frame->data,
+      ctx->video_frame->linesize,
+      0,
+      ctx->video_frame->height,
+      ctx->rgba_data,
+      ctx->rgba_linesize);
+  if (lines <= 0) {
+    return AVERROR(EINVAL);
+  }
+
+  return 1;
+}
+
+EMSCRIPTEN_KEEPALIVE uintptr_t ffmpeg_wasm_rgba_ptr(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return (ctx && ctx->rgba_data[0]) ? (uintptr_t)ctx->rgba_data[0] : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_rgba_stride(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return (ctx && ctx->rgba_data[0]) ? ctx->rgba_linesize[0] : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE size_t ffmpeg_wasm_rgba_size(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx && ctx->rgba_size > 0 ? (size_t)ctx->rgba_size : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_rgba_width(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx ? ctx->rgba_width : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_rgba_height(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx ? ctx->rgba_height : 0;
+}
+
+// Size of the frame_to_rgba output; 0x0 keeps the decoded size. Folded into
+// the existing sws conversion, so it costs no extra pass.
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_set_output_size(uintptr_t handle, int width, int height) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx) {
+    return;
+  }
+  ctx->out_width = width > 0 && height > 0 ? width & ~1 : 0;
+  ctx->out_height = width > 0 && height > 0 ? height & ~1 : 0;
+}
+
+// 10-bit 4:2:0 frames use the fused LUT path (tone mapping PQ/HLG to SDR,
+// BT.2020 -> BT.709) unless this is off; then they go through sws unmapped
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_set_tone_mapping(uintptr_t handle, int enabled) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (ctx) {
+    ctx->tone_mapping = enabled ? 1 : 0;
+  }
+}
+
+// Deinterlace decoded frames with "yadif" or "bwdif" (frames flagged as
+// interlaced only); NULL or "" turns it off. double_rate emits one frame per
+// field. Applies to read_frame, frame_to_rgba and mosaic tiles alike.
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_set_deinterlace(uintptr_t handle, const char *filter, int double_rate) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx) {
+    return AVERROR(EINVAL);
+  }
+  gop_cache_clear(ctx);  // Stored frames went through the old filter
+  if (!filter || !filter[0]) {
+    free_video_filter(ctx);
+    return 0;
+  }
+  if ((strcmp(filter, "yadif") != 0 && strcmp(filter, "bwdif") != 0) || !avfilter_get_by_name(filter)) {
+    return AVERROR_FILTER_NOT_FOUND;
+  }
+  if (!ctx->filter) {
+    ctx->filter = av_mallocz(sizeof(VideoFilter));
+    if (!ctx->filter) {
+      return AVERROR(ENOMEM);
+    }
+    ctx->filter->decoded = av_frame_alloc();
+    if (!ctx->filter->decoded) {
+      av_freep(&ctx->filter);
+      return AVERROR(ENOMEM);
+    }
+  }
+  video_filter_reset(ctx);
+  snprintf(ctx->filter->name, sizeof(ctx->filter->name), "%s", filter);
+  ctx->filter->double_rate = double_rate ? 1 : 0;
+  return 0;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_audio_channels(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx ? ctx->audio_channels : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_audio_sample_rate(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx ? ctx->audio_sample_rate : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_audio_nb_samples(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx ? ctx->audio_nb_samples : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE uintptr_t ffmpeg_wasm_audio_ptr(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return (ctx && ctx->audio_data) ? (uintptr_t)ctx->audio_data : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE size_t ffmpeg_wasm_audio_bytes(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->audio_data) {
+    return 0;
+  }
+  return (size_t)ctx->audio_nb_samples * (size_t)ctx->audio_channels * sizeof(float);
+}
+
+EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_audio_pts_seconds(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx ? ctx->audio_pts_seconds : 0.0;
+}
+
+EMSCRIPTEN_KEEPALIVE uintptr_t ffmpeg_wasm_frame_desc(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx ? (uintptr_t)&ctx->desc : 0;
+}
+
+// frame_to_rgba, render_subtitles and the rgba getters in one crossing
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_present_frame(uintptr_t handle, double subtitle_delay) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx) {
+    return AVERROR(EINVAL);
+  }
+  FFmpegWasmFrameDesc *desc = &ctx->desc;
+  desc->flags &= ~(uint32_t)(FFMPEG_WASM_FRAME_HAS_RGBA | FFMPEG_WASM_FRAME_SUBTITLES_DRAWN |
+                             FFMPEG_WASM_FRAME_TONE_MAPPED);
+  desc->rgba_data = 0;
+  desc->subtitle_status = 0;
+  int ret = ffmpeg_wasm_frame_to_rgba(handle);
+  if (ret >= 0) {
+    desc->rgba_data = (uint64_t)(uintptr_t)ctx->rgba_data[0];
+    desc->rgba_width = ctx->rgba_width;
+    desc->rgba_height = ctx->rgba_height;
+    desc->rgba_stride = ctx->rgba_linesize[0];
+    desc->flags |= FFMPEG_WASM_FRAME_HAS_RGBA;
+    if (ctx->rgba_fused && is_hdr_trc(ctx->tonemap->trc)) {
+      desc->flags |= FFMPEG_WASM_FRAME_TONE_MAPPED;
+    }
+    ret = ffmpeg_wasm_render_subtitles(handle, desc->pts + subtitle_delay);
+    desc->subtitle_status = ret;
+    if (ret > 0) {
+      desc->flags |= FFMPEG_WASM_FRAME_SUBTITLES_DRAWN;
+    }
+  }
+  desc->present_status = ret;
+  return ret;
+}
+
+// Rebuilt on every call: selection changes and stream additions (MPEG-TS
+// programs) are rare, and one allocation beats a getter per field.
+EMSCRIPTEN_KEEPALIVE uintptr_t ffmpeg_wasm_stream_table(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx) {
+    return 0;
+  }
+  int count = ffmpeg_wasm_streams_count(handle);
+  size_t size = sizeof(FFmpegWasmStreamTable) + (size_t)count * sizeof(FFmpegWasmStreamEntry);
+  if (size > ctx->stream_table_size) {
+    uint8_t *table = av_realloc(ctx->stream_table, size);
+    if (!table) {
+      return 0;
+    }
+    ctx->stream_table = table;
+    ctx->stream_table_size = size;
+  }
+
+  FFmpegWasmStreamTable *head = (FFmpegWasmStreamTable *)ctx->stream_table;
+  memset(head, 0, size);
+  head->version = FFMPEG_WASM_DESC_VERSION;
+  head->count = count;
+  head->entry_size = (int32_t)sizeof(FFmpegWasmStreamEntry);
+  head->selected_video = ctx->video_stream_index;
+  head->selected_audio = ctx->audio_stream_index;
+  head->selected_subtitle = ctx->subtitle_stream_index;
+  head->flags = (ctx->audio_enabled ? FFMPEG_WASM_STREAMS_AUDIO_ENABLED : 0) |
+                (ctx->subtitles_enabled ? FFMPEG_WASM_STREAMS_SUBTITLES_ENABLED : 0);
+
+  FFmpegWasmStreamEntry *entries = (FFmpegWasmStreamEntry *)(head + 1);
+  for (int i = 0; i < count; i++) {
+    FFmpegWasmStreamEntry *entry = &entries[i];
+    entry->index = i;
+    entry->media_type = ffmpeg_wasm_stream_media_type(handle, i);
+    entry->codec_id = ffmpeg_wasm_stream_codec_id(handle, i);
+    entry->flags = ffmpeg_wasm_stream_is_default(handle, i) ? FFMPEG_WASM_STREAM_DEFAULT : 0;
+    entry->codec_name = (uint64_t)(uintptr_t)ffmpeg_wasm_stream_codec_name(handle, i);
+    entry->language = (uint64_t)(uintptr_t)ffmpeg_wasm_stream_language(handle, i);
+    entry->title = (uint64_t)(uintptr_t)ffmpeg_wasm_stream_title(handle, i);
+  }
+  return (uintptr_t)head;
+}
+
+EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_read_position(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx ? (double)flow_read_position(ctx) : 0.0;
+}
+
+// Observed input bitrate in bits/s (container estimate until the first
+// sample), 0 if unknown
+EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_input_bitrate(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx ? flow_bitrate(ctx) : 0.0;
+}
+
+// Media buffered ahead of playback; in live mode this is the decoder's share
+// of the latency
+EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_buffered_seconds(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx && ctx->opened ? flow_buffered_seconds(ctx) : -1.0;
+}
+
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_clock_reset(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (ctx) {
+    clock_reset(&ctx->clock);
+  }
+}
+
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_clock_set_paused(uintptr_t handle, int paused, double wall) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || ctx->clock.paused == (paused ? 1 : 0)) {
+    return;
+  }
+  PresentClock *clock = &ctx->clock;
+  if (paused) {
+    clock->anchor_pts = clock_now(clock, wall);
+  } else {
+    clock->anchor_wall = wall;  // Resume where it stopped instead of catching up
+    clock->audio_wall = -1.0;
+  }
+  clock->paused = paused ? 1 : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_clock_set_speed(uintptr_t handle, double speed, double wall) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !(speed > 0.0)) {
+    return;
+  }
+  PresentClock *clock = &ctx->clock;
+  if (clock->anchored) {
+    clock_anchor(clock, clock_now(clock, wall), wall);
+  }
+  clock->speed = speed;
+  clock->audio_wall = -1.0;
+}
+
+// pts of the sample audible at wall. Ignored off 1x: the worklet always plays
+// at its own rate, so its position would pull the video back to 1x.
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_clock_audio_position(uintptr_t handle, double pts, double wall) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || ctx->clock.paused || ctx->clock.speed != 1.0) {
+    return;
+  }
+  PresentClock *clock = &ctx->clock;
+  clock->audio_wall = wall;
+  if (!clock->anchored) {
+    clock_anchor(clock, pts, wall);
+    clock->drift = 0.0;
+    return;
+  }
+  double drift = pts - clock_now(clock, wall);
+  if (fabs(drift) > CLOCK_SNAP_SECONDS) {
+    clock_anchor(clock, pts, wall);
+  } else {
+    clock->anchor_pts += drift * CLOCK_SLEW;
+  }
+  clock->drift = drift;
+}
+
+EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_clock_time(uintptr_t handle, double wall) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx && ctx->clock.anchored ? clock_now(&ctx->clock, wall) : -1.0;
+}
+
+// Returns the milliseconds to wait before presenting the frame with pts (0 =
+// present now; until then the previous frame stays up), or
+// FFMPEG_WASM_CLOCK_DROP when it is too late to be worth showing.
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_clock_schedule(uintptr_t handle, double pts, double wall) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx) {
+    return 0;
+  }
+  PresentClock *clock = &ctx->clock;
+  if (!clock->anchored || clock->paused) {
+    clock_anchor(clock, pts, wall);  // Paused: frame steps and previews
+    clock->last_pts = pts;
+    return 0;
+  }
+  double step = pts - clock->last_pts;
+  if (clock->last_pts >= 0.0 && step > 0.0 && step < 1.0) {
+    clock->frame_duration = clock->frame_duration > 0.0 ? 0.9 * clock->frame_duration + 0.1 * step : step;
+  }
+  clock->last_pts = pts;
+
+  double due = (pts - clock_now(clock, wall)) / clock->speed;
+  int audio_master = clock->audio_wall >= 0.0 && wall - clock->audio_wall < CLOCK_AUDIO_FRESH_SECONDS;
+  if (!audio_master && fabs(due) > CLOCK_RESYNC_SECONDS) {
+    clock_anchor(clock, pts, wall);  // Discontinuity or a long stall
+    clock->consecutive_drops = 0;
+    return 0;
+  }
+  if (due > CLOCK_EARLY_SECONDS) {
+    return (int)ceil(fmin(due, CLOCK_MAX_WAIT_SECONDS) * 1000.0);
+  }
+  double frame = clock->frame_duration > 0.0 ? clock->frame_duration : CLOCK_DEFAULT_FRAME_SECONDS;
+  double late = -due;
+  if (late > 2.0 * frame && clock->consecutive_drops < CLOCK_MAX_DROPS - 1) {
+    clock->consecutive_drops++;
+    clock->dropped++;
+    return FFMPEG_WASM_CLOCK_DROP;
+  }
+  clock->consecutive_drops = 0;
+  if (late > 0.5 * frame) {
+    clock->late++;
+  }
+  return 0;
+}
+
+EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_clock_drift(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx ? ctx->clock.drift : 0.0;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_clock_dropped(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx ? ctx->clock.dropped : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_clock_late(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx ? ctx->clock.late : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_buffered_bytes(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx) {
+    return 0.0;
+  }
+  if (ctx->range) {
+    return ffmpeg_wasm_range_cached_end(handle, (double)ctx->range->pos) - (double)ctx->range->pos;
+  }
+  if (ctx->buffer.size < ctx->buffer.read_pos) {
+    return 0.0;
+  }
+  double buffered = (double)(ctx->buffer.size - ctx->buffer.read_pos);
+  if (ctx->buffer.cold) {
+    buffered += (double)(ctx->buffer.offset - ctx->buffer.cold_pos);
+  }
+  return buffered;
+}
+
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_compact_buffer(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx) {
+    return;
+  }
+  compact_buffer(&ctx->buffer);
+  if (ctx->audio_input) {
+    compact_buffer(&ctx->audio_input->buffer);
+  }
+  enforce_memory_budget(ctx);
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_streams_count(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->fmt) {
+    return 0;
+  }
+  if (ctx->fmt->nb_streams > INT_MAX) {
+    return INT_MAX;
+  }
+  return (int)ctx->fmt->nb_streams;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_stream_media_type(uintptr_t handle, int stream_index) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->fmt || stream_index < 0 || stream_index >= (int)ctx->fmt->nb_streams) {
+    return AVMEDIA_TYPE_UNKNOWN;
+  }
+  AVStream *stream = ctx->fmt->streams[stream_index];
+  if (!stream || !stream->codecpar) {
+    return AVMEDIA_TYPE_UNKNOWN;
+  }
+  return stream->codecpar->codec_type;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_stream_codec_id(uintptr_t handle, int stream_index) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->fmt || stream_index < 0 || stream_index >= (int)ctx->fmt->nb_streams) {
+    return AV_CODEC_ID_NONE;
+  }
+  AVStream *stream = ctx->fmt->streams[stream_index];
+  if (!stream || !stream->codecpar) {
+    return AV_CODEC_ID_NONE;
+  }
+  return stream->codecpar->codec_id;
+}
+
+EMSCRIPTEN_KEEPALIVE const char *ffmpeg_wasm_stream_codec_name(uintptr_t handle, int stream_index) {
+  int codec_id = ffmpeg_wasm_stream_codec_id(handle, stream_index);
+  if (codec_id == AV_CODEC_ID_NONE) {
+    return NULL;
+  }
+  return avcodec_get_name((enum AVCodecID)codec_id);
+}
+
+EMSCRIPTEN_KEEPALIVE const char *ffmpeg_wasm_stream_language(uintptr_t handle, int stream_index) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->fmt || stream_index < 0 || stream_index >= (int)ctx->fmt->nb_streams) {
+    return NULL;
+  }
+  AVStream *stream = ctx->fmt->streams[stream_index];
+  if (!stream) {
+    return NULL;
+  }
+  AVDictionaryEntry *tag = av_dict_get(stream->metadata, "language", NULL, 0);
+  return tag ? tag->value : NULL;
+}
+
+EMSCRIPTEN_KEEPALIVE const char *ffmpeg_wasm_stream_title(uintptr_t handle, int stream_index) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->fmt || stream_index < 0 || stream_index >= (int)ctx->fmt->nb_streams) {
+    return NULL;
+  }
+  AVStream *stream = ctx->fmt->streams[stream_index];
+  if (!stream) {
+    return NULL;
+  }
+  AVDictionaryEntry *tag = av_dict_get(stream->metadata, "title", NULL, 0);
+  return tag ? tag->value : NULL;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_stream_is_default(uintptr_t handle, int stream_index) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->fmt || stream_index < 0 || stream_index >= (int)ctx->fmt->nb_streams) {
+    return 0;
+  }
+  AVStream *stream = ctx->fmt->streams[stream_index];
+  if (!stream) {
+    return 0;
+  }
+  return (stream->disposition & AV_DISPOSITION_DEFAULT) ? 1 : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_selected_video_stream(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx ? ctx->video_stream_index : -1;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_has_video(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return (ctx && ctx->video_codec) ? 1 : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_selected_audio_stream(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx ? ctx->audio_stream_index : -1;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_audio_is_enabled(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx ? ctx->audio_enabled : 0;
+}
+
+static int select_remux_stream(FFmpegWasmContext *ctx, enum AVMediaType type, int index) {
+  if (index == -1) {
+    index = av_find_best_stream(ctx->fmt, type, -1, -1, NULL, 0);
+    return index >= 0 ? index : -1;
+  }
+  if (index < 0 || index >= (int)ctx->fmt->nb_streams ||
+      ctx->fmt->streams[index]->codecpar->codec_type != type) {
+    return AVERROR(EINVAL);
+  }
+  return index;
+}
+
+// Remux-only contexts have no decoders to reopen; just record the choice,
+// picked up by the next ffmpeg_wasm_remux_start.
+static int select_remux_streams(FFmpegWasmContext *ctx, int video_stream_index, int audio_stream_index) {
+  int v_index = select_remux_stream(ctx, AVMEDIA_TYPE_VIDEO, video_stream_index);
+  int a_index = audio_stream_index == -2 ? -1 : select_remux_stream(ctx, AVMEDIA_TYPE_AUDIO, audio_stream_index);
+  if (v_index < -1 || a_index < -1) {
+    return AVERROR(EINVAL);
+  }
+  ctx->video_stream_index = v_index;
+  ctx->audio_stream_index = a_index;
+  ctx->audio_enabled = a_index >= 0;
+  if (v_index >= 0) {
+    ctx->video_time_base = ctx->fmt->streams[v_index]->time_base;
+  }
+  if (a_index >= 0) {
+    ctx->audio_time_base = ctx->fmt->streams[a_index]->time_base;
+  }
+  return 0;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_select_streams(uintptr_t handle, int video_stream_index, int audio_stream_index) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->fmt || !ctx->opened) {
+    return AVERROR(EINVAL);
+  }
+  if (ctx->remux_only) {
+    return select_remux_streams(ctx, video_stream_index, audio_stream_index);
+  }
+  if (ctx->audio_input || ctx->segment_format) {
+    return AVERROR(EINVAL);  // Manifest sources pick renditions in JS
+  }
+  ctx->missing_modules[0] = '\0';
+  ctx->primed = 0;
+  packet_cache_clear(ctx);
+  gop_cache_clear(ctx);
+
+  // -2 (or -1 with no eligible video) drops the video decoder: audio-only
+  int v_index = video_stream_index;
+  if (v_index == -1) {
+    v_index = find_video_stream(ctx);
+    if (v_index < 0) {
+      v_index = -2;
+    }
+  }
+  if (v_index < 0 && v_index != -2) {
+    return AVERROR(EINVAL);
+  }
 
-    if (rect->type == SUBTITLE_ASS && rect->ass) {
-      ass_process_chunk(ctx->ass_track, rect->ass, strlen(rect->ass),
-                        (long long)(start_sec * 1000), (long long)(duration_sec * 1000));
+  int ret = 0;
+  if (v_index == -2) {
+    close_video_decoder(ctx);
+  } else {
+    ret = reopen_video_stream(ctx, v_index);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+  discard_unused_video(ctx);
 
-      // Emit a debug log back to JS for visibility in the UI log panel
-      EM_ASM_({
-        postMessage({
-          type: "subtitleLog",
-          text: UTF8ToString($0),
-          startMs: $1,
-          endMs: $2
-        });
-      }, rect->ass, (int)start_ms, (int)end_ms);
-    } else if (rect->type == SUBTITLE_TEXT && rect->text) {
-      char buf[4096];
-      snprintf(buf, sizeof(buf), "Dialogue: 0,0:00:00.00,0:00:00.00,Default,,0,0,0,,%s", rect->text);
-      ass_process_chunk(ctx->ass_track, buf, strlen(buf),
-                        (long long)(start_sec * 1000), (long long)(duration_sec * 1000));
+  if (audio_stream_index == -2) {
+    close_audio_decoder(ctx);
+    ctx->audio_enabled = 0;
+    ctx->audio_eof = 1;
+    ctx->audio_flush_sent = 1;
+    return 0;
+  }
 
-      EM_ASM_({
-        postMessage({
-          type: "subtitleLog",
-          text: UTF8ToString($0),
-          startMs: $1,
-          endMs: $2
-        });
-      }, rect->text, (int)start_ms, (int)end_ms);
+  int a_index = audio_stream_index;
+  if (a_index == -1) {
+    const AVCodec *decoder = NULL;
+    int best = av_find_best_stream(ctx->fmt, AVMEDIA_TYPE_AUDIO, -1, -1, &decoder, 0);
+    if (best < 0) {
+      close_audio_decoder(ctx);
+      ctx->audio_enabled = 0;
+      ctx->audio_eof = 1;
+      ctx->audio_flush_sent = 1;
+      return 0;
     }
+    a_index = best;
   }
 
-  avsubtitle_free(&sub);
-}
+  if (a_index < 0) {
+    close_audio_decoder(ctx);
+    ctx->audio_enabled = 0;
+    ctx->audio_eof = 1;
+    ctx->audio_flush_sent = 1;
+    return 0;
+  }
 
-EMSCRIPTEN_KEEPALIVE unsigned int ffmpeg_wasm_avcodec_version(void) {
-  return avcodec_version();
+  ret = reopen_audio_stream(ctx, a_index);
+  if (ret < 0) {
+    return ret;
+  }
+  return 0;
 }
 
-EMSCRIPTEN_KEEPALIVE unsigned int ffmpeg_wasm_avformat_version(void) {
-  return avformat_version();
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_selected_subtitle_stream(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx ? ctx->subtitle_stream_index : -1;
 }
 
-EMSCRIPTEN_KEEPALIVE unsigned int ffmpeg_wasm_avutil_version(void) {
-  return avutil_version();
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_subtitles_enabled(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx ? ctx->subtitles_enabled : 0;
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_has_hevc_av1(void) {
-  const AVCodec *hevc = avcodec_find_decoder(AV_CODEC_ID_HEVC);
-  const AVCodec *av1 = avcodec_find_decoder(AV_CODEC_ID_AV1);
-  return (hevc != NULL) && (av1 != NULL);
-}
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_select_subtitle_stream(uintptr_t handle, int stream_index) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->fmt || !ctx->opened) {
+    return AVERROR(EINVAL);
+  }
+  ctx->missing_modules[0] = '\0';
 
-EMSCRIPTEN_KEEPALIVE uintptr_t ffmpeg_wasm_create(int initial_capacity) {
-  FFmpegWasmContext *ctx = (FFmpegWasmContext *)calloc(1, sizeof(FFmpegWasmContext));
-  if (!ctx) {
+  if (stream_index == -2) {
+    close_subtitle_decoder(ctx);
+    ctx->subtitles_enabled = 0;
     return 0;
   }
 
-  if (initial_capacity > 0) {
-    ctx->buffer.capacity = (size_t)initial_capacity;
-    ctx->buffer.data = av_malloc(ctx->buffer.capacity);
-    if (!ctx->buffer.data) {
-      free(ctx);
+  if (stream_index == -1) {
+    int best = av_find_best_stream(ctx->fmt, AVMEDIA_TYPE_SUBTITLE, -1, -1, NULL, 0);
+    if (best < 0) {
+      close_subtitle_decoder(ctx);
+      ctx->subtitles_enabled = 0;
       return 0;
     }
+    stream_index = best;
   }
 
-  ctx->video_stream_index = -1;
-  ctx->audio_stream_index = -1;
-  ctx->subtitle_stream_index = -1;
-  ctx->rgba_src_fmt = AV_PIX_FMT_NONE;
-  ctx->video_time_base = (AVRational){0, 1};
-  ctx->audio_time_base = (AVRational){0, 1};
-  ctx->audio_enabled = 1;
-  ctx->subtitles_enabled = 0;
-  ctx->buffer.start = 0;
-  ctx->buffer.limit = 0;
-  ctx->buffer.keep_all = 1;  // Keep all data until open succeeds
-  ctx->buffer.total_size = -1;
-  av_log_set_level(AV_LOG_ERROR);
-  return (uintptr_t)ctx;
+  return reopen_subtitle_stream(ctx, stream_index);
 }
 
-EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_destroy(uintptr_t handle) {
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_add_font(uintptr_t handle, const char *name, const uint8_t *data, size_t len) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx) {
-    return;
+  if (ctx && ctx->mosaic) {
+    return ffmpeg_wasm_mosaic_add_font((uintptr_t)ctx->mosaic, name, data, len);
+  }
+  if (!ctx || !ctx->ass_library || !name || !data || len == 0 || len > INT_MAX) {
+    return AVERROR(EINVAL);  // libass takes an int size
+  }
+  int ret = ass_fonts_add(&ctx->ass_fonts, &ctx->ass_renderer, name, data, (int)len);
+  if (ret <= 0) {
+    return ret;  // 0: this context already has the font
+  }
+  ctx->ass_library = ctx->ass_fonts.library;
+  if (ctx->ass_cache_trimmed) {
+    ass_set_cache_limits(ctx->ass_renderer, ASS_GLYPH_CACHE_MAX / 4, ASS_BITMAP_CACHE_MB_LOW);
   }
+  charge_ass_memory(ctx);
+  enforce_memory_budget(ctx);
+  return 0;
+}
 
-  reset_decoder(ctx);
-  if (ctx->buffer.data) {
-    av_freep(&ctx->buffer.data);
+// Builds the shared libass library (default font included) and a spare
+// renderer ahead of the first subtitle track, while the worker is idle.
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_prewarm(void) {
+  if (platform_is_split() && !platform_side_module(SUBTITLE_MODULE)) {
+    return FFMPEG_WASM_ERROR_NEED_MODULE;
   }
-  free(ctx);
+  if (!spare_ass_renderer) {
+    spare_ass_renderer = new_ass_renderer();
+  }
+  return spare_ass_renderer ? 0 : AVERROR(ENOMEM);
+}
+
+// 1 when "Inter" is compiled in and JS does not need to fetch and add it
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_has_default_font(void) {
+#ifdef FFMPEG_WASM_EMBEDDED_FONT
+  return 1;
+#else
+  return 0;
+#endif
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_append(uintptr_t handle, const uint8_t *data, int len) {
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_render_subtitles(uintptr_t handle, double pts_seconds) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx) {
-    av_log(NULL, AV_LOG_ERROR, "append: ctx is NULL\n");
-    return AVERROR(EINVAL);
-  }
-  if (!data) {
-    av_log(NULL, AV_LOG_ERROR, "append: data is NULL\n");
-    return AVERROR(EINVAL);
+  if (!ctx || !ctx->subtitles_enabled || !ctx->ass_renderer || !ctx->ass_track) {
+    return 0;
   }
-  if (len < 0) {
-    av_log(NULL, AV_LOG_ERROR, "append: len is negative (%d)\n", len);
-    return AVERROR(EINVAL);
+  if (!ctx->rgba_data[0] || ctx->rgba_width <= 0 || ctx->rgba_height <= 0) {
+    return 0;
   }
-  if (len == 0) {
+
+  ass_set_frame_size(ctx->ass_renderer, ctx->rgba_width, ctx->rgba_height);
+
+  int changed = 0;
+  ASS_Image *img = ass_render_frame(ctx->ass_renderer, ctx->ass_track,
+                                    (long long)(pts_seconds * 1000), &changed);
+  if (!img) {
+    int n = ctx->ass_track ? ctx->ass_track->n_events : 0;
+    long long first_start = -1;
+    long long first_end = -1;
+    if (ctx->ass_track && n > 0) {
+      ASS_Event *ev = &ctx->ass_track->events[0];
+      first_start = ev->Start;
+      first_end = ev->Start + ev->Duration;
+    }
+    platform_post_subtitle_debug("render returned null", n, (int)first_start, (int)first_end);
     return 0;
   }
 
-  size_t needed = ctx->buffer.start + ctx->buffer.size + (size_t)len;
-  int ret = ensure_capacity(&ctx->buffer, needed);
-  if (ret < 0) {
-    av_log(NULL, AV_LOG_ERROR, "append: ensure_capacity failed (%d), needed=%zu, start=%zu, size=%zu\n",
-           ret, needed, ctx->buffer.start, ctx->buffer.size);
-    return ret;
+  blend_ass_image(ctx->rgba_data[0], ctx->rgba_linesize[0],
+                  ctx->rgba_width, ctx->rgba_height, img);
+  return 1;
+}
+
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_subtitle_events_count(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->ass_track) {
+    return 0;
   }
+  return ctx->ass_track->n_events;
+}
 
-  memcpy(ctx->buffer.data + ctx->buffer.start + ctx->buffer.size, data, (size_t)len);
-  ctx->buffer.size += (size_t)len;
-  enforce_buffer_limit(&ctx->buffer);
-  if (ctx->avio) {
-    ctx->avio->eof_reached = 0;
-    ctx->avio->error = 0;
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_subtitle_first_start_ms(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (!ctx || !ctx->ass_track || ctx->ass_track->n_events <= 0) {
+    return -1;
   }
-  return len;
+  ASS_Event *ev = &ctx->ass_track->events[0];
+  return (int)ev->Start;
 }
 
-EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_set_eof(uintptr_t handle) {
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_subtitle_first_end_ms(uintptr_t handle) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (ctx) {
-    ctx->buffer.eof = 1;
-    if (ctx->avio) {
-      ctx->avio->eof_reached = 0;
-      ctx->avio->error = 0;
-    }
+  if (!ctx || !ctx->ass_track || ctx->ass_track->n_events <= 0) {
+    return -1;
   }
+  ASS_Event *ev = &ctx->ass_track->events[0];
+  return (int)(ev->Start + ev->Duration);
 }
 
-EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_set_keep_all(uintptr_t handle, int enabled) {
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_clear_subtitle_track(uintptr_t handle) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (ctx) {
-    ctx->buffer.keep_all = enabled ? 1 : 0;
+  if (!ctx || !ctx->ass_library) {
+    return;
+  }
+  if (ctx->ass_track) {
+    ass_free_track(ctx->ass_track);
+    ctx->ass_track = ass_new_track(ctx->ass_library);
+    if (ctx->ass_track && ctx->subtitle_codec &&
+        ctx->subtitle_codec->subtitle_header && ctx->subtitle_codec->subtitle_header_size > 0) {
+      ass_process_codec_private(ctx->ass_track, (char *)ctx->subtitle_codec->subtitle_header,
+                                ctx->subtitle_codec->subtitle_header_size);
+    }
   }
 }
 
-EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_set_buffer_limit(uintptr_t handle, int limit_bytes) {
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_set_memory_budget(uintptr_t handle, double budget_bytes) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
   if (!ctx) {
     return;
   }
-  if (limit_bytes <= 0) {
-    ctx->buffer.limit = 0;
-  } else {
-    ctx->buffer.limit = (size_t)limit_bytes;
+  ctx->mem.budget = clamp_size(budget_bytes);
+  if (ctx->mem.budget == 0) {
+    ctx->buffer.backlog = ctx->live_target > 0.0 ? 0 : DEFAULT_KEEP_BACKLOG;
   }
-  enforce_buffer_limit(&ctx->buffer);
+  enforce_memory_budget(ctx);
 }
 
-EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_set_file_size(uintptr_t handle, double size) {
+EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_memory_budget(uintptr_t handle) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (ctx) {
-    ctx->buffer.total_size = (int64_t)size;
-  }
+  return ctx ? (double)ctx->mem.budget : 0.0;
 }
 
-EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_set_buffer_offset(uintptr_t handle, double offset) {
+// category: FFMPEG_WASM_MEM_* or -1 for the context total
+EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_memory_current(uintptr_t handle, int category) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (ctx) {
-    ctx->buffer.offset = (int64_t)offset;
+  if (!ctx) {
+    return 0.0;
+  }
+  if (category < 0) {
+    return (double)ctx->mem.total;
+  }
+  if (category >= FFMPEG_WASM_MEM_CATEGORY_COUNT) {
+    return 0.0;
   }
+  return (double)ctx->mem.current[category];
 }
 
-EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_set_audio_enabled(uintptr_t handle, int enabled) {
+EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_memory_peak(uintptr_t handle, int category) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
   if (!ctx) {
-    return;
+    return 0.0;
   }
-  ctx->audio_enabled = enabled ? 1 : 0;
-  if (!ctx->audio_enabled) {
-    free_audio_buffers(ctx);
-    ctx->audio_eof = 1;
-    ctx->audio_flush_sent = 1;
-    if (ctx->audio_codec) {
-      avcodec_flush_buffers(ctx->audio_codec);
-    }
-  } else {
-    ctx->audio_eof = 0;
-    ctx->audio_flush_sent = 0;
-    if (ctx->audio_codec) {
-      avcodec_flush_buffers(ctx->audio_codec);
-    }
+  if (category < 0) {
+    return (double)ctx->mem.total_peak;
+  }
+  if (category >= FFMPEG_WASM_MEM_CATEGORY_COUNT) {
+    return 0.0;
   }
+  return (double)ctx->mem.peak[category];
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_open(uintptr_t handle, const char *format_name) {
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_memory_reset_peaks(uintptr_t handle) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
   if (!ctx) {
-    return AVERROR(EINVAL);
-  }
-  if (ctx->opened) {
-    return 0;
+    return;
   }
+  memcpy(ctx->mem.peak, ctx->mem.current, sizeof(ctx->mem.peak));
+  ctx->mem.total_peak = ctx->mem.total;
+}
 
-  ctx->buffer.read_pos = 0;
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_memory_over_budget(uintptr_t handle) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  return ctx ? mem_over_budget(&ctx->mem) : 0;
+}
 
-  const int avio_buffer_size = 32 * 1024;
-  uint8_t *avio_buffer = av_malloc(avio_buffer_size);
-  if (!avio_buffer) {
-    return AVERROR(ENOMEM);
+EMSCRIPTEN_KEEPALIVE uintptr_t ffmpeg_wasm_mosaic_create(int width, int height, int yuv) {
+  if (width <= 0 || height <= 0 || (yuv && ((width | height) & 1))) {
+    return 0;
   }
-
-  ctx->avio = avio_alloc_context(
-      avio_buffer,
-      avio_buffer_size,
-      0,
-      &ctx->buffer,
-      read_packet,
-      NULL,
-      seek_stream);
-  if (!ctx->avio) {
-    av_free(avio_buffer);
-    return AVERROR(ENOMEM);
+  FFmpegWasmMosaic *mosaic = (FFmpegWasmMosaic *)calloc(1, sizeof(FFmpegWasmMosaic));
+  if (!mosaic) {
+    return 0;
   }
-  // Disable seeking during open to prevent FFmpeg from seeking to find
-  // container metadata that isn't buffered yet. We'll enable it later
-  // once the file is opened and we can handle seek failures gracefully.
-  ctx->avio->seekable = 0;
-
-  ctx->fmt = avformat_alloc_context();
-  if (!ctx->fmt) {
-    reset_decoder(ctx);
-    return AVERROR(ENOMEM);
+  mosaic->width = width;
+  mosaic->height = height;
+  mosaic->format = yuv ? AV_PIX_FMT_YUV420P : AV_PIX_FMT_RGBA;
+  mosaic->size = av_image_alloc(mosaic->data, mosaic->linesize, width, height, mosaic->format, 1);
+  if (mosaic->size < 0) {
+    free(mosaic);
+    return 0;
   }
+  mosaic_fill_rect(mosaic, 0, 0, width, height);
 
-  ctx->fmt->pb = ctx->avio;
-  ctx->fmt->flags |= AVFMT_FLAG_CUSTOM_IO;
-  ctx->fmt->flags |= AVFMT_FLAG_NONBLOCK;
-
-  const AVInputFormat *input_format = NULL;
-  if (format_name && format_name[0]) {
-    input_format = av_find_input_format(format_name);
+  // One libass instance (fonts, glyph and bitmap caches) for every tile. Split
+  // builds need subtitles.wasm loaded before the mosaic is created.
+  if (platform_is_split() && !platform_side_module(SUBTITLE_MODULE)) {
+    av_freep(&mosaic->data[0]);
+    free(mosaic);
+    return 0;
   }
-
-  int ret = avformat_open_input(&ctx->fmt, NULL, input_format, NULL);
-  if (ret < 0) {
-    reset_decoder(ctx);
-    return ret;
+  mosaic->ass_renderer = new_ass_renderer();
+  if (!mosaic->ass_renderer) {
+    av_freep(&mosaic->data[0]);
+    free(mosaic);
+    return 0;
   }
+  mosaic->ass_library = shared_ass_library;
+  return (uintptr_t)mosaic;
+}
 
-  const AVCodec *video_decoder = NULL;
-  ret = av_find_best_stream(ctx->fmt, AVMEDIA_TYPE_VIDEO, -1, -1, &video_decoder, 0);
-  if (ret < 0 || !video_decoder) {
-    reset_decoder(ctx);
-    return ret < 0 ? ret : AVERROR_DECODER_NOT_FOUND;
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_mosaic_destroy(uintptr_t handle) {
+  FFmpegWasmMosaic *mosaic = (FFmpegWasmMosaic *)handle;
+  if (!mosaic) {
+    return;
   }
-
-  ctx->video_stream_index = ret;
-  AVStream *video_stream = ctx->fmt->streams[ctx->video_stream_index];
-  ctx->video_time_base = video_stream->time_base;
-
-  ctx->video_codec = avcodec_alloc_context3(video_decoder);
-  if (!ctx->video_codec) {
-    reset_decoder(ctx);
-    return AVERROR(ENOMEM);
+  for (int i = 0; i < MOSAIC_MAX_TILES; i++) {
+    mosaic_detach_tile(mosaic, i, 1);
   }
+  ass_renderer_done(mosaic->ass_renderer);
+  free_ass_fonts(&mosaic->ass_fonts);
+  av_freep(&mosaic->data[0]);
+  free(mosaic);
+}
 
-  ret = avcodec_parameters_to_context(ctx->video_codec, video_stream->codecpar);
-  if (ret < 0) {
-    reset_decoder(ctx);
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_mosaic_add_font(uintptr_t handle, const char *name, const uint8_t *data,
+                                                     size_t len) {
+  FFmpegWasmMosaic *mosaic = (FFmpegWasmMosaic *)handle;
+  if (!mosaic || !name || !data || len == 0 || len > INT_MAX) {
+    return AVERROR(EINVAL);
+  }
+  int ret = ass_fonts_add(&mosaic->ass_fonts, &mosaic->ass_renderer, name, data, (int)len);
+  if (ret <= 0) {
     return ret;
   }
+  mosaic->ass_library = mosaic->ass_fonts.library;
+  for (int i = 0; i < MOSAIC_MAX_TILES; i++) {
+    FFmpegWasmContext *ctx = mosaic->tiles[i].ctx;
+    if (ctx && ctx->ass_library) {
+      ctx->ass_library = mosaic->ass_library;  // Tiles borrow the renderer
+      ctx->ass_renderer = mosaic->ass_renderer;
+    }
+  }
+  return 0;
+}
 
-  ctx->video_codec->thread_count = 1;
-  ctx->video_codec->thread_type = 0;
+// Place a context in a tile. Its subtitles move to the shared libass
+// instance; tiles in a YUV atlas must be 2-pixel aligned. Returns the tile
+// index.
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_mosaic_attach(uintptr_t handle, uintptr_t ctx_handle, int x, int y,
+                                                   int width, int height) {
+  FFmpegWasmMosaic *mosaic = (FFmpegWasmMosaic *)handle;
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)ctx_handle;
+  if (!mosaic || !ctx || ctx->mosaic || width <= 0 || height <= 0 || x < 0 || y < 0 ||
+      x + width > mosaic->width || y + height > mosaic->height) {
+    return AVERROR(EINVAL);
+  }
+  if (mosaic->format == AV_PIX_FMT_YUV420P && ((x | y | width | height) & 1)) {
+    return AVERROR(EINVAL);
+  }
 
-  ret = avcodec_open2(ctx->video_codec, video_decoder, NULL);
-  if (ret < 0) {
-    reset_decoder(ctx);
-    return ret;
+  int index = -1;
+  for (int i = 0; i < MOSAIC_MAX_TILES; i++) {
+    if (!mosaic->tiles[i].ctx) {
+      index = i;
+      break;
+    }
+  }
+  if (index < 0) {
+    return AVERROR(ENOSPC);
   }
 
-  const AVCodec *audio_decoder = NULL;
-  ret = av_find_best_stream(ctx->fmt, AVMEDIA_TYPE_AUDIO, -1, -1, &audio_decoder, 0);
-  if (ret >= 0 && audio_decoder) {
-    ctx->audio_stream_index = ret;
-    AVStream *audio_stream = ctx->fmt->streams[ctx->audio_stream_index];
-    ctx->audio_time_base = audio_stream->time_base;
+  int subtitle_index = ctx->subtitles_enabled ? ctx->subtitle_stream_index : -1;
+  free_ass_renderer(ctx);
+  ctx->subtitles_enabled = 0;
+  ctx->mosaic = mosaic;
+  ctx->mosaic_tile = index;
+  if (ctx->opened && subtitle_index >= 0) {
+    reopen_subtitle_stream(ctx, subtitle_index);
+  }
+
+  MosaicTile *tile = &mosaic->tiles[index];
+  tile->ctx = ctx;
+  tile->x = x;
+  tile->y = y;
+  tile->width = width;
+  tile->height = height;
+  tile->src_fmt = AV_PIX_FMT_NONE;
+  tile->presented_serial = -1;
+  mosaic_fill_rect(mosaic, x, y, width, height);
+  return index;
+}
 
-    ctx->audio_codec = avcodec_alloc_context3(audio_decoder);
-    if (!ctx->audio_codec) {
-      reset_decoder(ctx);
-      return AVERROR(ENOMEM);
-    }
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_mosaic_detach(uintptr_t handle, int tile_index) {
+  FFmpegWasmMosaic *mosaic = (FFmpegWasmMosaic *)handle;
+  if (!mosaic || tile_index < 0 || tile_index >= MOSAIC_MAX_TILES) {
+    return;
+  }
+  mosaic_detach_tile(mosaic, tile_index, 1);
+}
 
-    ret = avcodec_parameters_to_context(ctx->audio_codec, audio_stream->codecpar);
-    if (ret < 0) {
-      reset_decoder(ctx);
-      return ret;
+static int mosaic_update_tile(FFmpegWasmMosaic *mosaic, MosaicTile *tile) {
+  FFmpegWasmContext *ctx = tile->ctx;
+  AVFrame *frame = ctx->video_frame;
+  int yuv = mosaic->format == AV_PIX_FMT_YUV420P;
+
+  if (!tile->sws || tile->src_width != frame->width || tile->src_height != frame->height ||
+      tile->src_fmt != frame->format) {
+    if (tile->sws) {
+      sws_freeContext(tile->sws);
+      tile->sws = NULL;
     }
 
-    ctx->audio_codec->thread_count = 1;
-    ctx->audio_codec->thread_type = 0;
+    // Aspect-fit inside the tile, letterboxed
+    double sar = frame->sample_aspect_ratio.num > 0 && frame->sample_aspect_ratio.den > 0
+                     ? av_q2d(frame->sample_aspect_ratio)
+                     : 1.0;
+    double aspect = frame->width * sar / frame->height;
+    int dst_width = tile->width;
+    int dst_height = (int)(tile->width / aspect + 0.5);
+    if (dst_height > tile->height) {
+      dst_height = tile->height;
+      dst_width = (int)(tile->height * aspect + 0.5);
+    }
+    if (yuv) {
+      dst_width &= ~1;
+      dst_height &= ~1;
+    }
+    if (dst_width < 2 || dst_height < 2) {
+      return AVERROR(EINVAL);
+    }
+    tile->dst_width = dst_width;
+    tile->dst_height = dst_height;
+    tile->dst_x = tile->x + (tile->width - dst_width) / 2;
+    tile->dst_y = tile->y + (tile->height - dst_height) / 2;
+    if (yuv) {
+      tile->dst_x &= ~1;
+      tile->dst_y &= ~1;
+    }
 
-    ret = avcodec_open2(ctx->audio_codec, audio_decoder, NULL);
-    if (ret < 0) {
-      reset_decoder(ctx);
-      return ret;
+    tile->sws = sws_getContext(frame->width, frame->height, (enum AVPixelFormat)frame->format,
+                               dst_width, dst_height, mosaic->format, SWS_BILINEAR, NULL, NULL, NULL);
+    if (!tile->sws) {
+      return AVERROR(ENOMEM);
     }
+    tile->src_width = frame->width;
+    tile->src_height = frame->height;
+    tile->src_fmt = (enum AVPixelFormat)frame->format;
+    mosaic_fill_rect(mosaic, tile->x, tile->y, tile->width, tile->height);
   }
 
-  ctx->packet = av_packet_alloc();
-  ctx->video_frame = av_frame_alloc();
-  ctx->audio_frame = av_frame_alloc();
-  if (!ctx->packet || !ctx->video_frame || !ctx->audio_frame) {
-    reset_decoder(ctx);
-    return AVERROR(ENOMEM);
+  uint8_t *dst[4] = {NULL, NULL, NULL, NULL};
+  if (yuv) {
+    dst[0] = mosaic->data[0] + tile->dst_y * mosaic->linesize[0] + tile->dst_x;
+    dst[1] = mosaic->data[1] + (tile->dst_y / 2) * mosaic->linesize[1] + tile->dst_x / 2;
+    dst[2] = mosaic->data[2] + (tile->dst_y / 2) * mosaic->linesize[2] + tile->dst_x / 2;
+  } else {
+    dst[0] = mosaic->data[0] + tile->dst_y * mosaic->linesize[0] + tile->dst_x * 4;
   }
-
-  ctx->opened = 1;
-  ctx->draining = 0;
-  ctx->video_eof = 0;
-  ctx->audio_eof = 0;
-  ctx->video_flush_sent = 0;
-  ctx->audio_flush_sent = 0;
-
-  // Now that file is opened, enable seeking for playback
-  // seek_stream will return -1 if position is outside buffered range
-  if (ctx->avio) {
-    ctx->avio->seekable = AVIO_SEEKABLE_NORMAL;
+  int lines = sws_scale(tile->sws, (const uint8_t *const *)frame->data, frame->linesize, 0,
+                        frame->height, dst, mosaic->linesize);
+  if (lines <= 0) {
+    return AVERROR(EINVAL);
   }
 
-  // Allow buffer compaction now that open succeeded
-  ctx->buffer.keep_all = 0;
-
+  // Subtitles are composited in RGBA atlases only. The shared renderer keeps
+  // its caches as long as tiles have the same size.
+  if (!yuv && ctx->subtitles_enabled && ctx->ass_track) {
+    ass_set_frame_size(mosaic->ass_renderer, tile->dst_width, tile->dst_height);
+    int changed = 0;
+    double pts = ffmpeg_wasm_frame_pts_seconds((uintptr_t)ctx);
+    ASS_Image *img = ass_render_frame(mosaic->ass_renderer, ctx->ass_track, (long long)(pts * 1000), &changed);
+    if (img) {
+      blend_ass_image(dst[0], mosaic->linesize[0], tile->dst_width, tile->dst_height, img);
+    }
+  }
   return 0;
 }
 
-EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_duration_seconds(uintptr_t handle) {
-  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx || !ctx->fmt) {
-    return 0.0;
-  }
-  if (ctx->fmt->duration != AV_NOPTS_VALUE && ctx->fmt->duration > 0) {
-    return ctx->fmt->duration / (double)AV_TIME_BASE;
+// Scale every tile whose context decoded a new video frame since the last
+// call into the atlas. Returns the number of tiles updated, so the caller can
+// skip the upload when nothing changed.
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_mosaic_present(uintptr_t handle) {
+  FFmpegWasmMosaic *mosaic = (FFmpegWasmMosaic *)handle;
+  if (!mosaic) {
+    return AVERROR(EINVAL);
   }
-
-  double best = 0.0;
-  for (unsigned int i = 0; i < ctx->fmt->nb_streams; i++) {
-    AVStream *stream = ctx->fmt->streams[i];
-    if (!stream) {
-      continue;
-    }
-    if (stream->duration == AV_NOPTS_VALUE || stream->duration <= 0) {
+  int updated = 0;
+  for (int i = 0; i < MOSAIC_MAX_TILES; i++) {
+    MosaicTile *tile = &mosaic->tiles[i];
+    FFmpegWasmContext *ctx = tile->ctx;
+    if (!ctx || !ctx->video_frame || ctx->video_frame->width <= 0 || ctx->video_frame->height <= 0 ||
+        ctx->video_frame_serial == tile->presented_serial) {
       continue;
     }
-    double seconds = stream->duration * av_q2d(stream->time_base);
-    if (seconds > best) {
-      best = seconds;
+    tile->presented_serial = ctx->video_frame_serial;
+    if (mosaic_update_tile(mosaic, tile) == 0) {
+      updated++;
     }
   }
-  return best;
+  return updated;
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_seek_seconds(uintptr_t handle, double seconds) {
-  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx || !ctx->fmt || !ctx->opened) {
-    return AVERROR(EINVAL);
+EMSCRIPTEN_KEEPALIVE uintptr_t ffmpeg_wasm_mosaic_data_ptr(uintptr_t handle, int plane) {
+  FFmpegWasmMosaic *mosaic = (FFmpegWasmMosaic *)handle;
+  if (!mosaic || plane < 0 || plane >= 4) {
+    return 0;
   }
+  return (uintptr_t)mosaic->data[plane];
+}
 
-  if (seconds < 0.0) {
-    seconds = 0.0;
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_mosaic_linesize(uintptr_t handle, int plane) {
+  FFmpegWasmMosaic *mosaic = (FFmpegWasmMosaic *)handle;
+  if (!mosaic || plane < 0 || plane >= 4) {
+    return 0;
   }
-  int64_t target = (int64_t)(seconds * AV_TIME_BASE);
-  // Allow seeking to a keyframe before or at the target, but not after.
-  // This ensures we don't overshoot and end up at a random future position.
-  int ret = avformat_seek_file(ctx->fmt, -1, INT64_MIN, target, target, 0);
-  if (ret < 0) {
-    return ret;
+  return mosaic->linesize[plane];
+}
+
+EMSCRIPTEN_KEEPALIVE size_t ffmpeg_wasm_mosaic_size(uintptr_t handle) {
+  FFmpegWasmMosaic *mosaic = (FFmpegWasmMosaic *)handle;
+  return mosaic && mosaic->size > 0 ? (size_t)mosaic->size : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_set_remux_only(uintptr_t handle, int enabled) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (ctx && !ctx->opened) {
+    ctx->remux_only = enabled ? 1 : 0;
   }
+}
 
-  if (ctx->video_codec) {
-    avcodec_flush_buffers(ctx->video_codec);
+static int remux_write_data_type(void *opaque, const uint8_t *buf, int buf_size,
+                                 enum AVIODataMarkerType type, int64_t time) {
+  RemuxState *remux = (RemuxState *)opaque;
+  if (type == AVIO_DATA_MARKER_HEADER) {
+    if (!remux->in_header) {
+      remux->in_header = 1;
+      byte_queue_consume(&remux->init, remux->init.size);
+    }
+    return byte_queue_push(&remux->init, buf, (size_t)buf_size) < 0 ? AVERROR(ENOMEM) : buf_size;
   }
-  if (ctx->audio_codec) {
-    avcodec_flush_buffers(ctx->audio_codec);
+  if (remux->in_header) {
+    remux->in_header = 0;
+    remux->init_serial++;
   }
+  return byte_queue_push(&remux->media, buf, (size_t)buf_size) < 0 ? AVERROR(ENOMEM) : buf_size;
+}
 
-  ctx->draining = 0;
-  ctx->video_eof = 0;
-  ctx->audio_eof = 0;
-  ctx->video_flush_sent = 0;
-  ctx->audio_flush_sent = 0;
-  return 0;
+static int remux_write_packet(void *opaque, const uint8_t *buf, int buf_size) {
+  return remux_write_data_type(opaque, buf, buf_size, AVIO_DATA_MARKER_UNKNOWN, AV_NOPTS_VALUE);
 }
 
-// Prepare for re-streaming from a new byte offset.
-// Keeps format context and codecs intact, just flushes buffers and resets stream position.
-// JS should call this, then stream new data from file.slice(new_offset).
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_prepare_restream(uintptr_t handle, double new_byte_offset) {
-  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx || !ctx->fmt || !ctx->opened) {
-    return AVERROR(EINVAL);
+// Codecs MSE can take in fragmented MP4
+static int remux_codec_supported(enum AVCodecID id) {
+  switch (id) {
+    case AV_CODEC_ID_H264:
+    case AV_CODEC_ID_HEVC:
+    case AV_CODEC_ID_AV1:
+    case AV_CODEC_ID_VP9:
+    case AV_CODEC_ID_AAC:
+    case AV_CODEC_ID_MP3:
+    case AV_CODEC_ID_OPUS:
+    case AV_CODEC_ID_FLAC:
+    case AV_CODEC_ID_AC3:
+    case AV_CODEC_ID_EAC3:
+      return 1;
+    default:
+      return 0;
   }
+}
 
-  int64_t byte_pos = (int64_t)new_byte_offset;
+// Find the first SPS in Annex B data (MPEG-TS input has no avcC)
+static const uint8_t *find_h264_sps(const uint8_t *data, int size) {
+  for (int i = 0; i + 6 < size; i++) {
+    if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1 && (data[i + 3] & 0x1F) == 7) {
+      return data + i + 4;
+    }
+  }
+  return NULL;
+}
 
-  // Flush codec buffers
-  if (ctx->video_codec) {
-    avcodec_flush_buffers(ctx->video_codec);
+// Fill sample rate, layout and profile from an ADTS header when the demuxer
+// did not (MPEG-TS without avformat_find_stream_info). The muxer needs them
+// for the moov; aac_adtstoasc is inserted automatically for the payload.
+static void fill_params_from_adts(AVCodecParameters *par, const AVPacket *pkt) {
+  static const int rates[] = {96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050,
+                              16000, 12000, 11025, 8000,  7350};
+  if (!pkt || pkt->size < 7 || pkt->data[0] != 0xFF || (pkt->data[1] & 0xF6) != 0xF0) {
+    return;
   }
-  if (ctx->audio_codec) {
-    avcodec_flush_buffers(ctx->audio_codec);
+  int rate_index = (pkt->data[2] >> 2) & 0x0F;
+  int channels = ((pkt->data[2] & 0x01) << 2) | (pkt->data[3] >> 6);
+  if (par->sample_rate <= 0 && rate_index < (int)(sizeof(rates) / sizeof(rates[0]))) {
+    par->sample_rate = rates[rate_index];
+  }
+  if (par->ch_layout.nb_channels <= 0 && channels > 0) {
+    av_channel_layout_default(&par->ch_layout, channels == 7 ? 8 : channels);
   }
+  if (par->profile < 0) {
+    par->profile = pkt->data[2] >> 6;  // Object type - 1
+  }
+}
 
-  // Clear stream buffer but keep it allocated
-  ctx->buffer.start = 0;
-  ctx->buffer.size = 0;
-  ctx->buffer.read_pos = 0;
-  ctx->buffer.eof = 0;
-  ctx->buffer.offset = byte_pos;
+// RFC 6381 codec string for MediaSource.isTypeSupported / addSourceBuffer
+static int remux_codec_string(const AVCodecParameters *par, const AVPacket *first, char *out, size_t size) {
+  const uint8_t *ext = par->extradata;
+  int ext_size = par->extradata_size;
+  switch (par->codec_id) {
+    case AV_CODEC_ID_H264: {
+      const uint8_t *sps = NULL;
+      if (ext && ext_size >= 4 && ext[0] == 1) {
+        sps = ext + 1;  // avcC: profile, compatibility, level
+      } else if (ext && ext_size > 0) {
+        sps = find_h264_sps(ext, ext_size);
+      }
+      if (!sps && first) {
+        sps = find_h264_sps(first->data, first->size);
+      }
+      if (sps) {
+        snprintf(out, size, "avc1.%02X%02X%02X", sps[0], sps[1], sps[2]);
+      } else {
+        snprintf(out, size, "avc1.%02X00%02X", par->profile > 0 ? par->profile : 0x64,
+                 par->level > 0 ? par->level : 0x28);
+      }
+      return 0;
+    }
+    case AV_CODEC_ID_HEVC: {
+      int profile = par->profile > 0 ? par->profile : 1;
+      int tier = 0;
+      uint32_t compat = profile == 1 ? 0x60000000 : 0x20000000;
+      int level = par->level > 0 ? par->level : 93;
+      uint8_t constraints[6] = {0xB0};  // progressive_source, frame_only
+      if (ext && ext_size >= 13 && ext[0] == 1) {
+        profile = ext[1] & 0x1F;
+        tier = (ext[1] >> 5) & 1;
+        compat = ((uint32_t)ext[2] << 24) | ((uint32_t)ext[3] << 16) | ((uint32_t)ext[4] << 8) | ext[5];
+        memcpy(constraints, ext + 6, sizeof(constraints));
+        level = ext[12];
+      }
+      uint32_t reversed = 0;
+      for (int i = 0; i < 32; i++) {
+        reversed |= ((compat >> i) & 1u) << (31 - i);
+      }
+      int len = snprintf(out, size, "hvc1.%d.%X.%c%d", profile, reversed, tier ? 'H' : 'L', level);
+      // Constraint bytes as hex, trailing zero bytes omitted (ISO/IEC 14496-15 E.3)
+      int nb_constraints = sizeof(constraints);
+      while (nb_constraints > 0 && !constraints[nb_constraints - 1]) {
+        nb_constraints--;
+      }
+      for (int i = 0; i < nb_constraints && len > 0 && (size_t)len < size; i++) {
+        len += snprintf(out + len, size - len, ".%X", constraints[i]);
+      }
+      return 0;
+    }
+    case AV_CODEC_ID_AV1: {
+      int profile = par->profile > 0 ? par->profile : 0;
+      int level = par->level > 0 ? par->level : 8;
+      int tier = 0;
+      int depth = par->bits_per_raw_sample == 10 ? 10 : 8;
+      if (ext && ext_size >= 4 && (ext[0] & 0x7F) == 1) {
+        profile = ext[1] >> 5;
+        level = ext[1] & 0x1F;
+        tier = ext[2] >> 7;
+        depth = (ext[2] & 0x40) ? ((ext[2] & 0x20) ? 12 : 10) : 8;
+      }
+      snprintf(out, size, "av01.%d.%02d%c.%02d", profile, level, tier ? 'H' : 'M', depth);
+      return 0;
+    }
+    case AV_CODEC_ID_VP9:
+      snprintf(out, size, "vp09.%02d.%02d.%02d", par->profile > 0 ? par->profile : 0,
+               par->level > 0 ? par->level : 10, par->bits_per_raw_sample == 10 ? 10 : 8);
+      return 0;
+    case AV_CODEC_ID_AAC: {
+      int object_type = par->profile >= 0 ? par->profile + 1 : 2;
+      if (ext && ext_size >= 1) {
+        object_type = ext[0] >> 3;  // AudioSpecificConfig
+      }
+      snprintf(out, size, "mp4a.40.%d", object_type > 0 ? object_type : 2);
+      return 0;
+    }
+    case AV_CODEC_ID_MP3:
+      snprintf(out, size, "mp4a.6B");
+      return 0;
+    case AV_CODEC_ID_OPUS:
+      snprintf(out, size, "opus");
+      return 0;
+    case AV_CODEC_ID_FLAC:
+      snprintf(out, size, "flac");
+      return 0;
+    case AV_CODEC_ID_AC3:
+      snprintf(out, size, "ac-3");
+      return 0;
+    case AV_CODEC_ID_EAC3:
+      snprintf(out, size, "ec-3");
+      return 0;
+    default:
+      return AVERROR(ENOSYS);
+  }
+}
 
-  // Reset EOF/draining state
-  ctx->draining = 0;
-  ctx->video_eof = 0;
-  ctx->audio_eof = 0;
-  ctx->video_flush_sent = 0;
-  ctx->audio_flush_sent = 0;
+static const AVPacket *remux_first_pending(RemuxState *remux, int out_index) {
+  for (int i = 0; i < remux->nb_pending; i++) {
+    if (remux->pending[i]->stream_index == out_index) {
+      return remux->pending[i];
+    }
+  }
+  return NULL;
+}
 
-  // Tell FFmpeg's AVIO layer about the new position
-  // This is critical - without this, FFmpeg will try to read from the old position
-  if (ctx->avio) {
-    ctx->avio->pos = byte_pos;
-    // Clear any internal AVIO buffer
-    ctx->avio->buf_ptr = ctx->avio->buffer;
-    ctx->avio->buf_end = ctx->avio->buffer;
+static int remux_write_header(FFmpegWasmContext *ctx) {
+  RemuxState *remux = ctx->remux;
+  char codecs[2][48] = {{0}};
+  int nb_codecs = 0;
+
+  for (int i = 0; i < remux->nb_input_streams; i++) {
+    int out = remux->stream_map[i];
+    if (out < 0) {
+      continue;
+    }
+    AVStream *ist = ctx->fmt->streams[i];
+    AVStream *ost = remux->ofmt->streams[out];
+    int ret = avcodec_parameters_copy(ost->codecpar, ist->codecpar);
+    if (ret < 0) {
+      return ret;
+    }
+    ost->codecpar->codec_tag = 0;
+    const AVPacket *first = remux_first_pending(remux, out);
+    if (ost->codecpar->codec_id == AV_CODEC_ID_AAC && !ost->codecpar->extradata_size) {
+      fill_params_from_adts(ost->codecpar, first);
+    } else if (ost->codecpar->codec_id == AV_CODEC_ID_HEVC) {
+      ost->codecpar->codec_tag = MKTAG('h', 'v', 'c', '1');  // Required by Safari, accepted everywhere
+    }
+    ret = remux_codec_string(ost->codecpar, first, codecs[nb_codecs], sizeof(codecs[0]));
+    if (ret < 0) {
+      return ret;
+    }
+    nb_codecs++;
   }
 
+  snprintf(remux->mime, sizeof(remux->mime), "%s/mp4; codecs=\"%s%s%s\"",
+           remux->has_video ? "video" : "audio", codecs[0], nb_codecs > 1 ? "," : "",
+           nb_codecs > 1 ? codecs[1] : "");
+
+  // delay_moov lets the muxer take SPS/PPS from the first packet when the
+  // input (MPEG-TS) carries them in-band only. frag_discont keeps source
+  // timestamps in tfdt so fragments land at the right media time after a seek.
+  // skip_trailer drops the mfra box, which SourceBuffers do not expect.
+  AVDictionary *opts = NULL;
+  if (remux->has_video) {
+    av_dict_set(&opts, "movflags", "frag_keyframe+empty_moov+default_base_moof+delay_moov+frag_discont+skip_trailer", 0);
+  } else {
+    // Every audio packet is a keyframe; cut by time instead
+    av_dict_set(&opts, "movflags", "empty_moov+default_base_moof+delay_moov+frag_discont+skip_trailer", 0);
+    av_dict_set(&opts, "frag_duration", "1000000", 0);
+  }
+  av_dict_set(&opts, "use_editlist", "0", 0);
+  int ret = avformat_write_header(remux->ofmt, &opts);
+  av_dict_free(&opts);
+  if (ret < 0) {
+    return ret;
+  }
+  remux->header_written = 1;
+
+  for (int i = 0; i < remux->nb_pending; i++) {
+    AVPacket *pkt = remux->pending[i];
+    AVStream *ost = remux->ofmt->streams[pkt->stream_index];
+    av_packet_rescale_ts(pkt, pkt->time_base, ost->time_base);
+    ret = av_interleaved_write_frame(remux->ofmt, pkt);
+    av_packet_free(&remux->pending[i]);
+    if (ret < 0) {
+      remux_drop_pending(remux);
+      return ret;
+    }
+  }
+  remux->nb_pending = 0;
   return 0;
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_read_frame(uintptr_t handle) {
+// Start (or restart after a seek) remuxing the selected streams to
+// fragmented MP4. flags: 1 = video, 2 = audio. Fails with AVERROR(ENOSYS)
+// when a selected codec has no MSE mapping, so the caller can fall back to
+// wasm decoding.
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_remux_start(uintptr_t handle, int flags) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx || !ctx->opened || !ctx->video_codec || !ctx->fmt) {
+  if (!ctx || !ctx->fmt || !ctx->opened || !ctx->packet) {
     return AVERROR(EINVAL);
   }
+  free_remux(ctx);
+  packet_cache_clear(ctx);
 
-  int ret = AVERROR(EAGAIN);
-  if (ctx->audio_enabled && ctx->audio_codec) {
-    ret = receive_audio_frame(ctx);
-    if (ret == 2) {
-      return 2;
-    }
-    if (ret < 0 && ret != AVERROR(EAGAIN)) {
-      return ret;
-    }
+  const AVOutputFormat *oformat = av_guess_format("mp4", NULL, NULL);
+  if (!oformat) {
+    return AVERROR_MUXER_NOT_FOUND;
   }
 
-  ret = receive_video_frame(ctx);
-  if (ret == 1) {
-    return 1;
+  RemuxState *remux = av_mallocz(sizeof(RemuxState));
+  if (!remux) {
+    return AVERROR(ENOMEM);
   }
-  if (ret < 0 && ret != AVERROR(EAGAIN)) {
+  ctx->remux = remux;
+  remux->nb_input_streams = (int)ctx->fmt->nb_streams;
+  remux->stream_map = av_malloc_array(remux->nb_input_streams, sizeof(int));
+  int ret = remux->stream_map ? avformat_alloc_output_context2(&remux->ofmt, oformat, NULL, NULL)
+                              : AVERROR(ENOMEM);
+  if (ret < 0) {
+    free_remux(ctx);
     return ret;
   }
+  remux->ofmt->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;  // Opus/FLAC in MP4
 
-  if (ctx->draining && (ctx->video_eof || !ctx->video_codec) &&
-      (ctx->audio_eof || !ctx->audio_codec || !ctx->audio_enabled)) {
-    return -1;
+  int selected[2] = {
+      (flags & 1) ? ctx->video_stream_index : -1,
+      (flags & 2) && ctx->audio_enabled ? ctx->audio_stream_index : -1,
+  };
+  for (int i = 0; i < remux->nb_input_streams; i++) {
+    remux->stream_map[i] = -1;
   }
-
-  for (;;) {
-    ret = av_read_frame(ctx->fmt, ctx->packet);
-    if (ret == AVERROR_EOF) {
-      ctx->draining = 1;
-      if (ctx->video_codec && !ctx->video_flush_sent) {
-        ctx->video_flush_sent = 1;
-        avcodec_send_packet(ctx->video_codec, NULL);
-      }
-      if (ctx->audio_enabled && ctx->audio_codec && !ctx->audio_flush_sent) {
-        ctx->audio_flush_sent = 1;
-        avcodec_send_packet(ctx->audio_codec, NULL);
-      }
+  for (int i = 0; i < 2; i++) {
+    if (selected[i] < 0) {
       continue;
     }
-    if (ret == AVERROR(EAGAIN)) {
-      return 0;
+    AVStream *ist = ctx->fmt->streams[selected[i]];
+    if (!remux_codec_supported(ist->codecpar->codec_id) ||
+        avformat_query_codec(oformat, ist->codecpar->codec_id, FF_COMPLIANCE_EXPERIMENTAL) != 1) {
+      free_remux(ctx);
+      return AVERROR(ENOSYS);
     }
-    if (ret < 0) {
-      return ret;
+    AVStream *ost = avformat_new_stream(remux->ofmt, NULL);
+    if (!ost) {
+      free_remux(ctx);
+      return AVERROR(ENOMEM);
     }
+    ost->time_base = ist->time_base;
+    remux->stream_map[selected[i]] = ost->index;
+    if (i == 0) {
+      remux->has_video = 1;
+    }
+  }
+  if (remux->ofmt->nb_streams == 0) {
+    free_remux(ctx);
+    return AVERROR_STREAM_NOT_FOUND;
+  }
 
-    if (ctx->packet->stream_index == ctx->video_stream_index) {
-      ret = avcodec_send_packet(ctx->video_codec, ctx->packet);
-      av_packet_unref(ctx->packet);
-      if (ret == AVERROR(EAGAIN)) {
-        ret = receive_video_frame(ctx);
-        if (ret == 1) {
-          return 1;
-        }
-        if (ret < 0 && ret != AVERROR(EAGAIN)) {
-          return ret;
-        }
-      } else if (ret < 0) {
-        return ret;
-      }
-    } else if (ctx->packet->stream_index == ctx->audio_stream_index) {
-      if (ctx->audio_enabled && ctx->audio_codec) {
-        ret = avcodec_send_packet(ctx->audio_codec, ctx->packet);
-        av_packet_unref(ctx->packet);
-        if (ret == AVERROR(EAGAIN)) {
-          ret = receive_audio_frame(ctx);
-          if (ret == 2) {
-            return 2;
-          }
-          if (ret < 0 && ret != AVERROR(EAGAIN)) {
-            return ret;
-          }
-        } else if (ret < 0) {
+  uint8_t *avio_buffer = av_malloc(REMUX_AVIO_BUFFER_SIZE);
+  remux->avio = avio_buffer ? avio_alloc_context(avio_buffer, REMUX_AVIO_BUFFER_SIZE, 1, remux, NULL,
+                                                 remux_write_packet, NULL)
+                            : NULL;
+  if (!remux->avio) {
+    av_free(avio_buffer);
+    free_remux(ctx);
+    return AVERROR(ENOMEM);
+  }
+  remux->avio->write_data_type = remux_write_data_type;
+  remux->avio->seekable = 0;
+  remux->ofmt->pb = remux->avio;
+  return 0;
+}
+
+// Move up to max_packets demuxed packets into the muxer. Returns packets
+// read (> 0), 0 when more input is needed, -1 once the trailer is written.
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_remux_step(uintptr_t handle, int max_packets) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  RemuxState *remux = ctx ? ctx->remux : NULL;
+  if (!remux) {
+    return AVERROR(EINVAL);
+  }
+  if (remux->error < 0) {
+    return remux->error;
+  }
+  if (remux->finished) {
+    return -1;
+  }
+
+  int processed = 0;
+  while (processed < max_packets) {
+    int ret = av_read_frame(ctx->fmt, ctx->packet);
+    if (ret == AVERROR(EAGAIN)) {
+      return processed;
+    }
+    if (ret == AVERROR_EOF) {
+      if (!remux->header_written) {
+        ret = remux_write_header(ctx);
+        if (ret < 0) {
+          remux_drop_pending(remux);
+          remux->error = ret;
           return ret;
         }
-      } else {
-        av_packet_unref(ctx->packet);
       }
-    } else if (ctx->packet->stream_index == ctx->subtitle_stream_index) {
-      if (ctx->subtitles_enabled && ctx->subtitle_codec) {
-        process_subtitle_packet(ctx, ctx->packet);
+      ret = av_write_trailer(remux->ofmt);
+      if (ret < 0) {
+        return ret;
       }
-      av_packet_unref(ctx->packet);
-    } else {
-      av_packet_unref(ctx->packet);
+      avio_flush(remux->avio);
+      remux->finished = 1;
+      return -1;
     }
+    if (ret < 0) {
+      return ret;
+    }
+    processed++;
 
-    if (ctx->audio_enabled && ctx->audio_codec) {
-      ret = receive_audio_frame(ctx);
-      if (ret == 2) {
-        return 2;
+    AVPacket *pkt = ctx->packet;
+    int in = pkt->stream_index;
+    int out = (in >= 0 && in < remux->nb_input_streams) ? remux->stream_map[in] : -1;
+    if (out < 0) {
+      av_packet_unref(pkt);
+      continue;
+    }
+    pkt->stream_index = out;
+    pkt->time_base = ctx->fmt->streams[in]->time_base;
+    pkt->pos = -1;
+
+    if (!remux->header_written) {
+      AVPacket *held = av_packet_alloc();
+      if (!held) {
+        av_packet_unref(pkt);
+        return AVERROR(ENOMEM);
       }
-      if (ret < 0 && ret != AVERROR(EAGAIN)) {
-        return ret;
+      av_packet_move_ref(held, pkt);
+      remux->pending[remux->nb_pending++] = held;
+      remux->seen_mask |= 1u << out;
+      if (remux->seen_mask == (1u << remux->ofmt->nb_streams) - 1 ||
+          remux->nb_pending == REMUX_PROBE_PACKETS) {
+        ret = remux_write_header(ctx);
+        if (ret < 0) {
+          // pending[] is full; never append to it again
+          remux_drop_pending(remux);
+          remux->error = ret;
+          return ret;
+        }
       }
+      continue;
     }
 
-    ret = receive_video_frame(ctx);
-    if (ret == 1) {
-      return 1;
-    }
-    if (ret < 0 && ret != AVERROR(EAGAIN)) {
+    av_packet_rescale_ts(pkt, pkt->time_base, remux->ofmt->streams[out]->time_base);
+    ret = av_interleaved_write_frame(remux->ofmt, pkt);
+    if (ret < 0) {
       return ret;
     }
-
-    if (ctx->draining && (ctx->video_eof || !ctx->video_codec) &&
-        (ctx->audio_eof || !ctx->audio_codec || !ctx->audio_enabled)) {
-      return -1;
-    }
   }
+  return processed;
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_read_video_frame(uintptr_t handle) {
-  for (;;) {
-    int ret = ffmpeg_wasm_read_frame(handle);
-    if (ret == 1 || ret <= 0) {
-      return ret;
-    }
-  }
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_remux_stop(uintptr_t handle) {
+  free_remux((FFmpegWasmContext *)handle);
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_video_width(uintptr_t handle) {
+EMSCRIPTEN_KEEPALIVE const char *ffmpeg_wasm_remux_mime(uintptr_t handle) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  return (ctx && ctx->video_codec) ? ctx->video_codec->width : 0;
+  return (ctx && ctx->remux && ctx->remux->header_written) ? ctx->remux->mime : "";
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_video_height(uintptr_t handle) {
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_remux_init_serial(uintptr_t handle) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  return (ctx && ctx->video_codec) ? ctx->video_codec->height : 0;
+  return (ctx && ctx->remux) ? ctx->remux->init_serial : 0;
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_frame_format(uintptr_t handle) {
+// The init segment stays available until the next restart so a
+// SourceBuffer can be re-created at any time.
+EMSCRIPTEN_KEEPALIVE uintptr_t ffmpeg_wasm_remux_init_ptr(uintptr_t handle) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  return (ctx && ctx->video_frame) ? ctx->video_frame->format : AV_PIX_FMT_NONE;
+  if (!ctx || !ctx->remux || ctx->remux->init_serial == 0) {
+    return 0;
+  }
+  return (uintptr_t)(ctx->remux->init.data + ctx->remux->init.start);
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_frame_data_ptr(uintptr_t handle, int plane) {
+EMSCRIPTEN_KEEPALIVE size_t ffmpeg_wasm_remux_init_size(uintptr_t handle) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx || !ctx->video_frame || plane < 0 || plane >= 4) {
+  if (!ctx || !ctx->remux || ctx->remux->init_serial == 0) {
     return 0;
   }
-  return (int)(uintptr_t)ctx->video_frame->data[plane];
+  return ctx->remux->init.size;
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_frame_linesize(uintptr_t handle, int plane) {
+EMSCRIPTEN_KEEPALIVE uintptr_t ffmpeg_wasm_remux_output_ptr(uintptr_t handle) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx || !ctx->video_frame || plane < 0 || plane >= 4) {
+  if (!ctx || !ctx->remux || !ctx->remux->media.data) {
     return 0;
   }
-  return ctx->video_frame->linesize[plane];
+  return (uintptr_t)(ctx->remux->media.data + ctx->remux->media.start);
 }
 
-EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_frame_pts_seconds(uintptr_t handle) {
+EMSCRIPTEN_KEEPALIVE size_t ffmpeg_wasm_remux_output_size(uintptr_t handle) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx || !ctx->video_frame || ctx->video_time_base.den == 0) {
-    return 0.0;
-  }
-  int64_t pts = ctx->video_frame->best_effort_timestamp;
-  if (pts == AV_NOPTS_VALUE) {
-    return 0.0;
-  }
-  return pts * av_q2d(ctx->video_time_base);
+  return (ctx && ctx->remux) ? ctx->remux->media.size : 0;
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_frame_to_rgba(uintptr_t handle) {
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_remux_consume(uintptr_t handle, size_t bytes) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx || !ctx->video_frame || ctx->video_frame->width <= 0 ||
-      ctx->video_frame->height <= 0) {
-    return AVERROR(EINVAL);
+  if (ctx && ctx->remux && bytes > 0) {
+    byte_queue_consume(&ctx->remux->media, bytes);
   }
+}
 
-  if (!ctx->sws || ctx->rgba_width != ctx->video_frame->width ||
-      ctx->rgba_height != ctx->video_frame->height ||
-      ctx->rgba_src_fmt != ctx->video_frame->format) {
-    if (ctx->sws) {
-      sws_freeContext(ctx->sws);
-      ctx->sws = NULL;
-    }
-    free_rgba_buffers(ctx);
-
-    ctx->sws = sws_getContext(
-        ctx->video_frame->width,
-        ctx->video_frame->height,
-        (enum AVPixelFormat)ctx->video_frame->format,
-        ctx->video_frame->width,
-        ctx->video_frame->height,
-        AV_PIX_FMT_RGBA,
-        SWS_BILINEAR,
-        NULL,
-        NULL,
-        NULL);
-    if (!ctx->sws) {
-      return AVERROR(ENOMEM);
+static int chunked_write(void *opaque, const uint8_t *buf, int buf_size) {
+  ChunkedOutput *out = (ChunkedOutput *)opaque;
+  int written = 0;
+  while (written < buf_size) {
+    int index = (int)(out->pos / EXPORT_CHUNK_SIZE);
+    int offset = (int)(out->pos % EXPORT_CHUNK_SIZE);
+    if (index >= out->nb_chunks) {
+      uint8_t **chunks = av_realloc_array(out->chunks, (size_t)index + 1, sizeof(*chunks));
+      if (!chunks) {
+        return AVERROR(ENOMEM);
+      }
+      out->chunks = chunks;
+      while (out->nb_chunks <= index) {
+        out->chunks[out->nb_chunks] = av_malloc(EXPORT_CHUNK_SIZE);
+        if (!out->chunks[out->nb_chunks]) {
+          return AVERROR(ENOMEM);
+        }
+        out->nb_chunks++;
+      }
     }
-
-    ctx->rgba_size = av_image_alloc(
-        ctx->rgba_data,
-        ctx->rgba_linesize,
-        ctx->video_frame->width,
-        ctx->video_frame->height,
-        AV_PIX_FMT_RGBA,
-        1);
-    if (ctx->rgba_size < 0) {
-      free_rgba_buffers(ctx);
-      return ctx->rgba_size;
+    int len = buf_size - written;
+    if (len > EXPORT_CHUNK_SIZE - offset) {
+      len = EXPORT_CHUNK_SIZE - offset;
     }
-
-    ctx->rgba_width = ctx->video_frame->width;
-    ctx->rgba_height = ctx->video_frame->height;
-    ctx->rgba_src_fmt = (enum AVPixelFormat)ctx->video_frame->format;
+    memcpy(out->chunks[index] + offset, buf + written, (size_t)len);
+    written += len;
+    out->pos += len;
   }
-
-  int lines = sws_scale(
-      ctx->sws,
-      (const uint8_t *const *)ctx->video_frame->data,
-      ctx->video_frame->linesize,
-      0,
-      ctx->video_frame->height,
-      ctx->rgba_data,
-      ctx->rgba_linesize);
-  if (lines <= 0) {
-    return AVERROR(EINVAL);
+  if (out->pos > out->size) {
+    out->size = out->pos;
   }
-
-  return 1;
+  return buf_size;
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_rgba_ptr(uintptr_t handle) {
-  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  return (ctx && ctx->rgba_data[0]) ? (int)(uintptr_t)ctx->rgba_data[0] : 0;
+static int64_t chunked_seek(void *opaque, int64_t offset, int whence) {
+  ChunkedOutput *out = (ChunkedOutput *)opaque;
+  int64_t pos;
+  switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+      return out->size;
+    case SEEK_SET:
+      pos = offset;
+      break;
+    case SEEK_CUR:
+      pos = out->pos + offset;
+      break;
+    case SEEK_END:
+      pos = out->size + offset;
+      break;
+    default:
+      return -1;
+  }
+  if (pos < 0 || pos > out->size) {
+    return -1;
+  }
+  out->pos = pos;
+  return pos;
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_rgba_stride(uintptr_t handle) {
-  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  return (ctx && ctx->rgba_data[0]) ? ctx->rgba_linesize[0] : 0;
+static int64_t export_packet_us(const AVPacket *pkt, AVRational time_base) {
+  int64_t ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+  return ts == AV_NOPTS_VALUE ? AV_NOPTS_VALUE : av_rescale_q(ts, time_base, AV_TIME_BASE_Q);
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_rgba_size(uintptr_t handle) {
-  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  return ctx ? ctx->rgba_size : 0;
+static const AVPacket *export_first_held(ExportJob *job, int stream_index) {
+  for (int i = 0; i < job->nb_gop; i++) {
+    if (job->gop[i]->stream_index == stream_index) {
+      return job->gop[i];
+    }
+  }
+  return NULL;
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_audio_channels(uintptr_t handle) {
-  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  return ctx ? ctx->audio_channels : 0;
+static int export_write_header(FFmpegWasmContext *ctx, ExportJob *job) {
+  for (int i = 0; i < job->nb_input_streams; i++) {
+    int out = job->stream_map[i];
+    if (out < 0) {
+      continue;
+    }
+    AVStream *ist = ctx->fmt->streams[i];
+    AVStream *ost = job->ofmt->streams[out];
+    int ret = avcodec_parameters_copy(ost->codecpar, ist->codecpar);
+    if (ret < 0) {
+      return ret;
+    }
+    ost->codecpar->codec_tag = 0;
+    if (ost->codecpar->codec_id == AV_CODEC_ID_AAC && !ost->codecpar->extradata_size) {
+      fill_params_from_adts(ost->codecpar, export_first_held(job, i));
+    }
+    ost->time_base = ist->time_base;
+    ost->disposition = ist->disposition;
+    av_dict_copy(&ost->metadata, ist->metadata, 0);  // Keep language and title
+  }
+  int ret = avformat_write_header(job->ofmt, NULL);
+  if (ret < 0) {
+    return ret;
+  }
+  job->header_written = 1;
+  return 0;
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_audio_sample_rate(uintptr_t handle) {
-  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  return ctx ? ctx->audio_sample_rate : 0;
+// Video ends at the first packet whose pts and dts are both at or past end,
+// so the clip is a decode-order prefix: a reference frame shown after end is
+// kept when B-frames before end, decoded later, depend on it.
+static int export_past_end(ExportJob *job, const AVPacket *pkt, AVRational in_tb, int64_t ts_us) {
+  if (job->ended_mask & (1u << job->stream_map[pkt->stream_index])) {
+    return 1;
+  }
+  if (ts_us == AV_NOPTS_VALUE || ts_us < job->end_us) {
+    return 0;
+  }
+  if (pkt->stream_index == job->video_in && pkt->dts != AV_NOPTS_VALUE) {
+    return av_rescale_q(pkt->dts, in_tb, AV_TIME_BASE_Q) >= job->end_us;
+  }
+  return 1;
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_audio_nb_samples(uintptr_t handle) {
-  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  return ctx ? ctx->audio_nb_samples : 0;
-}
+// Write one input packet shifted so the clip starts at cut_us. Packets past
+// end_us only mark their stream as done.
+static int export_write_packet(FFmpegWasmContext *ctx, ExportJob *job, AVPacket *pkt) {
+  int in = pkt->stream_index;
+  int out = job->stream_map[in];
+  AVRational in_tb = ctx->fmt->streams[in]->time_base;
+  int64_t ts_us = export_packet_us(pkt, in_tb);
+  if (export_past_end(job, pkt, in_tb, ts_us)) {
+    job->ended_mask |= 1u << out;
+    av_packet_unref(pkt);
+    return 0;
+  }
+  if (ts_us != AV_NOPTS_VALUE) {
+    if (in != job->video_in) {
+      int64_t end_us = ts_us + av_rescale_q(pkt->duration, in_tb, AV_TIME_BASE_Q);
+      int before = (job->flags & FFMPEG_WASM_EXPORT_TRIM_AUDIO) ? ts_us < job->cut_us : end_us <= job->cut_us;
+      if (before) {
+        av_packet_unref(pkt);
+        return 0;
+      }
+    }
+    if (job->last_us == AV_NOPTS_VALUE || ts_us > job->last_us) {
+      job->last_us = ts_us;
+    }
+  }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_audio_ptr(uintptr_t handle) {
-  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  return (ctx && ctx->audio_data) ? (int)(uintptr_t)ctx->audio_data : 0;
-}
+  if (!job->header_written) {
+    int ret = export_write_header(ctx, job);
+    if (ret < 0) {
+      av_packet_unref(pkt);
+      return ret;
+    }
+  }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_audio_bytes(uintptr_t handle) {
-  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx || !ctx->audio_data) {
-    return 0;
+  int64_t shift = av_rescale_q(job->cut_us, AV_TIME_BASE_Q, in_tb);
+  if (pkt->pts != AV_NOPTS_VALUE) {
+    pkt->pts -= shift;
   }
-  return ctx->audio_nb_samples * ctx->audio_channels * (int)sizeof(float);
+  if (pkt->dts != AV_NOPTS_VALUE) {
+    pkt->dts -= shift;
+  }
+  pkt->stream_index = out;
+  pkt->pos = -1;
+  av_packet_rescale_ts(pkt, in_tb, job->ofmt->streams[out]->time_base);
+  return av_interleaved_write_frame(job->ofmt, pkt);
 }
 
-EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_audio_pts_seconds(uintptr_t handle) {
-  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  return ctx ? ctx->audio_pts_seconds : 0.0;
+// The held GOP starts with the last video keyframe at or before start; it
+// becomes the clip origin.
+static int export_commit_gop(FFmpegWasmContext *ctx, ExportJob *job) {
+  AVPacket *key = job->gop[0];
+  job->cut_us = export_packet_us(key, ctx->fmt->streams[key->stream_index]->time_base);
+  if (job->cut_us == AV_NOPTS_VALUE) {
+    job->cut_us = job->start_us;
+  }
+  int ret = 0;
+  for (int i = 0; i < job->nb_gop && ret >= 0; i++) {
+    ret = export_write_packet(ctx, job, job->gop[i]);
+  }
+  export_free_gop(job);
+  return ret;
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_buffered_bytes(uintptr_t handle) {
-  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx) {
-    return 0;
+// Until the clip origin is known, hold the packets of the current GOP.
+static int export_find_cut(FFmpegWasmContext *ctx, ExportJob *job, AVPacket *pkt) {
+  int in = pkt->stream_index;
+  int64_t ts_us = export_packet_us(pkt, ctx->fmt->streams[in]->time_base);
+
+  if (job->video_in < 0) {
+    // Audio only: cut exactly at start
+    int64_t end_us = ts_us + av_rescale_q(pkt->duration, ctx->fmt->streams[in]->time_base, AV_TIME_BASE_Q);
+    if (ts_us == AV_NOPTS_VALUE || end_us <= job->start_us) {
+      av_packet_unref(pkt);
+      return 0;
+    }
+    job->cut_us = job->start_us;
+    return export_write_packet(ctx, job, pkt);
   }
-  if (ctx->buffer.size < ctx->buffer.read_pos) {
+
+  int is_video = in == job->video_in;
+  if (is_video && (pkt->flags & AV_PKT_FLAG_KEY) &&
+      (job->nb_gop == 0 || ts_us == AV_NOPTS_VALUE || ts_us <= job->start_us)) {
+    export_free_gop(job);  // A later keyframe that still covers start
+  } else if (job->nb_gop == 0) {
+    av_packet_unref(pkt);  // Nothing decodable before the first keyframe
     return 0;
   }
-  size_t buffered = ctx->buffer.size - ctx->buffer.read_pos;
-  if (buffered > INT_MAX) {
-    return INT_MAX;
+
+  if (job->nb_gop == job->gop_capacity) {
+    int capacity = job->gop_capacity ? job->gop_capacity * 2 : 256;
+    AVPacket **gop = av_realloc_array(job->gop, (size_t)capacity, sizeof(*gop));
+    if (!gop) {
+      av_packet_unref(pkt);
+      return AVERROR(ENOMEM);
+    }
+    job->gop = gop;
+    job->gop_capacity = capacity;
   }
-  return (int)buffered;
-}
+  AVPacket *held = av_packet_alloc();
+  if (!held) {
+    av_packet_unref(pkt);
+    return AVERROR(ENOMEM);
+  }
+  av_packet_move_ref(held, pkt);
+  job->gop[job->nb_gop++] = held;
 
-EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_compact_buffer(uintptr_t handle) {
-  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx) {
-    return;
+  if (is_video && ts_us != AV_NOPTS_VALUE && ts_us >= job->start_us) {
+    return export_commit_gop(ctx, job);
   }
-  compact_buffer(&ctx->buffer);
+  return 0;
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_streams_count(uintptr_t handle) {
-  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx || !ctx->fmt) {
-    return 0;
+static int export_finish(FFmpegWasmContext *ctx, ExportJob *job) {
+  int ret = 0;
+  if (job->cut_us == AV_NOPTS_VALUE && job->nb_gop > 0) {
+    ret = export_commit_gop(ctx, job);  // Input ended inside the GOP holding start
+    if (ret < 0) {
+      return ret;
+    }
   }
-  if (ctx->fmt->nb_streams > INT_MAX) {
-    return INT_MAX;
+  if (!job->header_written) {
+    return AVERROR(ERANGE);  // No packets in [start, end)
   }
-  return (int)ctx->fmt->nb_streams;
+  ret = av_write_trailer(job->ofmt);
+  if (ret < 0) {
+    return ret;
+  }
+  avio_flush(job->avio);
+  job->finished = 1;
+  return -1;
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_stream_media_type(uintptr_t handle, int stream_index) {
+// Stream-copy the selected tracks between start and end (seconds) into
+// container ("mp4" or "matroska"). The clip starts at the last video
+// keyframe at or before start; FFMPEG_WASM_EXPORT_TRIM_AUDIO also drops
+// audio that begins before it. Drive with ffmpeg_wasm_export_step.
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_export_clip(uintptr_t handle, double start, double end,
+                                                 const char *container, int flags) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx || !ctx->fmt || stream_index < 0 || stream_index >= (int)ctx->fmt->nb_streams) {
-    return AVMEDIA_TYPE_UNKNOWN;
+  if (!ctx || !ctx->fmt || !ctx->opened || !ctx->packet || !(end > start)) {
+    return AVERROR(EINVAL);
   }
-  AVStream *stream = ctx->fmt->streams[stream_index];
-  if (!stream || !stream->codecpar) {
-    return AVMEDIA_TYPE_UNKNOWN;
+  free_export(ctx);
+
+  const AVOutputFormat *oformat = av_guess_format(container && container[0] ? container : "mp4", NULL, NULL);
+  if (!oformat) {
+    return AVERROR_MUXER_NOT_FOUND;
   }
-  return stream->codecpar->codec_type;
+
+  ExportJob *job = av_mallocz(sizeof(ExportJob));
+  if (!job) {
+    return AVERROR(ENOMEM);
+  }
+  ctx->export_job = job;
+  job->flags = flags;
+  job->start_us = (int64_t)((start > 0.0 ? start : 0.0) * AV_TIME_BASE);
+  job->end_us = (int64_t)(end * AV_TIME_BASE);
+  job->cut_us = AV_NOPTS_VALUE;
+  job->last_us = AV_NOPTS_VALUE;
+  job->video_in = -1;
+  job->nb_input_streams = (int)ctx->fmt->nb_streams;
+  job->stream_map = av_malloc_array(job->nb_input_streams, sizeof(int));
+  int ret = job->stream_map ? avformat_alloc_output_context2(&job->ofmt, oformat, NULL, NULL)
+                            : AVERROR(ENOMEM);
+  if (ret < 0) {
+    free_export(ctx);
+    return ret;
+  }
+  job->ofmt->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;  // Opus/FLAC in MP4
+
+  for (int i = 0; i < job->nb_input_streams; i++) {
+    job->stream_map[i] = -1;
+  }
+  int selected[2] = {
+      (flags & FFMPEG_WASM_EXPORT_VIDEO) ? ctx->video_stream_index : -1,
+      (flags & FFMPEG_WASM_EXPORT_AUDIO) ? ctx->audio_stream_index : -1,
+  };
+  for (int i = 0; i < 2; i++) {
+    if (selected[i] < 0) {
+      continue;
+    }
+    enum AVCodecID codec_id = ctx->fmt->streams[selected[i]]->codecpar->codec_id;
+    if (avformat_query_codec(oformat, codec_id, FF_COMPLIANCE_EXPERIMENTAL) != 1) {
+      free_export(ctx);
+      return AVERROR(ENOSYS);
+    }
+    AVStream *ost = avformat_new_stream(job->ofmt, NULL);
+    if (!ost) {
+      free_export(ctx);
+      return AVERROR(ENOMEM);
+    }
+    job->stream_map[selected[i]] = ost->index;
+    if (i == 0) {
+      job->video_in = selected[i];
+    }
+  }
+  if (job->ofmt->nb_streams == 0) {
+    free_export(ctx);
+    return AVERROR_STREAM_NOT_FOUND;
+  }
+
+  uint8_t *avio_buffer = av_malloc(REMUX_AVIO_BUFFER_SIZE);
+  job->avio = avio_buffer ? avio_alloc_context(avio_buffer, REMUX_AVIO_BUFFER_SIZE, 1, &job->output, NULL,
+                                               chunked_write, chunked_seek)
+                          : NULL;
+  if (!job->avio) {
+    av_free(avio_buffer);
+    free_export(ctx);
+    return AVERROR(ENOMEM);
+  }
+  job->ofmt->pb = job->avio;
+
+  // Jump straight to the clip when its bytes are still buffered; otherwise
+  // packets are demuxed (not decoded) forward from the current position.
+  packet_cache_clear(ctx);
+  avformat_seek_file(ctx->fmt, -1, INT64_MIN, job->start_us, job->start_us, 0);
+  return 0;
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_stream_codec_id(uintptr_t handle, int stream_index) {
+// Demux up to max_packets and copy the ones inside the clip. Returns packets
+// read (> 0), 0 when more input is needed, -1 once the clip is complete.
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_export_step(uintptr_t handle, int max_packets) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx || !ctx->fmt || stream_index < 0 || stream_index >= (int)ctx->fmt->nb_streams) {
-    return AV_CODEC_ID_NONE;
+  ExportJob *job = ctx ? ctx->export_job : NULL;
+  if (!job) {
+    return AVERROR(EINVAL);
   }
-  AVStream *stream = ctx->fmt->streams[stream_index];
-  if (!stream || !stream->codecpar) {
-    return AV_CODEC_ID_NONE;
+  if (job->finished) {
+    return -1;
   }
-  return stream->codecpar->codec_id;
-}
 
-EMSCRIPTEN_KEEPALIVE const char *ffmpeg_wasm_stream_codec_name(uintptr_t handle, int stream_index) {
-  int codec_id = ffmpeg_wasm_stream_codec_id(handle, stream_index);
-  if (codec_id == AV_CODEC_ID_NONE) {
-    return NULL;
+  int processed = 0;
+  while (processed < max_packets) {
+    int ret = av_read_frame(ctx->fmt, ctx->packet);
+    if (ret == AVERROR(EAGAIN)) {
+      return processed;
+    }
+    if (ret == AVERROR_EOF) {
+      return export_finish(ctx, job);
+    }
+    if (ret < 0) {
+      return ret;
+    }
+    processed++;
+
+    AVPacket *pkt = ctx->packet;
+    int in = pkt->stream_index;
+    if (in < 0 || in >= job->nb_input_streams || job->stream_map[in] < 0) {
+      av_packet_unref(pkt);
+      continue;
+    }
+    ret = job->cut_us == AV_NOPTS_VALUE ? export_find_cut(ctx, job, pkt) : export_write_packet(ctx, job, pkt);
+    if (ret < 0) {
+      return ret;
+    }
+    if (job->ended_mask == (1u << job->ofmt->nb_streams) - 1) {
+      return export_finish(ctx, job);
+    }
   }
-  return avcodec_get_name((enum AVCodecID)codec_id);
+  return processed;
 }
 
-EMSCRIPTEN_KEEPALIVE const char *ffmpeg_wasm_stream_language(uintptr_t handle, int stream_index) {
+// Fraction of [clip origin, end) written so far
+EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_export_progress(uintptr_t handle) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx || !ctx->fmt || stream_index < 0 || stream_index >= (int)ctx->fmt->nb_streams) {
-    return NULL;
+  ExportJob *job = ctx ? ctx->export_job : NULL;
+  if (!job) {
+    return 0.0;
   }
-  AVStream *stream = ctx->fmt->streams[stream_index];
-  if (!stream) {
-    return NULL;
+  if (job->finished) {
+    return 1.0;
   }
-  AVDictionaryEntry *tag = av_dict_get(stream->metadata, "language", NULL, 0);
-  return tag ? tag->value : NULL;
+  if (job->cut_us == AV_NOPTS_VALUE || job->last_us == AV_NOPTS_VALUE || job->end_us <= job->cut_us) {
+    return 0.0;
+  }
+  double progress = (double)(job->last_us - job->cut_us) / (double)(job->end_us - job->cut_us);
+  return progress < 0.0 ? 0.0 : (progress > 1.0 ? 1.0 : progress);
 }
 
-EMSCRIPTEN_KEEPALIVE const char *ffmpeg_wasm_stream_title(uintptr_t handle, int stream_index) {
+EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_export_size(uintptr_t handle) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx || !ctx->fmt || stream_index < 0 || stream_index >= (int)ctx->fmt->nb_streams) {
-    return NULL;
-  }
-  AVStream *stream = ctx->fmt->streams[stream_index];
-  if (!stream) {
-    return NULL;
-  }
-  AVDictionaryEntry *tag = av_dict_get(stream->metadata, "title", NULL, 0);
-  return tag ? tag->value : NULL;
+  return (ctx && ctx->export_job) ? (double)ctx->export_job->output.size : 0.0;
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_stream_is_default(uintptr_t handle, int stream_index) {
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_export_chunk_count(uintptr_t handle) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx || !ctx->fmt || stream_index < 0 || stream_index >= (int)ctx->fmt->nb_streams) {
+  if (!ctx || !ctx->export_job) {
     return 0;
   }
-  AVStream *stream = ctx->fmt->streams[stream_index];
-  if (!stream) {
+  ChunkedOutput *out = &ctx->export_job->output;
+  return (int)((out->size + EXPORT_CHUNK_SIZE - 1) / EXPORT_CHUNK_SIZE);
+}
+
+EMSCRIPTEN_KEEPALIVE uintptr_t ffmpeg_wasm_export_chunk_ptr(uintptr_t handle, int index) {
+  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
+  if (index < 0 || index >= ffmpeg_wasm_export_chunk_count(handle)) {
     return 0;
   }
-  return (stream->disposition & AV_DISPOSITION_DEFAULT) ? 1 : 0;
+  return (uintptr_t)ctx->export_job->output.chunks[index];
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_selected_video_stream(uintptr_t handle) {
+EMSCRIPTEN_KEEPALIVE size_t ffmpeg_wasm_export_chunk_size(uintptr_t handle, int index) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  return ctx ? ctx->video_stream_index : -1;
+  if (index < 0 || index >= ffmpeg_wasm_export_chunk_count(handle)) {
+    return 0;
+  }
+  int64_t remaining = ctx->export_job->output.size - (int64_t)index * EXPORT_CHUNK_SIZE;
+  return remaining < EXPORT_CHUNK_SIZE ? (size_t)remaining : EXPORT_CHUNK_SIZE;
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_selected_audio_stream(uintptr_t handle) {
-  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  return ctx ? ctx->audio_stream_index : -1;
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_export_stop(uintptr_t handle) {
+  free_export((FFmpegWasmContext *)handle);
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_audio_is_enabled(uintptr_t handle) {
-  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  return ctx ? ctx->audio_enabled : 0;
+typedef struct PeakAccum {
+  float min;
+  float max;
+  double sum_sq;
+} PeakAccum;
+
+static inline void peak_accum_add(PeakAccum *acc, float v) {
+  acc->min = v < acc->min ? v : acc->min;
+  acc->max = v > acc->max ? v : acc->max;
+  acc->sum_sq += (double)v * v;
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_select_streams(uintptr_t handle, int video_stream_index, int audio_stream_index) {
-  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx || !ctx->fmt || !ctx->opened) {
-    return AVERROR(EINVAL);
+#ifdef __wasm_simd128__
+typedef struct PeakAccum4 {
+  v128_t min;
+  v128_t max;
+  v128_t sum_sq;
+} PeakAccum4;
+
+static inline void peak_accum4_init(PeakAccum4 *a, const PeakAccum *acc) {
+  a->min = wasm_f32x4_splat(acc->min);
+  a->max = wasm_f32x4_splat(acc->max);
+  a->sum_sq = wasm_f32x4_splat(0.0f);
+}
+
+static inline void peak_accum4_add(PeakAccum4 *a, v128_t v) {
+  a->min = wasm_f32x4_min(a->min, v);
+  a->max = wasm_f32x4_max(a->max, v);
+  a->sum_sq = wasm_f32x4_add(a->sum_sq, wasm_f32x4_mul(v, v));
+}
+
+static void peak_accum4_fold(const PeakAccum4 *a, PeakAccum *acc) {
+  float mins[4], maxs[4], sums[4];
+  wasm_v128_store(mins, a->min);
+  wasm_v128_store(maxs, a->max);
+  wasm_v128_store(sums, a->sum_sq);
+  for (int i = 0; i < 4; i++) {
+    acc->min = mins[i] < acc->min ? mins[i] : acc->min;
+    acc->max = maxs[i] > acc->max ? maxs[i] : acc->max;
+    acc->sum_sq += sums[i];
   }
+}
+#endif
 
-  int v_index = video_stream_index;
-  if (v_index == -1) {
-    const AVCodec *decoder = NULL;
-    int ret = av_find_best_stream(ctx->fmt, AVMEDIA_TYPE_VIDEO, -1, -1, &decoder, 0);
-    if (ret < 0) {
-      return ret;
-    }
-    v_index = ret;
+static void reduce_f32(const float *src, int n, PeakAccum *acc) {
+  int i = 0;
+#ifdef __wasm_simd128__
+  PeakAccum4 a4;
+  peak_accum4_init(&a4, acc);
+  for (; i + 4 <= n; i += 4) {
+    peak_accum4_add(&a4, wasm_v128_load(src + i));
   }
-  if (v_index < 0) {
-    return AVERROR(EINVAL);
+  peak_accum4_fold(&a4, acc);
+#endif
+  for (; i < n; i++) {
+    peak_accum_add(acc, src[i]);
   }
+}
 
-  int ret = reopen_video_stream(ctx, v_index);
-  if (ret < 0) {
-    return ret;
+static void reduce_s16(const int16_t *src, int n, PeakAccum *acc) {
+  const float scale = 1.0f / 32768.0f;
+  int i = 0;
+#ifdef __wasm_simd128__
+  PeakAccum4 a4;
+  peak_accum4_init(&a4, acc);
+  v128_t vscale = wasm_f32x4_splat(scale);
+  for (; i + 8 <= n; i += 8) {
+    v128_t v = wasm_v128_load(src + i);
+    peak_accum4_add(&a4, wasm_f32x4_mul(wasm_f32x4_convert_i32x4(wasm_i32x4_extend_low_i16x8(v)), vscale));
+    peak_accum4_add(&a4, wasm_f32x4_mul(wasm_f32x4_convert_i32x4(wasm_i32x4_extend_high_i16x8(v)), vscale));
+  }
+  peak_accum4_fold(&a4, acc);
+#endif
+  for (; i < n; i++) {
+    peak_accum_add(acc, src[i] * scale);
   }
+}
 
-  if (audio_stream_index == -2) {
-    close_audio_decoder(ctx);
-    ctx->audio_enabled = 0;
-    ctx->audio_eof = 1;
-    ctx->audio_flush_sent = 1;
-    return 0;
+static void reduce_s32(const int32_t *src, int n, PeakAccum *acc) {
+  const float scale = 1.0f / 2147483648.0f;
+  int i = 0;
+#ifdef __wasm_simd128__
+  PeakAccum4 a4;
+  peak_accum4_init(&a4, acc);
+  v128_t vscale = wasm_f32x4_splat(scale);
+  for (; i + 4 <= n; i += 4) {
+    peak_accum4_add(&a4, wasm_f32x4_mul(wasm_f32x4_convert_i32x4(wasm_v128_load(src + i)), vscale));
+  }
+  peak_accum4_fold(&a4, acc);
+#endif
+  for (; i < n; i++) {
+    peak_accum_add(acc, (float)src[i] * scale);
   }
+}
 
-  int a_index = audio_stream_index;
-  if (a_index == -1) {
-    const AVCodec *decoder = NULL;
-    int best = av_find_best_stream(ctx->fmt, AVMEDIA_TYPE_AUDIO, -1, -1, &decoder, 0);
-    if (best < 0) {
-      close_audio_decoder(ctx);
-      ctx->audio_enabled = 0;
-      ctx->audio_eof = 1;
-      ctx->audio_flush_sent = 1;
-      return 0;
-    }
-    a_index = best;
+// Reduce n values starting at value offset of one plane (or the packed buffer)
+static void reduce_samples(const uint8_t *data, enum AVSampleFormat fmt, int offset, int n, PeakAccum *acc) {
+  switch (fmt) {
+    case AV_SAMPLE_FMT_FLT:
+    case AV_SAMPLE_FMT_FLTP:
+      reduce_f32((const float *)data + offset, n, acc);
+      break;
+    case AV_SAMPLE_FMT_S16:
+    case AV_SAMPLE_FMT_S16P:
+      reduce_s16((const int16_t *)data + offset, n, acc);
+      break;
+    case AV_SAMPLE_FMT_S32:
+    case AV_SAMPLE_FMT_S32P:
+      reduce_s32((const int32_t *)data + offset, n, acc);
+      break;
+    case AV_SAMPLE_FMT_DBL:
+    case AV_SAMPLE_FMT_DBLP:
+      for (int i = 0; i < n; i++) {
+        peak_accum_add(acc, (float)((const double *)data)[offset + i]);
+      }
+      break;
+    case AV_SAMPLE_FMT_U8:
+    case AV_SAMPLE_FMT_U8P:
+      for (int i = 0; i < n; i++) {
+        peak_accum_add(acc, (data[offset + i] - 128) / 128.0f);
+      }
+      break;
+    default:
+      break;
   }
+}
 
-  if (a_index < 0) {
-    close_audio_decoder(ctx);
-    ctx->audio_enabled = 0;
-    ctx->audio_eof = 1;
-    ctx->audio_flush_sent = 1;
-    return 0;
+// Spread one decoded frame over the buckets its samples fall into. All
+// channels share a bucket, so planar and packed layouts reduce alike.
+static void peaks_add_frame(PeakJob *job, const AVFrame *frame) {
+  int rate = frame->sample_rate > 0 ? frame->sample_rate : job->codec->sample_rate;
+  int channels = frame->ch_layout.nb_channels;
+  if (rate <= 0 || channels <= 0 || frame->nb_samples <= 0) {
+    return;
   }
 
-  ret = reopen_audio_stream(ctx, a_index);
-  if (ret < 0) {
-    return ret;
+  int64_t first = job->next_sample;
+  if (frame->best_effort_timestamp != AV_NOPTS_VALUE) {
+    first = av_rescale_q(frame->best_effort_timestamp - job->start_pts, job->time_base, (AVRational){1, rate});
   }
-  return 0;
-}
+  job->next_sample = first + frame->nb_samples;
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_selected_subtitle_stream(uintptr_t handle) {
-  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  return ctx ? ctx->subtitle_stream_index : -1;
+  enum AVSampleFormat fmt = frame->format;
+  int planar = av_sample_fmt_is_planar(fmt);
+  int planes = planar ? channels : 1;
+  int width = planar ? 1 : channels;  // Values per sample within a plane
+  double per_bucket = job->duration * rate / job->buckets;
+
+  int i = 0;
+  while (i < frame->nb_samples) {
+    int64_t pos = first + i;
+    int64_t bucket = pos > 0 ? (int64_t)(pos / per_bucket) : 0;
+    int n = frame->nb_samples - i;
+    if (bucket >= job->buckets - 1) {
+      bucket = job->buckets - 1;  // Past the expected duration: fold into the last bucket
+    } else {
+      int64_t bucket_end = (int64_t)ceil((bucket + 1) * per_bucket);
+      if (bucket_end - pos < n) {
+        n = bucket_end - pos > 0 ? (int)(bucket_end - pos) : 1;
+      }
+    }
+
+    PeakAccum acc = {FLT_MAX, -FLT_MAX, 0.0};
+    for (int p = 0; p < planes; p++) {
+      reduce_samples(frame->extended_data[p], fmt, i * width, n * width, &acc);
+    }
+
+    float *out = job->peaks + bucket * 3;
+    if (job->counts[bucket] == 0 || acc.min < out[0]) {
+      out[0] = acc.min;
+    }
+    if (job->counts[bucket] == 0 || acc.max > out[1]) {
+      out[1] = acc.max;
+    }
+    job->sum_sq[bucket] += acc.sum_sq;
+    job->counts[bucket] += (int64_t)n * channels;
+    out[2] = (float)sqrt(job->sum_sq[bucket] / (double)job->counts[bucket]);
+    if (bucket + 1 > job->filled) {
+      job->filled = (int)bucket + 1;
+    }
+    i += n;
+  }
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_subtitles_enabled(uintptr_t handle) {
-  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  return ctx ? ctx->subtitles_enabled : 0;
+static int peaks_drain(PeakJob *job) {
+  for (;;) {
+    int ret = avcodec_receive_frame(job->codec, job->frame);
+    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+      return 0;
+    }
+    if (ret < 0) {
+      return ret;
+    }
+    peaks_add_frame(job, job->frame);
+    av_frame_unref(job->frame);
+  }
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_select_subtitle_stream(uintptr_t handle, int stream_index) {
+// Start computing waveform peaks for the selected (or best) audio stream.
+// Meant for a separate demux-only context (ffmpeg_wasm_set_remux_only):
+// every other stream is discarded. duration <= 0 uses the container's.
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_compute_peaks(uintptr_t handle, int buckets, double duration) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx || !ctx->fmt || !ctx->opened) {
+  if (!ctx || !ctx->fmt || !ctx->opened || !ctx->packet || buckets <= 0 || buckets > PEAKS_MAX_BUCKETS) {
     return AVERROR(EINVAL);
   }
+  free_peaks(ctx);
+  packet_cache_clear(ctx);
+  ctx->missing_modules[0] = '\0';
 
-  if (stream_index == -2) {
-    close_subtitle_decoder(ctx);
-    ctx->subtitles_enabled = 0;
-    return 0;
+  int stream_index = ctx->audio_stream_index;
+  if (stream_index < 0) {
+    stream_index = av_find_best_stream(ctx->fmt, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+    if (stream_index < 0) {
+      return stream_index;
+    }
   }
-
-  if (stream_index == -1) {
-    int best = av_find_best_stream(ctx->fmt, AVMEDIA_TYPE_SUBTITLE, -1, -1, NULL, 0);
-    if (best < 0) {
-      close_subtitle_decoder(ctx);
-      ctx->subtitles_enabled = 0;
-      return 0;
+  AVStream *stream = ctx->fmt->streams[stream_index];
+  if (!(duration > 0.0)) {
+    if (stream->duration != AV_NOPTS_VALUE && stream->duration > 0) {
+      duration = stream->duration * av_q2d(stream->time_base);
+    } else if (ctx->fmt->duration > 0) {
+      duration = (double)ctx->fmt->duration / AV_TIME_BASE;
+    } else {
+      return AVERROR(EINVAL);  // Unknown length; the caller must pass one
     }
-    stream_index = best;
+  }
+  const AVCodec *decoder = find_decoder(ctx, stream->codecpar->codec_id);
+  if (!decoder) {
+    return decoder_not_found(ctx);
   }
 
-  return reopen_subtitle_stream(ctx, stream_index);
-}
+  PeakJob *job = av_mallocz(sizeof(PeakJob));
+  if (!job) {
+    return AVERROR(ENOMEM);
+  }
+  ctx->peak_job = job;
+  job->stream_index = stream_index;
+  job->time_base = stream->time_base;
+  job->start_pts = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+  job->buckets = buckets;
+  job->duration = duration;
+  job->peaks = av_calloc((size_t)buckets * 3, sizeof(float));
+  job->sum_sq = av_calloc((size_t)buckets, sizeof(double));
+  job->counts = av_calloc((size_t)buckets, sizeof(int64_t));
+  job->frame = av_frame_alloc();
+  job->codec = avcodec_alloc_context3(decoder);
+  if (!job->peaks || !job->sum_sq || !job->counts || !job->frame || !job->codec) {
+    av_freep(&job->peaks);  // Not charged yet
+    free_peaks(ctx);
+    return AVERROR(ENOMEM);
+  }
+  mem_charge(&ctx->mem, FFMPEG_WASM_MEM_AUDIO,
+             (size_t)buckets * (3 * sizeof(float) + sizeof(double) + sizeof(int64_t)));
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_add_font(uintptr_t handle, const char *name, const uint8_t *data, int len) {
-  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx || !ctx->ass_library || !data || len <= 0) {
-    return AVERROR(EINVAL);
+  int ret = avcodec_parameters_to_context(job->codec, stream->codecpar);
+  if (ret >= 0) {
+    job->codec->thread_count = 1;
+    job->codec->thread_type = 0;
+    attach_memory_hooks(ctx, job->codec);
+    ret = avcodec_open2(job->codec, decoder, NULL);
+  }
+  if (ret < 0) {
+    free_peaks(ctx);
+    return ret;
+  }
+
+  for (unsigned int i = 0; i < ctx->fmt->nb_streams; i++) {
+    ctx->fmt->streams[i]->discard = (int)i == stream_index ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
   }
-  ass_add_font(ctx->ass_library, name, (char *)data, len);
   return 0;
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_render_subtitles(uintptr_t handle, double pts_seconds) {
+// Decode up to max_packets audio packets into the buckets. Returns packets
+// read, 0 = need data, -1 = done. Peaks are readable at any point.
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_peaks_step(uintptr_t handle, int max_packets) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx || !ctx->subtitles_enabled || !ctx->ass_renderer || !ctx->ass_track) {
-    return 0;
+  PeakJob *job = ctx ? ctx->peak_job : NULL;
+  if (!job) {
+    return AVERROR(EINVAL);
   }
-  if (!ctx->rgba_data[0] || ctx->rgba_width <= 0 || ctx->rgba_height <= 0) {
-    return 0;
+  if (job->finished) {
+    return -1;
   }
 
-  ass_set_frame_size(ctx->ass_renderer, ctx->rgba_width, ctx->rgba_height);
+  int processed = 0;
+  while (processed < max_packets) {
+    int ret = av_read_frame(ctx->fmt, ctx->packet);
+    if (ret == AVERROR(EAGAIN)) {
+      return processed;
+    }
+    if (ret == AVERROR_EOF) {
+      avcodec_send_packet(job->codec, NULL);
+      ret = peaks_drain(job);
+      job->finished = 1;
+      return ret < 0 ? ret : -1;
+    }
+    if (ret < 0) {
+      return ret;
+    }
+    processed++;
 
-  int changed = 0;
-  ASS_Image *img = ass_render_frame(ctx->ass_renderer, ctx->ass_track,
-                                    (long long)(pts_seconds * 1000), &changed);
-  if (!img) {
-    int n = ctx->ass_track ? ctx->ass_track->n_events : 0;
-    long long first_start = -1;
-    long long first_end = -1;
-    if (ctx->ass_track && n > 0) {
-      ASS_Event *ev = &ctx->ass_track->events[0];
-      first_start = ev->Start;
-      first_end = ev->Start + ev->Duration;
+    if (ctx->packet->stream_index != job->stream_index) {
+      av_packet_unref(ctx->packet);
+      continue;
+    }
+    ret = avcodec_send_packet(job->codec, ctx->packet);
+    av_packet_unref(ctx->packet);
+    if (ret < 0 && ret != AVERROR(EAGAIN) && ret != AVERROR_INVALIDDATA) {
+      return ret;  // A corrupt packet only leaves a gap in the waveform
+    }
+    ret = peaks_drain(job);
+    if (ret < 0 && ret != AVERROR_INVALIDDATA) {
+      return ret;
     }
-    EM_ASM_({
-      postMessage({
-        type: "subtitleDebug",
-        note: "render returned null",
-        nEvents: $0,
-        firstStartMs: $1,
-        firstEndMs: $2
-      });
-    }, n, (int)first_start, (int)first_end);
-    return 0;
   }
-
-  blend_ass_image(ctx->rgba_data[0], ctx->rgba_linesize[0],
-                  ctx->rgba_width, ctx->rgba_height, img);
-  return 1;
+  return processed;
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_subtitle_events_count(uintptr_t handle) {
+// buckets * 3 floats (min, max, rms per bucket), valid up to peaks_filled
+EMSCRIPTEN_KEEPALIVE uintptr_t ffmpeg_wasm_peaks_ptr(uintptr_t handle) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx || !ctx->ass_track) {
-    return 0;
-  }
-  return ctx->ass_track->n_events;
+  return (ctx && ctx->peak_job) ? (uintptr_t)ctx->peak_job->peaks : 0;
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_subtitle_first_start_ms(uintptr_t handle) {
+EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_peaks_filled(uintptr_t handle) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx || !ctx->ass_track || ctx->ass_track->n_events <= 0) {
-    return -1;
-  }
-  ASS_Event *ev = &ctx->ass_track->events[0];
-  return (int)ev->Start;
+  return (ctx && ctx->peak_job) ? ctx->peak_job->filled : 0;
 }
 
-EMSCRIPTEN_KEEPALIVE int ffmpeg_wasm_subtitle_first_end_ms(uintptr_t handle) {
+EMSCRIPTEN_KEEPALIVE double ffmpeg_wasm_peaks_duration(uintptr_t handle) {
   FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx || !ctx->ass_track || ctx->ass_track->n_events <= 0) {
-    return -1;
-  }
-  ASS_Event *ev = &ctx->ass_track->events[0];
-  return (int)(ev->Start + ev->Duration);
+  return (ctx && ctx->peak_job) ? ctx->peak_job->duration : 0.0;
 }
 
-EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_clear_subtitle_track(uintptr_t handle) {
-  FFmpegWasmContext *ctx = (FFmpegWasmContext *)handle;
-  if (!ctx || !ctx->ass_library) {
-    return;
-  }
-  if (ctx->ass_track) {
-    ass_free_track(ctx->ass_track);
-    ctx->ass_track = ass_new_track(ctx->ass_library);
-    if (ctx->ass_track && ctx->subtitle_codec &&
-        ctx->subtitle_codec->subtitle_header && ctx->subtitle_codec->subtitle_header_size > 0) {
-      ass_process_codec_private(ctx->ass_track, (char *)ctx->subtitle_codec->subtitle_header,
-                                ctx->subtitle_codec->subtitle_header_size);
-    }
-  }
+EMSCRIPTEN_KEEPALIVE void ffmpeg_wasm_peaks_stop(uintptr_t handle) {
+  free_peaks((FFmpegWasmContext *)handle);
 }
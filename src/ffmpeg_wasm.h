@@ -0,0 +1,391 @@
+#ifndef FFMPEG_WASM_H
+#define FFMPEG_WASM_H
+
+// Public C API of ffmpeg_wasm.c. In the wasm build these are reached from JS
+// through cwrap; the native build (scripts/build-native.sh) exports the same
+// functions from libffmpeg_wasm.so. Handles are FFmpegWasmContext pointers.
+//
+// Widths are chosen so nothing narrows in a -sMEMORY64 build: handles and
+// pointers are uintptr_t, lengths of memory blocks size_t, and offsets, file
+// sizes and limits double (exact to 2^53). build-ffmpeg.sh derives the
+// Memory64 signature conversions from this file, so keep one declaration
+// per line.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Memory accounting categories for ffmpeg_wasm_memory_current/_peak (-1 = total)
+enum {
+  FFMPEG_WASM_MEM_STREAM_BUFFER = 0,  // StreamBuffer capacity
+  FFMPEG_WASM_MEM_CODEC_FRAMES = 1,   // Decoded video frames held via get_buffer2
+  FFMPEG_WASM_MEM_RGBA = 2,           // sws RGBA output buffer
+  FFMPEG_WASM_MEM_AUDIO = 3,          // Decoded and resampled audio
+  FFMPEG_WASM_MEM_LIBASS = 4,         // libass cache ceiling plus injected fonts
+  FFMPEG_WASM_MEM_PACKET_CACHE = 5,   // Demuxed packets kept for back-seeks
+  FFMPEG_WASM_MEM_GOP_CACHE = 6,      // Decoded frames kept for step-back and reverse
+  FFMPEG_WASM_MEM_CATEGORY_COUNT
+};
+
+// Returned by open, select_streams, select_subtitle_stream and compute_peaks in
+// a split build when a side module has to be loaded first; the names are in
+// ffmpeg_wasm_missing_modules. FFERRTAG('N','M','O','D').
+enum {
+  FFMPEG_WASM_ERROR_NEED_MODULE = -0x444F4D4E,
+};
+
+// ffmpeg_wasm_export_clip flags
+enum {
+  FFMPEG_WASM_EXPORT_VIDEO = 1,
+  FFMPEG_WASM_EXPORT_AUDIO = 2,
+  FFMPEG_WASM_EXPORT_TRIM_AUDIO = 4,  // Drop audio that starts before the video keyframe
+};
+
+// Bulk descriptors: plain structs in wasm memory that JS reads through one
+// DataView instead of calling a getter per field. Fixed-width fields only,
+// pointers widened to 64 bits so the layout is the same in wasm32 and
+// Memory64 builds. Offsets are part of the ABI (checked in ffmpeg_wasm.c);
+// bump the version when they change.
+#define FFMPEG_WASM_DESC_VERSION 1
+
+// FFmpegWasmFrameDesc.type
+enum {
+  FFMPEG_WASM_FRAME_NONE = 0,
+  FFMPEG_WASM_FRAME_VIDEO = 1,
+  FFMPEG_WASM_FRAME_AUDIO = 2,
+};
+
+// FFmpegWasmFrameDesc.flags
+enum {
+  FFMPEG_WASM_FRAME_KEY = 1,
+  FFMPEG_WASM_FRAME_INTERLACED = 2,
+  FFMPEG_WASM_FRAME_SUBTITLES_ENABLED = 4,
+  FFMPEG_WASM_FRAME_SUBTITLES_DRAWN = 8,  // present_frame blended subtitles
+  FFMPEG_WASM_FRAME_HAS_RGBA = 16,        // rgba_* describe this frame
+  FFMPEG_WASM_FRAME_TONE_MAPPED = 32,     // PQ/HLG frame mapped to SDR BT.709
+};
+
+// Refreshed by every read_frame (type = what it returned) and by
+// present_frame. Video fields describe the last video frame, audio fields the
+// last converted audio block; both stay valid until the next read.
+typedef struct FFmpegWasmFrameDesc {
+  uint32_t version;            //   0
+  int32_t type;                //   4
+  double pts;                  //   8  Video frame pts, seconds
+  int32_t width;               //  16  Decoded size
+  int32_t height;              //  20
+  int32_t format;              //  24  AVPixelFormat
+  uint32_t flags;              //  28
+  uint64_t data[4];            //  32  Plane pointers
+  int32_t linesize[4];         //  64
+  int32_t color_primaries;     //  80
+  int32_t color_trc;           //  84
+  int32_t colorspace;          //  88
+  int32_t color_range;         //  92
+  uint64_t rgba_data;          //  96  present_frame output
+  int32_t rgba_width;          // 104
+  int32_t rgba_height;         // 108
+  int32_t rgba_stride;         // 112
+  int32_t present_status;      // 116  Last present_frame result
+  double audio_pts;            // 120  Seconds
+  uint64_t audio_data;         // 128  Interleaved float32
+  int32_t audio_channels;      // 136
+  int32_t audio_sample_rate;   // 140
+  int32_t audio_nb_samples;    // 144
+  int32_t subtitle_status;     // 148  render_subtitles result, 0 = none drawn
+} FFmpegWasmFrameDesc;         // 152
+
+// FFmpegWasmStreamTable.flags and FFmpegWasmStreamEntry.flags
+enum {
+  FFMPEG_WASM_STREAMS_AUDIO_ENABLED = 1,
+  FFMPEG_WASM_STREAMS_SUBTITLES_ENABLED = 2,
+  FFMPEG_WASM_STREAM_DEFAULT = 1,
+};
+
+// Header of the stream table; count entries of entry_size bytes follow it.
+// Strings are NUL-terminated UTF-8 owned by the demuxer, 0 = absent; they
+// and the table stay valid until the next open, select or stream_table call.
+typedef struct FFmpegWasmStreamTable {
+  uint32_t version;            //   0
+  int32_t count;               //   4
+  int32_t entry_size;          //   8
+  int32_t selected_video;      //  12
+  int32_t selected_audio;      //  16
+  int32_t selected_subtitle;   //  20
+  uint32_t flags;              //  24
+  uint32_t reserved;           //  28
+} FFmpegWasmStreamTable;       //  32
+
+typedef struct FFmpegWasmStreamEntry {
+  int32_t index;               //   0
+  int32_t media_type;          //   4  AVMediaType
+  int32_t codec_id;            //   8  AVCodecID
+  uint32_t flags;              //  12
+  uint64_t codec_name;         //  16
+  uint64_t language;           //  24
+  uint64_t title;              //  32
+} FFmpegWasmStreamEntry;       //  40
+
+// Returned by ffmpeg_wasm_clock_schedule for a frame to skip
+enum {
+  FFMPEG_WASM_CLOCK_DROP = -1,
+};
+
+unsigned int ffmpeg_wasm_avcodec_version(void);
+unsigned int ffmpeg_wasm_avformat_version(void);
+unsigned int ffmpeg_wasm_avutil_version(void);
+int ffmpeg_wasm_has_hevc_av1(void);
+
+// Split builds: comma-separated side modules the last open/select call needed
+// ("" when none), and 1 when decoders and libass are loaded on demand
+const char *ffmpeg_wasm_missing_modules(uintptr_t handle);
+int ffmpeg_wasm_is_split_build(void);
+int ffmpeg_wasm_is_memory64(void);
+
+// Context lifetime and byte input
+uintptr_t ffmpeg_wasm_create(int initial_capacity);
+void ffmpeg_wasm_destroy(uintptr_t handle);
+int ffmpeg_wasm_append(uintptr_t handle, const uint8_t *data, size_t len);
+void ffmpeg_wasm_set_eof(uintptr_t handle);
+void ffmpeg_wasm_set_keep_all(uintptr_t handle, int enabled);
+void ffmpeg_wasm_set_buffer_limit(uintptr_t handle, double limit_bytes);
+int ffmpeg_wasm_set_spill(uintptr_t handle, int enabled);
+double ffmpeg_wasm_spilled_bytes(uintptr_t handle);
+void ffmpeg_wasm_set_file_size(uintptr_t handle, double size);
+void ffmpeg_wasm_set_buffer_offset(uintptr_t handle, double offset);
+void ffmpeg_wasm_set_audio_enabled(uintptr_t handle, int enabled);
+void ffmpeg_wasm_set_attached_pictures(uintptr_t handle, int enabled);
+void ffmpeg_wasm_set_audio_batch_samples(uintptr_t handle, int samples);
+double ffmpeg_wasm_buffered_bytes(uintptr_t handle);
+void ffmpeg_wasm_compact_buffer(uintptr_t handle);
+
+// Ingest flow control: demuxer byte position, observed input bitrate (bits/s,
+// 0 = unknown) and seconds of media buffered ahead of playback (-1 = unknown)
+double ffmpeg_wasm_read_position(uintptr_t handle);
+double ffmpeg_wasm_input_bitrate(uintptr_t handle);
+double ffmpeg_wasm_buffered_seconds(uintptr_t handle);
+
+// A/V presentation clock. Wall times are the caller's clock in seconds;
+// audio_position feeds the pts audible at a wall time (the worklet's
+// consumed position), which the clock slews towards. schedule says when the
+// frame with pts is due: ms to wait, 0 = now, FFMPEG_WASM_CLOCK_DROP. seek
+// resets the anchor; dropped and late count frames over the context's life.
+void ffmpeg_wasm_clock_reset(uintptr_t handle);
+void ffmpeg_wasm_clock_set_paused(uintptr_t handle, int paused, double wall);
+void ffmpeg_wasm_clock_set_speed(uintptr_t handle, double speed, double wall);
+void ffmpeg_wasm_clock_audio_position(uintptr_t handle, double pts, double wall);
+double ffmpeg_wasm_clock_time(uintptr_t handle, double wall);
+int ffmpeg_wasm_clock_schedule(uintptr_t handle, double pts, double wall);
+double ffmpeg_wasm_clock_drift(uintptr_t handle);
+int ffmpeg_wasm_clock_dropped(uintptr_t handle);
+int ffmpeg_wasm_clock_late(uintptr_t handle);
+
+// Random-access byte source (HTTP Range): a sparse cache of up to cache_limit
+// bytes (0 = 64 MiB) replaces the StreamBuffer. Set before open; append_at
+// takes bytes at any offset. range_wanted is the hole a read stopped at (-1 =
+// none); range_cached_end is where the cached run from offset ends.
+int ffmpeg_wasm_set_range_source(uintptr_t handle, double total_size, double cache_limit);
+int ffmpeg_wasm_append_at(uintptr_t handle, double offset, const uint8_t *data, size_t len);
+double ffmpeg_wasm_range_position(uintptr_t handle);
+double ffmpeg_wasm_range_wanted(uintptr_t handle);
+double ffmpeg_wasm_range_cached_end(uintptr_t handle, double offset);
+
+// Manifest (HLS/DASH) sources: segments are appended in order, a separate
+// audio rendition through append_audio. mark_segment_boundary says the next
+// bytes start a new init segment (variant switch); restart_segments drops
+// everything buffered for a seek.
+int ffmpeg_wasm_append_audio(uintptr_t handle, const uint8_t *data, size_t len);
+void ffmpeg_wasm_set_audio_input_eof(uintptr_t handle);
+int ffmpeg_wasm_mark_segment_boundary(uintptr_t handle, int audio);
+int ffmpeg_wasm_restart_segments(uintptr_t handle);
+
+// Live input: minimal probing, no seeking, and a keyframe skip whenever more
+// than target_seconds is buffered ahead (buffered_seconds). Set before open.
+int ffmpeg_wasm_set_live(uintptr_t handle, double target_seconds);
+int ffmpeg_wasm_live_skips(uintptr_t handle);
+
+// Open-state cache: save_open_state serializes format, codec parameters,
+// extradata, duration and keyframe index (read via open_state_ptr/_size);
+// set_open_state hands it to the next open, which then skips probing.
+// resume_position restreams from the keyframe before seconds (Matroska/WebM)
+// and returns the byte offset to append from, or < 0 (AVERROR) when the
+// caller should keep appending from header_end.
+int ffmpeg_wasm_save_open_state(uintptr_t handle);
+uintptr_t ffmpeg_wasm_open_state_ptr(uintptr_t handle);
+size_t ffmpeg_wasm_open_state_size(uintptr_t handle);
+double ffmpeg_wasm_header_end(uintptr_t handle);
+int ffmpeg_wasm_set_open_state(uintptr_t handle, const uint8_t *data, size_t len);
+double ffmpeg_wasm_resume_position(uintptr_t handle, double seconds);
+
+// Open, seek and decode
+int ffmpeg_wasm_open(uintptr_t handle, const char *format_name);
+double ffmpeg_wasm_duration_seconds(uintptr_t handle);
+int ffmpeg_wasm_seek_seconds(uintptr_t handle, double seconds);
+int ffmpeg_wasm_prepare_restream(uintptr_t handle, double new_byte_offset);
+int ffmpeg_wasm_read_frame(uintptr_t handle);
+int ffmpeg_wasm_read_video_frame(uintptr_t handle);
+
+// Packet cache: the selected streams' latest demuxed packets, capped at
+// max_seconds and max_bytes (0 = off, the default). seek_cached serves a seek
+// inside it by flushing the decoders and replaying from the keyframe at or
+// before seconds; the input is not touched. 1 = served, 0 = not cached.
+int ffmpeg_wasm_set_packet_cache(uintptr_t handle, double max_seconds, double max_bytes);
+int ffmpeg_wasm_seek_cached(uintptr_t handle, double seconds);
+
+// Gapless playlist: preload opens a second context for the next item while
+// current plays (1 = ready, 0 = needs more input). Decoders of current with
+// matching parameters are adopted instead of opened; only an item that
+// adopts none decodes its first frames ahead (per context, not per stream).
+// handoff, after current's last frame, moves them over and continues
+// current's clock so the next item's first sample follows its last.
+int ffmpeg_wasm_preload(uintptr_t handle, uintptr_t current, double audio_seconds);
+int ffmpeg_wasm_handoff(uintptr_t handle, uintptr_t previous);
+
+// Keyframe-only trick play; step returns 1 = keyframe, 0 = need data, -1 = none
+int ffmpeg_wasm_set_trick_play(uintptr_t handle, int enabled);
+int ffmpeg_wasm_trick_step(uintptr_t handle, double target_seconds, int direction);
+
+// GOP cache for frame step-back and reverse playback: decoded frames copied
+// into a store capped at max_bytes (0 = off), downscaled to max_height when
+// it is > 0; changing max_height empties the store. gop_step hands out the
+// frame before seconds (direction < 0) or after it (> 0) like a decoded one,
+// decoding from the previous keyframe when the store lacks it: 1 = frame,
+// 0 = call again with the same arguments, -1 = no frame in that direction,
+// AVERROR(ERANGE) when a demuxer seek lands past the keyframe it asked for.
+// Seek to resume regular decoding.
+int ffmpeg_wasm_set_gop_cache(uintptr_t handle, double max_bytes, int max_height);
+int ffmpeg_wasm_gop_step(uintptr_t handle, double seconds, int direction);
+
+// Video frame access
+int ffmpeg_wasm_video_width(uintptr_t handle);
+int ffmpeg_wasm_video_height(uintptr_t handle);
+int ffmpeg_wasm_frame_format(uintptr_t handle);
+uintptr_t ffmpeg_wasm_frame_data_ptr(uintptr_t handle, int plane);
+int ffmpeg_wasm_frame_linesize(uintptr_t handle, int plane);
+double ffmpeg_wasm_frame_pts_seconds(uintptr_t handle);
+int ffmpeg_wasm_frame_to_rgba(uintptr_t handle);
+uintptr_t ffmpeg_wasm_rgba_ptr(uintptr_t handle);
+int ffmpeg_wasm_rgba_stride(uintptr_t handle);
+size_t ffmpeg_wasm_rgba_size(uintptr_t handle);
+int ffmpeg_wasm_rgba_width(uintptr_t handle);
+int ffmpeg_wasm_rgba_height(uintptr_t handle);
+
+// Optional filter stage: yadif/bwdif deinterlacing, and an output size that
+// frame_to_rgba applies in its own sws pass. yuv420p10 frames at their
+// decoded size take a fused path instead that tone maps PQ/HLG (BT.2390,
+// from MaxCLL or the mastering peak) to SDR BT.709; set_tone_mapping(0)
+// sends them through sws too.
+int ffmpeg_wasm_set_deinterlace(uintptr_t handle, const char *filter, int double_rate);
+void ffmpeg_wasm_set_output_size(uintptr_t handle, int width, int height);
+void ffmpeg_wasm_set_tone_mapping(uintptr_t handle, int enabled);
+
+// Audio frame access (interleaved float32 stereo @ 48 kHz)
+int ffmpeg_wasm_audio_channels(uintptr_t handle);
+int ffmpeg_wasm_audio_sample_rate(uintptr_t handle);
+int ffmpeg_wasm_audio_nb_samples(uintptr_t handle);
+uintptr_t ffmpeg_wasm_audio_ptr(uintptr_t handle);
+size_t ffmpeg_wasm_audio_bytes(uintptr_t handle);
+double ffmpeg_wasm_audio_pts_seconds(uintptr_t handle);
+
+// Bulk access: frame_desc returns the context's FFmpegWasmFrameDesc (a fixed
+// address for its lifetime). present_frame converts the video frame to RGBA
+// and blends subtitles at pts + subtitle_delay in one call, filling the rgba
+// fields; returns the subtitle result (0/1) or a negative AVERROR.
+// stream_table builds the stream list with the current selection.
+uintptr_t ffmpeg_wasm_frame_desc(uintptr_t handle);
+int ffmpeg_wasm_present_frame(uintptr_t handle, double subtitle_delay);
+uintptr_t ffmpeg_wasm_stream_table(uintptr_t handle);
+
+// Streams and track selection
+int ffmpeg_wasm_streams_count(uintptr_t handle);
+int ffmpeg_wasm_stream_media_type(uintptr_t handle, int stream_index);
+int ffmpeg_wasm_stream_codec_id(uintptr_t handle, int stream_index);
+const char *ffmpeg_wasm_stream_codec_name(uintptr_t handle, int stream_index);
+const char *ffmpeg_wasm_stream_language(uintptr_t handle, int stream_index);
+const char *ffmpeg_wasm_stream_title(uintptr_t handle, int stream_index);
+int ffmpeg_wasm_stream_is_default(uintptr_t handle, int stream_index);
+int ffmpeg_wasm_has_video(uintptr_t handle);
+int ffmpeg_wasm_selected_video_stream(uintptr_t handle);
+int ffmpeg_wasm_selected_audio_stream(uintptr_t handle);
+int ffmpeg_wasm_audio_is_enabled(uintptr_t handle);
+int ffmpeg_wasm_select_streams(uintptr_t handle, int video_stream_index, int audio_stream_index);
+
+// Subtitles (libass)
+// One libass library per instance: prewarm builds it plus a spare renderer;
+// has_default_font is 1 when "Inter" is compiled in (no add_font needed).
+// add_font fonts stay with the context (or mosaic) until it is destroyed;
+// the same name, size and bytes again is a no-op.
+int ffmpeg_wasm_prewarm(void);
+int ffmpeg_wasm_has_default_font(void);
+int ffmpeg_wasm_selected_subtitle_stream(uintptr_t handle);
+int ffmpeg_wasm_subtitles_enabled(uintptr_t handle);
+int ffmpeg_wasm_select_subtitle_stream(uintptr_t handle, int stream_index);
+int ffmpeg_wasm_add_font(uintptr_t handle, const char *name, const uint8_t *data, size_t len);
+int ffmpeg_wasm_render_subtitles(uintptr_t handle, double pts_seconds);
+int ffmpeg_wasm_subtitle_events_count(uintptr_t handle);
+int ffmpeg_wasm_subtitle_first_start_ms(uintptr_t handle);
+int ffmpeg_wasm_subtitle_first_end_ms(uintptr_t handle);
+void ffmpeg_wasm_clear_subtitle_track(uintptr_t handle);
+
+// Memory accounting and budget
+void ffmpeg_wasm_set_memory_budget(uintptr_t handle, double budget_bytes);
+double ffmpeg_wasm_memory_budget(uintptr_t handle);
+double ffmpeg_wasm_memory_current(uintptr_t handle, int category);
+double ffmpeg_wasm_memory_peak(uintptr_t handle, int category);
+void ffmpeg_wasm_memory_reset_peaks(uintptr_t handle);
+int ffmpeg_wasm_memory_over_budget(uintptr_t handle);
+
+// Mosaic: N contexts scaled into tiles of one shared RGBA or YUV420P atlas,
+// sharing one libass library/renderer. Handles are FFmpegWasmMosaic pointers.
+uintptr_t ffmpeg_wasm_mosaic_create(int width, int height, int yuv);
+void ffmpeg_wasm_mosaic_destroy(uintptr_t mosaic);
+int ffmpeg_wasm_mosaic_add_font(uintptr_t mosaic, const char *name, const uint8_t *data, size_t len);
+int ffmpeg_wasm_mosaic_attach(uintptr_t mosaic, uintptr_t handle, int x, int y, int width, int height);
+void ffmpeg_wasm_mosaic_detach(uintptr_t mosaic, int tile_index);
+int ffmpeg_wasm_mosaic_present(uintptr_t mosaic);
+uintptr_t ffmpeg_wasm_mosaic_data_ptr(uintptr_t mosaic, int plane);
+int ffmpeg_wasm_mosaic_linesize(uintptr_t mosaic, int plane);
+size_t ffmpeg_wasm_mosaic_size(uintptr_t mosaic);
+
+// Remux to fragmented MP4 (MSE). Call set_remux_only before open; step
+// returns packets moved, 0 = need data, -1 = trailer written.
+void ffmpeg_wasm_set_remux_only(uintptr_t handle, int enabled);
+int ffmpeg_wasm_remux_start(uintptr_t handle, int flags);
+int ffmpeg_wasm_remux_step(uintptr_t handle, int max_packets);
+void ffmpeg_wasm_remux_stop(uintptr_t handle);
+const char *ffmpeg_wasm_remux_mime(uintptr_t handle);
+int ffmpeg_wasm_remux_init_serial(uintptr_t handle);
+uintptr_t ffmpeg_wasm_remux_init_ptr(uintptr_t handle);
+size_t ffmpeg_wasm_remux_init_size(uintptr_t handle);
+uintptr_t ffmpeg_wasm_remux_output_ptr(uintptr_t handle);
+size_t ffmpeg_wasm_remux_output_size(uintptr_t handle);
+void ffmpeg_wasm_remux_consume(uintptr_t handle, size_t bytes);
+
+// Stream-copy clip export into an in-memory mp4/matroska file. step returns
+// packets read, 0 = need data, -1 = done; then read the chunks.
+int ffmpeg_wasm_export_clip(uintptr_t handle, double start, double end, const char *container, int flags);
+int ffmpeg_wasm_export_step(uintptr_t handle, int max_packets);
+double ffmpeg_wasm_export_progress(uintptr_t handle);
+double ffmpeg_wasm_export_size(uintptr_t handle);
+int ffmpeg_wasm_export_chunk_count(uintptr_t handle);
+uintptr_t ffmpeg_wasm_export_chunk_ptr(uintptr_t handle, int index);
+size_t ffmpeg_wasm_export_chunk_size(uintptr_t handle, int index);
+void ffmpeg_wasm_export_stop(uintptr_t handle);
+
+// Waveform peaks (min, max, rms per bucket) on a demux-only context; step
+// returns packets read, 0 = need data, -1 = done. Partial results are valid.
+int ffmpeg_wasm_compute_peaks(uintptr_t handle, int buckets, double duration);
+int ffmpeg_wasm_peaks_step(uintptr_t handle, int max_packets);
+uintptr_t ffmpeg_wasm_peaks_ptr(uintptr_t handle);
+int ffmpeg_wasm_peaks_filled(uintptr_t handle);
+double ffmpeg_wasm_peaks_duration(uintptr_t handle);
+void ffmpeg_wasm_peaks_stop(uintptr_t handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // FFMPEG_WASM_H
@@ -0,0 +1,456 @@
+// Native profiling harness for ffmpeg_wasm.c.
+//
+// Feeds a local file through the same append/open/read_frame API the web
+// worker uses, so the hot paths (ffmpeg_wasm_read_frame, frame_to_rgba,
+// blend_ass_image via render_subtitles) can be inspected with perf, valgrind
+// or gprof. Built by scripts/build-native.sh.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ffmpeg_wasm.h"
+
+#define CHUNK_BYTES (256 * 1024)        // Matches MAX_CHUNK_BYTES in ffmpeg-worker.js
+#define MIN_OPEN_BYTES (2 * 1024 * 1024)  // Matches MIN_OPEN_BYTES in ffmpeg-worker.js
+
+typedef struct Stage {
+  const char *name;
+  double seconds;
+  long calls;
+} Stage;
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void stage_add(Stage *stage, double start) {
+  stage->seconds += now_seconds() - start;
+  stage->calls += 1;
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [options] <media-file>\n"
+          "  -f, --format NAME     container hint passed to ffmpeg_wasm_open (e.g. matroska)\n"
+          "  -n, --frames N        stop after N video frames\n"
+          "  -s, --subtitles IDX   enable subtitle stream IDX (-1 = best)\n"
+          "      --font PATH       font file injected as \"Inter\" (like injectFont)\n"
+          "      --no-rgba         skip ffmpeg_wasm_frame_to_rgba\n"
+          "      --no-audio        disable audio decoding\n"
+          "      --chunk BYTES     append chunk size (default %d)\n"
+          "      --clip START:END  stream-copy this range instead of decoding (needs --out)\n"
+          "      --out PATH        clip output; .mkv selects matroska, anything else mp4\n"
+          "      --peaks N         compute N waveform buckets instead of decoding\n",
+          argv0, CHUNK_BYTES);
+}
+
+static uint8_t *read_whole_file(const char *path, long *out_len) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    return NULL;
+  }
+  fseek(fp, 0, SEEK_END);
+  long len = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  uint8_t *data = len > 0 ? malloc((size_t)len) : NULL;
+  if (data && fread(data, 1, (size_t)len, fp) != (size_t)len) {
+    free(data);
+    data = NULL;
+  }
+  fclose(fp);
+  *out_len = len;
+  return data;
+}
+
+// Append the next chunk; returns 0 at end of file (EOF already signalled)
+static size_t feed_chunk(uintptr_t ctx, FILE *fp, uint8_t *chunk, long chunk_bytes, Stage *st_append) {
+  size_t n = fread(chunk, 1, (size_t)chunk_bytes, fp);
+  if (n == 0) {
+    ffmpeg_wasm_set_eof(ctx);
+    return 0;
+  }
+  double t = now_seconds();
+  ffmpeg_wasm_append(ctx, chunk, n);
+  stage_add(st_append, t);
+  return n;
+}
+
+// Open ctx without decoders (remux-only), appending until the header parses
+static int open_demux_only(uintptr_t ctx, FILE *fp, uint8_t *chunk, long chunk_bytes, const char *format_name,
+                           Stage *st_append, int *eof) {
+  long appended = 0;
+  ffmpeg_wasm_set_remux_only(ctx, 1);
+  for (;;) {
+    while (!*eof && appended < MIN_OPEN_BYTES) {
+      size_t n = feed_chunk(ctx, fp, chunk, chunk_bytes, st_append);
+      *eof = n == 0;
+      appended += (long)n;
+    }
+    if (ffmpeg_wasm_open(ctx, format_name) == 0) {
+      return 0;
+    }
+    if (*eof) {
+      fprintf(stderr, "open failed\n");
+      return 1;
+    }
+    appended = 0;
+  }
+}
+
+// Clip export mode: demux only, no decoders, write the chunks to out_path
+static int run_export(uintptr_t ctx, FILE *fp, uint8_t *chunk, long chunk_bytes, const char *format_name,
+                      double start, double end, const char *out_path) {
+  Stage st_append = {"append", 0, 0};
+  Stage st_step = {"export_step", 0, 0};
+  int eof = 0;
+  double wall_start = now_seconds();
+
+  if (open_demux_only(ctx, fp, chunk, chunk_bytes, format_name, &st_append, &eof) != 0) {
+    return 1;
+  }
+
+  const char *dot = strrchr(out_path, '.');
+  const char *container = dot && strcmp(dot, ".mkv") == 0 ? "matroska" : "mp4";
+  int ret = ffmpeg_wasm_export_clip(ctx, start, end, container,
+                                    FFMPEG_WASM_EXPORT_VIDEO | FFMPEG_WASM_EXPORT_AUDIO);
+  if (ret < 0) {
+    fprintf(stderr, "export_clip failed (%d)\n", ret);
+    return 1;
+  }
+  for (;;) {
+    double t = now_seconds();
+    ret = ffmpeg_wasm_export_step(ctx, 256);
+    stage_add(&st_step, t);
+    if (ret == -1) {
+      break;
+    }
+    if (ret < 0) {
+      fprintf(stderr, "export_step failed (%d)\n", ret);
+      return 1;
+    }
+    if (ret == 0 && (eof || feed_chunk(ctx, fp, chunk, chunk_bytes, &st_append) == 0)) {
+      eof = 1;
+    }
+  }
+
+  FILE *out = fopen(out_path, "wb");
+  if (!out) {
+    perror(out_path);
+    return 1;
+  }
+  int count = ffmpeg_wasm_export_chunk_count(ctx);
+  for (int i = 0; i < count; i++) {
+    fwrite((const void *)ffmpeg_wasm_export_chunk_ptr(ctx, i), 1,
+           ffmpeg_wasm_export_chunk_size(ctx, i), out);
+  }
+  fclose(out);
+
+  double wall = now_seconds() - wall_start;
+  printf("exported %.1f MB to %s in %.3fs\n", ffmpeg_wasm_export_size(ctx) / 1048576.0, out_path, wall);
+  Stage *stages[] = {&st_append, &st_step};
+  for (size_t i = 0; i < sizeof(stages) / sizeof(stages[0]); i++) {
+    printf("  %-18s %8ld calls %10.3f ms total\n", stages[i]->name, stages[i]->calls, stages[i]->seconds * 1e3);
+  }
+  printf("memory peak %.1f MB\n", ffmpeg_wasm_memory_peak(ctx, -1) / 1048576.0);
+  return 0;
+}
+
+// Waveform mode: audio-only demux and decode, reduced into buckets in C
+static int run_peaks(uintptr_t ctx, FILE *fp, uint8_t *chunk, long chunk_bytes, const char *format_name,
+                     int buckets) {
+  Stage st_append = {"append", 0, 0};
+  Stage st_step = {"peaks_step", 0, 0};
+  int eof = 0;
+  double wall_start = now_seconds();
+
+  if (open_demux_only(ctx, fp, chunk, chunk_bytes, format_name, &st_append, &eof) != 0) {
+    return 1;
+  }
+  int ret = ffmpeg_wasm_compute_peaks(ctx, buckets, 0.0);
+  if (ret < 0) {
+    fprintf(stderr, "compute_peaks failed (%d)\n", ret);
+    return 1;
+  }
+  for (;;) {
+    double t = now_seconds();
+    ret = ffmpeg_wasm_peaks_step(ctx, 256);
+    stage_add(&st_step, t);
+    if (ret == -1) {
+      break;
+    }
+    if (ret < 0) {
+      fprintf(stderr, "peaks_step failed (%d)\n", ret);
+      return 1;
+    }
+    if (ret == 0 && (eof || feed_chunk(ctx, fp, chunk, chunk_bytes, &st_append) == 0)) {
+      eof = 1;
+    }
+  }
+
+  const float *peaks = (const float *)(uintptr_t)ffmpeg_wasm_peaks_ptr(ctx);
+  int filled = ffmpeg_wasm_peaks_filled(ctx);
+  float lo = 0.0f, hi = 0.0f, rms = 0.0f;
+  for (int i = 0; i < filled; i++) {
+    lo = peaks[i * 3] < lo ? peaks[i * 3] : lo;
+    hi = peaks[i * 3 + 1] > hi ? peaks[i * 3 + 1] : hi;
+    rms = peaks[i * 3 + 2] > rms ? peaks[i * 3 + 2] : rms;
+  }
+  double wall = now_seconds() - wall_start;
+  printf("%d/%d buckets over %.2fs in %.3fs (min %.3f, max %.3f, loudest rms %.3f)\n", filled, buckets,
+         ffmpeg_wasm_peaks_duration(ctx), wall, lo, hi, rms);
+  Stage *stages[] = {&st_append, &st_step};
+  for (size_t i = 0; i < sizeof(stages) / sizeof(stages[0]); i++) {
+    printf("  %-18s %8ld calls %10.3f ms total\n", stages[i]->name, stages[i]->calls, stages[i]->seconds * 1e3);
+  }
+  printf("memory peak %.1f MB\n", ffmpeg_wasm_memory_peak(ctx, -1) / 1048576.0);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *format_name = NULL;
+  const char *font_path = NULL;
+  long max_frames = -1;
+  int subtitle_index = -2;
+  int do_rgba = 1;
+  int audio = 1;
+  long chunk_bytes = CHUNK_BYTES;
+  double clip_start = -1.0;
+  double clip_end = -1.0;
+  const char *out_path = NULL;
+  int peak_buckets = 0;
+
+  static const struct option options[] = {
+      {"format", required_argument, NULL, 'f'},
+      {"frames", required_argument, NULL, 'n'},
+      {"subtitles", required_argument, NULL, 's'},
+      {"font", required_argument, NULL, 'F'},
+      {"no-rgba", no_argument, NULL, 'R'},
+      {"no-audio", no_argument, NULL, 'A'},
+      {"chunk", required_argument, NULL, 'c'},
+      {"clip", required_argument, NULL, 'C'},
+      {"out", required_argument, NULL, 'o'},
+      {"peaks", required_argument, NULL, 'P'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0},
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "f:n:s:h", options, NULL)) != -1) {
+    switch (opt) {
+      case 'f':
+        format_name = optarg;
+        break;
+      case 'n':
+        max_frames = strtol(optarg, NULL, 10);
+        break;
+      case 's':
+        subtitle_index = (int)strtol(optarg, NULL, 10);
+        break;
+      case 'F':
+        font_path = optarg;
+        break;
+      case 'R':
+        do_rgba = 0;
+        break;
+      case 'A':
+        audio = 0;
+        break;
+      case 'c':
+        chunk_bytes = strtol(optarg, NULL, 10);
+        break;
+      case 'C':
+        if (sscanf(optarg, "%lf:%lf", &clip_start, &clip_end) != 2) {
+          clip_start = clip_end = -1.0;
+        }
+        break;
+      case 'o':
+        out_path = optarg;
+        break;
+      case 'P':
+        peak_buckets = (int)strtol(optarg, NULL, 10);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 2;
+    }
+  }
+  if (optind >= argc || chunk_bytes <= 0 || (clip_end > clip_start) != (out_path != NULL)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  const char *path = argv[optind];
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    perror(path);
+    return 1;
+  }
+  fseek(fp, 0, SEEK_END);
+  long file_size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+
+  uint8_t *chunk = malloc((size_t)chunk_bytes);
+  uintptr_t ctx = ffmpeg_wasm_create(4 * 1024 * 1024);
+  if (!chunk || !ctx) {
+    fprintf(stderr, "allocation failed\n");
+    return 1;
+  }
+  ffmpeg_wasm_set_file_size(ctx, (double)file_size);
+  ffmpeg_wasm_set_buffer_limit(ctx, 500 * 1024 * 1024);
+
+  if (out_path || peak_buckets > 0) {
+    int mode_status = out_path ? run_export(ctx, fp, chunk, chunk_bytes, format_name, clip_start, clip_end, out_path)
+                               : run_peaks(ctx, fp, chunk, chunk_bytes, format_name, peak_buckets);
+    ffmpeg_wasm_destroy(ctx);
+    free(chunk);
+    fclose(fp);
+    return mode_status;
+  }
+
+  Stage st_append = {"append", 0, 0};
+  Stage st_open = {"open", 0, 0};
+  Stage st_read = {"read_frame", 0, 0};
+  Stage st_rgba = {"frame_to_rgba", 0, 0};
+  Stage st_subs = {"render_subtitles", 0, 0};
+
+  long appended = 0;
+  int eof = 0;
+  int opened = 0;
+  long video_frames = 0;
+  long audio_frames = 0;
+  int status = 0;
+  double wall_start = now_seconds();
+
+  for (;;) {
+    if (!opened) {
+      while (!eof && appended < MIN_OPEN_BYTES) {
+        size_t n = fread(chunk, 1, (size_t)chunk_bytes, fp);
+        if (n == 0) {
+          ffmpeg_wasm_set_eof(ctx);
+          eof = 1;
+          break;
+        }
+        double t = now_seconds();
+        ffmpeg_wasm_append(ctx, chunk, n);
+        stage_add(&st_append, t);
+        appended += (long)n;
+      }
+      double t = now_seconds();
+      int ret = ffmpeg_wasm_open(ctx, format_name);
+      stage_add(&st_open, t);
+      if (ret < 0) {
+        if (eof) {
+          fprintf(stderr, "open failed (%d)\n", ret);
+          status = 1;
+          break;
+        }
+        appended = 0;  // Retry after another MIN_OPEN_BYTES
+        continue;
+      }
+      opened = 1;
+      if (!audio) {
+        ffmpeg_wasm_set_audio_enabled(ctx, 0);
+      }
+      if (subtitle_index != -2) {
+        if (ffmpeg_wasm_select_subtitle_stream(ctx, subtitle_index) < 0) {
+          fprintf(stderr, "subtitle selection failed\n");
+        } else if (font_path) {
+          long font_len = 0;
+          uint8_t *font = read_whole_file(font_path, &font_len);
+          if (font) {
+            ffmpeg_wasm_add_font(ctx, "Inter", font, (int)font_len);
+            free(font);
+          }
+        }
+      }
+      printf("opened %dx%d, duration %.2fs, %d streams\n", ffmpeg_wasm_video_width(ctx),
+             ffmpeg_wasm_video_height(ctx), ffmpeg_wasm_duration_seconds(ctx),
+             ffmpeg_wasm_streams_count(ctx));
+    }
+
+    double t = now_seconds();
+    int ret = ffmpeg_wasm_read_frame(ctx);
+    stage_add(&st_read, t);
+
+    if (ret == 1) {
+      video_frames += 1;
+      if (do_rgba) {
+        t = now_seconds();
+        ffmpeg_wasm_frame_to_rgba(ctx);
+        stage_add(&st_rgba, t);
+        if (ffmpeg_wasm_subtitles_enabled(ctx)) {
+          t = now_seconds();
+          ffmpeg_wasm_render_subtitles(ctx, ffmpeg_wasm_frame_pts_seconds(ctx));
+          stage_add(&st_subs, t);
+        }
+      }
+      if (max_frames > 0 && video_frames >= max_frames) {
+        break;
+      }
+    } else if (ret == 2) {
+      audio_frames += 1;
+    } else if (ret == 0) {
+      size_t n = eof ? 0 : fread(chunk, 1, (size_t)chunk_bytes, fp);
+      if (n == 0) {
+        if (eof) {
+          fprintf(stderr, "decoder starved after EOF\n");
+          status = 1;
+          break;
+        }
+        ffmpeg_wasm_set_eof(ctx);
+        eof = 1;
+        continue;
+      }
+      t = now_seconds();
+      ffmpeg_wasm_append(ctx, chunk, n);
+      stage_add(&st_append, t);
+    } else if (ret == -1) {
+      break;
+    } else {
+      fprintf(stderr, "decode error (%d)\n", ret);
+      status = 1;
+      break;
+    }
+  }
+
+  double wall = now_seconds() - wall_start;
+  printf("video frames %ld, audio frames %ld, wall %.3fs (%.1f fps)\n", video_frames, audio_frames,
+         wall, wall > 0 ? video_frames / wall : 0.0);
+  Stage *stages[] = {&st_append, &st_open, &st_read, &st_rgba, &st_subs};
+  for (size_t i = 0; i < sizeof(stages) / sizeof(stages[0]); i++) {
+    Stage *s = stages[i];
+    if (s->calls == 0) {
+      continue;
+    }
+    printf("  %-18s %8ld calls %10.3f ms total %8.3f us/call\n", s->name, s->calls,
+           s->seconds * 1e3, s->seconds * 1e6 / (double)s->calls);
+  }
+  static const char *const mem_names[FFMPEG_WASM_MEM_CATEGORY_COUNT] = {
+      [FFMPEG_WASM_MEM_STREAM_BUFFER] = "stream_buffer",
+      [FFMPEG_WASM_MEM_CODEC_FRAMES] = "codec_frames",
+      [FFMPEG_WASM_MEM_RGBA] = "rgba",
+      [FFMPEG_WASM_MEM_AUDIO] = "audio",
+      [FFMPEG_WASM_MEM_LIBASS] = "libass",
+      [FFMPEG_WASM_MEM_PACKET_CACHE] = "packet_cache",
+      [FFMPEG_WASM_MEM_GOP_CACHE] = "gop_cache",
+  };
+  printf("memory peak %.1f MB\n", ffmpeg_wasm_memory_peak(ctx, -1) / 1048576.0);
+  for (int i = 0; i < FFMPEG_WASM_MEM_CATEGORY_COUNT; i++) {
+    printf("  %-18s %10.1f MB peak %10.1f MB now\n", mem_names[i],
+           ffmpeg_wasm_memory_peak(ctx, i) / 1048576.0,
+           ffmpeg_wasm_memory_current(ctx, i) / 1048576.0);
+  }
+
+  ffmpeg_wasm_destroy(ctx);
+  free(chunk);
+  fclose(fp);
+  return status;
+}
@@ -0,0 +1,161 @@
+#ifndef FFMPEG_WASM_PLATFORM_H
+#define FFMPEG_WASM_PLATFORM_H
+
+// Portability layer so ffmpeg_wasm.c builds both with Emscripten (the shipped
+// wasm module) and natively against a host FFmpeg/libass (profiling harness,
+// see scripts/build-native.sh). Everything Emscripten-specific lives here.
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <libavutil/log.h>
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/emscripten.h>
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>  // Built with -msimd128
+#endif
+#ifdef FFMPEG_WASM_SPLIT
+#include <dlfcn.h>  // Decoders and libass live in side modules
+#endif
+#else
+// Native builds export the same symbols from a shared library.
+#ifndef EMSCRIPTEN_KEEPALIVE
+#define EMSCRIPTEN_KEEPALIVE __attribute__((used, visibility("default")))
+#endif
+#endif
+
+// Side modules of a split build (build-ffmpeg.sh --split). The worker fetches
+// them with loadDynamicLibrary under their bare file name, so dlopen only
+// finds modules that are already loaded and never blocks on the network.
+static inline void *platform_side_module(const char *name) {
+#if defined(__EMSCRIPTEN__) && defined(FFMPEG_WASM_SPLIT)
+  return dlopen(name, RTLD_NOW | RTLD_GLOBAL);
+#else
+  (void)name;
+  return NULL;
+#endif
+}
+
+static inline void *platform_side_symbol(void *module, const char *symbol) {
+#if defined(__EMSCRIPTEN__) && defined(FFMPEG_WASM_SPLIT)
+  return module ? dlsym(module, symbol) : NULL;
+#else
+  (void)module;
+  (void)symbol;
+  return NULL;
+#endif
+}
+
+static inline int platform_is_split(void) {
+#if defined(__EMSCRIPTEN__) && defined(FFMPEG_WASM_SPLIT)
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+// Forward a decoded subtitle line to the worker's log panel.
+static inline void platform_post_subtitle_log(const char *text, int start_ms, int end_ms) {
+#ifdef __EMSCRIPTEN__
+  EM_ASM_({
+    postMessage({
+      type: "subtitleLog",
+      text: UTF8ToString($0),
+      startMs: $1,
+      endMs: $2
+    });
+  }, text, start_ms, end_ms);
+#else
+  av_log(NULL, AV_LOG_DEBUG, "subtitle [%d-%d ms]: %s\n", start_ms, end_ms, text ? text : "");
+#endif
+}
+
+// Report that libass produced no image for the requested time.
+static inline void platform_post_subtitle_debug(const char *note, int n_events, int first_start_ms,
+                                                int first_end_ms) {
+#ifdef __EMSCRIPTEN__
+  EM_ASM_({
+    postMessage({
+      type: "subtitleDebug",
+      note: UTF8ToString($0),
+      nEvents: $1,
+      firstStartMs: $2,
+      firstEndMs: $3
+    });
+  }, note, n_events, first_start_ms, first_end_ms);
+#else
+  av_log(NULL, AV_LOG_DEBUG, "subtitle debug: %s nEvents=%d firstStartMs=%d firstEndMs=%d\n",
+         note ? note : "", n_events, first_start_ms, first_end_ms);
+#endif
+}
+
+// Secondary store for bytes the stream buffer spills (ffmpeg_wasm_set_spill).
+// In the browser JS registers a store under the context handle in
+// Module.spillStores (web/spill-store.js: OPFS sync access handle, or a temp
+// file under Node); natively it is an anonymous temp file. Reads and writes
+// are synchronous and return the byte count, or -1. The handle goes to JS as
+// a pointer ('p'), which arrives as a Number like the cwrap handle that keys
+// the Map; a uintptr_t would be a BigInt under --memory64.
+static inline void *platform_spill_open(uintptr_t id) {
+#ifdef __EMSCRIPTEN__
+  int ok = EM_ASM_INT({ return Module.spillStores && Module.spillStores.has($0) ? 1 : 0; }, (void *)id);
+  return ok ? (void *)id : NULL;
+#else
+  (void)id;
+  return tmpfile();
+#endif
+}
+
+static inline int platform_spill_write(void *store, int64_t pos, const uint8_t *data, int len) {
+#ifdef __EMSCRIPTEN__
+  return EM_ASM_INT({
+    try {
+      return Module.spillStores.get($0).write($1, HEAPU8.subarray($2, $2 + $3));
+    } catch (err) {
+      return -1;
+    }
+  }, store, (double)pos, data, len);
+#else
+  FILE *file = (FILE *)store;
+  if (fseek(file, (long)pos, SEEK_SET) != 0) {  // 64-bit long on the native hosts
+    return -1;
+  }
+  return (int)fwrite(data, 1, (size_t)len, file);
+#endif
+}
+
+static inline int platform_spill_read(void *store, int64_t pos, uint8_t *data, int len) {
+#ifdef __EMSCRIPTEN__
+  return EM_ASM_INT({
+    try {
+      return Module.spillStores.get($0).read($1, HEAPU8.subarray($2, $2 + $3));
+    } catch (err) {
+      return -1;
+    }
+  }, store, (double)pos, data, len);
+#else
+  FILE *file = (FILE *)store;
+  if (fseek(file, (long)pos, SEEK_SET) != 0) {
+    return -1;
+  }
+  size_t got = fread(data, 1, (size_t)len, file);
+  return got > 0 ? (int)got : -1;
+#endif
+}
+
+static inline void platform_spill_close(void *store) {
+#ifdef __EMSCRIPTEN__
+  EM_ASM({
+    const store = Module.spillStores && Module.spillStores.get($0);
+    if (store) {
+      Module.spillStores.delete($0);
+      store.close();
+    }
+  }, store);
+#else
+  fclose((FILE *)store);
+#endif
+}
+
+#endif  // FFMPEG_WASM_PLATFORM_H
@@ -12,6 +12,7 @@ const overlayPause = document.getElementById("overlayPause");
 const overlayPlayPause = document.getElementById("overlayPlayPause"); // if unified
 const overlayStop = document.getElementById("overlayStop"); // Removed in v3 UI but logic might remain? No, logic uses overlayPlay/Pause.
 const seekRange = document.getElementById("seekRange");
+const waveformCanvas = document.getElementById("waveformCanvas");
 const timeCurrentEl = document.getElementById("timeCurrent");
 const timeTotalEl = document.getElementById("timeTotal");
 const overlayMute = document.getElementById("overlayMute");
@@ -19,6 +20,7 @@ const overlayVolume = document.getElementById("overlayVolume");
 const overlayFullscreen = document.getElementById("overlayFullscreen");
 const canvas2d = document.getElementById("canvas2d");
 const canvasGl = document.getElementById("canvasGl");
+const mseVideo = document.getElementById("mseVideo");
 const canvasWrap = document.getElementById("canvasWrap");
 const playerEl = document.getElementById("player");
 const logEl = document.getElementById("log");
@@ -56,10 +58,16 @@ const shortcutsCloseBtn = document.getElementById("shortcutsCloseBtn");
 const menuOpenBtn = document.getElementById("menuOpenBtn");
 const menuUrlBtn = document.getElementById("menuUrlBtn");
 const menuCloseBtn = document.getElementById("menuCloseBtn");
+const menuExportBtn = document.getElementById("menuExportBtn");
 const shortcutsBtn = document.getElementById("shortcutsBtn");
 
 const DEFAULT_AUDIO_RATE = 48000;
 const PLAYBACK_SPEEDS = [0.25, 0.5, 0.75, 1.0, 1.25, 1.5, 1.75, 2.0];
+const TRICK_RATES = [-32, -16, -8, -4, -1, 0, 4, 8, 16, 32]; // Keyframe scan rates; -1 is decoded reverse
+const MSE_REPORT_MS = 250; // How often buffered-ahead is reported to the worker
+const MSE_EVICT_KEEP_SECONDS = 10; // Played media kept when the SourceBuffer is full
+const EXPORT_DEFAULT_SECONDS = 30; // Clip length when no loop end (B) is set
+const WAVEFORM_BUCKETS = 1024; // Peaks behind the scrub bar, resampled to its width
 
 const state = {
   worker: null,
@@ -71,9 +79,23 @@ const state = {
   seekEnabled: false,
   seekHint: "",
   renderMode: "2d",
+  passthrough: false, // Current source plays through MSE on mseVideo
+  waveformRequested: false,
+  lastPeaks: null,
+  mse: null,
   formatHint: "",
   frames: 0,
   bytes: 0,
+  bufferedSeconds: -1,
+  bitrate: 0,
+  variant: "", // HLS/DASH variant being fetched
+  liveTarget: 0, // Live source latency target in seconds, 0 = not live
+  liveSkips: -1,
+  spilledBytes: 0, // Consumed input kept in OPFS instead of the heap
+  droppedFrames: 0, // Video frames the A/V clock skipped to catch up
+  lateFrames: 0,
+  clockDrift: 0, // Seconds, audio position minus presentation clock
+  playlist: { files: [], index: 0 }, // Local files picked together play back to back
   pts: 0,
   lastSeekCommitTs: 0,
   lastSeekCommitValue: 0,
@@ -91,6 +113,7 @@ const state = {
     bufferedSeconds: 0,
     pending: [],
     warned: false,
+    epoch: 0,
   },
   tracks: {
     video: -1,
@@ -100,6 +123,7 @@ const state = {
   volume: 0.8,
   muted: false,
   playbackSpeed: 1.0,
+  trickRate: 0,
   audioDelay: 0, // in seconds
   subtitleDelay: 0, // in seconds
   loop: {
@@ -108,6 +132,8 @@ const state = {
     endTime: null,
   },
   aspectRatio: "auto", // auto, 16:9, 4:3, fill, stretch
+  deinterlace: "", // "", yadif, bwdif
+  wasmModule: null, // { module, buildId } compiled by the first worker
   filters: {
     brightness: 100,
     contrast: 100,
@@ -307,6 +333,12 @@ const updateMenuCheckmarks = () => {
       state.renderMode === val ? "✓" : "";
   });
 
+  // Deinterlace
+  document.querySelectorAll('[data-action="setDeinterlace"]').forEach((el) => {
+    el.querySelector(".menu-checkbox").textContent =
+      state.deinterlace === el.getAttribute("data-value") ? "✓" : "";
+  });
+
   // Aspect Ratio
   document.querySelectorAll('[data-action="setAspect"]').forEach((el) => {
     const val = el.getAttribute("data-value");
@@ -414,12 +446,22 @@ const toggleFullscreen = async () => {
   }
 };
 
+// "mse" renders through the canvas 2D path whenever passthrough is not
+// possible for the current source.
+const canvasRenderMode = () => (state.renderMode === "webgl" ? "webgl" : "2d");
+
+const updateSurfaces = () => {
+  const canvasMode = canvasRenderMode();
+  canvas2d.classList.toggle("is-hidden", state.passthrough || canvasMode !== "2d");
+  canvasGl.classList.toggle("is-hidden", state.passthrough || canvasMode !== "webgl");
+  if (mseVideo) mseVideo.classList.toggle("is-hidden", !state.passthrough);
+};
+
 const setRenderMode = (mode) => {
-  state.renderMode = mode === "webgl" ? "webgl" : "2d";
-  canvas2d.classList.toggle("is-hidden", state.renderMode !== "2d");
-  canvasGl.classList.toggle("is-hidden", state.renderMode !== "webgl");
+  state.renderMode = mode === "webgl" || mode === "mse" ? mode : "2d";
+  updateSurfaces();
   if (state.worker) {
-    state.worker.postMessage({ type: "renderMode", mode: state.renderMode });
+    state.worker.postMessage({ type: "renderMode", mode: canvasRenderMode() });
   }
   updateMenuCheckmarks();
 };
@@ -469,10 +511,15 @@ const resetAudioState = () => {
     bufferedSeconds: 0,
     pending: [],
     warned: false,
+    epoch: state.audio ? state.audio.epoch : 0, // Last audioClear epoch from the worker
   };
 };
 
 const applyGain = () => {
+  if (mseVideo) {
+    mseVideo.volume = state.volume;
+    mseVideo.muted = state.muted;
+  }
   if (!state.audio.gain) return;
   state.audio.gain.gain.value = state.muted ? 0 : state.volume;
 };
@@ -515,7 +562,25 @@ const updateAudioDisplay = () => {
 
 const updateStats = () => {
   if (frameCountEl) frameCountEl.textContent = state.frames.toString();
-  if (bytesCountEl) bytesCountEl.textContent = formatBytes(state.bytes);
+  if (bytesCountEl) {
+    bytesCountEl.textContent = formatBytes(state.bytes);
+    const flow =
+      state.bufferedSeconds >= 0
+        ? `${state.bufferedSeconds.toFixed(1)}s buffered ahead at ${(state.bitrate / 1e6).toFixed(2)} Mbit/s`
+        : "";
+    const extras = [flow];
+    if (state.variant) extras.push(`variant ${state.variant}`);
+    if (state.spilledBytes > 0) extras.push(`${formatBytes(state.spilledBytes)} spilled to disk`);
+    if (state.droppedFrames > 0 || state.lateFrames > 0) {
+      extras.push(
+        `${state.droppedFrames} dropped, ${state.lateFrames} late, drift ${Math.round(state.clockDrift * 1000)} ms`
+      );
+    }
+    if (state.liveSkips >= 0) {
+      extras.push(`live, target ${Math.round(state.liveTarget * 1000)} ms, ${state.liveSkips} keyframe skips`);
+    }
+    bytesCountEl.title = extras.filter(Boolean).join(", ");
+  }
   if (ptsValueEl) ptsValueEl.textContent = `${state.pts.toFixed(2)}s`;
   updateAudioDisplay();
 };
@@ -530,8 +595,8 @@ const syncAudioClock = () => {
 const flushAudioQueue = () => {
   if (!state.audio.ready || !state.audio.worklet) return;
   while (state.audio.pending.length) {
-    const buffer = state.audio.pending.shift();
-    state.audio.worklet.port.postMessage({ type: "push", buffer }, [buffer]);
+    const { buffer, pts, epoch } = state.audio.pending.shift();
+    state.audio.worklet.port.postMessage({ type: "push", buffer, pts, epoch }, [buffer]);
   }
 };
 
@@ -569,8 +634,11 @@ const initAudio = (sampleRate, channels) => {
     worklet.connect(gain).connect(audioContext.destination);
     worklet.port.onmessage = (event) => {
       if (!event.data || event.data.type !== "status") return;
+      reportAudioClock(audioContext, event.data);
     };
     worklet.port.postMessage({ type: "config", channels });
+    worklet.port.postMessage({ type: "clear", epoch: state.audio.epoch });
+    worklet.port.postMessage({ type: "latency", seconds: state.liveTarget });
 
     state.audio.context = audioContext;
     state.audio.worklet = worklet;
@@ -596,11 +664,30 @@ const initAudio = (sampleRate, channels) => {
   return state.audio.initPromise;
 };
 
-const queueAudioBuffer = (buffer, pts) => {
+// The worklet's playing position, as the pts audible at an epoch-based wall
+// time in seconds (the worker's performance.now() has another origin)
+const reportAudioClock = (audioContext, status) => {
+  if (!state.worker || !Number.isFinite(status.pts) || status.epoch !== state.audio.epoch) return;
+  const stamp = audioContext.getOutputTimestamp ? audioContext.getOutputTimestamp() : null;
+  const audibleMs =
+    stamp && stamp.performanceTime
+      ? stamp.performanceTime + (status.time - stamp.contextTime) * 1000
+      : performance.now() + (status.time - audioContext.currentTime + (audioContext.outputLatency || 0)) * 1000;
+  state.worker.postMessage({
+    type: "audioClock",
+    pts: status.pts,
+    wall: (performance.timeOrigin + audibleMs) / 1000,
+    epoch: status.epoch,
+  });
+};
+
+const queueAudioBuffer = (buffer, pts, epoch) => {
+  // Past a playlist handoff, reports for the previous item's samples are stale
+  if (Number.isFinite(epoch)) state.audio.epoch = epoch;
   if (!state.audio.ready || !state.audio.worklet) {
-    if (state.audio.pending.length < 12) state.audio.pending.push(buffer);
+    if (state.audio.pending.length < 12) state.audio.pending.push({ buffer, pts, epoch });
   } else {
-    state.audio.worklet.port.postMessage({ type: "push", buffer }, [buffer]);
+    state.audio.worklet.port.postMessage({ type: "push", buffer, pts, epoch }, [buffer]);
   }
 
   if (state.audio.basePts === null && Number.isFinite(pts)) {
@@ -609,9 +696,10 @@ const queueAudioBuffer = (buffer, pts) => {
   }
 };
 
-const clearAudioQueue = () => {
+const clearAudioQueue = (epoch) => {
+  if (Number.isFinite(epoch)) state.audio.epoch = epoch;
   if (state.audio.worklet)
-    state.audio.worklet.port.postMessage({ type: "clear" });
+    state.audio.worklet.port.postMessage({ type: "clear", epoch: state.audio.epoch });
   state.audio.pending = [];
   state.audio.basePts = null;
   state.audio.startTime = state.audio.context
@@ -645,7 +733,61 @@ const resumeAudio = () => {
   }
 };
 
+// min/max envelope per pixel column, drawn from the worker's peak buckets
+const drawWaveform = (msg) => {
+  if (!waveformCanvas) return;
+  const width = waveformCanvas.clientWidth;
+  const height = waveformCanvas.clientHeight;
+  const dpr = window.devicePixelRatio || 1;
+  waveformCanvas.width = Math.max(1, Math.round(width * dpr));
+  waveformCanvas.height = Math.max(1, Math.round(height * dpr));
+  const ctx = waveformCanvas.getContext("2d");
+  ctx.clearRect(0, 0, waveformCanvas.width, waveformCanvas.height);
+  if (!msg || !msg.filled) return;
+
+  const peaks = new Float32Array(msg.data);
+  const mid = waveformCanvas.height / 2;
+  const columns = waveformCanvas.width;
+  ctx.fillStyle = "rgba(255, 255, 255, 0.35)";
+  for (let x = 0; x < columns; x += 1) {
+    const first = Math.floor((x / columns) * msg.buckets);
+    const last = Math.max(first + 1, Math.floor(((x + 1) / columns) * msg.buckets));
+    if (first >= msg.filled) break;
+    let lo = 0;
+    let hi = 0;
+    for (let b = first; b < Math.min(last, msg.filled); b += 1) {
+      lo = Math.min(lo, peaks[b * 3]);
+      hi = Math.max(hi, peaks[b * 3 + 1]);
+    }
+    const top = mid - Math.min(1, hi) * mid;
+    const bottom = mid - Math.max(-1, lo) * mid;
+    ctx.fillRect(x, top, 1, Math.max(1, bottom - top));
+  }
+};
+
+const currentFile = () => state.playlist.files[state.playlist.index] || null;
+
+// The worker opens the next item while this one plays and switches at its end
+const preloadNextItem = () => {
+  const next = state.playlist.files[state.playlist.index + 1];
+  if (next && state.worker && !state.passthrough) {
+    state.worker.postMessage({ type: "preload", file: next });
+  }
+};
+
+const requestWaveform = (streams) => {
+  const file = currentFile();
+  if (state.waveformRequested || !file || !state.worker) return;
+  if (!streams.some((stream) => stream && stream.mediaType === 1)) return;
+  state.waveformRequested = true;
+  state.worker.postMessage({ type: "computePeaks", buckets: WAVEFORM_BUCKETS });
+};
+
 const resetUi = () => {
+  state.trickRate = 0;
+  state.waveformRequested = false;
+  state.lastPeaks = null;
+  drawWaveform(null);
   state.frames = 0;
   state.bytes = 0;
   state.pts = 0;
@@ -697,10 +839,174 @@ if (canvasWrap) {
   canvasWrap.addEventListener("pointermove", onUserActivity);
 }
 
+// ============================================
+// Passthrough (MSE)
+// ============================================
+// The worker remuxes to fragmented MP4 and the browser decodes it, so no
+// frames cross the worker boundary. Seeks inside the buffered range are
+// served locally; everything else restarts the remuxer in the worker.
+
+const passthroughSupported = () =>
+  Boolean(mseVideo && typeof MediaSource !== "undefined");
+
+const bufferedAhead = () => {
+  const t = mseVideo.currentTime;
+  const ranges = mseVideo.buffered;
+  for (let i = 0; i < ranges.length; i += 1) {
+    if (t >= ranges.start(i) - 0.1 && t <= ranges.end(i)) {
+      return ranges.end(i) - t;
+    }
+  }
+  return 0;
+};
+
+const isBuffered = (seconds) => {
+  const ranges = mseVideo.buffered;
+  for (let i = 0; i < ranges.length; i += 1) {
+    if (seconds >= ranges.start(i) && seconds < ranges.end(i) - 0.5) {
+      return true;
+    }
+  }
+  return false;
+};
+
+const pumpMseQueue = () => {
+  const mse = state.mse;
+  if (!mse || !mse.sourceBuffer || mse.sourceBuffer.updating) return;
+  if (mse.queue.length) {
+    const buffer = mse.queue.shift();
+    try {
+      mse.sourceBuffer.appendBuffer(buffer);
+    } catch (err) {
+      if (err.name !== "QuotaExceededError") {
+        log(`SourceBuffer append failed: ${err.message}`);
+        return;
+      }
+      // Full: drop played media and retry on updateend
+      mse.queue.unshift(buffer);
+      const end = mseVideo.currentTime - MSE_EVICT_KEEP_SECONDS;
+      if (end > 0) mse.sourceBuffer.remove(0, end);
+    }
+    return;
+  }
+  if (mse.ended && mse.mediaSource.readyState === "open") {
+    mse.mediaSource.endOfStream();
+  }
+};
+
+const reportMseBuffer = () => {
+  const mse = state.mse;
+  if (!mse || !state.worker) return;
+  const { mediaSource, sourceBuffer } = mse;
+  if (
+    state.duration > 0 &&
+    mediaSource.readyState === "open" &&
+    sourceBuffer &&
+    !sourceBuffer.updating &&
+    !Number.isFinite(mediaSource.duration)
+  ) {
+    mediaSource.duration = state.duration;
+  }
+  state.worker.postMessage({
+    type: "remuxBuffered",
+    ahead: bufferedAhead(),
+    currentTime: mseVideo.currentTime,
+  });
+  state.pts = mseVideo.currentTime;
+  if (!state.scrubbing) updateTimeline(state.pts);
+  updateStats();
+  checkLoopBoundary();
+};
+
+const startPassthrough = () => {
+  const mediaSource = new MediaSource();
+  const mse = {
+    mediaSource,
+    url: URL.createObjectURL(mediaSource),
+    opened: new Promise((resolve) =>
+      mediaSource.addEventListener("sourceopen", resolve, { once: true })
+    ),
+    sourceBuffer: null,
+    queue: [],
+    ended: false,
+    reportTimer: setInterval(reportMseBuffer, MSE_REPORT_MS),
+  };
+  state.mse = mse;
+  state.passthrough = true;
+  mseVideo.src = mse.url;
+  mseVideo.playbackRate = state.playbackSpeed;
+  applyGain();
+  updateSurfaces();
+};
+
+const stopPassthrough = () => {
+  const mse = state.mse;
+  state.mse = null;
+  state.passthrough = false;
+  if (mse) {
+    clearInterval(mse.reportTimer);
+    mseVideo.pause();
+    mseVideo.removeAttribute("src");
+    mseVideo.load();
+    URL.revokeObjectURL(mse.url);
+  }
+  updateSurfaces();
+};
+
+const handleRemuxInit = async (msg) => {
+  const mse = state.mse;
+  if (!mse) return;
+  const reject = () =>
+    state.worker.postMessage({ type: "remuxReject", mime: msg.mime });
+  if (!MediaSource.isTypeSupported(msg.mime)) {
+    reject();
+    return;
+  }
+  await mse.opened;
+  if (state.mse !== mse) return;
+  try {
+    if (!mse.sourceBuffer) {
+      mse.sourceBuffer = mse.mediaSource.addSourceBuffer(msg.mime);
+      mse.sourceBuffer.addEventListener("updateend", pumpMseQueue);
+    } else {
+      // Restarted remuxer (seek or track change): anything still queued
+      // belongs to the previous init segment.
+      mse.queue = [];
+      mse.ended = false;
+      if (mse.sourceBuffer.updating) mse.sourceBuffer.abort();
+      if (mse.sourceBuffer.changeType) mse.sourceBuffer.changeType(msg.mime);
+    }
+  } catch (err) {
+    log(`SourceBuffer setup failed: ${err.message}`);
+    reject();
+    return;
+  }
+  mse.queue.push(msg.buffer);
+  pumpMseQueue();
+  if (Number.isFinite(msg.seekTarget) && msg.seekTarget > 0) {
+    mseVideo.currentTime = msg.seekTarget;
+  }
+  if (state.playing) mseVideo.play().catch(() => {});
+  state.worker.postMessage({ type: "remuxAccept" });
+  log(`Passthrough: ${msg.mime}`);
+};
+
+const markEnded = () => {
+  state.playing = false;
+  pauseBtn.disabled = true;
+  stopBtn.disabled = false;
+  startBtn.disabled = false;
+  syncOverlayControls();
+  setStatus("Ended");
+};
+
+if (mseVideo) mseVideo.addEventListener("ended", markEnded);
+
 const stopPlayback = async () => {
   state.playing = false;
   state.started = false;
   if (state.worker) state.worker.postMessage({ type: "stop" });
+  stopPassthrough();
   await closeAudio();
   pauseBtn.disabled = true;
   stopBtn.disabled = true;
@@ -714,7 +1020,9 @@ const stopPlayback = async () => {
 const pausePlayback = () => {
   if (!state.playing) return;
   state.playing = false;
-  if (state.worker) state.worker.postMessage({ type: "pause" });
+  state.trickRate = 0; // The worker leaves trick play on pause
+  if (state.passthrough) mseVideo.pause();
+  else if (state.worker) state.worker.postMessage({ type: "pause" });
   suspendAudio();
   log("Paused.");
   pauseBtn.disabled = true;
@@ -726,7 +1034,7 @@ const pausePlayback = () => {
 const startPlayback = () => {
   if (!state.ready || !state.worker) return;
 
-  const file = fileInput.files && fileInput.files[0];
+  const file = currentFile();
   const url = urlInput.value.trim();
 
   if (!state.started) {
@@ -747,6 +1055,9 @@ const startPlayback = () => {
     syncOverlayControls();
     setPausedState(false);
 
+    const passthrough = state.renderMode === "mse" && passthroughSupported();
+    if (passthrough) startPassthrough();
+
     state.worker.postMessage({
       type: "load",
       file: file || null,
@@ -756,14 +1067,17 @@ const startPlayback = () => {
       videoStreamIndex: state.tracks.video,
       audioStreamIndex: state.tracks.audio,
       subtitleStreamIndex: state.tracks.subtitle,
+      passthrough,
     });
+    if (file) preloadNextItem();
   } else {
     state.playing = true;
     pauseBtn.disabled = false;
     startBtn.disabled = true;
     syncOverlayControls();
     setPausedState(false);
-    state.worker.postMessage({ type: "play" });
+    if (state.passthrough) mseVideo.play().catch(() => {});
+    else state.worker.postMessage({ type: "play" });
   }
 
   resumeAudio();
@@ -779,7 +1093,11 @@ const performSeek = (seconds) => {
   state.pts = target;
   updateTimeline(target);
   updateStats();
-  state.worker.postMessage({ type: "seek", seconds: target });
+  if (state.passthrough && isBuffered(target)) {
+    mseVideo.currentTime = target;
+  } else {
+    state.worker.postMessage({ type: "seek", seconds: target });
+  }
   showOsd(`Seek: ${formatTime(target)}`);
 };
 
@@ -811,7 +1129,16 @@ const initWorker = () => {
     const msg = event.data;
     if (!msg || !msg.type) return;
 
+    if (msg.type === "wasmModule") {
+      // Handed to workers created later so they skip compilation
+      state.wasmModule = { module: msg.module, buildId: msg.buildId };
+      return;
+    }
+
     if (msg.type === "ready") {
+      if (msg.startupMs !== undefined) {
+        log(`Worker ready in ${msg.startupMs} ms (wasm: ${msg.wasmSource}).`);
+      }
       state.ready = true;
       startBtn.disabled = false;
       setStatus("Ready");
@@ -842,6 +1169,28 @@ const initWorker = () => {
       state.lastStreams = msg.streams; // Store for menu repopulation
       populateTrackSelects(msg);
       populateSubtitleTracks(msg.streams || []);
+      requestWaveform(msg.streams || []);
+      return;
+    }
+
+    if (msg.type === "trickPlay") {
+      state.trickRate = Number(msg.rate) || 0;
+      if (state.trickRate !== 0 && !state.playing) {
+        state.playing = true;
+        syncOverlayControls();
+        setPausedState(false);
+      }
+      return;
+    }
+
+    if (msg.type === "peaks") {
+      state.lastPeaks = msg;
+      drawWaveform(msg);
+      return;
+    }
+
+    if (msg.type === "peaksError") {
+      log(`Waveform unavailable: ${msg.message}`);
       return;
     }
 
@@ -861,6 +1210,23 @@ const initWorker = () => {
     if (msg.type === "stats") {
       state.frames = msg.frames || 0;
       state.bytes = msg.bytes || 0;
+      state.bufferedSeconds = Number.isFinite(msg.bufferedSeconds) ? msg.bufferedSeconds : -1;
+      state.bitrate = msg.bitrate || 0;
+      state.variant = msg.variant || "";
+      state.liveSkips = Number.isFinite(msg.liveSkips) ? msg.liveSkips : -1;
+      state.spilledBytes = msg.spilledBytes || 0;
+      state.droppedFrames = msg.droppedFrames || 0;
+      state.lateFrames = msg.lateFrames || 0;
+      state.clockDrift = msg.clockDrift || 0;
+      if (state.passthrough) {
+        // Timeline is driven by mseVideo in reportMseBuffer
+        if (msg.duration > 0 && msg.duration !== state.duration) {
+          setDuration(msg.duration);
+          if (state.seekEnabled) setSeekEnabled(true, state.seekHint);
+        }
+        updateStats();
+        return;
+      }
       state.pts = Number.isFinite(msg.pts) ? msg.pts : 0;
       if (
         Number.isFinite(msg.duration) &&
@@ -882,22 +1248,82 @@ const initWorker = () => {
       const pts = Number.isFinite(msg.pts) ? msg.pts : null;
       if (!state.audio.initPromise && !state.audio.failed)
         initAudio(sampleRate, channels);
-      if (msg.buffer instanceof ArrayBuffer) queueAudioBuffer(msg.buffer, pts);
+      if (msg.buffer instanceof ArrayBuffer) queueAudioBuffer(msg.buffer, pts, msg.epoch);
       return;
     }
 
     if (msg.type === "audioClear") {
-      clearAudioQueue();
+      clearAudioQueue(msg.epoch);
+      return;
+    }
+
+    if (msg.type === "live") {
+      // The worklet plays slightly fast while it holds more than the target
+      state.liveTarget = msg.target || 0;
+      if (state.audio.worklet) {
+        state.audio.worklet.port.postMessage({ type: "latency", seconds: state.liveTarget });
+      }
       return;
     }
 
     if (msg.type === "ended") {
-      state.playing = false;
-      pauseBtn.disabled = true;
-      stopBtn.disabled = false;
-      startBtn.disabled = false;
-      syncOverlayControls();
-      setStatus("Ended");
+      markEnded();
+      return;
+    }
+
+    if (msg.type === "playlistAdvance") {
+      state.playlist.index += 1;
+      log(`Now playing ${msg.name} (${state.playlist.index + 1}/${state.playlist.files.length}).`);
+      state.waveformRequested = false;
+      state.lastPeaks = null;
+      drawWaveform(null);
+      if (state.loop.startTime !== null || state.loop.endTime !== null) clearLoop();
+      preloadNextItem();
+      return;
+    }
+
+    if (msg.type === "exportProgress") {
+      setStatus(`Exporting ${Math.round((msg.progress || 0) * 100)}%`);
+      return;
+    }
+
+    if (msg.type === "exportDone") {
+      setStatus(state.playing ? "Playing" : "Ready");
+      saveExport(msg.blob);
+      return;
+    }
+
+    if (msg.type === "exportError") {
+      log(`Export failed: ${msg.message}`);
+      return;
+    }
+
+    if (msg.type === "remuxInit") {
+      handleRemuxInit(msg);
+      return;
+    }
+
+    if (msg.type === "remuxData") {
+      if (state.mse && msg.buffer instanceof ArrayBuffer) {
+        state.mse.queue.push(msg.buffer);
+        pumpMseQueue();
+      }
+      return;
+    }
+
+    if (msg.type === "remuxEnd") {
+      if (state.mse) {
+        state.mse.ended = true;
+        pumpMseQueue();
+      }
+      return;
+    }
+
+    if (msg.type === "passthrough") {
+      if (!msg.active && state.passthrough) {
+        stopPassthrough();
+        log("Passthrough off; rendering frames from the worker.");
+      }
       return;
     }
 
@@ -926,7 +1352,9 @@ const initWorker = () => {
       type: "init",
       canvas2d: offscreen2d,
       canvasGl: offscreenGl,
-      renderMode: state.renderMode,
+      renderMode: canvasRenderMode(),
+      wasmModule: state.wasmModule ? state.wasmModule.module : null,
+      wasmBuildId: state.wasmModule ? state.wasmModule.buildId : "",
     },
     [offscreen2d, offscreenGl]
   );
@@ -952,6 +1380,8 @@ document.addEventListener("click", (e) => {
     updateMenuCheckmarks();
   } else if (action === "setAspect") {
     setAspectRatio(value);
+  } else if (action === "setDeinterlace") {
+    setDeinterlace(value || "");
   } else if (action === "setSpeed") {
     setPlaybackSpeed(parseFloat(value));
   }
@@ -966,6 +1396,44 @@ if (menuUrlBtn)
   });
 if (menuCloseBtn) menuCloseBtn.addEventListener("click", () => stopPlayback());
 
+// Stream-copy the A-B range (or 30 s from the playhead) without decoding
+const exportClip = () => {
+  const file = currentFile();
+  if (!state.worker || !state.started || !file) {
+    log("Open a local file to export a clip.");
+    return;
+  }
+  const start = state.loop.startTime ?? state.pts;
+  const end =
+    state.loop.endTime !== null && state.loop.endTime > start
+      ? state.loop.endTime
+      : start + EXPORT_DEFAULT_SECONDS;
+  const matroska = /\.(mkv|webm)$/i.test(file.name) || state.formatHint === "matroska";
+  state.exportName = `${file.name.replace(/\.[^.]+$/, "")}_${Math.floor(start)}-${Math.floor(end)}.${
+    matroska ? "mkv" : "mp4"
+  }`;
+  state.worker.postMessage({
+    type: "exportClip",
+    start,
+    end,
+    container: matroska ? "matroska" : "mp4",
+  });
+  log(`Exporting ${formatTime(start)} - ${formatTime(end)}...`);
+};
+
+const saveExport = (blob) => {
+  const url = URL.createObjectURL(blob);
+  const link = document.createElement("a");
+  link.href = url;
+  link.download = state.exportName || "clip.mp4";
+  link.click();
+  setTimeout(() => URL.revokeObjectURL(url), 10000);
+  log(`Exported ${state.exportName} (${formatBytes(blob.size)}).`);
+};
+
+if (menuExportBtn) menuExportBtn.addEventListener("click", exportClip);
+window.addEventListener("resize", () => drawWaveform(state.lastPeaks));
+
 // URL Modal
 if (urlCancelBtn)
   urlCancelBtn.addEventListener("click", () =>
@@ -977,6 +1445,7 @@ if (urlLoadBtn)
       urlModal.classList.remove("visible");
       stopPlayback().then(() => {
         fileInput.value = ""; // clear file
+        state.playlist = { files: [], index: 0 };
         startPlayback();
       });
     }
@@ -985,6 +1454,8 @@ if (urlLoadBtn)
 // File Input
 fileInput.addEventListener("change", () => {
   if (fileInput.files && fileInput.files[0]) {
+    state.playlist = { files: Array.from(fileInput.files), index: 0 };
+    if (state.playlist.files.length > 1) log(`Playlist: ${state.playlist.files.length} files.`);
     urlInput.value = "";
     stopPlayback().then(() => startPlayback());
   }
@@ -1068,6 +1539,8 @@ const showOsd = (message) => {
 const setPlaybackSpeed = (speed) => {
   const clamped = Math.max(0.25, Math.min(2.0, speed));
   state.playbackSpeed = clamped;
+  state.trickRate = 0;
+  if (mseVideo) mseVideo.playbackRate = clamped;
   if (state.worker)
     state.worker.postMessage({ type: "setSpeed", speed: clamped });
   if (speedDisplay) speedDisplay.textContent = `${clamped}x`;
@@ -1168,6 +1641,15 @@ document.getElementById("loopClearBtn")?.addEventListener("click", () => {
   showOsd("Loop Cleared");
 });
 
+const setDeinterlace = (filter) => {
+  state.deinterlace = filter;
+  if (state.worker) {
+    state.worker.postMessage({ type: "setDeinterlace", filter });
+  }
+  updateMenuCheckmarks();
+  showOsd(`Deinterlace: ${filter || "off"}`);
+};
+
 // Aspect Ratio
 const setAspectRatio = (ratio) => {
   state.aspectRatio = ratio;
@@ -1240,6 +1722,16 @@ const cycleSpeed = (direction) => {
   setPlaybackSpeed(PLAYBACK_SPEEDS[newIdx]);
 };
 
+// Keyframe-only scanning and 1x reverse ({ / }); 0 returns to regular playback
+const cycleTrickRate = (direction) => {
+  if (!state.worker || !state.started || state.passthrough) return;
+  const idx = TRICK_RATES.indexOf(state.trickRate);
+  const next = TRICK_RATES[Math.max(0, Math.min(TRICK_RATES.length - 1, idx + direction))];
+  state.trickRate = next;
+  state.worker.postMessage({ type: "trickPlay", rate: next });
+  showOsd(next === 0 ? "Scan off" : next === -1 ? "Reverse 1x" : `Scan ${next}x`);
+};
+
 const adjustSubtitleDelay = (deltaMs) => {
   const newDelay = state.subtitleDelay + deltaMs / 1000;
   setSubtitleDelay(Math.max(-5, Math.min(5, newDelay)));
@@ -1396,6 +1888,14 @@ document.addEventListener("keydown", (e) => {
       e.preventDefault();
       setPlaybackSpeed(1.0);
       break;
+    case "{":
+      e.preventDefault();
+      cycleTrickRate(-1);
+      break;
+    case "}":
+      e.preventDefault();
+      cycleTrickRate(1);
+      break;
 
     case "z":
       e.preventDefault();
@@ -1,3 +1,5 @@
+const CATCHUP_RATE = 1.03; // Live: playback rate while more than the latency target is queued
+
 class FFmpegAudioWorklet extends AudioWorkletProcessor {
   constructor() {
     super();
@@ -9,6 +11,16 @@ class FFmpegAudioWorklet extends AudioWorkletProcessor {
     this.writeIndex = 0;
     this.available = 0;
     this.reportCounter = 0;
+    this.targetFrames = 0; // Live latency target, 0 = always play at 1x
+    this.rate = 1;
+    this.phase = 0; // Fractional position between readIndex and the next frame
+    // Playback position for the worker's A/V clock: pts of pushed blocks by
+    // the frame count they start at, and frames consumed since the last clear
+    this.segments = [];
+    this.pushedFrames = 0;
+    this.consumedFrames = 0;
+    this.epoch = 0; // Echoed back so reports from before a clear are ignored
+    this.lastPlayed = null; // { pts, epoch, time } of the latest block that had samples
 
     this.port.onmessage = (event) => {
       const data = event.data;
@@ -20,9 +32,21 @@ class FFmpegAudioWorklet extends AudioWorkletProcessor {
         this.setChannels(nextChannels);
       } else if (data.type === "push" && data.buffer instanceof ArrayBuffer) {
         const samples = new Float32Array(data.buffer);
+        if (Number.isFinite(data.pts)) {
+          // A playlist handoff bumps the epoch without a clear: the previous
+          // item's queued samples still play and report its epoch
+          const epoch = Number.isFinite(data.epoch) ? data.epoch : this.epoch;
+          this.segments.push({ frame: this.pushedFrames, pts: data.pts, epoch });
+        }
         this.pushSamples(samples);
       } else if (data.type === "clear") {
         this.resetBuffer();
+        if (Number.isFinite(data.epoch)) {
+          this.epoch = data.epoch;
+        }
+      } else if (data.type === "latency") {
+        const seconds = Number.isFinite(data.seconds) ? data.seconds : 0;
+        this.targetFrames = Math.max(0, Math.floor(seconds * sampleRate));
       }
     };
   }
@@ -44,6 +68,56 @@ class FFmpegAudioWorklet extends AudioWorkletProcessor {
     this.readIndex = 0;
     this.writeIndex = 0;
     this.available = 0;
+    this.phase = 0;
+    this.segments = [];
+    this.pushedFrames = 0;
+    this.consumedFrames = 0;
+    this.lastPlayed = null;
+  }
+
+  // { pts, epoch } of the next frame to be played, null when no block carried one
+  playingPts() {
+    while (this.segments.length > 1 && this.segments[1].frame <= this.consumedFrames) {
+      this.segments.shift();
+    }
+    const seg = this.segments[0];
+    if (!seg || seg.frame > this.consumedFrames) {
+      return null;
+    }
+    return { pts: seg.pts + (this.consumedFrames - seg.frame) / sampleRate, epoch: seg.epoch };
+  }
+
+  // Over the target: play fast until the queue is back under half of it
+  updateRate() {
+    const queued = this.available / this.channels;
+    if (this.targetFrames > 0 && queued > this.targetFrames) {
+      this.rate = CATCHUP_RATE;
+    } else if (this.targetFrames <= 0 || queued <= this.targetFrames / 2) {
+      this.rate = 1;
+      this.phase = 0;
+    }
+  }
+
+  // Linear interpolation between neighbouring frames
+  readResampled(output, frames) {
+    const channels = this.channels;
+    for (let i = 0; i < frames; i += 1) {
+      if (this.available < channels * 2) {
+        return;
+      }
+      const next = (this.readIndex + channels) % this.capacity;
+      for (let ch = 0; ch < channels && ch < output.length; ch += 1) {
+        const a = this.buffer[this.readIndex + ch];
+        output[ch][i] = a + (this.buffer[next + ch] - a) * this.phase;
+      }
+      this.phase += this.rate;
+      while (this.phase >= 1) {
+        this.readIndex = (this.readIndex + channels) % this.capacity;
+        this.available -= channels;
+        this.consumedFrames += 1;
+        this.phase -= 1;
+      }
+    }
   }
 
   pushSamples(samples) {
@@ -52,9 +126,14 @@ class FFmpegAudioWorklet extends AudioWorkletProcessor {
     }
 
     let input = samples;
+    this.pushedFrames += samples.length / this.channels;
     if (input.length >= this.capacity) {
       input = input.subarray(input.length - this.capacity);
-      this.resetBuffer();
+      this.consumedFrames += (this.available + samples.length - input.length) / this.channels;
+      this.readIndex = 0;
+      this.writeIndex = 0;
+      this.available = 0;
+      this.phase = 0;
     }
 
     const free = this.capacity - this.available;
@@ -62,6 +141,7 @@ class FFmpegAudioWorklet extends AudioWorkletProcessor {
       const drop = input.length - free;
       this.readIndex = (this.readIndex + drop) % this.capacity;
       this.available -= drop;
+      this.consumedFrames += drop / this.channels;
     }
 
     let offset = 0;
@@ -88,7 +168,12 @@ class FFmpegAudioWorklet extends AudioWorkletProcessor {
       output[ch].fill(0);
     }
 
-    if (this.available > 0) {
+    const blockPts = this.playingPts();
+    const before = this.available;
+    this.updateRate();
+    if (this.rate !== 1) {
+      this.readResampled(output, frames);
+    } else if (this.available > 0) {
       for (let i = 0; i < frames; i += 1) {
         for (let ch = 0; ch < this.channels; ch += 1) {
           let sample = 0;
@@ -96,6 +181,9 @@ class FFmpegAudioWorklet extends AudioWorkletProcessor {
             sample = this.buffer[this.readIndex];
             this.readIndex = (this.readIndex + 1) % this.capacity;
             this.available -= 1;
+            if (ch === this.channels - 1) {
+              this.consumedFrames += 1;
+            }
           }
           if (ch < output.length) {
             output[ch][i] = sample;
@@ -104,14 +192,25 @@ class FFmpegAudioWorklet extends AudioWorkletProcessor {
       }
     }
 
+    if (blockPts !== null && this.available < before) {
+      this.lastPlayed = { pts: blockPts.pts, epoch: blockPts.epoch, time: currentTime };
+    }
+
     this.reportCounter += 1;
     if (this.reportCounter >= 20) {
       this.reportCounter = 0;
+      // pts/time: the first sample of the latest block that played, and the
+      // context time it was rendered for; absent while starved or cleared
+      const played = this.lastPlayed;
+      this.lastPlayed = null;
       this.port.postMessage({
         type: "status",
         available: this.available,
         channels: this.channels,
         sampleRate,
+        pts: played ? played.pts : null,
+        time: played ? played.time : null,
+        epoch: played ? played.epoch : this.epoch,
       });
     }
     return true;
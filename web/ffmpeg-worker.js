@@ -1,14 +1,55 @@
-/* global FFmpegWasm */
+/* global FFmpegWasm, loadWasmModule, instantiateFromModule, ManifestSource, isManifestUrl,
+   openOpfsSpillStore, clearStaleSpill, attachSpillStore, detachSpillStore */
 
 const DEFAULT_AUDIO_RATE = 48000;
 const BUFFER_LIMIT_BYTES = 500 * 1024 * 1024;
+const BUFFER_LIMIT_BYTES_64 = 4 * 1024 * 1024 * 1024; // Memory64 builds (ffmpeg_wasm_is_memory64)
+const SPILL_HEAP_LIMIT_BYTES = 64 * 1024 * 1024; // Heap buffer limit once consumed bytes spill to OPFS
+const DEFAULT_MEMORY_BUDGET_BYTES = 768 * 1024 * 1024; // Hard budget for everything one context owns
+const DEFAULT_MEMORY_BUDGET_BYTES_64 = 6 * 1024 * 1024 * 1024;
 const DEFAULT_MAX_BUFFER_BYTES = 512 * 1024 * 1024;
 const SEEK_MAX_BUFFER_BYTES = 48 * 1024 * 1024;
-const BUFFER_POLL_MS = 15;
-const MAX_CHUNK_BYTES = 256 * 1024;
+const MAX_CHUNK_BYTES = 256 * 1024; // Append size until the input bitrate is known
+const MIN_INGEST_CHUNK = 64 * 1024;
+const MAX_INGEST_CHUNK = 2 * 1024 * 1024;
+const INGEST_CHUNK_SECONDS = 0.25; // Append about this much media per call
+const FLOW_LOW_SECONDS = 10; // Ingest resumes below this much media buffered ahead
+const FLOW_HIGH_SECONDS = 30; // ...and pauses above this
+const FLOW_WAIT_MAX_MS = 250; // Re-check a paused ingest at least this often
 const MIN_OPEN_BYTES = 2 * 1024 * 1024; // Default minimum bytes before attempting to open container
 const MIN_OPEN_BYTES_SMALL = 256 * 1024; // Lower threshold for small files
 const HEADER_SAMPLE_BYTES = 32; // Bytes to sample for EBML header sanity-check
+const REMUX_PACKETS_PER_TICK = 256;
+const REMUX_MAX_AHEAD_SECONDS = 30; // Stop feeding MSE once the page has this much buffered
+const REMUX_THROTTLE_MS = 100;
+const EXPORT_PACKETS_PER_STEP = 512;
+const AUDIO_ONLY_LEAD_SECONDS = 1.5; // Audio-only: decode this far ahead of the wall clock
+const TRICK_MIN_RATE = 4; // |rate| from which scanning shows keyframes only
+const TRICK_INTERVAL_MS = 125; // Target display rate while scanning (8 fps)
+const GOP_CACHE_BYTES = 96 * 1024 * 1024; // Decoded frames kept for step-back and reverse
+const REVERSE_MAX_HEIGHT = 540; // Reverse playback stores frames downscaled to this height
+const PEAKS_PACKETS_PER_STEP = 256;
+const PEAKS_SLICE_MS = 12; // Yield to playback between peak steps
+const PEAKS_POST_MS = 250;
+const EXPORT_MEMORY_BUDGET_BYTES = 128 * 1024 * 1024; // Input side only; the clip itself is extra
+const PRELOAD_AUDIO_SECONDS = 0.5; // Decoded ahead for the next playlist item when it has no video
+const PRELOAD_WAIT_MS = 20; // Re-check at end of stream while the next item is still preloading
+const PACKET_CACHE_SECONDS = 30; // Demuxed packets kept so short back-seeks skip the input
+const PACKET_CACHE_BYTES = 32 * 1024 * 1024;
+const NEED_MODULE = -0x444f4d4e; // FFMPEG_WASM_ERROR_NEED_MODULE (split builds)
+const RANGE_PARALLEL = 4; // Concurrent Range requests per URL source
+const RANGE_MIN_CHUNK = 128 * 1024;
+const RANGE_MAX_CHUNK = 4 * 1024 * 1024;
+const RANGE_TARGET_MS = 400; // Chunk size adapts so one request takes about this long
+const RANGE_TAIL_BYTES = 1024 * 1024; // Fetched up front for moov/Cues/seek indexes at the end
+const RANGE_READAHEAD_BYTES = 24 * 1024 * 1024; // Until the input bitrate is known
+const RANGE_READAHEAD_MAX = 96 * 1024 * 1024;
+const RANGE_OPEN_BYTES = 256 * 1024;
+const MANIFEST_MAX_ERRORS = 8; // Consecutive segment failures before giving up
+const LIVE_LATENCY_TARGET = 0.3; // Live: seconds buffered in the decoder before it skips to a keyframe
+const LIVE_OPEN_BYTES = 16 * 1024; // Enough for a PAT/PMT; open retries as data arrives
+const LIVE_RESYNC_SECONDS = 0.25; // Live pacing re-anchors when a frame is this far off the wall clock
+const RESUME_HEADER_SLACK = 64 * 1024; // Appended past a cached header end in case the demuxer reads ahead
 
 const sleep = (ms) => new Promise((resolve) => setTimeout(resolve, ms));
 
@@ -17,6 +58,7 @@ const state = {
   api: null,
   ctx: 0,
   opened: false,
+  audioOnly: false,
   playing: false,
   waitingForData: false,
   draining: false,
@@ -37,9 +79,19 @@ const state = {
   seekUiLast: 0,
   seekPreviewLast: 0,
   maxBufferBytes: DEFAULT_MAX_BUFFER_BYTES,
+  memoryBudgetBytes: DEFAULT_MEMORY_BUDGET_BYTES,
+  memory64: false, // -sMEMORY64 module
   decodeTimer: null,
   reader: null,
   abortController: null,
+  range: null, // HTTP Range source: { url, total, token, inflight, chunk }
+  manifest: null, // HLS/DASH source (ManifestSource)
+  live: null, // Live source: { target } in seconds; no seeking, paced to arrival
+  socket: null, // WebSocket feeding a live source
+  openStateKey: "", // Open-state cache key of the active file, "" = not cached
+  restore: null, // Cached open-state record the active file was opened from
+  ingestPaused: false, // Above FLOW_HIGH_SECONDS until back under FLOW_LOW_SECONDS
+  ingestWaiters: [],
   lastOpenError: null,
   lastOpenErrorLogged: null,
   renderMode: "2d",
@@ -61,10 +113,49 @@ const state = {
   // New feature state
   playbackSpeed: 1.0,
   subtitleDelay: 0,
+  sideModules: new Map(), // name -> load promise (split builds)
+  moduleLoading: false,
+  deinterlace: "", // "", "yadif" or "bwdif"
   fontData: null,
+  // Passthrough: remux to fragmented MP4 and let the page decode via MSE
+  passthrough: false,
+  remux: null,
+  sourceArgs: null,
+  exportJob: null,
+  trick: null, // { rate, reverse, anchorPts, anchorWall, target, pending, lastPts }
+  gopActive: false, // Stepped back: the decoder is mid-GOP, so playing on seeks first
+  gopStepTimer: null, // A step waiting for its GOP to decode; further steps are ignored
+  trickTimer: null,
+  peakJob: null,
+  frameDesc: null, // { ptr, view } over the context's FFmpegWasmFrameDesc
+  toneMappedLogged: false,
+  heldFrame: false, // The decoded video frame waits for its clock_schedule time
+  audioEpoch: 0, // Bumped per audioClear and playlist handoff; audio clock reports carry it back
+  preload: null, // Next playlist item opening in its own context (preloadNext)
 };
 
 const postLog = (message) => postMessage({ type: "log", message });
+
+const postAudioClear = () => {
+  state.audioEpoch += 1;
+  postMessage({ type: "audioClear", epoch: state.audioEpoch });
+};
+
+// Wall time shared with the page: epoch-based seconds, since a worker's
+// performance.now() has its own origin
+const wallSeconds = () => (performance.timeOrigin + performance.now()) / 1000;
+
+const CLOCK_DROP = -1; // FFMPEG_WASM_CLOCK_DROP
+
+// Seek, track switch, reset: the next frame anchors the clock again
+const resetClock = () => {
+  state.basePts = null;
+  state.baseWall = 0;
+  state.heldFrame = false;
+  if (state.ctx && state.api && state.api.clockReset) {
+    state.api.clockReset(state.ctx);
+  }
+};
 const postStatus = (message) => postMessage({ type: "status", message });
 
 const isMp4Container = (file) => {
@@ -137,6 +228,47 @@ const createApi = (Module) => ({
     "number",
     "number",
   ]),
+  setRangeSource: cwrapMaybe(Module, "ffmpeg_wasm_set_range_source", "number", [
+    "number",
+    "number",
+    "number",
+  ]),
+  appendAt: cwrapMaybe(Module, "ffmpeg_wasm_append_at", "number", [
+    "number",
+    "number",
+    "number",
+    "number",
+  ]),
+  rangePosition: cwrapMaybe(Module, "ffmpeg_wasm_range_position", "number", ["number"]),
+  readPosition: cwrapMaybe(Module, "ffmpeg_wasm_read_position", "number", ["number"]),
+  inputBitrate: cwrapMaybe(Module, "ffmpeg_wasm_input_bitrate", "number", ["number"]),
+  bufferedSeconds: cwrapMaybe(Module, "ffmpeg_wasm_buffered_seconds", "number", ["number"]),
+  rangeWanted: cwrapMaybe(Module, "ffmpeg_wasm_range_wanted", "number", ["number"]),
+  appendAudio: cwrapMaybe(Module, "ffmpeg_wasm_append_audio", "number", [
+    "number",
+    "number",
+    "number",
+  ]),
+  setAudioInputEof: cwrapMaybe(Module, "ffmpeg_wasm_set_audio_input_eof", null, ["number"]),
+  markSegmentBoundary: cwrapMaybe(Module, "ffmpeg_wasm_mark_segment_boundary", "number", [
+    "number",
+    "number",
+  ]),
+  restartSegments: cwrapMaybe(Module, "ffmpeg_wasm_restart_segments", "number", ["number"]),
+  setLive: cwrapMaybe(Module, "ffmpeg_wasm_set_live", "number", ["number", "number"]),
+  liveSkips: cwrapMaybe(Module, "ffmpeg_wasm_live_skips", "number", ["number"]),
+  setSpill: cwrapMaybe(Module, "ffmpeg_wasm_set_spill", "number", ["number", "number"]),
+  spilledBytes: cwrapMaybe(Module, "ffmpeg_wasm_spilled_bytes", "number", ["number"]),
+  saveOpenState: cwrapMaybe(Module, "ffmpeg_wasm_save_open_state", "number", ["number"]),
+  openStatePtr: cwrapMaybe(Module, "ffmpeg_wasm_open_state_ptr", "number", ["number"]),
+  openStateSize: cwrapMaybe(Module, "ffmpeg_wasm_open_state_size", "number", ["number"]),
+  headerEnd: cwrapMaybe(Module, "ffmpeg_wasm_header_end", "number", ["number"]),
+  setOpenState: cwrapMaybe(Module, "ffmpeg_wasm_set_open_state", "number", ["number", "number", "number"]),
+  resumePosition: cwrapMaybe(Module, "ffmpeg_wasm_resume_position", "number", ["number", "number"]),
+  rangeCachedEnd: cwrapMaybe(Module, "ffmpeg_wasm_range_cached_end", "number", [
+    "number",
+    "number",
+  ]),
   setBufferOffset: cwrapMaybe(Module, "ffmpeg_wasm_set_buffer_offset", null, [
     "number",
     "number",
@@ -180,6 +312,13 @@ const createApi = (Module) => ({
     "number",
     ["number"]
   ),
+  hasVideo: cwrapMaybe(Module, "ffmpeg_wasm_has_video", "number", ["number"]),
+  setAttachedPictures: cwrapMaybe(
+    Module,
+    "ffmpeg_wasm_set_attached_pictures",
+    null,
+    ["number", "number"]
+  ),
   selectedAudioStream: cwrapMaybe(
     Module,
     "ffmpeg_wasm_selected_audio_stream",
@@ -248,8 +387,351 @@ const createApi = (Module) => ({
     "number",
     "number",
   ]),
+  setMemoryBudget: cwrapMaybe(Module, "ffmpeg_wasm_set_memory_budget", null, [
+    "number",
+    "number",
+  ]),
+  memoryCurrent: cwrapMaybe(Module, "ffmpeg_wasm_memory_current", "number", [
+    "number",
+    "number",
+  ]),
+  memoryPeak: cwrapMaybe(Module, "ffmpeg_wasm_memory_peak", "number", [
+    "number",
+    "number",
+  ]),
+  memoryOverBudget: cwrapMaybe(
+    Module,
+    "ffmpeg_wasm_memory_over_budget",
+    "number",
+    ["number"]
+  ),
+  setRemuxOnly: cwrapMaybe(Module, "ffmpeg_wasm_set_remux_only", null, [
+    "number",
+    "number",
+  ]),
+  remuxStart: cwrapMaybe(Module, "ffmpeg_wasm_remux_start", "number", [
+    "number",
+    "number",
+  ]),
+  remuxStep: cwrapMaybe(Module, "ffmpeg_wasm_remux_step", "number", [
+    "number",
+    "number",
+  ]),
+  remuxMime: cwrapMaybe(Module, "ffmpeg_wasm_remux_mime", "string", ["number"]),
+  remuxInitSerial: cwrapMaybe(
+    Module,
+    "ffmpeg_wasm_remux_init_serial",
+    "number",
+    ["number"]
+  ),
+  remuxInitPtr: cwrapMaybe(Module, "ffmpeg_wasm_remux_init_ptr", "number", [
+    "number",
+  ]),
+  remuxInitSize: cwrapMaybe(Module, "ffmpeg_wasm_remux_init_size", "number", [
+    "number",
+  ]),
+  remuxOutputPtr: cwrapMaybe(
+    Module,
+    "ffmpeg_wasm_remux_output_ptr",
+    "number",
+    ["number"]
+  ),
+  remuxOutputSize: cwrapMaybe(
+    Module,
+    "ffmpeg_wasm_remux_output_size",
+    "number",
+    ["number"]
+  ),
+  remuxConsume: cwrapMaybe(Module, "ffmpeg_wasm_remux_consume", null, [
+    "number",
+    "number",
+  ]),
+  exportClip: cwrapMaybe(Module, "ffmpeg_wasm_export_clip", "number", [
+    "number",
+    "number",
+    "number",
+    "string",
+    "number",
+  ]),
+  exportStep: cwrapMaybe(Module, "ffmpeg_wasm_export_step", "number", [
+    "number",
+    "number",
+  ]),
+  exportProgress: cwrapMaybe(
+    Module,
+    "ffmpeg_wasm_export_progress",
+    "number",
+    ["number"]
+  ),
+  exportChunkCount: cwrapMaybe(
+    Module,
+    "ffmpeg_wasm_export_chunk_count",
+    "number",
+    ["number"]
+  ),
+  exportChunkPtr: cwrapMaybe(
+    Module,
+    "ffmpeg_wasm_export_chunk_ptr",
+    "number",
+    ["number", "number"]
+  ),
+  exportChunkSize: cwrapMaybe(
+    Module,
+    "ffmpeg_wasm_export_chunk_size",
+    "number",
+    ["number", "number"]
+  ),
+  exportStop: cwrapMaybe(Module, "ffmpeg_wasm_export_stop", null, ["number"]),
+  setTrickPlay: cwrapMaybe(Module, "ffmpeg_wasm_set_trick_play", "number", [
+    "number",
+    "number",
+  ]),
+  setPacketCache: cwrapMaybe(Module, "ffmpeg_wasm_set_packet_cache", "number", [
+    "number",
+    "number",
+    "number",
+  ]),
+  seekCached: cwrapMaybe(Module, "ffmpeg_wasm_seek_cached", "number", ["number", "number"]),
+  setGopCache: cwrapMaybe(Module, "ffmpeg_wasm_set_gop_cache", "number", [
+    "number",
+    "number",
+    "number",
+  ]),
+  gopStep: cwrapMaybe(Module, "ffmpeg_wasm_gop_step", "number", ["number", "number", "number"]),
+  trickStep: cwrapMaybe(Module, "ffmpeg_wasm_trick_step", "number", [
+    "number",
+    "number",
+    "number",
+  ]),
+  setDeinterlace: cwrapMaybe(Module, "ffmpeg_wasm_set_deinterlace", "number", [
+    "number",
+    "string",
+    "number",
+  ]),
+  missingModules: cwrapMaybe(Module, "ffmpeg_wasm_missing_modules", "string", ["number"]),
+  prewarm: cwrapMaybe(Module, "ffmpeg_wasm_prewarm", "number", []),
+  hasDefaultFont: cwrapMaybe(Module, "ffmpeg_wasm_has_default_font", "number", []),
+  rgbaWidth: cwrapMaybe(Module, "ffmpeg_wasm_rgba_width", "number", ["number"]),
+  rgbaHeight: cwrapMaybe(Module, "ffmpeg_wasm_rgba_height", "number", ["number"]),
+  computePeaks: cwrapMaybe(Module, "ffmpeg_wasm_compute_peaks", "number", [
+    "number",
+    "number",
+    "number",
+  ]),
+  peaksStep: cwrapMaybe(Module, "ffmpeg_wasm_peaks_step", "number", [
+    "number",
+    "number",
+  ]),
+  peaksPtr: cwrapMaybe(Module, "ffmpeg_wasm_peaks_ptr", "number", ["number"]),
+  peaksFilled: cwrapMaybe(Module, "ffmpeg_wasm_peaks_filled", "number", [
+    "number",
+  ]),
+  peaksDuration: cwrapMaybe(Module, "ffmpeg_wasm_peaks_duration", "number", [
+    "number",
+  ]),
+  peaksStop: cwrapMaybe(Module, "ffmpeg_wasm_peaks_stop", null, ["number"]),
+  frameDesc: cwrapMaybe(Module, "ffmpeg_wasm_frame_desc", "number", ["number"]),
+  presentFrame: cwrapMaybe(Module, "ffmpeg_wasm_present_frame", "number", [
+    "number",
+    "number",
+  ]),
+  streamTable: cwrapMaybe(Module, "ffmpeg_wasm_stream_table", "number", ["number"]),
+  clockReset: cwrapMaybe(Module, "ffmpeg_wasm_clock_reset", null, ["number"]),
+  clockSetPaused: cwrapMaybe(Module, "ffmpeg_wasm_clock_set_paused", null, [
+    "number",
+    "number",
+    "number",
+  ]),
+  clockSetSpeed: cwrapMaybe(Module, "ffmpeg_wasm_clock_set_speed", null, [
+    "number",
+    "number",
+    "number",
+  ]),
+  clockAudioPosition: cwrapMaybe(Module, "ffmpeg_wasm_clock_audio_position", null, [
+    "number",
+    "number",
+    "number",
+  ]),
+  clockSchedule: cwrapMaybe(Module, "ffmpeg_wasm_clock_schedule", "number", [
+    "number",
+    "number",
+    "number",
+  ]),
+  clockDrift: cwrapMaybe(Module, "ffmpeg_wasm_clock_drift", "number", ["number"]),
+  clockDropped: cwrapMaybe(Module, "ffmpeg_wasm_clock_dropped", "number", ["number"]),
+  clockLate: cwrapMaybe(Module, "ffmpeg_wasm_clock_late", "number", ["number"]),
+  preload: cwrapMaybe(Module, "ffmpeg_wasm_preload", "number", ["number", "number", "number"]),
+  handoff: cwrapMaybe(Module, "ffmpeg_wasm_handoff", "number", ["number", "number"]),
 });
 
+// Byte offsets in the bulk descriptors (FFmpegWasmFrameDesc,
+// FFmpegWasmStreamTable and FFmpegWasmStreamEntry in src/ffmpeg_wasm.h)
+const DESC_VERSION = 1;
+const FRAME_DESC = {
+  size: 152,
+  pts: 8,
+  width: 16,
+  height: 20,
+  flags: 28,
+  rgbaData: 96,
+  rgbaWidth: 104,
+  rgbaHeight: 108,
+  rgbaStride: 112,
+  audioPts: 120,
+  audioData: 128,
+  audioChannels: 136,
+  audioSampleRate: 140,
+  audioNbSamples: 144,
+};
+const FRAME_SUBTITLES_ENABLED = 4;
+const FRAME_HAS_RGBA = 16;
+const FRAME_TONE_MAPPED = 32;
+const STREAM_TABLE = { size: 32, count: 4, entrySize: 8, video: 12, audio: 16, subtitle: 20, flags: 24 };
+const STREAM_ENTRY = { mediaType: 4, flags: 12, codecName: 16, language: 24, title: 32 };
+const STREAMS_AUDIO_ENABLED = 1;
+const STREAMS_SUBTITLES_ENABLED = 2;
+const STREAM_DEFAULT = 1;
+
+// 64-bit pointer fields; wasm addresses stay below 2^53
+const readPtr = (view, offset) =>
+  view.getUint32(offset, true) + view.getUint32(offset + 4, true) * 2 ** 32;
+
+const readCString = (ptr) => {
+  if (!ptr) return null;
+  const heap = state.Module.HEAPU8;
+  const end = heap.indexOf(0, ptr);
+  return new TextDecoder().decode(heap.subarray(ptr, end < 0 ? heap.length : end));
+};
+
+// null on modules without the descriptor exports; the view is rebuilt after
+// memory growth detaches the old buffer
+const frameDescView = () => {
+  const desc = state.frameDesc;
+  if (!desc) return null;
+  const buffer = state.Module.HEAPU8.buffer;
+  if (!desc.view || desc.view.buffer !== buffer) {
+    desc.view = new DataView(buffer, desc.ptr, FRAME_DESC.size);
+  }
+  return desc.view;
+};
+
+const attachFrameDesc = () => {
+  state.frameDesc = null;
+  if (!state.api.frameDesc || !state.api.presentFrame) return;
+  const ptr = state.api.frameDesc(state.ctx);
+  if (!ptr) return;
+  state.frameDesc = { ptr, view: null };
+  if (frameDescView().getUint32(0, true) !== DESC_VERSION) {
+    postLog("Frame descriptor version mismatch; using per-field getters.");
+    state.frameDesc = null;
+  }
+};
+
+const framePts = () => {
+  const view = frameDescView();
+  return view ? view.getFloat64(FRAME_DESC.pts, true) : state.api.pts(state.ctx);
+};
+
+const audioPts = () => {
+  const view = frameDescView();
+  return view ? view.getFloat64(FRAME_DESC.audioPts, true) : state.api.audioPts(state.ctx);
+};
+
+// Order matches FFMPEG_WASM_MEM_* in src/ffmpeg_wasm.h
+const MEMORY_CATEGORIES = ["streamBuffer", "codecFrames", "rgba", "audio", "libass", "packetCache", "gopCache"];
+
+const getMemoryPayload = () => {
+  if (!state.api || !state.ctx || !state.api.memoryCurrent) {
+    return null;
+  }
+  const current = {};
+  const peak = {};
+  MEMORY_CATEGORIES.forEach((name, index) => {
+    current[name] = state.api.memoryCurrent(state.ctx, index);
+    peak[name] = state.api.memoryPeak(state.ctx, index);
+  });
+  return {
+    total: state.api.memoryCurrent(state.ctx, -1),
+    peakTotal: state.api.memoryPeak(state.ctx, -1),
+    budget: state.memoryBudgetBytes,
+    current,
+    peak,
+  };
+};
+
+// A Memory64 heap can hold far more than 4 GB, so the input buffer may too
+const bufferLimitBytes = () => (state.memory64 ? BUFFER_LIMIT_BYTES_64 : BUFFER_LIMIT_BYTES);
+
+const applyMemoryBudget = () => {
+  if (state.ctx && state.api.setMemoryBudget) {
+    state.api.setMemoryBudget(state.ctx, state.memoryBudgetBytes);
+  }
+};
+
+const applyPacketCache = () => {
+  if (state.ctx && state.api.setPacketCache) {
+    state.api.setPacketCache(state.ctx, PACKET_CACHE_SECONDS, PACKET_CACHE_BYTES);
+  }
+};
+
+// Split builds keep most decoders and libass in side modules; fetch each one
+// once, the first time a call reports it missing.
+const loadSideModules = (names) =>
+  Promise.all(
+    names.map((name) => {
+      if (!state.sideModules.has(name)) {
+        const started = performance.now();
+        const promise = state.Module.loadDynamicLibrary(name, {
+          loadAsync: true,
+          global: true,
+          nodelete: true,
+        }).then(
+          () => postLog(`Loaded ${name} in ${(performance.now() - started).toFixed(0)} ms`),
+          (err) => {
+            postLog(`Failed to load ${name}: ${err.message || err}`);
+            throw err;
+          }
+        );
+        state.sideModules.set(name, promise);
+      }
+      return state.sideModules.get(name);
+    })
+  );
+
+// Returns false unless ret asks for side modules; otherwise loads them and
+// calls retry, unless the session changed meanwhile.
+const retryWithModules = (ret, ctx, retry) => {
+  if (ret !== NEED_MODULE || !state.api.missingModules || !state.Module.loadDynamicLibrary) {
+    return false;
+  }
+  const names = state.api.missingModules(ctx).split(",").filter(Boolean);
+  const token = state.sessionToken;
+  state.moduleLoading = true;
+  postStatus("Loading codec...");
+  loadSideModules(names).then(
+    () => {
+      state.moduleLoading = false;
+      if (token === state.sessionToken) retry();
+    },
+    () => {
+      state.moduleLoading = false;
+      if (token === state.sessionToken) postStatus("Codec unavailable");
+    }
+  );
+  return true;
+};
+
+const applyDeinterlace = () => {
+  if (!state.ctx || !state.api.setDeinterlace) {
+    return;
+  }
+  const ret = state.api.setDeinterlace(state.ctx, state.deinterlace, 0);
+  if (ret < 0) {
+    postLog(`Deinterlace filter "${state.deinterlace}" unavailable (${ret}).`);
+    state.deinterlace = "";
+  }
+};
+
 const getStreamsPayload = () => {
   if (!state.api || !state.ctx || !state.opened) {
     return null;
@@ -263,6 +745,17 @@ const getStreamsPayload = () => {
     return null;
   }
 
+  // A cached open state already has the descriptors
+  const cached = state.restore && state.restore.streams;
+  if (Array.isArray(cached) && cached.length === count) {
+    return buildStreamsPayload(cached);
+  }
+
+  const table = readStreamTable();
+  if (table && table.streams.length === count) {
+    return table;
+  }
+
   const streams = [];
   for (let i = 0; i < count; i += 1) {
     const mediaType = state.api.streamMediaType(state.ctx, i);
@@ -280,7 +773,44 @@ const getStreamsPayload = () => {
       : false;
     streams.push({ index: i, mediaType, codec, language, title, isDefault });
   }
+  return buildStreamsPayload(streams);
+};
+
+// The whole stream list and selection in one call; null without the export
+const readStreamTable = () => {
+  const ptr = state.api.streamTable ? state.api.streamTable(state.ctx) : 0;
+  if (!ptr) return null;
+  const heap = state.Module.HEAPU8.buffer;
+  const head = new DataView(heap, ptr, STREAM_TABLE.size);
+  if (head.getUint32(0, true) !== DESC_VERSION) return null;
+  const count = head.getInt32(STREAM_TABLE.count, true);
+  const entrySize = head.getInt32(STREAM_TABLE.entrySize, true);
+  const flags = head.getUint32(STREAM_TABLE.flags, true);
+  const streams = [];
+  for (let i = 0; i < count; i += 1) {
+    const entry = new DataView(heap, ptr + STREAM_TABLE.size + i * entrySize, entrySize);
+    streams.push({
+      index: i,
+      mediaType: entry.getInt32(STREAM_ENTRY.mediaType, true),
+      codec: readCString(readPtr(entry, STREAM_ENTRY.codecName)),
+      language: readCString(readPtr(entry, STREAM_ENTRY.language)),
+      title: readCString(readPtr(entry, STREAM_ENTRY.title)),
+      isDefault: Boolean(entry.getUint32(STREAM_ENTRY.flags, true) & STREAM_DEFAULT),
+    });
+  }
+  return {
+    type: "streams",
+    streams,
+    audioOnly: state.audioOnly,
+    selectedVideo: head.getInt32(STREAM_TABLE.video, true),
+    selectedAudio: head.getInt32(STREAM_TABLE.audio, true),
+    selectedSubtitle: head.getInt32(STREAM_TABLE.subtitle, true),
+    audioEnabled: Boolean(flags & STREAMS_AUDIO_ENABLED),
+    subtitlesEnabled: Boolean(flags & STREAMS_SUBTITLES_ENABLED),
+  };
+};
 
+const buildStreamsPayload = (streams) => {
   const selectedVideo = state.api.selectedVideoStream
     ? state.api.selectedVideoStream(state.ctx)
     : -1;
@@ -300,6 +830,7 @@ const getStreamsPayload = () => {
   return {
     type: "streams",
     streams,
+    audioOnly: state.audioOnly,
     selectedVideo,
     selectedAudio,
     selectedSubtitle,
@@ -330,6 +861,16 @@ const emitStats = (force = false) => {
     seeking: state.seeking,
     audioChannels: state.audioChannels,
     audioSampleRate: state.audioSampleRate,
+    memory: getMemoryPayload(),
+    bufferedSeconds: bufferedSeconds(),
+    readPosition: state.opened && state.api.readPosition ? state.api.readPosition(state.ctx) : 0,
+    bitrate: state.api && state.api.inputBitrate && state.ctx ? state.api.inputBitrate(state.ctx) : 0,
+    variant: state.manifest ? state.manifest.variantLabel : "",
+    liveSkips: state.live && state.opened && state.api.liveSkips ? state.api.liveSkips(state.ctx) : -1,
+    spilledBytes: state.ctx && state.api.spilledBytes ? state.api.spilledBytes(state.ctx) : 0,
+    droppedFrames: state.ctx && state.api.clockDropped ? state.api.clockDropped(state.ctx) : 0,
+    lateFrames: state.ctx && state.api.clockLate ? state.api.clockLate(state.ctx) : 0,
+    clockDrift: state.ctx && state.api.clockDrift ? state.api.clockDrift(state.ctx) : 0,
   });
 };
 
@@ -338,15 +879,17 @@ const destroyDecoder = () => {
     state.api.destroy(state.ctx);
   }
   state.ctx = 0;
+  state.frameDesc = null;
+  state.toneMappedLogged = false;
   state.opened = false;
+  state.remux = null;
   state.waitingForData = false;
   state.draining = false;
   state.frames = 0;
   state.bytes = 0;
   state.duration = 0;
   state.currentTime = 0;
-  state.basePts = null;
-  state.baseWall = 0;
+  resetClock();
   state.seeking = false;
   state.seekTarget = null;
   state.seekUiLast = 0;
@@ -378,6 +921,13 @@ const stopStream = async () => {
   }
   const controller = state.abortController;
   state.abortController = null;
+  state.range = null;
+  state.manifest = null;
+  const socket = state.socket;
+  state.socket = null;
+  if (socket) {
+    socket.close();
+  }
   if (controller) {
     controller.abort();
   }
@@ -417,9 +967,15 @@ const clearCanvas = () => {
 };
 
 const resetPlayback = async () => {
+  persistOpenState();
+  cancelPreload();
   state.sessionToken += 1;
   state.playing = false;
   stopDecodeLoop();
+  stopTrickPlay(false);
+  state.gopActive = false;
+  clearTimeout(state.gopStepTimer);
+  state.gopStepTimer = null;
   await stopStream();
   clearCanvas();
   destroyDecoder();
@@ -427,8 +983,11 @@ const resetPlayback = async () => {
   state.activeFile = null;
   state.activeUrl = null;
   state.formatHint = "";
+  state.live = null;
+  state.openStateKey = "";
+  state.restore = null;
 
-  postMessage({ type: "audioClear" });
+  postAudioClear();
   postStatus("Ready");
 };
 
@@ -441,11 +1000,38 @@ const ensureDecoder = (bufferBytes) => {
     return;
   }
   if (state.api.setBufferLimit && hasExport("ffmpeg_wasm_set_buffer_limit")) {
-    state.api.setBufferLimit(state.ctx, BUFFER_LIMIT_BYTES);
+    state.api.setBufferLimit(state.ctx, bufferLimitBytes());
+  }
+  applyMemoryBudget();
+  applyPacketCache();
+  applyDeinterlace();
+  attachFrameDesc();
+};
+
+// Local files: consumed input goes to an OPFS file instead of staying in the
+// heap, so the buffer limit drops to SPILL_HEAP_LIMIT_BYTES while every byte
+// read so far stays seekable. Attaches while the stream starts; open keeps
+// everything anyway, so nothing is dropped before the store is there.
+const enableSpill = async () => {
+  const ctx = state.ctx;
+  const session = state.sessionToken;
+  if (!ctx || !state.api.setSpill || typeof openOpfsSpillStore !== "function") return;
+  const store = await openOpfsSpillStore(`spill-${ctx}-${Date.now()}.bin`);
+  if (!store) return;
+  if (ctx !== state.ctx || session !== state.sessionToken) {
+    store.close();
+    return;
+  }
+  attachSpillStore(state.Module, ctx, store);
+  const ret = state.api.setSpill(ctx, 1);
+  if (ret < 0) {
+    detachSpillStore(state.Module, ctx);
+    return;
   }
+  state.api.setBufferLimit(ctx, SPILL_HEAP_LIMIT_BYTES);
 };
 
-const allocateAndAppend = (chunk) => {
+const allocateAndAppend = (chunk, offset, audio = false) => {
   const Module = state.Module;
   const ptr = Module._malloc(chunk.length);
   if (!ptr) {
@@ -453,7 +1039,14 @@ const allocateAndAppend = (chunk) => {
     return -12; // AVERROR(ENOMEM)
   }
   Module.HEAPU8.set(chunk, ptr);
-  const ret = state.api.append(state.ctx, ptr, chunk.length);
+  let ret;
+  if (audio) {
+    ret = state.api.appendAudio(state.ctx, ptr, chunk.length);
+  } else if (offset === undefined) {
+    ret = state.api.append(state.ctx, ptr, chunk.length);
+  } else {
+    ret = state.api.appendAt(state.ctx, offset, ptr, chunk.length);
+  }
   Module._free(ptr);
   return ret;
 };
@@ -489,6 +1082,19 @@ const ebmlHeaderLooksValid = () => {
 };
 
 const getMinOpenBytes = () => {
+  if (state.restore) {
+    return 1; // The cached header length was appended in one go
+  }
+  if (state.live) {
+    return LIVE_OPEN_BYTES;
+  }
+  if (state.manifest) {
+    return 1; // Whole segments arrive; open retries until the headers are in
+  }
+  if (state.range) {
+    // Open retries fetch whatever the demuxer asks for next
+    return Math.min(RANGE_OPEN_BYTES, state.range.total);
+  }
   if (state.activeFile && Number.isFinite(state.activeFile.size)) {
     const size = state.activeFile.size;
     if (size <= MIN_OPEN_BYTES_SMALL) {
@@ -514,15 +1120,31 @@ const describeOpenFailure = (ret, minOpenBytes) => {
   return `Open failed (${ret}).${hintText}`;
 };
 
+// No video decoder (music, podcasts, or video dropped via selectStreams):
+// audio pts drive the clock and seeks keep audio enabled.
+const updateAudioOnly = () => {
+  const audioOnly = state.api.hasVideo ? !state.api.hasVideo(state.ctx) : false;
+  if (audioOnly !== state.audioOnly) {
+    state.audioOnly = audioOnly;
+    postLog(audioOnly ? "Audio-only source; video decoding skipped." : "Video stream selected.");
+  }
+};
+
 const tryOpen = () => {
-  if (state.opened || !state.ctx) return;
+  if (state.opened || !state.ctx || state.moduleLoading) return;
+  // A separate audio rendition must be in before open picks the decoders
+  if (state.manifest && !state.manifest.primed) return;
   // Wait for minimum data before attempting to parse container header
   const minOpenBytes = getMinOpenBytes();
   if (state.bytes < minOpenBytes && !state.draining) return;
 
   const ret = state.api.open(state.ctx, state.formatHint || null);
+  if (retryWithModules(ret, state.ctx, tryOpen)) {
+    return;
+  }
   if (ret === 0) {
     state.opened = true;
+    updateAudioOnly();
     state.lastOpenError = null;
     state.lastOpenErrorLogged = null;
     state.duration = 0;
@@ -542,6 +1164,9 @@ const tryOpen = () => {
         );
       }
     }
+    if (state.manifest && state.manifest.duration > 0) {
+      state.duration = state.manifest.duration;
+    }
     postStatus("Playing");
     if (state.pendingStreamSelection && state.api.selectStreams) {
       const { videoStreamIndex, audioStreamIndex, subtitleStreamIndex } =
@@ -552,15 +1177,22 @@ const tryOpen = () => {
         Number(videoStreamIndex),
         Number(audioStreamIndex)
       );
-      if (selectRet < 0) {
+      if (
+        retryWithModules(selectRet, state.ctx, () =>
+          onmessage({ data: { type: "selectStreams", videoStreamIndex, audioStreamIndex } })
+        )
+      ) {
+        // Selected again once the codec module is in
+      } else if (selectRet < 0) {
         postLog(`Track selection failed (${selectRet}).`);
       } else {
-        postMessage({ type: "audioClear" });
-        state.basePts = null;
-        state.baseWall = 0;
+        updateAudioOnly();
+        postAudioClear();
+        resetClock();
       }
       // Apply subtitle selection if requested
       if (
+        !state.passthrough &&
         state.api.selectSubtitleStream &&
         subtitleStreamIndex !== undefined &&
         subtitleStreamIndex !== -2
@@ -569,7 +1201,13 @@ const tryOpen = () => {
           state.ctx,
           subtitleStreamIndex
         );
-        if (subRet < 0) {
+        if (
+          retryWithModules(subRet, state.ctx, () =>
+            onmessage({ data: { type: "selectSubtitle", subtitleStreamIndex } })
+          )
+        ) {
+          // Selected again once subtitles.wasm is in
+        } else if (subRet < 0) {
           postLog(`Subtitle track selection failed (${subRet}).`);
         } else {
           postLog(
@@ -583,6 +1221,9 @@ const tryOpen = () => {
     }
     emitStreams();
     emitStats(true);
+    if (state.passthrough && !startRemux(0)) {
+      return;
+    }
     startDecodeLoop(0);
   } else if (ret !== state.lastOpenError) {
     state.lastOpenError = ret;
@@ -603,13 +1244,15 @@ const tryOpen = () => {
   }
 };
 
-const appendChunk = (token, chunk) => {
+// offset is only given for a range source, whose chunks arrive out of order;
+// audio chunks belong to a manifest's separate audio rendition
+const appendChunk = (token, chunk, offset, audio = false) => {
   if (token !== state.streamToken) {
     return false;
   }
   if (!state.ctx) return false;
-  captureHeaderSample(chunk);
-  const ret = allocateAndAppend(chunk);
+  if (!offset && !audio) captureHeaderSample(chunk);
+  const ret = allocateAndAppend(chunk, offset, audio);
   if (ret < 0) {
     postLog(`Append failed with code ${ret}.`);
     state.streamRunning = false;
@@ -627,22 +1270,75 @@ const appendChunk = (token, chunk) => {
   return true;
 };
 
-const waitForBuffer = async (token) => {
-  if (!state.api || !state.ctx || !state.api.bufferedBytes) {
-    return;
-  }
-  if (!hasExport("ffmpeg_wasm_buffered_bytes")) {
-    return;
+// Ingest waits on consumption rather than a timer: the decode loop (and
+// finished range requests) wake it, with FLOW_WAIT_MAX_MS as a backstop for
+// when nothing is consuming, e.g. while paused.
+const wakeIngest = () => {
+  const waiters = state.ingestWaiters;
+  state.ingestWaiters = [];
+  for (const wake of waiters) wake();
+};
+
+const waitForIngestWake = (maxMs) =>
+  new Promise((resolve) => {
+    const timer = setTimeout(resolve, maxMs);
+    state.ingestWaiters.push(() => {
+      clearTimeout(timer);
+      resolve();
+    });
+  });
+
+// Appends carry about INGEST_CHUNK_SECONDS of media at the observed bitrate
+const ingestChunkBytes = () => {
+  const bitrate = state.api.inputBitrate ? state.api.inputBitrate(state.ctx) : 0;
+  if (!(bitrate > 0)) return MAX_CHUNK_BYTES;
+  const bytes = Math.round((bitrate / 8) * INGEST_CHUNK_SECONDS);
+  return Math.min(MAX_INGEST_CHUNK, Math.max(MIN_INGEST_CHUNK, bytes));
+};
+
+// Seconds of media the C side holds ahead of playback, -1 if not known yet
+const bufferedSeconds = () =>
+  state.opened && state.api.bufferedSeconds ? state.api.bufferedSeconds(state.ctx) : -1;
+
+const ingestShouldWait = () => {
+  // Live input cannot be paused; the decoder skips ahead instead
+  if (state.live) {
+    return false;
   }
-  if (!Number.isFinite(state.maxBufferBytes)) {
-    return;
+  // Over the memory budget the C side has already trimmed what it can; hold
+  // ingest until the decoder consumes unread bytes. Never while it is starved
+  // or still opening, or neither side could make progress.
+  if (
+    state.api.memoryOverBudget &&
+    state.opened &&
+    !state.waitingForData &&
+    state.api.memoryOverBudget(state.ctx) > 0
+  ) {
+    return true;
   }
-  while (
-    token === state.streamToken &&
-    state.streamRunning &&
+  if (
+    state.api.bufferedBytes &&
+    Number.isFinite(state.maxBufferBytes) &&
     state.api.bufferedBytes(state.ctx) > state.maxBufferBytes
   ) {
-    await sleep(BUFFER_POLL_MS);
+    return true;
+  }
+  // Watermarks in media seconds; a seek fast-forward reads as fast as it can
+  const ahead = bufferedSeconds();
+  if (ahead < 0 || state.seeking || state.waitingForData) {
+    state.ingestPaused = false;
+    return false;
+  }
+  state.ingestPaused = ahead > (state.ingestPaused ? FLOW_LOW_SECONDS : FLOW_HIGH_SECONDS);
+  return state.ingestPaused;
+};
+
+const waitForBuffer = async (token) => {
+  if (!state.api || !state.ctx) {
+    return;
+  }
+  while (token === state.streamToken && state.streamRunning && ingestShouldWait()) {
+    await waitForIngestWake(FLOW_WAIT_MAX_MS);
   }
 };
 
@@ -665,15 +1361,16 @@ const streamFile = async (file, startByte = 0) => {
     if (token !== state.streamToken) break;
     if (done) break;
     if (value && value.length) {
-      for (let offset = 0; offset < value.length; offset += MAX_CHUNK_BYTES) {
+      const chunkBytes = ingestChunkBytes();
+      for (let offset = 0; offset < value.length; offset += chunkBytes) {
         if (token !== state.streamToken) break;
         await waitForBuffer(token);
         if (token !== state.streamToken) break;
-        const slice = value.subarray(offset, offset + MAX_CHUNK_BYTES);
+        const slice = value.subarray(offset, offset + chunkBytes);
         if (!appendChunk(token, slice)) {
           return;
         }
-        if (value.length > MAX_CHUNK_BYTES) {
+        if (value.length > chunkBytes) {
           await sleep(0);
         }
       }
@@ -734,15 +1431,16 @@ const streamUrl = async (url) => {
     if (token !== state.streamToken) break;
     if (done) break;
     if (value && value.length) {
-      for (let offset = 0; offset < value.length; offset += MAX_CHUNK_BYTES) {
+      const chunkBytes = ingestChunkBytes();
+      for (let offset = 0; offset < value.length; offset += chunkBytes) {
         if (token !== state.streamToken) break;
         await waitForBuffer(token);
         if (token !== state.streamToken) break;
-        const slice = value.subarray(offset, offset + MAX_CHUNK_BYTES);
+        const slice = value.subarray(offset, offset + chunkBytes);
         if (!appendChunk(token, slice)) {
           return;
         }
-        if (value.length > MAX_CHUNK_BYTES) {
+        if (value.length > chunkBytes) {
           await sleep(0);
         }
       }
@@ -766,6 +1464,358 @@ const streamUrl = async (url) => {
   }
 };
 
+const contentRangeTotal = (header) => {
+  const match = /\/(\d+)\s*$/.exec(header || "");
+  return match ? Number(match[1]) : 0;
+};
+
+// tail requests (container indexes) survive repositioning
+const fetchRange = async (range, start, end, tail = false) => {
+  const controller = new AbortController();
+  const entry = { start, end, controller, tail };
+  range.inflight.add(entry);
+  const started = performance.now();
+  try {
+    const resp = await fetch(range.url, {
+      headers: { Range: `bytes=${start}-${end - 1}` },
+      signal: controller.signal,
+    });
+    if (resp.status !== 206) {
+      throw new Error(`HTTP ${resp.status} for range ${start}-${end - 1}`);
+    }
+    const bytes = new Uint8Array(await resp.arrayBuffer());
+    if (range.token !== state.streamToken) return;
+    // Double or halve the chunk so one request stays near RANGE_TARGET_MS
+    const ms = performance.now() - started;
+    if (ms < RANGE_TARGET_MS / 2) {
+      range.chunk = Math.min(RANGE_MAX_CHUNK, range.chunk * 2);
+    } else if (ms > RANGE_TARGET_MS * 2) {
+      range.chunk = Math.max(RANGE_MIN_CHUNK, range.chunk / 2);
+    }
+    const chunkBytes = ingestChunkBytes();
+    for (let offset = 0; offset < bytes.length; offset += chunkBytes) {
+      if (!appendChunk(range.token, bytes.subarray(offset, offset + chunkBytes), start + offset)) {
+        return;
+      }
+    }
+  } catch (err) {
+    if (!controller.signal.aborted && range.token === state.streamToken) {
+      postLog(`Range fetch failed: ${err.message}`);
+      range.errors += 1;
+    }
+  } finally {
+    range.inflight.delete(entry);
+    wakeIngest();
+  }
+};
+
+// Keep up to RANGE_PARALLEL requests filling the holes ahead of whatever the
+// demuxer reads next; requests far from a new position (after a seek) are
+// dropped.
+const scheduleRangeFetches = (range) => {
+  const api = state.api;
+  const wanted = api.rangeWanted(state.ctx);
+  const pos = wanted >= 0 ? wanted : api.rangePosition(state.ctx);
+  // Read ahead FLOW_HIGH_SECONDS of media once the bitrate is known
+  const bitrate = state.api.inputBitrate ? state.api.inputBitrate(state.ctx) : 0;
+  const readahead =
+    bitrate > 0
+      ? Math.min(RANGE_READAHEAD_MAX, Math.max(RANGE_MAX_CHUNK, (bitrate / 8) * FLOW_HIGH_SECONDS))
+      : RANGE_READAHEAD_BYTES;
+  const horizon = Math.min(range.total, pos + readahead);
+  for (const entry of range.inflight) {
+    if (entry.end <= pos || entry.start >= horizon) {
+      if (!entry.tail) entry.controller.abort();
+    }
+  }
+
+  const live = () => [...range.inflight].filter((entry) => !entry.controller.signal.aborted);
+  let cursor = pos;
+  while (live().length < RANGE_PARALLEL && cursor < horizon) {
+    // Skip what is cached or already requested
+    const cached = api.rangeCachedEnd(state.ctx, cursor);
+    const covering = live().find((entry) => entry.start <= cursor && cursor < entry.end);
+    if (cached > cursor || covering) {
+      cursor = Math.max(cached, covering ? covering.end : 0);
+      continue;
+    }
+    let end = Math.min(range.total, cursor + range.chunk);
+    for (const entry of live()) {
+      if (entry.start > cursor && entry.start < end) end = entry.start;
+    }
+    fetchRange(range, cursor, end);
+    cursor = end;
+  }
+};
+
+// Random-access URL source: concurrent Range requests into the C range cache.
+// Falls back to one sequential fetch when the server ignores Range.
+const streamRange = async (url) => {
+  const token = (state.streamToken += 1);
+  state.streamRunning = true;
+  const abortController = new AbortController();
+  state.abortController = abortController;
+  postLog(`Fetching stream: ${url}`);
+
+  let probe;
+  try {
+    probe = await fetch(url, {
+      headers: { Range: `bytes=0-${RANGE_MIN_CHUNK - 1}` },
+      signal: abortController.signal,
+    });
+  } catch (err) {
+    if (token !== state.streamToken) return;
+    postLog(`Fetch failed: ${err.message}`);
+    state.streamRunning = false;
+    return;
+  }
+  if (token !== state.streamToken) return;
+
+  const total = probe.status === 206 ? contentRangeTotal(probe.headers.get("Content-Range")) : 0;
+  if (!total || !state.api.setRangeSource || state.api.setRangeSource(state.ctx, total, 0) < 0) {
+    if (probe.body) probe.body.cancel().catch(() => {});
+    postLog("Server does not support byte ranges; streaming sequentially.");
+    streamUrl(url);
+    return;
+  }
+
+  const range = { url, total, token, inflight: new Set(), chunk: RANGE_MIN_CHUNK, errors: 0 };
+  state.range = range;
+  abortController.signal.addEventListener("abort", () => {
+    for (const entry of range.inflight) entry.controller.abort();
+  });
+  state.seekEnabled = true;
+  postMessage({ type: "seekInfo", enabled: true, slow: false, reason: "" });
+  postLog(`Range source: ${total} bytes, up to ${RANGE_PARALLEL} parallel requests.`);
+
+  try {
+    const head = new Uint8Array(await probe.arrayBuffer());
+    if (!appendChunk(token, head, 0)) return;
+  } catch (err) {
+    if (token !== state.streamToken) return;
+    postLog(`Fetch failed: ${err.message}`);
+  }
+  if (total > RANGE_MIN_CHUNK) {
+    const tailStart = Math.max(RANGE_MIN_CHUNK, total - RANGE_TAIL_BYTES);
+    fetchRange(range, tailStart, total, true);
+  }
+
+  while (token === state.streamToken && state.streamRunning && range.errors < 8) {
+    await waitForBuffer(token);
+    if (token !== state.streamToken) break;
+    scheduleRangeFetches(range);
+    await waitForIngestWake(FLOW_WAIT_MAX_MS);
+  }
+  if (token === state.streamToken && range.errors >= 8) {
+    postLog("Too many range request failures; stopping.");
+    postStatus("Network error");
+    state.streamRunning = false;
+  }
+};
+
+// Fetch segments until every track has ended (or the stream is replaced).
+// Also restarted by a seek after the end was reached.
+const pumpManifest = async (source, token) => {
+  state.streamRunning = true;
+  let errors = 0;
+  while (token === state.streamToken && state.streamRunning && !source.ended) {
+    await waitForBuffer(token);
+    if (token !== state.streamToken) return;
+    try {
+      await source.step();
+      errors = 0;
+    } catch (err) {
+      if (token !== state.streamToken) return;
+      errors += 1;
+      postLog(`Segment fetch failed: ${err.message}`);
+      if (errors >= MANIFEST_MAX_ERRORS) {
+        postLog("Too many segment failures; stopping.");
+        postStatus("Network error");
+        state.streamRunning = false;
+        return;
+      }
+      await sleep(500 * errors);
+    }
+  }
+  if (token !== state.streamToken || !state.streamRunning) {
+    return;
+  }
+  state.streamRunning = false;
+  state.draining = true;
+  postLog("Manifest stream ended. Draining decoder.");
+  tryOpen();
+  startDecodeLoop(0);
+};
+
+// Live MPEG-TS over a WebSocket (e.g. scripts/udp-ws-relay.py): every binary
+// message is appended as it arrives and wakes the decode loop
+const streamWebSocket = (url) => {
+  const token = (state.streamToken += 1);
+  state.streamRunning = true;
+  postLog(`Connecting: ${url}`);
+
+  let socket;
+  try {
+    socket = new WebSocket(url);
+  } catch (err) {
+    postLog(`WebSocket failed: ${err.message}`);
+    state.streamRunning = false;
+    return;
+  }
+  socket.binaryType = "arraybuffer";
+  state.socket = socket;
+  socket.onmessage = (event) => {
+    if (event.data instanceof ArrayBuffer && event.data.byteLength) {
+      appendChunk(token, new Uint8Array(event.data));
+    }
+  };
+  socket.onerror = () => {
+    if (token === state.streamToken) postLog("WebSocket error.");
+  };
+  socket.onclose = () => {
+    if (token !== state.streamToken || !state.streamRunning) return;
+    state.streamRunning = false;
+    state.api.setEof(state.ctx);
+    state.draining = true;
+    postLog("Live stream closed. Draining decoder.");
+    tryOpen();
+    startDecodeLoop(0);
+  };
+};
+
+// Serialized open state of the active local file, or null
+const captureOpenState = () => {
+  if (!state.opened || !state.ctx || !state.activeFile || state.remux || !state.api.saveOpenState) {
+    return null;
+  }
+  const size = state.api.saveOpenState(state.ctx);
+  if (size <= 0) {
+    return null;
+  }
+  const payload = getStreamsPayload();
+  return {
+    blob: heapSlice(state.api.openStatePtr(state.ctx), size),
+    headerEnd: state.api.headerEnd(state.ctx),
+    position: state.currentTime,
+    duration: state.duration,
+    streams: payload ? payload.streams : null,
+  };
+};
+
+const persistOpenState = () => {
+  if (!state.openStateKey) return;
+  const record = captureOpenState();
+  if (record) {
+    storeOpenState(state.openStateKey, record).catch(() => {});
+  }
+};
+
+// Reopen from a cached open state: only the container header and the input
+// from the indexed keyframe before position are read, with no probing; the
+// decode loop then fast-forwards to position as for a seek
+const streamFileFromState = async (file, record, position) => {
+  const token = (state.streamToken += 1);
+  state.streamRunning = true;
+  const Module = state.Module;
+  const ptr = Module._malloc(record.blob.byteLength);
+  if (!ptr) {
+    streamFile(file);
+    return;
+  }
+  Module.HEAPU8.set(new Uint8Array(record.blob), ptr);
+  const setRet = state.api.setOpenState(state.ctx, ptr, record.blob.byteLength);
+  Module._free(ptr);
+  if (setRet < 0) {
+    postLog(`Cached open state rejected (${setRet}); probing.`);
+    streamFile(file);
+    return;
+  }
+  state.restore = record;
+
+  const headEnd = Math.min(file.size, record.headerEnd + RESUME_HEADER_SLACK);
+  let head;
+  try {
+    head = new Uint8Array(await file.slice(0, headEnd).arrayBuffer());
+  } catch (err) {
+    postLog(`File read failed: ${err.message}`);
+    state.streamRunning = false;
+    return;
+  }
+  if (token !== state.streamToken || !appendChunk(token, head)) return;
+  if (!state.opened) {
+    postLog("Cached header did not open; reading on.");
+    state.restore = null;
+    streamFile(file, headEnd);
+    return;
+  }
+
+  let start = headEnd;
+  if (position > 0) {
+    const pos = state.api.resumePosition(state.ctx, position);
+    if (pos >= 0) {
+      start = pos;
+    }
+    postAudioClear();
+    state.seeking = true;
+    state.seekTarget = position;
+    resetClock();
+    muteAudioForSeek();
+    postStatus("Seeking...");
+  }
+  postLog(
+    `Opened from cached state (${record.headerEnd} header bytes), streaming from byte ${start}.`
+  );
+  streamFile(file, start);
+};
+
+// HLS/DASH: segments go into the byte layer in order; variant switches mark
+// segment boundaries so only the demuxer is reopened
+const streamManifest = async (url) => {
+  const token = (state.streamToken += 1);
+  state.streamRunning = true;
+  const abortController = new AbortController();
+  state.abortController = abortController;
+  postLog(`Fetching manifest: ${url}`);
+
+  const source = new ManifestSource(url, abortController.signal, {
+    append: (bytes, audio) => appendChunk(token, bytes, undefined, audio),
+    markBoundary: (audio) => {
+      const ret = state.api.markSegmentBoundary(state.ctx, audio ? 1 : 0);
+      if (ret < 0) postLog(`Segment boundary rejected (${ret}).`);
+    },
+    end: (audio) => {
+      if (token !== state.streamToken) return;
+      if (audio) {
+        state.api.setAudioInputEof(state.ctx);
+      } else {
+        state.api.setEof(state.ctx);
+      }
+    },
+    log: postLog,
+  });
+  try {
+    await source.load();
+  } catch (err) {
+    if (token !== state.streamToken) return;
+    postLog(`Manifest failed: ${err.message}`);
+    postStatus("Manifest error");
+    state.streamRunning = false;
+    return;
+  }
+  if (token !== state.streamToken) return;
+
+  state.manifest = source;
+  state.seekEnabled = !source.live;
+  postMessage({
+    type: "seekInfo",
+    enabled: state.seekEnabled,
+    slow: false,
+    reason: source.live ? "Seek disabled for live streams." : "",
+  });
+  postLog(`Manifest: ${source.describe()}.`);
+  pumpManifest(source, token);
+};
+
 const copyRgba = (ptr, stride, width, height, target) => {
   const rowSize = width * 4;
   const heap = state.Module.HEAPU8;
@@ -938,9 +1988,77 @@ const renderFrameWebGL = (ptr, stride, width, height) => {
   gl.drawArrays(gl.TRIANGLE_STRIP, 0, 4);
 };
 
+const logSubtitleRender = (drew, pts, enabled) => {
+  if (state._subtitleDebugCount === undefined) {
+    state._subtitleDebugCount = 0;
+  }
+  if (
+    state._subtitleDebugCount < 10 ||
+    (pts >= 30 && pts - (state._subtitleLastLogPts || 0) >= 1)
+  ) {
+    const selectedSub = state.api.selectedSubtitleStream
+      ? state.api.selectedSubtitleStream(state.ctx)
+      : -1;
+    postLog(
+      `Subtitle render: ret=${drew} enabled=${enabled} track=${selectedSub} delay=${state.subtitleDelay.toFixed(
+        3
+      )} pts=${pts.toFixed(3)} events=${state.api.subtitleEventsCount ? state.api.subtitleEventsCount(state.ctx) : "n/a"} firstStartMs=${state.api.subtitleFirstStartMs ? state.api.subtitleFirstStartMs(state.ctx) : "n/a"} firstEndMs=${state.api.subtitleFirstEndMs ? state.api.subtitleFirstEndMs(state.ctx) : "n/a"}`
+    );
+    state._subtitleDebugCount += 1;
+    state._subtitleLastLogPts = pts;
+  }
+  if (drew > 0 && !state._subtitleDrawnOnce) {
+    state._subtitleDrawnOnce = true;
+    postLog("Subtitles drew onto frame.");
+  }
+};
+
+const drawRgba = (ptr, stride, width, height) => {
+  if (state.renderMode === "webgl") {
+    renderFrameWebGL(ptr, stride, width, height);
+  } else {
+    renderFrame2d(ptr, stride, width, height);
+  }
+};
+
+// One present_frame call converts, scales and blends subtitles; the result
+// comes back in the frame descriptor
 const renderFrame = () => {
-  const width = state.api.width(state.ctx);
-  const height = state.api.height(state.ctx);
+  const view = frameDescView();
+  if (!view) {
+    renderFrameLegacy();
+    return;
+  }
+  if (view.getInt32(FRAME_DESC.width, true) <= 0 || view.getInt32(FRAME_DESC.height, true) <= 0) {
+    return;
+  }
+  const ret = state.api.presentFrame(state.ctx, state.subtitleDelay);
+  const flags = view.getUint32(FRAME_DESC.flags, true);
+  if (ret < 0 || !(flags & FRAME_HAS_RGBA)) {
+    postLog(`RGBA conversion failed (${ret}).`);
+    return;
+  }
+  if (flags & FRAME_TONE_MAPPED && !state.toneMappedLogged) {
+    state.toneMappedLogged = true;
+    postLog("HDR video: tone mapped to SDR BT.709.");
+  }
+  logSubtitleRender(
+    ret,
+    view.getFloat64(FRAME_DESC.pts, true) + state.subtitleDelay,
+    flags & FRAME_SUBTITLES_ENABLED ? 1 : 0
+  );
+  drawRgba(
+    readPtr(view, FRAME_DESC.rgbaData),
+    view.getInt32(FRAME_DESC.rgbaStride, true),
+    view.getInt32(FRAME_DESC.rgbaWidth, true),
+    view.getInt32(FRAME_DESC.rgbaHeight, true)
+  );
+};
+
+// Modules built before ffmpeg_wasm_present_frame
+const renderFrameLegacy = () => {
+  let width = state.api.width(state.ctx);
+  let height = state.api.height(state.ctx);
   if (width <= 0 || height <= 0) {
     return;
   }
@@ -949,81 +2067,112 @@ const renderFrame = () => {
     postLog(`RGBA conversion failed (${rgbaOk}).`);
     return;
   }
+  if (state.api.rgbaWidth) {
+    // May differ from the decoded size once an output size is set
+    width = state.api.rgbaWidth(state.ctx);
+    height = state.api.rgbaHeight(state.ctx);
+  }
   if (state.api.renderSubtitles) {
     const pts = state.api.pts(state.ctx) + state.subtitleDelay;
     const enabled = state.api.subtitlesEnabled
       ? state.api.subtitlesEnabled(state.ctx)
       : true;
-    const selectedSub = state.api.selectedSubtitleStream
-      ? state.api.selectedSubtitleStream(state.ctx)
-      : -1;
     const drew = state.api.renderSubtitles(state.ctx, pts);
-
-    if (state._subtitleDebugCount === undefined) {
-      state._subtitleDebugCount = 0;
-    }
-    if (
-      state._subtitleDebugCount < 10 ||
-      (pts >= 30 && pts - (state._subtitleLastLogPts || 0) >= 1)
-    ) {
-      postLog(
-        `Subtitle render: ret=${drew} enabled=${enabled} track=${selectedSub} delay=${state.subtitleDelay.toFixed(
-          3
-        )} pts=${pts.toFixed(3)} events=${state.api.subtitleEventsCount ? state.api.subtitleEventsCount(state.ctx) : "n/a"} firstStartMs=${state.api.subtitleFirstStartMs ? state.api.subtitleFirstStartMs(state.ctx) : "n/a"} firstEndMs=${state.api.subtitleFirstEndMs ? state.api.subtitleFirstEndMs(state.ctx) : "n/a"}`
-      );
-      state._subtitleDebugCount += 1;
-      state._subtitleLastLogPts = pts;
-    }
-    if (drew > 0 && !state._subtitleDrawnOnce) {
-      state._subtitleDrawnOnce = true;
-      postLog("Subtitles drew onto frame.");
-    }
+    logSubtitleRender(drew, pts, enabled);
   } else if (!state._subtitleRenderMissingLogged) {
     state._subtitleRenderMissingLogged = true;
     postLog("Subtitle render function missing in wasm.");
   }
-  const ptr = state.api.rgbaPtr(state.ctx);
-  const stride = state.api.rgbaStride(state.ctx);
-  if (state.renderMode === "webgl") {
-    renderFrameWebGL(ptr, stride, width, height);
-  } else {
-    renderFrame2d(ptr, stride, width, height);
-  }
+  drawRgba(state.api.rgbaPtr(state.ctx), state.api.rgbaStride(state.ctx), width, height);
 };
 
 const handleAudioFrame = () => {
-  const channels = state.api.audioChannels(state.ctx);
-  const sampleRate = state.api.audioSampleRate(state.ctx);
-  const nbSamples = state.api.audioSamples(state.ctx);
-  const ptr = state.api.audioPtr(state.ctx);
+  const view = frameDescView();
+  const channels = view
+    ? view.getInt32(FRAME_DESC.audioChannels, true)
+    : state.api.audioChannels(state.ctx);
+  const sampleRate = view
+    ? view.getInt32(FRAME_DESC.audioSampleRate, true)
+    : state.api.audioSampleRate(state.ctx);
+  const nbSamples = view
+    ? view.getInt32(FRAME_DESC.audioNbSamples, true)
+    : state.api.audioSamples(state.ctx);
+  const ptr = view ? readPtr(view, FRAME_DESC.audioData) : state.api.audioPtr(state.ctx);
   if (!channels || !sampleRate || nbSamples <= 0 || !ptr) {
     return;
   }
 
   const totalSamples = nbSamples * channels;
-  const view = new Float32Array(state.Module.HEAPF32.buffer, ptr, totalSamples);
+  const view32 = new Float32Array(state.Module.HEAPF32.buffer, ptr, totalSamples);
   const copy = new Float32Array(totalSamples);
-  copy.set(view);
-  const pts = state.api.audioPts(state.ctx);
+  copy.set(view32);
+  const pts = audioPts();
   state.audioChannels = channels;
   state.audioSampleRate = sampleRate;
   postMessage(
-    { type: "audio", channels, sampleRate, pts, buffer: copy.buffer },
+    { type: "audio", channels, sampleRate, pts, epoch: state.audioEpoch, buffer: copy.buffer },
     [copy.buffer]
   );
 };
 
+// Seeks fast-forward on video pts with audio off; audio-only sources have
+// nothing else to land on, so they keep decoding and drop early audio.
+const muteAudioForSeek = () => {
+  if (
+    !state.audioOnly &&
+    state.api.setAudioEnabled &&
+    hasExport("ffmpeg_wasm_set_audio_enabled")
+  ) {
+    state.api.setAudioEnabled(state.ctx, 0);
+  }
+};
+
 const scheduleNext = (delayMs) => {
+  wakeIngest(); // The decoder just consumed input
   stopDecodeLoop();
   state.decodeTimer = setTimeout(decodeTick, delayMs);
 };
 
+// Live streams keep arrival-paced presentation (LIVE_RESYNC_SECONDS)
+const useMasterClock = () => !state.live && Boolean(state.api.clockSchedule);
+
+const presentVideoFrame = () => {
+  renderFrame();
+  state.frames += 1;
+  emitStats();
+  if (state.api.compactBuffer && state.frames % 60 === 0) {
+    state.api.compactBuffer(state.ctx);
+  }
+};
+
+// The frame decoded last tick, waiting for its slot. False while it should
+// keep waiting; a frame the clock gave up on is dropped unrendered
+const presentHeldFrame = () => {
+  const wait = state.api.clockSchedule(state.ctx, framePts(), wallSeconds());
+  if (wait > 0) {
+    scheduleNext(wait);
+    return false;
+  }
+  state.heldFrame = false;
+  if (wait !== CLOCK_DROP) {
+    presentVideoFrame();
+  }
+  return true;
+};
+
 const decodeTick = () => {
   state.decodeTimer = null;
   const token = state.sessionToken;
   if (!state.playing || !state.opened) {
     return;
   }
+  if (state.remux) {
+    remuxTick(token);
+    return;
+  }
+  if (state.heldFrame && !presentHeldFrame()) {
+    return;
+  }
 
   const budgetMs = state.seeking ? 4 : 8;
   const start = performance.now();
@@ -1033,6 +2182,41 @@ const decodeTick = () => {
     }
 
     const result = state.api.readFrame(state.ctx);
+    if (result === 2 && state.audioOnly) {
+      const pts = audioPts();
+      state.currentTime = pts;
+      if (state.seeking && state.seekTarget !== null) {
+        if (pts < state.seekTarget) {
+          continue;
+        }
+        state.seeking = false;
+        state.seekTarget = null;
+        resetClock();
+        state.maxBufferBytes = DEFAULT_MAX_BUFFER_BYTES;
+        postStatus("Playing");
+        postAudioClear();
+      }
+      handleAudioFrame();
+      state.frames += 1;
+      emitStats();
+      if (state.api.compactBuffer && state.frames % 60 === 0) {
+        state.api.compactBuffer(state.ctx);
+      }
+      if (state.basePts === null) {
+        state.basePts = pts;
+        state.baseWall = performance.now() / 1000;
+      }
+      // Stay a little ahead of playback instead of decoding the whole file
+      const speed = state.playbackSpeed || 1.0;
+      const lead = state.live ? state.live.target : AUDIO_ONLY_LEAD_SECONDS;
+      const targetTime = state.baseWall + (pts - state.basePts) / speed;
+      const aheadMs = (targetTime - performance.now() / 1000 - lead) * 1000;
+      if (aheadMs > 0) {
+        scheduleNext(aheadMs);
+        return;
+      }
+      continue;
+    }
     if (result === 2) {
       if (!state.seeking) {
         handleAudioFrame();
@@ -1056,7 +2240,7 @@ const decodeTick = () => {
     }
 
     if (result === 1) {
-      const pts = state.api.pts(state.ctx);
+      const pts = framePts();
       state.currentTime = pts;
       if (state.duration === 0) {
         const now = performance.now();
@@ -1098,12 +2282,11 @@ const decodeTick = () => {
       ) {
         state.seeking = false;
         state.seekTarget = null;
-        state.basePts = null;
-        state.baseWall = 0;
+        resetClock();
         state.maxBufferBytes = DEFAULT_MAX_BUFFER_BYTES;
         postStatus("Playing");
         // Clear any stale audio before re-enabling
-        postMessage({ type: "audioClear" });
+        postAudioClear();
         if (
           state.api.setAudioEnabled &&
           hasExport("ffmpeg_wasm_set_audio_enabled")
@@ -1112,6 +2295,20 @@ const decodeTick = () => {
         }
       }
 
+      if (useMasterClock()) {
+        const wait = state.api.clockSchedule(state.ctx, pts, wallSeconds());
+        if (wait === CLOCK_DROP) {
+          continue;
+        }
+        if (wait > 0) {
+          state.heldFrame = true;
+          scheduleNext(wait);
+          return;
+        }
+        presentVideoFrame();
+        continue;
+      }
+
       if (state.basePts === null) {
         state.basePts = pts;
         state.baseWall = performance.now() / 1000;
@@ -1131,6 +2328,13 @@ const decodeTick = () => {
       const elapsedVideo = pts - state.basePts;
       const targetTime = state.baseWall + elapsedVideo / speed;
       const nowSeconds = performance.now() / 1000;
+      if (state.live && Math.abs(targetTime - nowSeconds) > LIVE_RESYNC_SECONDS) {
+        // Arrival is the clock: late frames and keyframe skips re-anchor
+        state.basePts = pts;
+        state.baseWall = nowSeconds;
+        scheduleNext(0);
+        return;
+      }
       const delayMs = Math.max(0, (targetTime - nowSeconds) * 1000);
       scheduleNext(delayMs);
       return;
@@ -1142,9 +2346,21 @@ const decodeTick = () => {
       return;
     }
 
-    if (result === -1) {
-      // Clear seeking state if we hit EOF during a seek
-      if (state.seeking) {
+    if (result === -1 && state.preload && !state.seeking) {
+      // Gapless playlist: the next item takes over without a reset
+      if (!state.preload.ready) {
+        scheduleNext(PRELOAD_WAIT_MS);
+        return;
+      }
+      if (handoffPreload()) {
+        scheduleNext(0);
+        return;
+      }
+    }
+
+    if (result === -1) {
+      // Clear seeking state if we hit EOF during a seek
+      if (state.seeking) {
         state.seeking = false;
         state.seekTarget = null;
         state.maxBufferBytes = DEFAULT_MAX_BUFFER_BYTES;
@@ -1179,13 +2395,117 @@ const startDecodeLoop = (delayMs) => {
   scheduleNext(delayMs);
 };
 
+// Passthrough: demux and remux to fragmented MP4 here, decode in the page
+// through MSE. Returns false when the source has to be decoded in wasm.
+const startRemux = (seekTarget) => {
+  const ret = state.api.remuxStart(state.ctx, 3);
+  if (ret < 0) {
+    fallbackToDecode(`Passthrough unavailable (${ret}); decoding in wasm.`);
+    return false;
+  }
+  state.remux = {
+    initSerial: 0,
+    awaitingAccept: false,
+    ended: false,
+    ahead: 0,
+    seekTarget,
+  };
+  return true;
+};
+
+const fallbackToDecode = (reason) => {
+  postLog(reason);
+  postMessage({ type: "passthrough", active: false });
+  if (state.sourceArgs) {
+    startSource({ ...state.sourceArgs, passthrough: false });
+  }
+};
+
+const heapSlice = (ptr, size) =>
+  state.Module.HEAPU8.slice(ptr, ptr + size).buffer;
+
+const flushRemuxOutput = () => {
+  const size = state.api.remuxOutputSize(state.ctx);
+  if (size <= 0) return;
+  const buffer = heapSlice(state.api.remuxOutputPtr(state.ctx), size);
+  state.api.remuxConsume(state.ctx, size);
+  postMessage({ type: "remuxData", buffer }, [buffer]);
+};
+
+const remuxTick = (token) => {
+  const remux = state.remux;
+  if (remux.awaitingAccept || remux.ended) return;
+  if (remux.ahead > REMUX_MAX_AHEAD_SECONDS) {
+    scheduleNext(REMUX_THROTTLE_MS);
+    return;
+  }
+
+  const ret = state.api.remuxStep(state.ctx, REMUX_PACKETS_PER_TICK);
+  if (token !== state.sessionToken) return;
+  if (ret < -1) {
+    fallbackToDecode(`Remux failed (${ret}); decoding in wasm.`);
+    return;
+  }
+
+  // A new init segment means a new SourceBuffer configuration; hold media
+  // until the page has accepted the mime type.
+  const serial = state.api.remuxInitSerial(state.ctx);
+  if (serial !== remux.initSerial) {
+    remux.initSerial = serial;
+    remux.awaitingAccept = true;
+    const buffer = heapSlice(
+      state.api.remuxInitPtr(state.ctx),
+      state.api.remuxInitSize(state.ctx)
+    );
+    postMessage(
+      {
+        type: "remuxInit",
+        mime: state.api.remuxMime(state.ctx),
+        buffer,
+        seekTarget: remux.seekTarget,
+      },
+      [buffer]
+    );
+    return;
+  }
+
+  flushRemuxOutput();
+  emitStats();
+  if (ret === -1) {
+    remux.ended = true;
+    postMessage({ type: "remuxEnd" });
+    emitStats(true);
+    return;
+  }
+  if (ret === 0) {
+    state.waitingForData = true;
+    return;
+  }
+  scheduleNext(0);
+};
+
+const performRemuxSeek = (target) => {
+  stopDecodeLoop();
+  const ret = state.api.seek(state.ctx, target);
+  if (ret < 0) {
+    postLog(`Seek failed with code ${ret}.`);
+    startDecodeLoop(0);
+    return;
+  }
+  if (startRemux(target)) {
+    state.currentTime = target;
+    emitStats(true);
+    startDecodeLoop(0);
+  }
+};
+
 const performSlowSeek = (target) => {
   // For forward seeks: just fast-forward through frames (don't restart)
   // For backward seeks: must restart from beginning (MKV can't seek backward in stream)
   const needsRestart = target < state.currentTime;
 
-  if (needsRestart && !state.activeFile) {
-    postLog("Backward seek requires a local file.");
+  if (needsRestart && !state.activeFile && !state.activeUrl) {
+    postLog("Backward seek requires a local file or a URL.");
     return;
   }
 
@@ -1197,18 +2517,15 @@ const performSlowSeek = (target) => {
       : `Slow seek forward to ${target.toFixed(2)}s (fast-forwarding).`
   );
 
-  postMessage({ type: "audioClear" });
+  postAudioClear();
   state.seeking = true;
   state.seekTarget = target;
-  state.basePts = null;
-  state.baseWall = 0;
+  resetClock();
   emitStats(true);
   postStatus("Seeking...");
 
   // Disable audio during seek
-  if (state.api.setAudioEnabled && hasExport("ffmpeg_wasm_set_audio_enabled")) {
-    state.api.setAudioEnabled(state.ctx, 0);
-  }
+  muteAudioForSeek();
 
   if (!needsRestart) {
     // Forward seek: just continue decoding, the decode loop will fast-forward
@@ -1216,8 +2533,11 @@ const performSlowSeek = (target) => {
     return;
   }
 
-  // Backward seek: restart from beginning
+  // Backward seek: restart from beginning, or from the keyframe before the
+  // target when the open state can be carried over
   const file = state.activeFile;
+  const url = state.activeUrl;
+  const record = file ? captureOpenState() : null;
   const sessionToken = (state.sessionToken += 1);
   stopDecodeLoop();
 
@@ -1242,34 +2562,73 @@ const performSlowSeek = (target) => {
       state.currentTime = 0;
       state.frames = 0;
 
-      if (state.api.setFileSize && hasExport("ffmpeg_wasm_set_file_size")) {
+      if (file && state.api.setFileSize && hasExport("ffmpeg_wasm_set_file_size")) {
         state.api.setFileSize(state.ctx, file.size);
       }
-      if (
-        state.api.setAudioEnabled &&
-        hasExport("ffmpeg_wasm_set_audio_enabled")
-      ) {
-        state.api.setAudioEnabled(state.ctx, 0);
-      }
+      muteAudioForSeek();
 
-      streamFile(file);
+      if (file && !state.passthrough) {
+        enableSpill();
+      }
+      if (record) {
+        streamFileFromState(file, record, target);
+      } else if (file) {
+        streamFile(file);
+      } else {
+        streamRange(url);
+      }
       state.playing = true;
       startDecodeLoop(0);
     })
     .catch(() => {});
 };
 
+// Targets inside the packet cache replay it from the keyframe before them;
+// the input and its buffer are left alone, so this works in slow-seek mode
+const seekFromCache = (target) => {
+  if (!state.api.seekCached || !state.ctx || !state.opened || state.trick) return false;
+  if (state.api.seekCached(state.ctx, target) !== 1) return false;
+
+  stopDecodeLoop();
+  postAudioClear();
+  state.seeking = true;
+  state.seekTarget = target;
+  resetClock();
+  state.currentTime = 0;
+  state.frames = 0;
+  postStatus("Seeking...");
+  muteAudioForSeek();
+  emitStats(true);
+  startDecodeLoop(0);
+  return true;
+};
+
 const performSeek = (seconds) => {
   if (!state.seekEnabled) {
     postLog("Seek disabled for this source.");
     return;
   }
+  state.gopActive = false;
 
   const target =
     state.duration > 0
       ? Math.max(0, Math.min(seconds, state.duration))
       : Math.max(0, seconds);
 
+  if (state.remux) {
+    performRemuxSeek(target);
+    return;
+  }
+
+  if (state.manifest) {
+    performManifestSeek(target);
+    return;
+  }
+
+  if (seekFromCache(target)) {
+    return;
+  }
+
   if (state.seekSlow) {
     performSlowSeek(target);
     return;
@@ -1281,7 +2640,7 @@ const performSeek = (seconds) => {
   }
 
   stopDecodeLoop();
-  postMessage({ type: "audioClear" });
+  postAudioClear();
 
   const isBackward = target < state.currentTime;
   const ret = state.api.seek(state.ctx, target);
@@ -1299,7 +2658,7 @@ const performSeek = (seconds) => {
     // Peek at next frame to check actual position
     const peekRet = state.api.readFrame(state.ctx);
     if (peekRet === 1) {
-      const actualPts = state.api.pts(state.ctx);
+      const actualPts = framePts();
       // If we're still far ahead of target, fall back to slow seek
       if (actualPts > target + 10) {
         postLog(
@@ -1316,21 +2675,226 @@ const performSeek = (seconds) => {
   // Set seeking state so decode loop fast-forwards if FFmpeg jumped to wrong keyframe
   state.seeking = true;
   state.seekTarget = target;
-  state.basePts = null;
-  state.baseWall = 0;
+  resetClock();
   state.currentTime = 0;
   state.frames = 0;
   postStatus("Seeking...");
 
   // Disable audio during seek fast-forward
-  if (state.api.setAudioEnabled && hasExport("ffmpeg_wasm_set_audio_enabled")) {
-    state.api.setAudioEnabled(state.ctx, 0);
-  }
+  muteAudioForSeek();
+
+  emitStats(true);
+  startDecodeLoop(0);
+};
 
+// Drop what is buffered and continue from the segment containing target;
+// the decode loop fast-forwards from its first keyframe as for other seeks
+const performManifestSeek = (target) => {
+  stopDecodeLoop();
+  postAudioClear();
+  const ret = state.api.restartSegments(state.ctx);
+  if (ret < 0) {
+    postLog(`Seek failed with code ${ret}.`);
+    startDecodeLoop(0);
+    return;
+  }
+  state.manifest.seek(target);
+  state.draining = false;
+  state.seeking = true;
+  state.seekTarget = target;
+  resetClock();
+  state.currentTime = 0;
+  state.frames = 0;
+  postStatus("Seeking...");
+  muteAudioForSeek();
   emitStats(true);
+  if (!state.streamRunning) {
+    pumpManifest(state.manifest, state.streamToken);
+  }
+  wakeIngest();
   startDecodeLoop(0);
 };
 
+// Trick play: one keyframe per TRICK_INTERVAL_MS, TRICK_INTERVAL_MS * rate of
+// media time apart. The target follows the wall clock, so slow keyframes are
+// skipped rather than slowing the scan down.
+const trickTick = () => {
+  state.trickTimer = null;
+  const trick = state.trick;
+  if (!trick || !state.playing) return;
+  if (trick.reverse) {
+    reverseTick(trick);
+    return;
+  }
+
+  const now = performance.now();
+  if (!trick.pending) {
+    let target = trick.anchorPts + (trick.rate * (now - trick.anchorWall)) / 1000;
+    if (state.duration > 0) target = Math.min(target, state.duration);
+    trick.target = Math.max(0, target);
+  }
+  const ret = state.api.trickStep(state.ctx, trick.target, trick.rate > 0 ? 1 : -1);
+  if (ret === 0) {
+    trick.pending = true;
+    state.trickTimer = setTimeout(trickTick, 30);
+    return;
+  }
+  trick.pending = false;
+
+  if (ret === 1) {
+    const pts = framePts();
+    if (pts !== trick.lastPts) {
+      trick.lastPts = pts;
+      state.currentTime = pts;
+      renderFrame();
+      state.frames += 1;
+      emitStats(true);
+    }
+    if (trick.rate < 0 && trick.target <= 0) {
+      setTrickPlay(0); // Reached the start; play from there
+      return;
+    }
+    const spent = performance.now() - now;
+    state.trickTimer = setTimeout(trickTick, Math.max(0, TRICK_INTERVAL_MS - spent));
+    return;
+  }
+
+  if (ret === -1 && trick.rate < 0) {
+    setTrickPlay(0);
+    return;
+  }
+  if (ret !== -1) postLog(`Trick play failed (${ret}).`);
+  stopTrickPlay(false);
+  postMessage({ type: "trickPlay", rate: 0 });
+  if (ret === -1) {
+    state.playing = false;
+    postMessage({ type: "ended" });
+  }
+  emitStats(true);
+};
+
+// Reverse playback below TRICK_MIN_RATE: every frame, from the GOP store,
+// shown when the wall clock reaches it. A frame that comes out late is shown
+// at once, and the next request starts from the clock, which skips frames.
+const reverseTick = (trick) => {
+  const now = performance.now();
+  if (!trick.pending) {
+    const clock = Math.max(0, trick.anchorPts + (trick.rate * (now - trick.anchorWall)) / 1000);
+    const ahead = clock + 0.001;
+    trick.target = trick.lastPts === null ? ahead : Math.min(trick.lastPts, ahead);
+  }
+  const ret = state.api.gopStep(state.ctx, trick.target, -1);
+  if (ret === 0) {
+    // Still decoding the GOP (or waiting for input)
+    trick.pending = true;
+    wakeIngest();
+    state.trickTimer = setTimeout(trickTick, 0);
+    return;
+  }
+  trick.pending = false;
+
+  if (ret === 1) {
+    const pts = framePts();
+    trick.lastPts = pts;
+    const due = trick.anchorWall + ((pts - trick.anchorPts) * 1000) / trick.rate;
+    state.trickTimer = setTimeout(() => {
+      state.trickTimer = null;
+      if (state.trick !== trick) return;
+      state.currentTime = pts;
+      renderFrame();
+      state.frames += 1;
+      emitStats(true);
+      trickTick();
+    }, Math.max(0, due - performance.now()));
+    return;
+  }
+
+  if (ret === -1) {
+    setTrickPlay(0); // Reached the first frame; play from there
+    return;
+  }
+  postLog(`Reverse playback failed (${ret}).`);
+  stopTrickPlay(false);
+  postMessage({ type: "trickPlay", rate: 0 });
+  emitStats(true);
+};
+
+const stopTrickPlay = (resume) => {
+  clearTimeout(state.trickTimer);
+  state.trickTimer = null;
+  const trick = state.trick;
+  if (!trick) return;
+  state.trick = null;
+  if (state.ctx && state.api.setTrickPlay && !trick.reverse) state.api.setTrickPlay(state.ctx, 0);
+  if (resume) performSeek(state.currentTime);
+};
+
+// Step-back and reverse decode from keyframes into the C-side frame store.
+// Audio stays off, and the decoder is left mid-GOP, so playing on seeks first.
+const enterGopMode = (maxHeight) => {
+  state.api.setGopCache(state.ctx, GOP_CACHE_BYTES, maxHeight);
+  if (!state.gopActive) postAudioClear();
+  state.gopActive = true;
+  muteAudioForSeek();
+  state.seeking = false;
+  state.seekTarget = null;
+};
+
+const setTrickPlay = (rate) => {
+  const reverse = rate < 0 && -rate < TRICK_MIN_RATE;
+  if (Math.abs(rate) < TRICK_MIN_RATE && !reverse) {
+    if (state.trick) {
+      stopTrickPlay(true);
+      postStatus(state.playing ? "Playing" : "Paused");
+    }
+    postMessage({ type: "trickPlay", rate: 0 });
+    return;
+  }
+  if (
+    !state.opened ||
+    state.remux ||
+    state.audioOnly ||
+    !state.seekEnabled ||
+    state.seekSlow ||
+    state.manifest ||
+    !(reverse ? state.api.gopStep : state.api.trickStep)
+  ) {
+    postLog("Trick play needs a seekable video source.");
+    postMessage({ type: "trickPlay", rate: 0 });
+    return;
+  }
+  if (state.trick && state.trick.reverse !== reverse) {
+    stopTrickPlay(false);
+  }
+  if (!state.trick) {
+    stopDecodeLoop();
+    if (reverse) {
+      enterGopMode(REVERSE_MAX_HEIGHT);
+    } else if (state.api.setTrickPlay(state.ctx, 1) < 0) {
+      postMessage({ type: "trickPlay", rate: 0 });
+      return;
+    } else {
+      postAudioClear();
+      state.seeking = false;
+      state.seekTarget = null;
+    }
+  }
+  clearTimeout(state.trickTimer);
+  state.trick = {
+    rate,
+    reverse,
+    anchorPts: state.currentTime,
+    anchorWall: performance.now(),
+    target: state.currentTime,
+    pending: false,
+    lastPts: null,
+  };
+  state.playing = true;
+  postStatus(reverse ? `Reverse ${-rate}x` : `Scanning ${rate}x`);
+  postMessage({ type: "trickPlay", rate });
+  trickTick();
+};
+
 const setRenderMode = (mode) => {
   state.renderMode = mode === "webgl" ? "webgl" : "2d";
   if (state.renderMode === "2d") {
@@ -1399,10 +2963,39 @@ const startSource = async ({
   videoStreamIndex,
   audioStreamIndex,
   subtitleStreamIndex,
+  passthrough,
+  latencyTarget,
 }) => {
   await resetPlayback();
 
+  state.sourceArgs = {
+    file,
+    url,
+    formatHint,
+    bufferBytes,
+    videoStreamIndex,
+    audioStreamIndex,
+    subtitleStreamIndex,
+  };
   state.formatHint = typeof formatHint === "string" ? formatHint.trim() : "";
+  const manifest = Boolean(
+    url && !file && state.api && state.api.restartSegments && isManifestUrl(url, state.formatHint)
+  );
+  if (manifest) {
+    state.formatHint = ""; // hls/dash name the playlist, not the segments
+  }
+  const live = Boolean(url && !file && state.api && state.api.setLive && /^wss?:\/\//i.test(url));
+  state.live = live
+    ? { target: Number(latencyTarget) > 0 ? Number(latencyTarget) : LIVE_LATENCY_TARGET }
+    : null;
+  if (live && !state.formatHint) {
+    state.formatHint = "mpegts";
+  }
+  postMessage({ type: "live", target: state.live ? state.live.target : 0 });
+  // Variant switches reopen the demuxer under the decoders, and live input
+  // plays as it arrives; neither goes through passthrough
+  state.passthrough = Boolean(passthrough && state.api.setRemuxOnly && !manifest && !live);
+
   state.maxBufferBytes = DEFAULT_MAX_BUFFER_BYTES;
   state.headerSample = null;
   state.lastOpenErrorLogged = null;
@@ -1422,7 +3015,14 @@ const startSource = async ({
 
   state.seekEnabled = Boolean(file);
   state.seekSlow = false; // Always try fast seek first; will fallback if it fails
-  if (state.seekEnabled) {
+  if (live) {
+    postMessage({
+      type: "seekInfo",
+      enabled: false,
+      slow: false,
+      reason: "Seek disabled for live streams.",
+    });
+  } else if (state.seekEnabled) {
     postMessage({
       type: "seekInfo",
       enabled: true,
@@ -1440,12 +3040,18 @@ const startSource = async ({
 
   ensureDecoder(bufferBytes);
   if (!state.ctx) return;
+  if (state.passthrough) {
+    state.api.setRemuxOnly(state.ctx, 1);
+  }
+  if (live) {
+    state.api.setLive(state.ctx, state.live.target);
+  }
 
   // keep_all is now managed by C code:
   // - Set to 1 at create (prevents buffer compaction during open)
   // - Set to 0 after successful open (allows normal compaction during playback)
   if (state.api.setBufferLimit && hasExport("ffmpeg_wasm_set_buffer_limit")) {
-    state.api.setBufferLimit(state.ctx, BUFFER_LIMIT_BYTES);
+    state.api.setBufferLimit(state.ctx, bufferLimitBytes());
   }
   if (file && state.api.setFileSize && hasExport("ffmpeg_wasm_set_file_size")) {
     state.api.setFileSize(state.ctx, file.size);
@@ -1457,9 +3063,24 @@ const startSource = async ({
   emitStats(true);
 
   if (file) {
-    streamFile(file);
+    const session = state.sessionToken;
+    if (!state.passthrough) {
+      enableSpill();
+    }
+    const { key, record } = await loadOpenState(file);
+    if (session !== state.sessionToken) return;
+    state.openStateKey = key;
+    if (record && !state.passthrough && state.api.setOpenState) {
+      streamFileFromState(file, record, record.position || 0);
+    } else {
+      streamFile(file);
+    }
+  } else if (manifest) {
+    streamManifest(url);
+  } else if (live) {
+    streamWebSocket(url);
   } else if (url) {
-    streamUrl(url);
+    streamRange(url);
   } else {
     postLog("Choose a file or enter a URL.");
     state.playing = false;
@@ -1469,24 +3090,350 @@ const startSource = async ({
   startDecodeLoop(0);
 };
 
-const initModule = async () => {
+// Clip export runs on its own demux-only context fed from the active file, so
+// playback keeps its position. Bytes before the clip are demuxed and dropped,
+// never decoded; reading stops as soon as the clip end is reached.
+const exportClip = async ({ start, end, container, trimAudio }) => {
+  const api = state.api;
+  const file = state.activeFile;
+  if (!file || !api.exportClip || !api.setRemuxOnly) {
+    postMessage({
+      type: "exportError",
+      message: file ? "Export API not available; rebuild wasm." : "Clip export needs a local file.",
+    });
+    return;
+  }
+  if (state.exportJob) {
+    postMessage({ type: "exportError", message: "An export is already running." });
+    return;
+  }
+
+  const ctx = api.create(4 * 1024 * 1024);
+  if (!ctx) {
+    postMessage({ type: "exportError", message: "Failed to create export context." });
+    return;
+  }
+  const job = { ctx, cancelled: false };
+  state.exportJob = job;
+  api.setRemuxOnly(ctx, 1);
+  api.setFileSize(ctx, file.size);
+  api.setBufferLimit(ctx, bufferLimitBytes());
+  if (api.setMemoryBudget) api.setMemoryBudget(ctx, EXPORT_MEMORY_BUDGET_BYTES);
+  const videoStream = api.selectedVideoStream ? api.selectedVideoStream(state.ctx) : -1;
+  const audioStream = api.selectedAudioStream ? api.selectedAudioStream(state.ctx) : -1;
+  const flags = 1 | 2 | (trimAudio ? 4 : 0);
+
+  const reader = file.stream().getReader();
+  let appended = 0;
+  let eof = false;
+  let started = false;
+  let lastProgress = 0;
   try {
-    importScripts("ffmpeg_wasm.js");
+    while (!job.cancelled) {
+      if (started) {
+        const ret = api.exportStep(ctx, EXPORT_PACKETS_PER_STEP);
+        if (ret === -1) break;
+        if (ret < -1) throw new Error(`Export failed (${ret}).`);
+        const now = performance.now();
+        if (now - lastProgress > 200) {
+          lastProgress = now;
+          postMessage({ type: "exportProgress", progress: api.exportProgress(ctx), bytesRead: appended });
+        }
+        if (ret > 0) continue;
+        if (eof) throw new Error("Export stalled at end of file.");
+      }
+
+      const { value, done } = await reader.read();
+      if (done) {
+        api.setEof(ctx);
+        eof = true;
+      } else {
+        for (let offset = 0; offset < value.length; offset += MAX_CHUNK_BYTES) {
+          const slice = value.subarray(offset, offset + MAX_CHUNK_BYTES);
+          const ptr = state.Module._malloc(slice.length);
+          state.Module.HEAPU8.set(slice, ptr);
+          api.append(ctx, ptr, slice.length);
+          state.Module._free(ptr);
+        }
+        appended += value.length;
+      }
+
+      if (!started && (appended >= MIN_OPEN_BYTES || eof)) {
+        const openRet = api.open(ctx, state.formatHint || null);
+        if (openRet === 0) {
+          api.selectStreams(ctx, videoStream, audioStream >= 0 ? audioStream : -2);
+          const ret = api.exportClip(ctx, start, end, container || "mp4", flags);
+          if (ret < 0) throw new Error(`Export setup failed (${ret}).`);
+          started = true;
+        } else if (eof) {
+          throw new Error(`Export open failed (${openRet}).`);
+        }
+      }
+    }
+
+    if (!job.cancelled) {
+      const parts = [];
+      const count = api.exportChunkCount(ctx);
+      for (let i = 0; i < count; i += 1) {
+        const ptr = api.exportChunkPtr(ctx, i);
+        parts.push(state.Module.HEAPU8.slice(ptr, ptr + api.exportChunkSize(ctx, i)));
+      }
+      const mime = container === "matroska" ? "video/x-matroska" : "video/mp4";
+      const blob = new Blob(parts, { type: mime });
+      postMessage({ type: "exportDone", blob, bytesRead: appended });
+    }
   } catch (err) {
-    postLog(`Failed to load ffmpeg_wasm.js: ${err.message}`);
-    postStatus("Missing ffmpeg_wasm.js");
+    postMessage({ type: "exportError", message: err.message });
+  } finally {
+    reader.cancel().catch(() => {});
+    api.exportStop(ctx);
+    api.destroy(ctx);
+    state.exportJob = null;
+  }
+};
+
+const postPeaks = (job, done) => {
+  const { api } = state;
+  const filled = api.peaksFilled(job.ctx);
+  const ptr = api.peaksPtr(job.ctx);
+  const data = ptr
+    ? new Float32Array(state.Module.HEAPF32.buffer, ptr, filled * 3).slice()
+    : new Float32Array(0);
+  postMessage(
+    {
+      type: "peaks",
+      buckets: job.buckets,
+      filled,
+      duration: api.peaksDuration(job.ctx),
+      data: data.buffer,
+      done,
+    },
+    [data.buffer]
+  );
+};
+
+// Waveform for the scrub bar on its own audio-only demux context; only the
+// min/max/rms bucket array crosses postMessage, refreshed as bytes arrive.
+const computePeaks = async ({ buckets }) => {
+  const api = state.api;
+  const file = state.activeFile;
+  if (!file || !api.computePeaks || !api.setRemuxOnly) {
+    postMessage({
+      type: "peaksError",
+      message: file ? "Peaks API not available; rebuild wasm." : "Waveform needs a local file.",
+    });
     return;
   }
+  if (state.peakJob) state.peakJob.cancelled = true;
 
-  if (typeof FFmpegWasm !== "function") {
-    postLog("FFmpegWasm factory not found.");
-    postStatus("Missing FFmpegWasm");
+  const ctx = api.create(4 * 1024 * 1024);
+  if (!ctx) {
+    postMessage({ type: "peaksError", message: "Failed to create peaks context." });
     return;
   }
+  const job = { ctx, buckets: Math.max(1, buckets | 0), cancelled: false };
+  state.peakJob = job;
+  api.setRemuxOnly(ctx, 1);
+  api.setFileSize(ctx, file.size);
+  api.setBufferLimit(ctx, bufferLimitBytes());
+  if (api.setMemoryBudget) api.setMemoryBudget(ctx, EXPORT_MEMORY_BUDGET_BYTES);
+  const audioStream = api.selectedAudioStream ? api.selectedAudioStream(state.ctx) : -1;
+
+  const reader = file.stream().getReader();
+  let appended = 0;
+  let eof = false;
+  let started = false;
+  let lastPost = 0;
+  try {
+    while (!job.cancelled) {
+      if (started) {
+        const sliceStart = performance.now();
+        let ret = 0;
+        do {
+          ret = api.peaksStep(ctx, PEAKS_PACKETS_PER_STEP);
+        } while (ret > 0 && performance.now() - sliceStart < PEAKS_SLICE_MS);
+        if (ret === -1) break;
+        if (ret < -1) throw new Error(`Peaks failed (${ret}).`);
+        const now = performance.now();
+        if (now - lastPost > PEAKS_POST_MS) {
+          lastPost = now;
+          postPeaks(job, false);
+        }
+        if (ret > 0) {
+          await sleep(0);
+          continue;
+        }
+        if (eof) throw new Error("Peaks stalled at end of file.");
+      }
 
-  postStatus("Loading FFmpeg module...");
+      const { value, done } = await reader.read();
+      if (job.cancelled) break;
+      if (done) {
+        api.setEof(ctx);
+        eof = true;
+      } else {
+        for (let offset = 0; offset < value.length; offset += MAX_CHUNK_BYTES) {
+          const slice = value.subarray(offset, offset + MAX_CHUNK_BYTES);
+          const ptr = state.Module._malloc(slice.length);
+          state.Module.HEAPU8.set(slice, ptr);
+          api.append(ctx, ptr, slice.length);
+          state.Module._free(ptr);
+        }
+        appended += value.length;
+      }
 
-  // Start loading font
+      if (!started && (appended >= MIN_OPEN_BYTES || eof)) {
+        const openRet = api.open(ctx, state.formatHint || null);
+        if (openRet === 0) {
+          if (audioStream >= 0) api.selectStreams(ctx, -1, audioStream);
+          let ret = api.computePeaks(ctx, job.buckets, state.duration || 0);
+          if (ret === NEED_MODULE && api.missingModules) {
+            await loadSideModules(api.missingModules(ctx).split(",").filter(Boolean));
+            ret = api.computePeaks(ctx, job.buckets, state.duration || 0);
+          }
+          if (ret < 0) throw new Error(`Peaks setup failed (${ret}).`);
+          started = true;
+        } else if (eof) {
+          throw new Error(`Peaks open failed (${openRet}).`);
+        }
+      }
+    }
+    if (!job.cancelled) postPeaks(job, true);
+  } catch (err) {
+    if (!job.cancelled) postMessage({ type: "peaksError", message: err.message });
+  } finally {
+    reader.cancel().catch(() => {});
+    api.peaksStop(ctx);
+    api.destroy(ctx);
+    if (state.peakJob === job) state.peakJob = null;
+  }
+};
+
+const cancelPreload = () => {
+  const job = state.preload;
+  state.preload = null;
+  if (job) {
+    job.cancelled = true;
+    if (job.ctx) state.api.destroy(job.ctx);
+  }
+};
+
+// Gapless playlist: the next local file opens in its own context while the
+// current one plays, reusing its decoders when the parameters match, and its
+// first frames are decoded ahead. decodeTick hands over at end of stream;
+// reading resumes where the preload stopped.
+const preloadNext = async ({ file }) => {
+  cancelPreload();
+  const api = state.api;
+  if (!file || !api.preload || !api.handoff) return;
+  const job = { ctx: 0, file, appended: 0, eof: false, opened: false, ready: false, cancelled: false };
+  state.preload = job;
+  // Decoders are matched against the current item's, so it has to be open
+  while (!state.opened && !job.cancelled) {
+    await sleep(PRELOAD_WAIT_MS * 5);
+  }
+  if (job.cancelled) return;
+  if (state.passthrough || state.live || !state.activeFile) {
+    postLog(`Gapless preload needs local files; ${file.name} will open normally.`);
+    state.preload = null;
+    return;
+  }
+
+  const ctx = api.create(4 * 1024 * 1024);
+  if (!ctx) {
+    state.preload = null;
+    return;
+  }
+  job.ctx = ctx;
+  api.setFileSize(ctx, file.size);
+  api.setBufferLimit(ctx, bufferLimitBytes());
+
+  const reader = file.stream().getReader();
+  try {
+    while (!job.ready) {
+      const { value, done } = await reader.read();
+      if (job.cancelled) return;
+      if (done) {
+        api.setEof(ctx);
+        job.eof = true;
+      } else {
+        for (let offset = 0; offset < value.length; offset += MAX_CHUNK_BYTES) {
+          const slice = value.subarray(offset, offset + MAX_CHUNK_BYTES);
+          const ptr = state.Module._malloc(slice.length);
+          state.Module.HEAPU8.set(slice, ptr);
+          api.append(ctx, ptr, slice.length);
+          state.Module._free(ptr);
+        }
+        job.appended += value.length;
+      }
+      if (job.appended < Math.min(MIN_OPEN_BYTES, file.size) && !job.eof) continue;
+
+      let ret = api.preload(ctx, state.ctx, PRELOAD_AUDIO_SECONDS);
+      if (ret === NEED_MODULE && api.missingModules) {
+        await loadSideModules(api.missingModules(ctx).split(",").filter(Boolean));
+        if (job.cancelled) return;
+        ret = api.preload(ctx, state.ctx, PRELOAD_AUDIO_SECONDS);
+      }
+      if (ret === 1) {
+        job.ready = true;
+      } else if (ret === 0) {
+        job.opened = true;
+      } else if (job.opened || job.eof) {
+        throw new Error(`Preload failed (${ret}).`);
+      }
+    }
+    postLog(`Next item ready: ${file.name} (${job.appended} bytes read ahead).`);
+  } catch (err) {
+    postLog(`${file.name}: ${err.message} It will open normally.`);
+    if (state.preload === job) cancelPreload();
+  } finally {
+    reader.cancel().catch(() => {});
+  }
+};
+
+// The preloaded item becomes the playing one. Audio already queued from the
+// previous item keeps playing; the epoch bump only retires its clock reports.
+const handoffPreload = () => {
+  const job = state.preload;
+  state.preload = null;
+  persistOpenState();
+  const ret = state.api.handoff(job.ctx, state.ctx);
+  if (ret < 0) {
+    postLog(`Gapless handoff failed (${ret}).`);
+    state.api.destroy(job.ctx);
+    return false;
+  }
+  stopStream();
+  state.api.destroy(state.ctx);
+  state.ctx = job.ctx;
+  attachFrameDesc();
+  state.activeFile = job.file;
+  state.sourceArgs = { ...state.sourceArgs, file: job.file };
+  state.openStateKey = "";
+  state.bytes = job.appended;
+  state.draining = job.eof;
+  state.waitingForData = false;
+  state.heldFrame = false;
+  state.headerSample = null;
+  state.toneMappedLogged = false;
+  state.currentTime = 0;
+  state.duration = state.api.duration ? Math.max(0, state.api.duration(state.ctx)) : 0;
+  state.audioEpoch += 1;
+  applyMemoryBudget();
+  applyPacketCache();
+  applyDeinterlace();
+  updateAudioOnly();
+  if (!job.eof) {
+    streamFile(job.file, job.appended);
+  }
+  enableSpill();
+  postMessage({ type: "playlistAdvance", name: job.file.name });
+  emitStreams();
+  emitStats(true);
+  return true;
+};
+
+const loadDefaultFont = () =>
   fetch("Inter-Regular.ttf")
     .then((resp) => {
       if (resp.ok) return resp.arrayBuffer();
@@ -1502,10 +3449,52 @@ const initModule = async () => {
       postLog(`Failed to load default font: ${e.message}`);
     });
 
+const initModule = async (sharedWasm) => {
+  try {
+    importScripts(
+      "wasm-module-cache.js",
+      "manifest-source.js",
+      "open-state-cache.js",
+      "spill-store.js",
+      "ffmpeg_wasm.js"
+    );
+  } catch (err) {
+    postLog(`Failed to load ffmpeg_wasm.js: ${err.message}`);
+    postStatus("Missing ffmpeg_wasm.js");
+    return;
+  }
+
+  if (typeof FFmpegWasm !== "function") {
+    postLog("FFmpegWasm factory not found.");
+    postStatus("Missing FFmpegWasm");
+    return;
+  }
+
+  postStatus("Loading FFmpeg module...");
+
+  // Compile while streaming (or reuse a cached/shared module); Emscripten's
+  // own loader stays the fallback.
+  let compiled = null;
+  try {
+    compiled = await loadWasmModule({
+      wasmUrl: "ffmpeg_wasm.wasm",
+      shared: sharedWasm,
+    });
+  } catch (err) {
+    postLog(`Wasm precompile failed (${err.message}); using the default loader.`);
+  }
+
   try {
     state.Module = await FFmpegWasm({
       print: (text) => postLog(text),
       printErr: (text) => postLog(text),
+      ...(compiled
+        ? {
+            instantiateWasm: instantiateFromModule(compiled.module, (err) =>
+              postLog(`Wasm instantiate failed: ${err.message}`)
+            ),
+          }
+        : {}),
     });
   } catch (err) {
     postLog(`Module load failed: ${err.message}`);
@@ -1514,8 +3503,36 @@ const initModule = async () => {
   }
 
   state.api = createApi(state.Module);
+  clearStaleSpill();
+  // performance.now() starts with the worker, so this is cold/warm time to ready
+  const startupMs = Math.round(performance.now());
+  const wasmSource = compiled ? compiled.source : "default";
+  const split = hasExport("ffmpeg_wasm_is_split_build") && state.Module._ffmpeg_wasm_is_split_build();
+  state.memory64 = hasExport("ffmpeg_wasm_is_memory64") && state.Module._ffmpeg_wasm_is_memory64() === 1;
+  if (state.memory64 && state.memoryBudgetBytes === DEFAULT_MEMORY_BUDGET_BYTES) {
+    state.memoryBudgetBytes = DEFAULT_MEMORY_BUDGET_BYTES_64;
+  }
+  postLog(
+    `FFmpeg module ready ${startupMs} ms after worker start (wasm: ${wasmSource})${
+      split ? "; split build, codecs load on demand" : ""
+    }${state.memory64 ? "; 64-bit memory" : ""}`
+  );
+  // Builds with the font compiled in skip the fetch and the per-context copy;
+  // prewarm builds the shared libass library and a spare renderer up front
+  // (split builds do that once subtitles.wasm is loaded).
+  if (state.api.hasDefaultFont && state.api.hasDefaultFont()) {
+    postLog("Default font (Inter) is embedded in the module.");
+  } else {
+    loadDefaultFont();
+  }
+  if (state.api.prewarm && !split) {
+    state.api.prewarm();
+  }
+  if (compiled && compiled.source !== "shared") {
+    postMessage({ type: "wasmModule", module: compiled.module, buildId: compiled.buildId });
+  }
   postStatus("Ready");
-  postMessage({ type: "ready" });
+  postMessage({ type: "ready", startupMs, wasmSource });
   postLog("Module ready.");
 };
 
@@ -1539,7 +3556,7 @@ onmessage = (event) => {
       state.ctx2d = state.canvas2d.getContext("2d", { alpha: false });
     }
     setRenderMode(msg.renderMode);
-    initModule();
+    initModule(msg.wasmModule ? { module: msg.wasmModule, buildId: msg.wasmBuildId || "" } : null);
     return;
   }
 
@@ -1548,19 +3565,47 @@ onmessage = (event) => {
   }
 
   if (msg.type === "load") {
+    if (state.peakJob) state.peakJob.cancelled = true;
     startSource(msg);
   } else if (msg.type === "play") {
+    stopTrickPlay(true);
+    if (state.gopActive) performSeek(state.currentTime);
     state.playing = true;
+    if (state.ctx && state.api.clockSetPaused) {
+      state.api.clockSetPaused(state.ctx, 0, wallSeconds());
+    } else {
+      // The old anchor predates the pause; keeping it races to catch up
+      state.basePts = null;
+    }
     postStatus("Playing");
     startDecodeLoop(0);
   } else if (msg.type === "pause") {
+    persistOpenState();
     state.playing = false;
+    stopTrickPlay(true);
     stopDecodeLoop();
+    if (state.ctx && state.api.clockSetPaused) {
+      state.api.clockSetPaused(state.ctx, 1, wallSeconds());
+    }
     postStatus("Paused");
   } else if (msg.type === "stop") {
+    if (state.peakJob) state.peakJob.cancelled = true;
     resetPlayback();
   } else if (msg.type === "seek") {
-    performSeek(Number(msg.seconds) || 0);
+    if (state.trick) {
+      // Keep scanning from the new position
+      state.trick.anchorPts = Math.max(0, Number(msg.seconds) || 0);
+      state.trick.anchorWall = performance.now();
+      state.trick.pending = false;
+      state.trick.lastPts = null;
+    } else {
+      performSeek(Number(msg.seconds) || 0);
+    }
+  } else if (msg.type === "trickPlay") {
+    setTrickPlay(Number(msg.rate) || 0);
+  } else if (msg.type === "setDeinterlace") {
+    state.deinterlace = msg.filter === "yadif" || msg.filter === "bwdif" ? msg.filter : "";
+    applyDeinterlace();
   } else if (msg.type === "renderMode") {
     setRenderMode(msg.mode);
   } else if (msg.type === "selectStreams") {
@@ -1583,18 +3628,47 @@ onmessage = (event) => {
       videoStreamIndex,
       audioStreamIndex
     );
+    if (retryWithModules(ret, state.ctx, () => onmessage({ data: msg }))) {
+      return;
+    }
     if (ret < 0) {
       postLog(`Track selection failed (${ret}).`);
       return;
     }
-    postMessage({ type: "audioClear" });
-    state.basePts = null;
-    state.baseWall = 0;
+    updateAudioOnly();
+    postAudioClear();
+    resetClock();
     emitStreams();
+    if (state.remux) {
+      performRemuxSeek(state.currentTime);
+    }
+  } else if (msg.type === "exportClip") {
+    exportClip(msg);
+  } else if (msg.type === "preload") {
+    preloadNext(msg);
+  } else if (msg.type === "computePeaks") {
+    computePeaks(msg);
+  } else if (msg.type === "cancelExport") {
+    if (state.exportJob) state.exportJob.cancelled = true;
+  } else if (msg.type === "remuxAccept") {
+    if (state.remux) {
+      state.remux.awaitingAccept = false;
+      startDecodeLoop(0);
+    }
+  } else if (msg.type === "remuxReject") {
+    if (state.remux) {
+      fallbackToDecode(`MSE cannot play ${msg.mime}; decoding in wasm.`);
+    }
+  } else if (msg.type === "remuxBuffered") {
+    if (state.remux) {
+      state.remux.ahead = Number(msg.ahead) || 0;
+      state.currentTime = Number(msg.currentTime) || 0;
+    }
   } else if (msg.type === "screenshot") {
     // Capture current frame as screenshot
     takeScreenshot();
   } else if (msg.type === "setSpeed") {
+    stopTrickPlay(true);
     // Set playback speed
     const speed = Number(msg.speed) || 1.0;
     state.playbackSpeed = Math.max(0.25, Math.min(2.0, speed));
@@ -1603,7 +3677,20 @@ onmessage = (event) => {
       state.baseWall = performance.now() / 1000;
       state.basePts = state.currentTime;
     }
+    if (state.ctx && state.api.clockSetSpeed) {
+      state.api.clockSetSpeed(state.ctx, state.playbackSpeed, wallSeconds());
+    }
     postLog(`Playback speed set to ${state.playbackSpeed}x`);
+  } else if (msg.type === "audioClock") {
+    // Worklet playback position; reports from before the last clear are stale
+    if (
+      msg.epoch === state.audioEpoch &&
+      state.ctx &&
+      !state.seeking &&
+      state.api.clockAudioPosition
+    ) {
+      state.api.clockAudioPosition(state.ctx, Number(msg.pts), Number(msg.wall));
+    }
   } else if (msg.type === "frameStep") {
     // Step one frame forward or backward
     frameStep(msg.direction || 1);
@@ -1624,6 +3711,9 @@ onmessage = (event) => {
       return;
     }
     const ret = state.api.selectSubtitleStream(state.ctx, subtitleStreamIndex);
+    if (retryWithModules(ret, state.ctx, () => onmessage({ data: msg }))) {
+      return;
+    }
     if (ret < 0) {
       postLog(`Subtitle track selection failed (${ret}).`);
       return;
@@ -1656,6 +3746,16 @@ onmessage = (event) => {
           : `set to ${subtitleStreamIndex}`
       }`
     );
+  } else if (msg.type === "setMemoryBudget") {
+    const bytes = Number(msg.bytes);
+    state.memoryBudgetBytes = Number.isFinite(bytes) && bytes > 0 ? bytes : 0;
+    applyMemoryBudget();
+    postLog(
+      state.memoryBudgetBytes > 0
+        ? `Memory budget set to ${(state.memoryBudgetBytes / 1048576).toFixed(0)} MB`
+        : "Memory budget disabled"
+    );
+    emitStats(true);
   } else if (msg.type === "setSubtitleDelay") {
     // Set subtitle delay
     state.subtitleDelay = Number(msg.delay) || 0;
@@ -1734,15 +3834,38 @@ const frameStep = (direction) => {
     return;
   }
 
+  if (state.gopStepTimer) return;
+
   // Pause playback
   state.playing = false;
   stopDecodeLoop();
+  stopTrickPlay(false);
+
+  if (state.gopActive && state.api.gopStep) {
+    enterGopMode(0); // Full size again after reverse playback's smaller copies
+    gopFrameStep(direction, state.sessionToken);
+    return;
+  }
+
+  if (
+    direction < 0 &&
+    state.api.gopStep &&
+    state.seekEnabled &&
+    !state.seekSlow &&
+    !state.audioOnly &&
+    !state.remux &&
+    !state.manifest
+  ) {
+    enterGopMode(0);
+    gopFrameStep(direction, state.sessionToken);
+    return;
+  }
 
   if (direction > 0) {
     // Step forward: decode next frame
     const result = state.api.readFrame(state.ctx);
     if (result === 1) {
-      const pts = state.api.pts(state.ctx);
+      const pts = framePts();
       state.currentTime = pts;
       renderFrame();
       state.frames += 1;
@@ -1755,10 +3878,32 @@ const frameStep = (direction) => {
       postLog("No more frames available");
     }
   } else {
-    // Step backward: seek to previous keyframe (limited support)
-    // This is complex with streaming - would need to seek backward
-    postLog("Backward frame step not supported in streaming mode");
+    postLog("Backward frame step needs a seekable video source.");
   }
 
   postStatus("Paused");
 };
+
+// One frame either way through the GOP store; 0 means the GOP before is
+// still decoding, so try again shortly
+const gopFrameStep = (direction, token) => {
+  state.gopStepTimer = null;
+  if (token !== state.sessionToken || !state.ctx) return;
+  const ret = state.api.gopStep(state.ctx, state.currentTime, direction);
+  if (ret === 0) {
+    wakeIngest();
+    state.gopStepTimer = setTimeout(() => gopFrameStep(direction, token), 0);
+    return;
+  }
+  if (ret === 1) {
+    state.currentTime = framePts();
+    renderFrame();
+    state.frames += 1;
+    emitStats(true);
+  } else if (ret === -1) {
+    postLog(direction > 0 ? "No more frames available" : "At the first frame");
+  } else {
+    postLog(`Frame step failed (${ret}).`);
+  }
+  postStatus("Paused");
+};
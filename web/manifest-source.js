@@ -0,0 +1,645 @@
+// HLS / DASH source for the decode worker (importScripts). Playlists and MPDs
+// are parsed here and segments fetched in order into the worker's append
+// callbacks, init segment first. A variant switch (or an HLS discontinuity)
+// marks a segment boundary, where the C side reopens its demuxer while the
+// decoders stay open. A separate audio rendition goes to the audio input.
+
+const MANIFEST_SWITCH_UP = 0.75; // Pick variants up to this share of the measured bandwidth
+const MANIFEST_BANDWIDTH_WEIGHT = 0.3; // EWMA weight of the latest segment's throughput
+const MANIFEST_MIN_SAMPLE_BYTES = 64 * 1024; // Smaller fetches measure latency, not bandwidth
+const MANIFEST_LIVE_EDGE_SEGMENTS = 3; // Live: start this many segments from the end
+
+const isManifestUrl = (url, formatHint = "") => {
+  const hint = formatHint.toLowerCase();
+  if (hint === "hls" || hint === "dash") return true;
+  const path = String(url).split(/[?#]/)[0].toLowerCase();
+  return path.endsWith(".m3u8") || path.endsWith(".mpd");
+};
+
+const resolveUrl = (ref, base) => new URL(ref, base).href;
+
+// --- HLS -------------------------------------------------------------------
+
+const parseAttributeList = (text) => {
+  const attrs = {};
+  const re = /([A-Z0-9-]+)=("[^"]*"|[^,]*)/g;
+  let match;
+  while ((match = re.exec(text))) {
+    const value = match[2];
+    attrs[match[1]] = value.startsWith('"') ? value.slice(1, -1) : value;
+  }
+  return attrs;
+};
+
+// "length[@offset]"; without an offset the range follows the previous one
+const parseByteRange = (text, previousEnd) => {
+  const [length, offset] = text.split("@").map(Number);
+  const start = Number.isFinite(offset) ? offset : previousEnd;
+  return { start, end: start + length };
+};
+
+const parseHlsMedia = (lines, url) => {
+  const segments = [];
+  let sequence = 0;
+  let targetDuration = 0;
+  let endList = false;
+  let init = null;
+  let duration = 0;
+  let range = null;
+  let rangeEnd = 0;
+  let discontinuity = false;
+  let start = 0;
+  for (const line of lines) {
+    if (line.startsWith("#EXT-X-MEDIA-SEQUENCE:")) {
+      sequence = Number(line.slice(22)) || 0;
+    } else if (line.startsWith("#EXT-X-TARGETDURATION:")) {
+      targetDuration = Number(line.slice(22)) || 0;
+    } else if (line === "#EXT-X-ENDLIST") {
+      endList = true;
+    } else if (line === "#EXT-X-DISCONTINUITY") {
+      discontinuity = true;
+    } else if (line.startsWith("#EXT-X-MAP:")) {
+      const attrs = parseAttributeList(line.slice(11));
+      init = {
+        url: resolveUrl(attrs.URI, url),
+        range: attrs.BYTERANGE ? parseByteRange(attrs.BYTERANGE, 0) : null,
+      };
+    } else if (line.startsWith("#EXT-X-KEY:")) {
+      const attrs = parseAttributeList(line.slice(11));
+      if (attrs.METHOD && attrs.METHOD !== "NONE") {
+        throw new Error(`Encrypted HLS (${attrs.METHOD}) is not supported`);
+      }
+    } else if (line.startsWith("#EXTINF:")) {
+      duration = parseFloat(line.slice(8)) || 0;
+    } else if (line.startsWith("#EXT-X-BYTERANGE:")) {
+      range = parseByteRange(line.slice(17), rangeEnd);
+    } else if (!line.startsWith("#")) {
+      segments.push({
+        seq: sequence + segments.length,
+        url: resolveUrl(line, url),
+        range,
+        start,
+        duration,
+        init,
+        discontinuity,
+      });
+      start += duration;
+      if (range) rangeEnd = range.end;
+      range = null;
+      discontinuity = false;
+    }
+  }
+  return { segments, endList, targetDuration, duration: start, loadedAt: performance.now() };
+};
+
+// Master playlist: variants sorted by bandwidth, plus the default audio
+// rendition of their audio group when it has its own URI
+const parseHlsMaster = (lines, url) => {
+  const variants = [];
+  const audioGroups = new Map();
+  for (let i = 0; i < lines.length; i += 1) {
+    const line = lines[i];
+    if (line.startsWith("#EXT-X-STREAM-INF:")) {
+      const attrs = parseAttributeList(line.slice(18));
+      const uri = lines.slice(i + 1).find((next) => !next.startsWith("#"));
+      if (!uri) continue;
+      const bandwidth = Number(attrs["AVERAGE-BANDWIDTH"] || attrs.BANDWIDTH) || 0;
+      variants.push({
+        url: resolveUrl(uri, url),
+        bandwidth,
+        label: attrs.RESOLUTION || `${Math.round(bandwidth / 1000)} kbit/s`,
+        audioGroup: attrs.AUDIO || null,
+        playlist: null,
+      });
+    } else if (line.startsWith("#EXT-X-MEDIA:")) {
+      const attrs = parseAttributeList(line.slice(13));
+      if (attrs.TYPE !== "AUDIO" || !attrs.URI) continue;
+      const group = audioGroups.get(attrs["GROUP-ID"]) || [];
+      group.push({
+        url: resolveUrl(attrs.URI, url),
+        bandwidth: 0,
+        label: attrs.NAME || attrs.LANGUAGE || "audio",
+        isDefault: attrs.DEFAULT === "YES",
+        playlist: null,
+      });
+      audioGroups.set(attrs["GROUP-ID"], group);
+    }
+  }
+  variants.sort((a, b) => a.bandwidth - b.bandwidth);
+  const group = variants.length ? audioGroups.get(variants[0].audioGroup) : null;
+  const audio = group ? group.find((rendition) => rendition.isDefault) || group[0] : null;
+  return { main: variants, audio: audio ? [audio] : null };
+};
+
+// --- DASH ------------------------------------------------------------------
+
+// Just enough XML for MPDs (DOMParser is not available in workers): elements
+// with attributes and text, namespace prefixes dropped.
+const decodeXmlEntities = (text) =>
+  text.replace(/&(amp|lt|gt|quot|apos);/g, (all, name) => ({ amp: "&", lt: "<", gt: ">", quot: '"', apos: "'" })[name]);
+
+const parseXml = (text) => {
+  const root = { name: "", attrs: {}, children: [], text: "" };
+  const stack = [root];
+  const re = /<!--[\s\S]*?-->|<\?[\s\S]*?\?>|<!\[CDATA\[([\s\S]*?)\]\]>|<!DOCTYPE[^>]*>|<(\/?)([\w:.-]+)([^>]*?)(\/?)>|([^<]+)/g;
+  let match;
+  while ((match = re.exec(text))) {
+    const top = stack[stack.length - 1];
+    if (match[1] !== undefined || match[6] !== undefined) {
+      top.text += match[1] !== undefined ? match[1] : decodeXmlEntities(match[6]);
+      continue;
+    }
+    if (!match[3]) continue;
+    if (match[2]) {
+      if (stack.length > 1) stack.pop();
+      continue;
+    }
+    const node = { name: match[3].replace(/^.*:/, ""), attrs: {}, children: [], text: "" };
+    for (const attr of match[4].matchAll(/([\w:.-]+)\s*=\s*(?:"([^"]*)"|'([^']*)')/g)) {
+      node.attrs[attr[1].replace(/^.*:/, "")] = decodeXmlEntities(attr[2] !== undefined ? attr[2] : attr[3]);
+    }
+    top.children.push(node);
+    if (!match[5]) stack.push(node);
+  }
+  return root;
+};
+
+const xmlChildren = (node, name) => (node ? node.children.filter((child) => child.name === name) : []);
+const xmlChild = (node, name) => xmlChildren(node, name)[0] || null;
+
+const parseIsoDuration = (text) => {
+  const match =
+    /^P(?:([\d.]+)D)?(?:T(?:([\d.]+)H)?(?:([\d.]+)M)?(?:([\d.]+)S)?)?$/.exec((text || "").trim());
+  if (!match) return 0;
+  const [days, hours, minutes, seconds] = match.slice(1).map((value) => Number(value) || 0);
+  return days * 86400 + hours * 3600 + minutes * 60 + seconds;
+};
+
+const withBaseUrl = (base, node) => {
+  const baseUrl = xmlChild(node, "BaseURL");
+  return baseUrl ? resolveUrl(baseUrl.text.trim(), base) : base;
+};
+
+// $Name$ and $Name%0Nd$ identifiers of SegmentTemplate; $$ is a literal $
+const fillTemplate = (template, values) =>
+  template.replace(/\$(\w*)(?:%0(\d+)d)?\$/g, (all, name, width) => {
+    if (!name) return "$";
+    if (values[name] === undefined) return all;
+    const value = String(values[name]);
+    return width ? value.padStart(Number(width), "0") : value;
+  });
+
+// "first-last", inclusive as in HTTP
+const parseDashRange = (text) => {
+  if (!text) return null;
+  const [first, last] = text.split("-").map(Number);
+  return { start: first, end: last + 1 };
+};
+
+const dashSegments = (set, rep, base, periodDuration) => {
+  const values = { RepresentationID: rep.attrs.id, Bandwidth: rep.attrs.bandwidth };
+  const setTemplate = xmlChild(set, "SegmentTemplate");
+  const repTemplate = xmlChild(rep, "SegmentTemplate");
+  if (setTemplate || repTemplate) {
+    const attrs = { ...(setTemplate ? setTemplate.attrs : {}), ...(repTemplate ? repTemplate.attrs : {}) };
+    const timeline = xmlChild(repTemplate, "SegmentTimeline") || xmlChild(setTemplate, "SegmentTimeline");
+    const timescale = Number(attrs.timescale) || 1;
+    const offset = Number(attrs.presentationTimeOffset) || 0;
+    let number = attrs.startNumber !== undefined ? Number(attrs.startNumber) : 1;
+    const init = attrs.initialization
+      ? { url: resolveUrl(fillTemplate(attrs.initialization, values), base), range: null }
+      : null;
+    const segments = [];
+    const push = (time, duration) => {
+      segments.push({
+        seq: number,
+        url: resolveUrl(fillTemplate(attrs.media, { ...values, Number: number, Time: time }), base),
+        range: null,
+        start: (time - offset) / timescale,
+        duration: duration / timescale,
+        init,
+        discontinuity: false,
+      });
+      number += 1;
+    };
+    if (timeline) {
+      let time = 0;
+      for (const entry of xmlChildren(timeline, "S")) {
+        if (entry.attrs.t !== undefined) time = Number(entry.attrs.t);
+        const duration = Number(entry.attrs.d);
+        let repeat = Number(entry.attrs.r) || 0;
+        if (repeat < 0) {
+          repeat = Math.ceil((periodDuration * timescale + offset - time) / duration) - 1;
+        }
+        for (let i = 0; i <= repeat; i += 1) {
+          push(time, duration);
+          time += duration;
+        }
+      }
+    } else if (attrs.duration) {
+      const duration = Number(attrs.duration);
+      const count = Math.ceil((periodDuration * timescale) / duration);
+      for (let i = 0; i < count; i += 1) push(offset + i * duration, duration);
+    }
+    return segments;
+  }
+
+  const list = xmlChild(rep, "SegmentList") || xmlChild(set, "SegmentList");
+  if (list) {
+    const timescale = Number(list.attrs.timescale) || 1;
+    const duration = (Number(list.attrs.duration) || 0) / timescale;
+    const initNode = xmlChild(list, "Initialization");
+    const init = initNode
+      ? {
+          url: initNode.attrs.sourceURL ? resolveUrl(initNode.attrs.sourceURL, base) : base,
+          range: parseDashRange(initNode.attrs.range),
+        }
+      : null;
+    return xmlChildren(list, "SegmentURL").map((entry, i) => ({
+      seq: i,
+      url: entry.attrs.media ? resolveUrl(entry.attrs.media, base) : base,
+      range: parseDashRange(entry.attrs.mediaRange),
+      start: i * duration,
+      duration,
+      init,
+      discontinuity: false,
+    }));
+  }
+
+  // SegmentBase with an index: segments come from the sidx box, fetched with
+  // the variant's first use (ManifestSource.playlist)
+  const segmentBase = xmlChild(rep, "SegmentBase") || xmlChild(set, "SegmentBase");
+  const indexRange = segmentBase ? parseDashRange(segmentBase.attrs.indexRange) : null;
+  if (indexRange) {
+    const initNode = xmlChild(segmentBase, "Initialization");
+    const initRange = initNode ? parseDashRange(initNode.attrs.range) : null;
+    return {
+      url: base,
+      indexRange,
+      // Without Initialization@range the header is everything before the index
+      init: { url: base, range: initRange || { start: 0, end: indexRange.start } },
+      presentationTimeOffset: Number(segmentBase.attrs.presentationTimeOffset) || 0,
+    };
+  }
+
+  // Single file without an index: one segment, no switching inside it
+  return [{ seq: 0, url: base, range: null, start: 0, duration: periodDuration, init: null, discontinuity: false }];
+};
+
+// Subsegments of a sidx box (ISO/IEC 14496-12 8.16.3) as byte-range
+// segments. bytes start at index.indexRange.start; offsets count from the
+// first byte after the box.
+const parseSidx = (bytes, index) => {
+  const view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+  let pos = 0;
+  while (pos + 8 <= bytes.length) {
+    const size = view.getUint32(pos);
+    const type = String.fromCharCode(...bytes.subarray(pos + 4, pos + 8));
+    if (type === "sidx") break;
+    if (size < 8) throw new Error("Malformed DASH segment index");
+    pos += size;
+  }
+  if (pos + 8 > bytes.length) throw new Error("DASH segment index has no sidx box");
+
+  const boxEnd = pos + view.getUint32(pos);
+  const version = bytes[pos + 8];
+  const timescale = view.getUint32(pos + 16) || 1;
+  let cursor = pos + 20;
+  let time;
+  let offset;
+  if (version === 0) {
+    time = view.getUint32(cursor);
+    offset = view.getUint32(cursor + 4);
+    cursor += 8;
+  } else {
+    time = Number(view.getBigUint64(cursor));
+    offset = Number(view.getBigUint64(cursor + 8));
+    cursor += 16;
+  }
+  const count = view.getUint16(cursor + 2);
+  cursor += 4;
+  if (cursor + count * 12 > bytes.length) throw new Error("Truncated DASH segment index");
+
+  let start = index.indexRange.start + boxEnd + offset;
+  const segments = [];
+  for (let i = 0; i < count; i += 1, cursor += 12) {
+    const reference = view.getUint32(cursor);
+    if (reference & 0x80000000) throw new Error("Hierarchical DASH segment indexes are not supported");
+    const size = reference & 0x7fffffff;
+    const duration = view.getUint32(cursor + 4);
+    segments.push({
+      seq: i,
+      url: index.url,
+      range: { start, end: start + size },
+      start: (time - index.presentationTimeOffset) / timescale,
+      duration: duration / timescale,
+      init: index.init,
+      discontinuity: false,
+    });
+    start += size;
+    time += duration;
+  }
+  return segments;
+};
+
+const dashContentType = (set, rep) => {
+  const type = set.attrs.contentType || rep.attrs.mimeType || set.attrs.mimeType || "";
+  return type.split("/")[0];
+};
+
+// Static MPDs, first period. Video representations form the main track; the
+// first audio adaptation set becomes the audio input (or the main track when
+// there is no video).
+const parseMpd = (text, url) => {
+  const mpd = xmlChild(parseXml(text), "MPD");
+  if (!mpd) throw new Error("Not a DASH manifest");
+  if (mpd.attrs.type === "dynamic") throw new Error("Live DASH (type=dynamic) is not supported");
+  const period = xmlChild(mpd, "Period");
+  if (!period) throw new Error("MPD has no Period");
+  const duration =
+    parseIsoDuration(period.attrs.duration) || parseIsoDuration(mpd.attrs.mediaPresentationDuration);
+  const periodBase = withBaseUrl(withBaseUrl(url, mpd), period);
+
+  const video = [];
+  let audio = null;
+  for (const set of xmlChildren(period, "AdaptationSet")) {
+    const setBase = withBaseUrl(periodBase, set);
+    const reps = xmlChildren(set, "Representation");
+    const type = reps.length ? dashContentType(set, reps[0]) : "";
+    if (type !== "video" && type !== "audio") continue;
+    if (type === "audio" && audio) continue;
+    const variants = reps.map((rep) => {
+      const bandwidth = Number(rep.attrs.bandwidth) || 0;
+      const segments = dashSegments(set, rep, withBaseUrl(setBase, rep), duration);
+      const indexed = !Array.isArray(segments);
+      return {
+        url: null,
+        bandwidth,
+        label:
+          rep.attrs.width && rep.attrs.height
+            ? `${rep.attrs.width}x${rep.attrs.height}`
+            : `${Math.round(bandwidth / 1000)} kbit/s`,
+        index: indexed ? segments : null,
+        playlist: indexed ? null : { segments, endList: true, targetDuration: 0, duration, loadedAt: 0 },
+      };
+    });
+    variants.sort((a, b) => a.bandwidth - b.bandwidth);
+    if (type === "video") {
+      video.push(...variants);
+    } else {
+      audio = variants;
+    }
+  }
+  if (!video.length && !audio) throw new Error("MPD has no audio or video representations");
+  video.sort((a, b) => a.bandwidth - b.bandwidth);
+  return { main: video.length ? video : audio, audio: video.length ? audio : null, duration };
+};
+
+// --- Source ----------------------------------------------------------------
+
+class ManifestSource {
+  // callbacks: append(bytes, audio), markBoundary(audio), end(audio), log(message)
+  constructor(url, signal, callbacks) {
+    this.url = url;
+    this.signal = signal;
+    this.callbacks = callbacks;
+    this.tracks = [];
+    this.duration = 0;
+    this.live = false;
+    this.bandwidth = 0;
+    this.generation = 0; // Bumped by seek; fetches of an older generation are dropped
+    this.initCache = new Map();
+  }
+
+  async fetchResponse(url, range) {
+    const headers = range ? { Range: `bytes=${range.start}-${range.end - 1}` } : undefined;
+    const resp = await fetch(url, { headers, signal: this.signal });
+    if (!resp.ok) {
+      throw new Error(`HTTP ${resp.status} for ${url}`);
+    }
+    return resp;
+  }
+
+  async fetchText(url) {
+    const resp = await this.fetchResponse(url, null);
+    return { text: await resp.text(), url: resp.url || url };
+  }
+
+  async fetchBytes(url, range, measure) {
+    const started = performance.now();
+    const resp = await this.fetchResponse(url, range);
+    let bytes = new Uint8Array(await resp.arrayBuffer());
+    if (range && resp.status === 200) {
+      bytes = bytes.subarray(range.start, range.end); // Server ignored Range
+    }
+    const seconds = (performance.now() - started) / 1000;
+    if (measure && bytes.length >= MANIFEST_MIN_SAMPLE_BYTES && seconds > 0) {
+      const sample = (bytes.length * 8) / seconds;
+      this.bandwidth = this.bandwidth
+        ? (1 - MANIFEST_BANDWIDTH_WEIGHT) * this.bandwidth + MANIFEST_BANDWIDTH_WEIGHT * sample
+        : sample;
+    }
+    return bytes;
+  }
+
+  // Init segments are shared by every segment of a variant and refetched on
+  // every switch back to it and after each seek, so they are kept
+  initSegment(init) {
+    const key = `${init.url}#${init.range ? `${init.range.start}-${init.range.end}` : ""}`;
+    if (!this.initCache.has(key)) {
+      const pending = this.fetchBytes(init.url, init.range, false);
+      pending.catch(() => this.initCache.delete(key));
+      this.initCache.set(key, pending);
+    }
+    return this.initCache.get(key);
+  }
+
+  async load() {
+    const { text, url } = await this.fetchText(this.url);
+    let parsed;
+    if (text.trimStart().startsWith("#EXTM3U")) {
+      const lines = text.split(/\r?\n/).map((line) => line.trim()).filter(Boolean);
+      if (lines.some((line) => line.startsWith("#EXT-X-STREAM-INF:"))) {
+        parsed = parseHlsMaster(lines, url);
+      } else {
+        const playlist = parseHlsMedia(lines, url);
+        parsed = { main: [{ url, bandwidth: 0, label: "default", playlist }], audio: null };
+      }
+    } else if (/<MPD[\s>]/.test(text)) {
+      parsed = parseMpd(text, url);
+    } else {
+      throw new Error("Not an HLS playlist or DASH manifest");
+    }
+    if (!parsed.main.length) throw new Error("Manifest lists no variants");
+
+    const track = (variants, audio) => ({
+      audio,
+      variants,
+      variant: 0,
+      seq: null, // Next segment; null = pick by time
+      time: 0, // Media time where the next segment starts
+      initKey: null, // Init (or variant, for TS) the demuxer was opened on
+      primed: false,
+      ended: false,
+    });
+    this.tracks = [track(parsed.main, false)];
+    if (parsed.audio) this.tracks.push(track(parsed.audio, true));
+
+    const first = await this.playlist(this.tracks[0].variants[0]);
+    this.live = !first.endList;
+    this.duration = this.live ? 0 : parsed.duration || first.duration;
+    return this;
+  }
+
+  get primed() {
+    return this.tracks.every((track) => track.primed || track.ended);
+  }
+
+  get ended() {
+    return this.tracks.every((track) => track.ended);
+  }
+
+  get variantLabel() {
+    const track = this.tracks[0];
+    return track ? track.variants[track.variant].label : "";
+  }
+
+  describe() {
+    const main = this.tracks[0];
+    const parts = [`${main.variants.length} variant(s)`];
+    if (this.tracks[1]) parts.push("separate audio");
+    parts.push(this.live ? "live" : `${this.duration.toFixed(1)}s`);
+    return parts.join(", ");
+  }
+
+  // Media playlists (and DASH segment indexes) load on first use; live ones
+  // reload every half target duration, keeping start times continuous across
+  // reloads
+  async playlist(variant) {
+    if (variant.index) {
+      if (!variant.indexLoad) {
+        variant.indexLoad = this.fetchBytes(variant.index.url, variant.index.indexRange, false).then((bytes) => {
+          const segments = parseSidx(bytes, variant.index);
+          const duration = segments.reduce((sum, segment) => sum + segment.duration, 0);
+          variant.playlist = { segments, endList: true, targetDuration: 0, duration, loadedAt: 0 };
+          return variant.playlist;
+        });
+        variant.indexLoad.catch(() => {
+          variant.indexLoad = null;
+        });
+      }
+      return variant.indexLoad;
+    }
+    const current = variant.playlist;
+    if (current && (current.endList || performance.now() - current.loadedAt < (current.targetDuration * 1000) / 2)) {
+      return current;
+    }
+    const { text, url } = await this.fetchText(variant.url);
+    const lines = text.split(/\r?\n/).map((line) => line.trim()).filter(Boolean);
+    const fresh = parseHlsMedia(lines, url);
+    const anchor = current && fresh.segments.length
+      ? current.segments.find((segment) => segment.seq === fresh.segments[0].seq)
+      : null;
+    if (anchor) {
+      for (const segment of fresh.segments) segment.start += anchor.start;
+    }
+    variant.playlist = fresh;
+    return fresh;
+  }
+
+  pickVariant(track) {
+    if (track.variants.length < 2 || !(this.bandwidth > 0)) return false;
+    let best = 0;
+    track.variants.forEach((variant, i) => {
+      if (variant.bandwidth <= this.bandwidth * MANIFEST_SWITCH_UP) best = i;
+    });
+    if (best === track.variant) return false;
+    this.callbacks.log(
+      `Switching ${track.audio ? "audio" : "video"} to ${track.variants[best].label} ` +
+        `(${(this.bandwidth / 1e6).toFixed(2)} Mbit/s measured)`
+    );
+    track.variant = best;
+    return true;
+  }
+
+  // Segment to continue from: by sequence number normally, by media time
+  // after a seek or (VOD) a variant switch
+  nextSegment(track, playlist) {
+    const { segments } = playlist;
+    if (!segments.length) return null;
+    if (track.seq === null) {
+      if (this.live) {
+        return segments[Math.max(0, segments.length - MANIFEST_LIVE_EDGE_SEGMENTS)];
+      }
+      const index = segments.findIndex((segment) => segment.start + segment.duration > track.time + 0.001);
+      return index >= 0 ? segments[index] : null;
+    }
+    if (track.seq < segments[0].seq) {
+      this.callbacks.log("Fell behind the live window; skipping ahead.");
+      return segments[0];
+    }
+    return segments.find((segment) => segment.seq === track.seq) || null;
+  }
+
+  // Fetch and append the next segment of whichever track is behind
+  async step() {
+    const pending = this.tracks.filter((track) => !track.ended);
+    if (!pending.length) return;
+    const track = pending.reduce((a, b) => (b.time < a.time ? b : a));
+    const generation = this.generation;
+
+    if (this.pickVariant(track) && !this.live) {
+      track.seq = null;
+    }
+    const variant = track.variants[track.variant];
+    const playlist = await this.playlist(variant);
+    if (generation !== this.generation) return;
+    const segment = this.nextSegment(track, playlist);
+    if (!segment) {
+      if (playlist.endList) {
+        track.ended = true;
+        this.callbacks.end(track.audio);
+      } else {
+        await new Promise((resolve) => setTimeout(resolve, (playlist.targetDuration * 1000) / 2));
+      }
+      return;
+    }
+
+    // New init segment (or, for TS, a new variant): the demuxer reopens there
+    const initKey = segment.init
+      ? `${segment.init.url}#${segment.init.range ? segment.init.range.start : ""}`
+      : `variant:${track.variant}`;
+    const reopen = track.initKey !== initKey || (segment.discontinuity && track.initKey !== null);
+    const [init, bytes] = await Promise.all([
+      reopen && segment.init ? this.initSegment(segment.init) : null,
+      this.fetchBytes(segment.url, segment.range, true),
+    ]);
+    if (generation !== this.generation) return;
+
+    if (reopen) {
+      if (track.initKey !== null) this.callbacks.markBoundary(track.audio);
+      track.initKey = initKey;
+      if (init && !this.callbacks.append(init, track.audio)) return;
+    }
+    if (!this.callbacks.append(bytes, track.audio)) return;
+    track.seq = segment.seq + 1;
+    track.time = segment.start + segment.duration;
+    track.primed = true;
+  }
+
+  // The caller has dropped everything buffered; continue every track from
+  // the segment containing seconds, init segment first
+  seek(seconds) {
+    this.generation += 1;
+    for (const track of this.tracks) {
+      track.seq = null;
+      track.time = seconds;
+      track.initKey = null;
+      track.ended = false;
+    }
+  }
+}
+
+if (typeof module !== "undefined" && module.exports) {
+  module.exports = { isManifestUrl, parseHlsMedia, parseHlsMaster, parseMpd, parseSidx, fillTemplate, ManifestSource };
+}
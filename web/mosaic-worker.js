@@ -0,0 +1,384 @@
+/* global FFmpegWasm, loadWasmModule, instantiateFromModule */
+
+// Monitoring-wall worker: decodes N feeds in one wasm instance and composites
+// them into a single RGBA atlas via the ffmpeg_wasm_mosaic_* API, so each tick
+// costs one putImageData regardless of the feed count.
+//
+// Messages in:
+//   { type: "init", canvas, width, height, cols, rows, wasmModule?, wasmBuildId? }
+//   { type: "addFeed", id, file? , url?, formatHint? }
+//   { type: "removeFeed", id }
+//   { type: "play" } / { type: "pause" }
+// Messages out: ready, log, feedOpened, feedEnded, stats, wasmModule
+
+importScripts("wasm-module-cache.js", "ffmpeg_wasm.js");
+
+const MAX_CHUNK_BYTES = 256 * 1024;
+const MIN_OPEN_BYTES = 2 * 1024 * 1024;
+const MAX_FEED_BUFFER_BYTES = 32 * 1024 * 1024; // Per feed; a wall has many
+const FEED_MEMORY_BUDGET_BYTES = 96 * 1024 * 1024;
+const TICK_MS = 16;
+const MAX_FRAMES_PER_FEED_TICK = 4;
+const BUFFER_POLL_MS = 15;
+const NEED_MODULE = -0x444f4d4e; // FFMPEG_WASM_ERROR_NEED_MODULE (split builds)
+
+const sleep = (ms) => new Promise((resolve) => setTimeout(resolve, ms));
+
+const state = {
+  Module: null,
+  api: null,
+  mosaic: 0,
+  canvas: null,
+  ctx2d: null,
+  width: 0,
+  height: 0,
+  cols: 1,
+  rows: 1,
+  feeds: new Map(),
+  playing: false,
+  timer: null,
+  presents: 0,
+  fontData: null,
+  sideModules: new Map(), // name -> load promise (split builds)
+};
+
+const postLog = (message) => postMessage({ type: "log", message });
+
+const createApi = (Module) => ({
+  create: Module.cwrap("ffmpeg_wasm_create", "number", ["number"]),
+  destroy: Module.cwrap("ffmpeg_wasm_destroy", null, ["number"]),
+  append: Module.cwrap("ffmpeg_wasm_append", "number", ["number", "number", "number"]),
+  setEof: Module.cwrap("ffmpeg_wasm_set_eof", null, ["number"]),
+  setFileSize: Module.cwrap("ffmpeg_wasm_set_file_size", null, ["number", "number"]),
+  setAudioEnabled: Module.cwrap("ffmpeg_wasm_set_audio_enabled", null, ["number", "number"]),
+  setMemoryBudget: Module.cwrap("ffmpeg_wasm_set_memory_budget", null, ["number", "number"]),
+  bufferedBytes: Module.cwrap("ffmpeg_wasm_buffered_bytes", "number", ["number"]),
+  open: Module.cwrap("ffmpeg_wasm_open", "number", ["number", "string"]),
+  readFrame: Module.cwrap("ffmpeg_wasm_read_frame", "number", ["number"]),
+  pts: Module.cwrap("ffmpeg_wasm_frame_pts_seconds", "number", ["number"]),
+  selectSubtitle: Module.cwrap("ffmpeg_wasm_select_subtitle_stream", "number", ["number", "number"]),
+  missingModules:
+    typeof Module._ffmpeg_wasm_missing_modules === "function"
+      ? Module.cwrap("ffmpeg_wasm_missing_modules", "string", ["number"])
+      : null,
+  mosaicCreate: Module.cwrap("ffmpeg_wasm_mosaic_create", "number", ["number", "number", "number"]),
+  mosaicAddFont: Module.cwrap("ffmpeg_wasm_mosaic_add_font", "number", [
+    "number",
+    "string",
+    "number",
+    "number",
+  ]),
+  mosaicAttach: Module.cwrap("ffmpeg_wasm_mosaic_attach", "number", [
+    "number",
+    "number",
+    "number",
+    "number",
+    "number",
+    "number",
+  ]),
+  mosaicDetach: Module.cwrap("ffmpeg_wasm_mosaic_detach", null, ["number", "number"]),
+  mosaicPresent: Module.cwrap("ffmpeg_wasm_mosaic_present", "number", ["number"]),
+  mosaicDataPtr: Module.cwrap("ffmpeg_wasm_mosaic_data_ptr", "number", ["number", "number"]),
+  mosaicSize: Module.cwrap("ffmpeg_wasm_mosaic_size", "number", ["number"]),
+});
+
+const withHeapCopy = (bytes, fn) => {
+  const ptr = state.Module._malloc(bytes.length);
+  if (!ptr) {
+    return -1;
+  }
+  state.Module.HEAPU8.set(bytes, ptr);
+  const ret = fn(ptr);
+  state.Module._free(ptr);
+  return ret;
+};
+
+const tileRect = (slot) => {
+  const tileW = Math.floor(state.width / state.cols) & ~1;
+  const tileH = Math.floor(state.height / state.rows) & ~1;
+  const col = slot % state.cols;
+  const row = Math.floor(slot / state.cols);
+  return { x: col * tileW, y: row * tileH, w: tileW, h: tileH };
+};
+
+const freeSlot = () => {
+  const used = new Set([...state.feeds.values()].map((feed) => feed.slot));
+  for (let slot = 0; slot < state.cols * state.rows; slot += 1) {
+    if (!used.has(slot)) return slot;
+  }
+  return -1;
+};
+
+const loadSideModules = (names) =>
+  Promise.all(
+    names.map((name) => {
+      if (!state.sideModules.has(name)) {
+        state.sideModules.set(
+          name,
+          state.Module.loadDynamicLibrary(name, { loadAsync: true, global: true, nodelete: true })
+        );
+      }
+      return state.sideModules.get(name);
+    })
+  );
+
+const tryOpen = (feed) => {
+  if (feed.opened || feed.loadingModules || (feed.appended < MIN_OPEN_BYTES && !feed.eof)) {
+    return;
+  }
+  const ret = state.api.open(feed.ctx, feed.formatHint || "");
+  if (ret === NEED_MODULE && state.api.missingModules) {
+    feed.loadingModules = true;
+    loadSideModules(state.api.missingModules(feed.ctx).split(",").filter(Boolean)).then(
+      () => {
+        feed.loadingModules = false;
+        if (!feed.closed) tryOpen(feed);
+      },
+      (err) => postLog(`Feed ${feed.id}: codec module failed (${err.message || err})`)
+    );
+    return;
+  }
+  if (ret < 0) {
+    if (feed.eof) {
+      postLog(`Feed ${feed.id}: open failed (${ret})`);
+    }
+    return;
+  }
+  feed.opened = true;
+  state.api.selectSubtitle(feed.ctx, -1);
+  postMessage({ type: "feedOpened", id: feed.id });
+};
+
+const pump = async (feed, reader) => {
+  while (!feed.closed) {
+    while (
+      !feed.closed &&
+      state.api.bufferedBytes(feed.ctx) > MAX_FEED_BUFFER_BYTES
+    ) {
+      await sleep(BUFFER_POLL_MS);
+    }
+    const { value, done } = await reader.read();
+    if (feed.closed) return;
+    if (done) break;
+    for (let offset = 0; offset < value.length; offset += MAX_CHUNK_BYTES) {
+      const slice = value.subarray(offset, offset + MAX_CHUNK_BYTES);
+      withHeapCopy(slice, (ptr) => state.api.append(feed.ctx, ptr, slice.length));
+      feed.appended += slice.length;
+    }
+    tryOpen(feed);
+  }
+  if (!feed.closed) {
+    state.api.setEof(feed.ctx);
+    feed.eof = true;
+    tryOpen(feed);
+  }
+};
+
+const addFeed = async (msg) => {
+  if (state.feeds.has(msg.id)) {
+    removeFeed(msg.id);
+  }
+  const slot = freeSlot();
+  if (slot < 0) {
+    postLog(`Feed ${msg.id}: mosaic is full`);
+    return;
+  }
+  const ctx = state.api.create(4 * 1024 * 1024);
+  if (!ctx) {
+    postLog(`Feed ${msg.id}: create failed`);
+    return;
+  }
+  state.api.setAudioEnabled(ctx, 0);
+  state.api.setMemoryBudget(ctx, FEED_MEMORY_BUDGET_BYTES);
+
+  const rect = tileRect(slot);
+  const tile = state.api.mosaicAttach(state.mosaic, ctx, rect.x, rect.y, rect.w, rect.h);
+  if (tile < 0) {
+    state.api.destroy(ctx);
+    postLog(`Feed ${msg.id}: attach failed (${tile})`);
+    return;
+  }
+
+  const feed = {
+    id: msg.id,
+    ctx,
+    tile,
+    slot,
+    formatHint: msg.formatHint || "",
+    appended: 0,
+    opened: false,
+    loadingModules: false,
+    eof: false,
+    ended: false,
+    closed: false,
+    basePts: null,
+    baseWall: 0,
+  };
+  state.feeds.set(msg.id, feed);
+
+  try {
+    let reader;
+    if (msg.file) {
+      state.api.setFileSize(ctx, msg.file.size);
+      reader = msg.file.stream().getReader();
+    } else {
+      const resp = await fetch(msg.url);
+      if (!resp.ok || !resp.body) throw new Error(`HTTP ${resp.status}`);
+      reader = resp.body.getReader();
+    }
+    await pump(feed, reader);
+  } catch (err) {
+    postLog(`Feed ${msg.id}: ${err.message}`);
+  }
+};
+
+const removeFeed = (id) => {
+  const feed = state.feeds.get(id);
+  if (!feed) return;
+  feed.closed = true;
+  state.api.mosaicDetach(state.mosaic, feed.tile);
+  state.api.destroy(feed.ctx);
+  state.feeds.delete(id);
+};
+
+// Decode each feed up to its wall-clock position, then present once.
+const tick = () => {
+  const now = performance.now();
+  for (const feed of state.feeds.values()) {
+    if (!feed.opened || feed.ended) continue;
+    for (let i = 0; i < MAX_FRAMES_PER_FEED_TICK; i += 1) {
+      if (feed.basePts !== null) {
+        const dueWall = feed.baseWall + (feed.lastPts - feed.basePts) * 1000;
+        if (dueWall > now) break;
+      }
+      const ret = state.api.readFrame(feed.ctx);
+      if (ret === 1) {
+        feed.lastPts = state.api.pts(feed.ctx);
+        if (feed.basePts === null) {
+          feed.basePts = feed.lastPts;
+          feed.baseWall = now;
+        }
+      } else if (ret === -1) {
+        feed.ended = true;
+        postMessage({ type: "feedEnded", id: feed.id });
+        break;
+      } else if (ret !== 2) {
+        break; // Need data or error; retry next tick
+      }
+    }
+  }
+
+  if (state.api.mosaicPresent(state.mosaic) > 0) {
+    const ptr = state.api.mosaicDataPtr(state.mosaic, 0);
+    const pixels = new Uint8ClampedArray(
+      state.Module.HEAPU8.buffer,
+      ptr,
+      state.api.mosaicSize(state.mosaic)
+    );
+    state.ctx2d.putImageData(new ImageData(pixels, state.width, state.height), 0, 0);
+    state.presents += 1;
+  }
+
+  if (state.playing) {
+    state.timer = setTimeout(tick, TICK_MS);
+  }
+};
+
+const init = async (msg) => {
+  state.canvas = msg.canvas;
+  state.width = msg.width & ~1;
+  state.height = msg.height & ~1;
+  state.cols = Math.max(1, msg.cols | 0);
+  state.rows = Math.max(1, msg.rows | 0);
+  state.canvas.width = state.width;
+  state.canvas.height = state.height;
+  state.ctx2d = state.canvas.getContext("2d", { alpha: false });
+
+  let compiled = null;
+  try {
+    compiled = await loadWasmModule({
+      wasmUrl: "ffmpeg_wasm.wasm",
+      shared: msg.wasmModule ? { module: msg.wasmModule, buildId: msg.wasmBuildId || "" } : null,
+    });
+  } catch (err) {
+    postLog(`Wasm precompile failed (${err.message}); using the default loader.`);
+  }
+  state.Module = await FFmpegWasm({
+    print: (text) => postLog(text),
+    printErr: (text) => postLog(text),
+    ...(compiled
+      ? {
+          instantiateWasm: instantiateFromModule(compiled.module, (err) =>
+            postLog(`Wasm instantiate failed: ${err.message}`)
+          ),
+        }
+      : {}),
+  });
+  postLog(`Mosaic module ready ${Math.round(performance.now())} ms after worker start (wasm: ${compiled ? compiled.source : "default"})`);
+  state.api = createApi(state.Module);
+  if (state.Module.loadDynamicLibrary) {
+    // Split build: the shared libass renderer lives in a side module
+    try {
+      await loadSideModules(["subtitles.wasm"]);
+    } catch (err) {
+      postLog(`Failed to load subtitles.wasm: ${err.message || err}`);
+    }
+  }
+  state.mosaic = state.api.mosaicCreate(state.width, state.height, 0);
+  if (!state.mosaic) {
+    postLog("Mosaic create failed");
+    return;
+  }
+
+  const embeddedFont =
+    typeof state.Module._ffmpeg_wasm_has_default_font === "function" &&
+    state.Module._ffmpeg_wasm_has_default_font();
+  try {
+    const resp = embeddedFont ? null : await fetch("Inter-Regular.ttf");
+    if (resp && resp.ok) {
+      const font = new Uint8Array(await resp.arrayBuffer());
+      withHeapCopy(font, (ptr) =>
+        state.api.mosaicAddFont(state.mosaic, "Inter", ptr, font.length)
+      );
+    }
+  } catch (err) {
+    postLog(`Failed to load default font: ${err.message}`);
+  }
+
+  if (compiled && compiled.source !== "shared") {
+    postMessage({ type: "wasmModule", module: compiled.module, buildId: compiled.buildId });
+  }
+  setInterval(() => {
+    postMessage({ type: "stats", feeds: state.feeds.size, presents: state.presents });
+  }, 1000);
+  postMessage({ type: "ready" });
+};
+
+onmessage = (event) => {
+  const msg = event.data;
+  if (!msg || !msg.type) return;
+  if (msg.type === "init") {
+    init(msg);
+    return;
+  }
+  if (!state.api || !state.mosaic) return;
+
+  if (msg.type === "addFeed") {
+    addFeed(msg);
+  } else if (msg.type === "removeFeed") {
+    removeFeed(msg.id);
+  } else if (msg.type === "play") {
+    if (!state.playing) {
+      state.playing = true;
+      const now = performance.now();
+      for (const feed of state.feeds.values()) {
+        feed.basePts = null; // Re-anchor after a pause
+        feed.baseWall = now;
+      }
+      tick();
+    }
+  } else if (msg.type === "pause") {
+    state.playing = false;
+    clearTimeout(state.timer);
+  }
+};
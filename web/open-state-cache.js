@@ -0,0 +1,74 @@
+/* global indexedDB, idbRequest */
+
+// Open-state cache for local files (importScripts, after wasm-module-cache.js
+// for idbRequest). Records are keyed by size, mtime and a SHA-256 of the
+// first 64 KiB and hold the blob from ffmpeg_wasm_save_open_state, the
+// container header length, the stream descriptors and the last position.
+
+const OPEN_STATE_DB = "ffmpeg-open-state";
+const OPEN_STATE_STORE = "files";
+const OPEN_STATE_HEAD_BYTES = 64 * 1024;
+const OPEN_STATE_MAX_RECORDS = 64; // Oldest records are dropped beyond this
+
+const openStateDb = () => {
+  if (typeof indexedDB === "undefined") {
+    return Promise.resolve(null);
+  }
+  const req = indexedDB.open(OPEN_STATE_DB, 1);
+  req.onupgradeneeded = () => req.result.createObjectStore(OPEN_STATE_STORE);
+  return idbRequest(req).catch(() => null);
+};
+
+// "" when hashing is unavailable (no SubtleCrypto outside secure contexts)
+const openStateKey = async (file) => {
+  if (typeof crypto === "undefined" || !crypto.subtle) {
+    return "";
+  }
+  try {
+    const head = await file.slice(0, OPEN_STATE_HEAD_BYTES).arrayBuffer();
+    const digest = new Uint8Array(await crypto.subtle.digest("SHA-256", head));
+    const hex = Array.from(digest, (b) => b.toString(16).padStart(2, "0")).join("");
+    return `${file.size}:${file.lastModified || 0}:${hex}`;
+  } catch (err) {
+    return "";
+  }
+};
+
+// Resolves { key, record }; record is null on a miss
+const loadOpenState = async (file) => {
+  const key = await openStateKey(file);
+  const db = key ? await openStateDb() : null;
+  if (!db) {
+    return { key, record: null };
+  }
+  try {
+    const store = db.transaction(OPEN_STATE_STORE).objectStore(OPEN_STATE_STORE);
+    const record = await idbRequest(store.get(key));
+    return { key, record: record && record.blob instanceof ArrayBuffer ? record : null };
+  } catch (err) {
+    return { key, record: null };
+  }
+};
+
+const storeOpenState = async (key, record) => {
+  const db = key ? await openStateDb() : null;
+  if (!db) {
+    return;
+  }
+  const store = db
+    .transaction(OPEN_STATE_STORE, "readwrite")
+    .objectStore(OPEN_STATE_STORE);
+  await idbRequest(store.put({ ...record, savedAt: Date.now() }, key));
+
+  const keys = await idbRequest(store.getAllKeys());
+  if (keys.length <= OPEN_STATE_MAX_RECORDS) {
+    return;
+  }
+  const records = await idbRequest(store.getAll());
+  const byAge = keys
+    .map((k, i) => ({ key: k, savedAt: (records[i] && records[i].savedAt) || 0 }))
+    .sort((a, b) => a.savedAt - b.savedAt);
+  for (const old of byAge.slice(0, keys.length - OPEN_STATE_MAX_RECORDS)) {
+    store.delete(old.key);
+  }
+};
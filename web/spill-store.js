@@ -0,0 +1,94 @@
+/* global navigator */
+
+// Secondary stores for the stream buffer spill (ffmpeg_wasm_set_spill). The
+// C side reads and writes them synchronously through Module.spillStores,
+// keyed by context handle. In the worker this is an OPFS sync access handle;
+// under Node (web/test-node.mjs) a temp file. Both expose
+// write(pos, bytes) / read(pos, bytes) returning the byte count, and close().
+
+const SPILL_DIR = "ffmpeg-spill";
+
+// null when OPFS sync access handles are unavailable (main thread, old browsers)
+const openOpfsSpillStore = async (name) => {
+  if (typeof navigator === "undefined" || !navigator.storage || !navigator.storage.getDirectory) {
+    return null;
+  }
+  try {
+    const root = await navigator.storage.getDirectory();
+    const dir = await root.getDirectoryHandle(SPILL_DIR, { create: true });
+    const handle = await dir.getFileHandle(name, { create: true });
+    if (typeof handle.createSyncAccessHandle !== "function") {
+      return null;
+    }
+    const access = await handle.createSyncAccessHandle();
+    access.truncate(0);
+    return {
+      write: (pos, bytes) => access.write(bytes, { at: pos }),
+      read: (pos, bytes) => access.read(bytes, { at: pos }),
+      close: () => {
+        try {
+          access.close();
+        } catch (err) {
+          // Already closed
+        }
+        dir.removeEntry(name).catch(() => {});
+      },
+    };
+  } catch (err) {
+    return null;
+  }
+};
+
+// Files left behind by workers that were killed; ones still open elsewhere
+// are locked and stay
+const clearStaleSpill = async () => {
+  if (typeof navigator === "undefined" || !navigator.storage || !navigator.storage.getDirectory) {
+    return;
+  }
+  try {
+    const root = await navigator.storage.getDirectory();
+    const dir = await root.getDirectoryHandle(SPILL_DIR, { create: true });
+    for await (const name of dir.keys()) {
+      await dir.removeEntry(name).catch(() => {});
+    }
+  } catch (err) {
+    // No OPFS
+  }
+};
+
+const openNodeSpillStore = () => {
+  const fs = require("fs");
+  const os = require("os");
+  const path = require("path");
+  const dir = fs.mkdtempSync(path.join(os.tmpdir(), "ffmpeg-spill-"));
+  const fd = fs.openSync(path.join(dir, "spill.bin"), "w+");
+  return {
+    write: (pos, bytes) => fs.writeSync(fd, bytes, 0, bytes.length, pos),
+    read: (pos, bytes) => fs.readSync(fd, bytes, 0, bytes.length, pos),
+    close: () => {
+      fs.closeSync(fd);
+      fs.rmSync(dir, { recursive: true, force: true });
+    },
+  };
+};
+
+const attachSpillStore = (Module, handle, store) => {
+  if (!Module.spillStores) {
+    Module.spillStores = new Map();
+  }
+  Module.spillStores.set(handle, store);
+};
+
+// Only for a store the C side never took (set_spill failed); otherwise
+// ffmpeg_wasm_destroy closes it
+const detachSpillStore = (Module, handle) => {
+  const store = Module.spillStores && Module.spillStores.get(handle);
+  if (store) {
+    Module.spillStores.delete(handle);
+    store.close();
+  }
+};
+
+if (typeof module !== "undefined" && module.exports) {
+  module.exports = { openNodeSpillStore, attachSpillStore, detachSpillStore };
+}
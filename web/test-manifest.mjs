@@ -0,0 +1,222 @@
+#!/usr/bin/env node
+// Run: node test-manifest.mjs
+// Parses the playlists and MPDs in test-manifests/ with manifest-source.js
+// and drives ManifestSource over a fake fetch, checking segment order,
+// init segments, boundaries and seeks. No wasm or network needed.
+
+import assert from "assert/strict";
+import { readFileSync } from "fs";
+import { fileURLToPath } from "url";
+import { dirname, join } from "path";
+import { createRequire } from "module";
+
+const __dirname = dirname(fileURLToPath(import.meta.url));
+const require = createRequire(import.meta.url);
+const { isManifestUrl, parseHlsMedia, parseHlsMaster, parseMpd, parseSidx, fillTemplate, ManifestSource } =
+  require("./manifest-source.js");
+
+const BASE = "https://test.invalid/";
+const fixture = (name) => readFileSync(join(__dirname, "test-manifests", name), "utf8");
+const lines = (text) => text.split(/\r?\n/).map((line) => line.trim()).filter(Boolean);
+const ranges = (segments) => segments.map((segment) => segment.range && [segment.range.start, segment.range.end]);
+
+let failures = 0;
+const test = async (name, fn) => {
+  try {
+    await fn();
+    console.log(`ok   ${name}`);
+  } catch (err) {
+    failures += 1;
+    console.log(`FAIL ${name}\n     ${err.message}`);
+  }
+};
+
+// sidx v0 box with one reference per subsegment size, 1000 ticks/s
+const makeSidx = (sizes, { firstOffset = 0, duration = 1500, earliest = 0 } = {}) => {
+  const bytes = new Uint8Array(32 + sizes.length * 12);
+  const view = new DataView(bytes.buffer);
+  view.setUint32(0, bytes.length);
+  bytes.set([0x73, 0x69, 0x64, 0x78], 4); // "sidx"
+  view.setUint32(12, 1); // reference_ID
+  view.setUint32(16, 1000); // timescale
+  view.setUint32(20, earliest);
+  view.setUint32(24, firstOffset);
+  view.setUint16(30, sizes.length);
+  sizes.forEach((size, i) => {
+    view.setUint32(32 + i * 12, size);
+    view.setUint32(36 + i * 12, duration);
+    view.setUint32(40 + i * 12, 0x90000000); // starts_with_SAP, type 1
+  });
+  return bytes;
+};
+
+// Files served by the fake fetch; Range requests get 206 slices
+const serve = (files) => {
+  const requests = [];
+  globalThis.fetch = async (url, options = {}) => {
+    const range = options.headers && options.headers.Range;
+    requests.push(range ? `${url.replace(BASE, "")} ${range.slice(6)}` : url.replace(BASE, ""));
+    const body = files[url.replace(BASE, "")];
+    if (body === undefined) return new Response("", { status: 404 });
+    const bytes = typeof body === "string" ? new TextEncoder().encode(body) : body;
+    if (!range) return new Response(bytes, { status: 200 });
+    const [first, last] = range.slice(6).split("-").map(Number);
+    return new Response(bytes.slice(first, last + 1), { status: 206 });
+  };
+  return requests;
+};
+
+const play = async (source, maxSteps = 64) => {
+  const events = [];
+  source.callbacks = {
+    append: (bytes, audio) => events.push(`${audio ? "audio " : ""}append ${bytes.length}`) > 0,
+    markBoundary: (audio) => events.push(`${audio ? "audio " : ""}boundary`),
+    end: (audio) => events.push(`${audio ? "audio " : ""}end`),
+    log: () => {},
+  };
+  for (let i = 0; i < maxSteps && !source.ended; i += 1) {
+    await source.step();
+  }
+  return events;
+};
+
+await test("manifest URLs", () => {
+  assert.equal(isManifestUrl("https://x/a/master.m3u8?token=1"), true);
+  assert.equal(isManifestUrl("https://x/manifest.mpd#t=3"), true);
+  assert.equal(isManifestUrl("https://x/video.mp4"), false);
+  assert.equal(isManifestUrl("https://x/stream", "DASH"), true);
+});
+
+await test("HLS master: variants by bandwidth, default audio rendition", () => {
+  const parsed = parseHlsMaster(lines(fixture("master.m3u8")), `${BASE}master.m3u8`);
+  assert.deepEqual(parsed.main.map((variant) => variant.url), [`${BASE}360p/index.m3u8`, `${BASE}720p/index.m3u8`]);
+  assert.deepEqual(parsed.main.map((variant) => variant.bandwidth), [800000, 2500000]);
+  assert.equal(parsed.main[1].label, "1280x720");
+  assert.equal(parsed.audio.length, 1);
+  assert.equal(parsed.audio[0].url, `${BASE}audio/en.m3u8`);
+});
+
+await test("HLS media: sequence, maps, byte ranges, discontinuity", () => {
+  const playlist = parseHlsMedia(lines(fixture("media-fmp4.m3u8")), `${BASE}vod/index.m3u8`);
+  const { segments } = playlist;
+  assert.equal(playlist.endList, true);
+  assert.equal(playlist.duration, 14);
+  assert.deepEqual(segments.map((segment) => segment.seq), [10, 11, 12, 13]);
+  assert.deepEqual(segments.map((segment) => segment.start), [0, 4, 8, 11.5]);
+  assert.deepEqual(segments.map((segment) => segment.discontinuity), [false, false, true, false]);
+  assert.deepEqual(ranges(segments), [null, null, [720, 1720], [1720, 2520]]);
+  assert.equal(segments[0].init.url, `${BASE}vod/init.mp4`);
+  assert.deepEqual(segments[2].init.range, { start: 0, end: 720 });
+});
+
+await test("HLS live playlist has no end", () => {
+  const playlist = parseHlsMedia(lines(fixture("media-live.m3u8")), `${BASE}live.m3u8`);
+  assert.equal(playlist.endList, false);
+  assert.equal(playlist.targetDuration, 2);
+  assert.equal(playlist.segments[0].seq, 100);
+});
+
+await test("DASH SegmentTemplate with $Number$", () => {
+  const parsed = parseMpd(fixture("template-number.mpd"), `${BASE}dash/manifest.mpd`);
+  assert.equal(parsed.duration, 10);
+  assert.deepEqual(parsed.main.map((variant) => variant.label), ["640x360", "1280x720"]);
+  const segments = parsed.main[1].playlist.segments;
+  assert.equal(segments.length, 3);
+  assert.equal(segments[0].url, `${BASE}dash/media/v720/seg-00001.m4s`);
+  assert.equal(segments[2].init.url, `${BASE}dash/media/v720/init.mp4`);
+  assert.deepEqual(segments.map((segment) => segment.start), [0, 4, 8]);
+  const audio = parsed.audio[0].playlist.segments;
+  assert.equal(audio.length, 3);
+  assert.equal(audio[1].url, `${BASE}dash/media/a128/seg-2.m4s`);
+  assert.equal(audio[1].duration, 4);
+});
+
+await test("DASH SegmentTimeline with $Time$, repeat to period end", () => {
+  const parsed = parseMpd(fixture("template-timeline.mpd"), `${BASE}tl/manifest.mpd`);
+  const segments = parsed.main[0].playlist.segments;
+  assert.deepEqual(segments.map((segment) => segment.start), [0, 3, 6, 9, 11]);
+  assert.equal(segments[0].url, `${BASE}tl/chunk-v1-9000.m4s`);
+  assert.equal(segments[3].url, `${BASE}tl/chunk-v1-819000.m4s`);
+  assert.equal(fillTemplate("$$x$Number%03d$", { Number: 7 }), "$x007");
+});
+
+await test("DASH SegmentList with media ranges", () => {
+  const parsed = parseMpd(fixture("segment-list.mpd"), `${BASE}sl/manifest.mpd`);
+  const segments = parsed.main[0].playlist.segments;
+  assert.deepEqual(ranges(segments), [[800, 1800], [1800, 3000], [3000, 3600]]);
+  assert.equal(segments[0].url, `${BASE}sl/video.mp4`);
+  assert.deepEqual(segments[0].init.range, { start: 0, end: 800 });
+  assert.deepEqual(segments.map((segment) => segment.start), [0, 2, 4]);
+});
+
+await test("DASH SegmentBase: index parsed from sidx", () => {
+  const parsed = parseMpd(fixture("segment-base.mpd"), `${BASE}od/manifest.mpd`);
+  const [lo, hi] = parsed.main;
+  assert.equal(lo.playlist, null);
+  assert.deepEqual(lo.index.indexRange, { start: 1000, end: 1080 });
+  assert.deepEqual(lo.index.init.range, { start: 0, end: 1000 }); // No Initialization: bytes before the index
+  assert.deepEqual(hi.index.init.range, { start: 0, end: 1000 });
+  const sidx = makeSidx([5000, 6000, 7000, 4000], { firstOffset: 16, earliest: 3000 });
+  const segments = parseSidx(sidx, lo.index);
+  assert.deepEqual(ranges(segments), [[1096, 6096], [6096, 12096], [12096, 19096], [19096, 23096]]);
+  assert.deepEqual(segments.map((segment) => segment.start), [3, 4.5, 6, 7.5]);
+  assert.equal(segments[1].duration, 1.5);
+});
+
+await test("ManifestSource: HLS order, init segments, boundary, seek", async () => {
+  const requests = serve({
+    "vod/index.m3u8": fixture("media-fmp4.m3u8"),
+    "vod/init.mp4": new Uint8Array(100),
+    "vod/seg10.m4s": new Uint8Array(4000),
+    "vod/seg11.m4s": new Uint8Array(4100),
+    "vod/init-b.mp4": new Uint8Array(720),
+    "vod/media-b.mp4": new Uint8Array(2520),
+  });
+  const source = await new ManifestSource(`${BASE}vod/index.m3u8`, undefined, {}).load();
+  assert.equal(source.live, false);
+  assert.equal(source.duration, 14);
+  const events = await play(source);
+  assert.deepEqual(events, [
+    "append 100",
+    "append 4000",
+    "append 4100",
+    "boundary",
+    "append 720",
+    "append 1000",
+    "append 800",
+    "end",
+  ]);
+  assert.deepEqual(requests.slice(-3), ["vod/init-b.mp4 0-719", "vod/media-b.mp4 720-1719", "vod/media-b.mp4 1720-2519"]);
+
+  // A seek restarts from the segment holding the target, init first and
+  // without a boundary (the caller restarts the demuxer itself)
+  source.seek(7.5);
+  const afterSeek = await play(source, 1);
+  assert.deepEqual(afterSeek, ["append 100", "append 4100"]);
+});
+
+await test("ManifestSource: SegmentBase fetches the index once, then byte ranges", async () => {
+  const file = new Uint8Array(1080 + 2000 + 3000 + 2500 + 1500);
+  file.set(makeSidx([2000, 3000, 2500, 1500], { duration: 1500 }), 1000);
+  const requests = serve({
+    "od/manifest.mpd": fixture("segment-base.mpd"),
+    "od/lo.mp4": file,
+    "od/hi.mp4": file,
+  });
+  const source = await new ManifestSource(`${BASE}od/manifest.mpd`, undefined, {}).load();
+  assert.equal(source.duration, 6);
+  const events = await play(source);
+  assert.deepEqual(events, ["append 1000", "append 2000", "append 3000", "append 2500", "append 1500", "end"]);
+  assert.deepEqual(requests, [
+    "od/manifest.mpd",
+    "od/lo.mp4 1000-1079",
+    "od/lo.mp4 0-999",
+    "od/lo.mp4 1080-3079",
+    "od/lo.mp4 3080-6079",
+    "od/lo.mp4 6080-8579",
+    "od/lo.mp4 8580-10079",
+  ]);
+});
+
+console.log(failures ? `\n${failures} failed` : "\nAll manifest tests passed");
+process.exit(failures ? 1 : 0);
@@ -1,5 +1,6 @@
 #!/usr/bin/env node
 // Run: node test-node.mjs <video-file> [seek-percent]
+// SPILL=1 spills consumed input to a temp file and seeks back into it
 
 import { readFileSync } from "fs";
 import { fileURLToPath } from "url";
@@ -9,6 +10,8 @@ import { createRequire } from "module";
 const __dirname = dirname(fileURLToPath(import.meta.url));
 const require = createRequire(import.meta.url);
 const FFmpegWasm = require("./ffmpeg_wasm.js");
+const { openNodeSpillStore, attachSpillStore } = require("./spill-store.js");
+const spill = process.env.SPILL === "1";
 
 // const file = process.argv[2];
 // const seekPercent = parseInt(process.argv[3]) || 50;
@@ -55,6 +58,10 @@ const api = {
     "number",
     "number",
   ]),
+  setBufferLimit: Module.cwrap("ffmpeg_wasm_set_buffer_limit", null, ["number", "number"]),
+  compactBuffer: Module.cwrap("ffmpeg_wasm_compact_buffer", null, ["number"]),
+  setSpill: Module.cwrap("ffmpeg_wasm_set_spill", "number", ["number", "number"]),
+  spilledBytes: Module.cwrap("ffmpeg_wasm_spilled_bytes", "number", ["number"]),
 };
 
 const append = (ctx, chunk) => {
@@ -78,6 +85,12 @@ if (openRet !== 0) {
   process.exit(1);
 }
 
+if (spill) {
+  attachSpillStore(Module, ctx, openNodeSpillStore());
+  console.log(`set_spill() returned: ${api.setSpill(ctx, 1)}`);
+  api.setBufferLimit(ctx, 4 * 1024 * 1024);
+}
+
 const duration = api.duration(ctx);
 const w = api.width(ctx);
 const h = api.height(ctx);
@@ -123,5 +136,22 @@ if (seekRet >= 0) {
   console.log("Seek failed");
 }
 
+// Test 3: everything before the seek point left the heap; seek back into it
+if (spill) {
+  api.compactBuffer(ctx);
+  console.log(`\n=== SEEK back to 1s, ${(api.spilledBytes(ctx) / 1024 / 1024).toFixed(1)}MB spilled ===`);
+  console.log(`seek() returned: ${api.seek(ctx, 1)}`);
+  for (let i = 0; i < 50; i++) {
+    const ret = api.readFrame(ctx);
+    if (ret === 1) {
+      console.log(`Frame PTS: ${api.pts(ctx).toFixed(3)}s`);
+      break;
+    } else if (ret < 0) {
+      console.log(`Decode error/EOF: ${ret}`);
+      break;
+    }
+  }
+}
+
 api.destroy(ctx);
 console.log("\nDone");
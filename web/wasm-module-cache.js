@@ -0,0 +1,55 @@
+/* global FFMPEG_WASM_BUILD_ID */
+
+// Compiled-module loader for the workers (importScripts, with
+// ffmpeg_wasm.js). The wasm is compiled while it streams in and handed to the
+// page, so later workers skip compilation entirely; Emscripten then only
+// instantiates it. build-ffmpeg.sh appends FFMPEG_WASM_BUILD_ID to the glue, so
+// checking a shared module costs no request.
+
+// Also used by open-state-cache.js
+const idbRequest = (req) =>
+  new Promise((resolve, reject) => {
+    req.onsuccess = () => resolve(req.result);
+    req.onerror = () => reject(req.error);
+  });
+
+// "" for glue built before the id was embedded
+const wasmBuildId = () => (typeof FFMPEG_WASM_BUILD_ID === "string" ? FFMPEG_WASM_BUILD_ID : "");
+
+const compileWasm = async (url) => {
+  if (WebAssembly.compileStreaming) {
+    try {
+      return await WebAssembly.compileStreaming(fetch(url));
+    } catch (err) {
+      // Served without application/wasm; compile from the bytes instead
+    }
+  }
+  const resp = await fetch(url);
+  if (!resp.ok) {
+    throw new Error(`HTTP ${resp.status} for ${url}`);
+  }
+  return WebAssembly.compile(await resp.arrayBuffer());
+};
+
+// Resolves { module, source, buildId }; source is "shared" (from the page) or
+// "compiled". Repeat visits rely on the browser's code cache for streamed
+// compiles; WebAssembly.Module cannot be stored in IndexedDB.
+const loadWasmModule = async ({ wasmUrl, shared }) => {
+  const buildId = wasmBuildId();
+  if (
+    shared &&
+    shared.module instanceof WebAssembly.Module &&
+    (!buildId || shared.buildId === buildId)
+  ) {
+    return { module: shared.module, source: "shared", buildId };
+  }
+  return { module: await compileWasm(wasmUrl), source: "compiled", buildId };
+};
+
+// Emscripten instantiateWasm hook for an already compiled module.
+const instantiateFromModule = (module, onError) => (imports, receiveInstance) => {
+  WebAssembly.instantiate(module, imports)
+    .then((instance) => receiveInstance(instance, module))
+    .catch(onError);
+  return {};
+};